@@ -0,0 +1,55 @@
+#include <chord/codec.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Measures the compression ratio and the CPU cost of chord::BodyCodec on text bodies of growing size,
+ * like the ones compressed by Node::Send and decompressed by Node::Receive.
+*/
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+    const int bodies = argc > 1 ? std::atoi(argv[1]) : 2000;
+    const std::vector<std::string> words = {"the", "meeting", "is", "moved", "to", "next", "week", "please", "confirm",
+                                            "your", "attendance", "regards", "project", "report", "attached", "thanks"};
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> word(0, words.size() - 1);
+    std::cout << std::setw(10) << "body" << std::setw(10) << "ratio" << std::setw(16) << "compress MB/s"
+              << std::setw(18) << "decompress MB/s" << std::setw(14) << "us/body" << std::endl;
+    for(size_t size : {256, 1024, 4096, 16384, 65536}) {
+        std::vector<std::string> samples(bodies);
+        for(auto &body : samples) {
+            while(body.size() < size) {
+                body += words[word(rng)];
+                body += word(rng) == 0 ? ".\n" : " ";
+            }
+        }
+        chord::BodyCodec codec;
+        codec.configure(chord::Codec::find("zlib"), 0);
+        auto start = std::chrono::steady_clock::now();
+        for(auto &body : samples) {
+            codec.encode(body);
+        }
+        double compress = elapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        std::string decoded;
+        for(auto &body : samples) {
+            decoded.clear();
+            codec.decode(body, decoded);
+        }
+        double decompress = elapsedMs(start), mb = static_cast<double>(codec.inputBytes()) / (1 << 20);
+        std::cout << std::setw(10) << size << std::fixed << std::setprecision(2) << std::setw(10)
+                  << static_cast<double>(codec.inputBytes()) / codec.outputBytes() << std::setprecision(1)
+                  << std::setw(16) << mb / (compress / 1000) << std::setw(18) << mb / (decompress / 1000)
+                  << std::setw(14) << static_cast<double>(codec.compressUs()) / bodies << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <chord/mailbox_store.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Fills a chord::MailboxStore with broadcast-like traffic, every message body is drawn from a small pool
+ * like the bodies of load_mock_data, and compares the memory used with and without the shared bodies.
+*/
+
+/**
+ * @returns the resident memory of the process in megabytes
+*/
+double residentMb() {
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024.0) / 1024.0;
+}
+
+int main(int argc, char **argv) {
+    const int boxes = argc > 1 ? std::atoi(argv[1]) : 5000, messages = argc > 2 ? std::atoi(argv[2]) : 20,
+              pool = argc > 3 ? std::atoi(argv[3]) : 50;
+    std::mt19937 rng(42);
+    std::vector<std::string> bodies;
+    for(int i = 0; i < pool; i++) {
+        bodies.push_back(std::string(512 + rng() % 4096, 'a' + i % 26));
+    }
+    std::cout << boxes << " mailboxes of " << messages << " messages, bodies drawn from " << pool << std::endl;
+    std::cout << std::setw(10) << "dedup" << std::setw(12) << "fill ms" << std::setw(12) << "rss +MB"
+              << std::setw(14) << "saved MB" << std::endl;
+    // The sharing runs first, the memory released by a run is reused by the next one
+    for(size_t threshold : {256, 0}) {
+        double before = residentMb();
+        auto start = std::chrono::steady_clock::now();
+        {
+            chord::MailboxStore store;
+            store.setDedup(threshold);
+            std::uniform_int_distribution<int> body(0, pool - 1);
+            for(chord::key_t key = 0; key < boxes; key++) {
+                store.insert(key, {"user" + std::to_string(key) + "@test.com", "psw"});
+                for(int i = 0; i < messages; i++) {
+                    // Like Node::Send, one message at a time through MailboxStore::write
+                    mail::Message msg("user@test.com", "sender@test.com", "subject", bodies[body(rng)]);
+                    store.write(key, [&msg](mail::MailBox &box) { box.insertMessage(msg); });
+                }
+            }
+            double fill = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            double saved = (store.sharedBytes() - store.blobs().bytes()) / (1024.0 * 1024.0);
+            std::cout << std::setw(10) << (threshold > 0 ? "on" : "off") << std::fixed << std::setprecision(1)
+                      << std::setw(12) << fill << std::setw(12) << residentMb() - before << std::setw(14) << saved << std::endl;
+        }
+    }
+    return 0;
+}
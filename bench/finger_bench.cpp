@@ -0,0 +1,63 @@
+#include <chord/server.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+/**
+ * Builds rings of growing size on localhost and counts the Node::SearchFinger requests
+ * needed to rebuild the finger table of every node.
+*/
+
+uint64_t fingerRpcs(const std::vector<std::unique_ptr<chord::Node>> &ring) {
+    uint64_t rpcs = 0;
+    for(auto &node : ring) {
+        rpcs += node->getStats().finger_rpcs;
+    }
+    return rpcs;
+}
+
+int main(int argc, char *argv[]) {
+    int base_port = argc > 1 ? std::atoi(argv[1]) : 51000;
+    std::cout << std::setw(8) << "nodes"
+              << std::setw(16) << "rpcs/rebuild"
+              << std::setw(16) << "rpcs/finger"
+              << std::setw(16) << "linear walk"
+              << std::setw(12) << "ms" << std::endl;
+    for(int size = 4; size <= 128; size *= 2) {
+        std::vector<std::unique_ptr<chord::Node>> ring;
+        for(int i = 0; i < size; i++) {
+            ring.emplace_back(new chord::Node("127.0.0.1", base_port + i));
+        }
+        std::sort(ring.begin(), ring.end(), [](auto &lhs, auto &rhs) {
+            return lhs->getInfo().id < rhs->getInfo().id;
+        });
+        for(int i = 0; i < size; i++) {
+            ring[i]->setSuccessor(ring[(i + 1) % size]->getInfo());
+        }
+        // The first build fills the tables, the second one is measured with complete tables
+        for(auto &node : ring) {
+            node->buildFingerTable();
+        }
+
+        uint64_t before = fingerRpcs(ring);
+        auto start = std::chrono::steady_clock::now();
+        for(auto &node : ring) {
+            node->buildFingerTable();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        double per_node = static_cast<double>(fingerRpcs(ring) - before) / size;
+
+        std::cout << std::setw(8) << size
+                  << std::setw(16) << std::fixed << std::setprecision(1) << per_node
+                  << std::setw(16) << std::setprecision(2) << per_node / (chord::M - 1)
+                  // Expected cost of walking the ring one successor at a time
+                  << std::setw(16) << std::setprecision(1) << (chord::M - 1) * size / 2.0
+                  << std::setw(12) << elapsed.count() << std::endl;
+        base_port += size;
+    }
+    return EXIT_SUCCESS;
+}
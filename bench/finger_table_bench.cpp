@@ -0,0 +1,90 @@
+#include <chord/finger_table.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+/**
+ * Compares the closest preceding finger lookup of chord::FingerTable with the linear scan
+ * over a vector of chord::NodeInfo that was used before, for rings of growing size.
+*/
+
+const chord::NodeInfo& linearScan(const std::vector<chord::NodeInfo> &fingers, chord::key_t owner, chord::key_t key) {
+    for(auto finger = fingers.rbegin(); finger != fingers.rend(); finger++) {
+        if(!finger->address.empty() && finger->id != key && chord::between(finger->id, owner, key)) {
+            return *finger;
+        }
+    }
+    return fingers.front();
+}
+
+template<class Lookup>
+double nsPerLookup(const std::vector<chord::key_t> &keys, Lookup lookup, chord::key_t &checksum) {
+    auto start = std::chrono::steady_clock::now();
+    for(chord::key_t key : keys) {
+        checksum += lookup(key).id;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return static_cast<double>(elapsed.count()) / keys.size();
+}
+
+int main(int argc, char *argv[]) {
+    int lookups = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    chord::key_t ring = 1LL << chord::M;
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<chord::key_t> dist(0, ring - 1);
+
+    std::vector<chord::key_t> keys(lookups);
+    for(auto &key : keys) {
+        key = dist(rng);
+    }
+
+    std::cout << std::setw(8) << "nodes"
+              << std::setw(12) << "peers"
+              << std::setw(16) << "scan ns/op"
+              << std::setw(16) << "table ns/op"
+              << std::setw(12) << "speedup" << std::endl;
+    for(int size = 4; size <= 4096; size *= 4) {
+        // Random ring, the fingers of the first node are computed directly from the sorted ids
+        std::vector<chord::key_t> ids(size);
+        for(auto &id : ids) {
+            id = dist(rng);
+        }
+        std::sort(ids.begin(), ids.end());
+        chord::key_t owner = ids.front();
+
+        std::vector<chord::NodeInfo> fingers(chord::M);
+        chord::FingerTable table(owner);
+        for(int i = 0; i < chord::M; i++) {
+            chord::key_t start = (owner + (1LL << i)) % ring;
+            auto it = std::lower_bound(ids.begin(), ids.end(), start);
+            chord::key_t id = it == ids.end() ? ids.front() : *it;
+            fingers[i] = {"10.0.0." + std::to_string(id % 256), static_cast<int>(50000 + id % 1000), id};
+            table.set(i, fingers[i]);
+        }
+        int peers = 0;
+        for(int i = 0; i < chord::M; i++) {
+            peers += (i == 0 || !(fingers[i] == fingers[i - 1]));
+        }
+
+        chord::key_t checksum = 0;
+        double scan = nsPerLookup(keys, [&](chord::key_t key) -> const chord::NodeInfo& {
+            return linearScan(fingers, owner, key);
+        }, checksum);
+        double lookup = nsPerLookup(keys, [&](chord::key_t key) -> const chord::NodeInfo& {
+            return table.closestPreceding(key);
+        }, checksum);
+
+        std::cout << std::setw(8) << size
+                  << std::setw(12) << peers
+                  << std::setw(16) << std::fixed << std::setprecision(1) << scan
+                  << std::setw(16) << lookup
+                  << std::setw(12) << std::setprecision(2) << scan / lookup
+                  // Printed so the compiler can't drop the lookups
+                  << (checksum == 42 ? " " : "") << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
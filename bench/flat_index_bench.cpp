@@ -0,0 +1,74 @@
+#include <chord/flat_index.hpp>
+#include <mail/mail.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * Compares the mailbox lookup done by the node before, std::map::at with an exception for
+ * missing mailboxes, with chord::FlatIndex::find, for growing fractions of missing mailboxes.
+ * Forwarded requests always look for a mailbox that is not on the node.
+*/
+
+template<class Lookup>
+double nsPerLookup(const std::vector<chord::key_t> &keys, Lookup lookup, size_t &checksum) {
+    auto start = std::chrono::steady_clock::now();
+    for(chord::key_t key : keys) {
+        checksum += lookup(key);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return static_cast<double>(elapsed.count()) / keys.size();
+}
+
+int main(int argc, char *argv[]) {
+    int boxes = argc > 1 ? std::atoi(argv[1]) : 10000;
+    int lookups = argc > 2 ? std::atoi(argv[2]) : 1000000;
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<chord::key_t> dist(0, (1LL << chord::M) - 1);
+
+    std::map<chord::key_t, mail::MailBox> map;
+    chord::FlatIndex<mail::MailBox> index;
+    std::vector<chord::key_t> present;
+    for(int i = 0; i < boxes; i++) {
+        chord::key_t key = dist(rng);
+        mail::MailBox box("user" + std::to_string(i), "psw");
+        map.insert({key, box});
+        index.insert(key, box);
+        present.push_back(key);
+    }
+
+    std::cout << boxes << " mailboxes" << std::endl;
+    std::cout << std::setw(10) << "misses"
+              << std::setw(16) << "map ns/op"
+              << std::setw(16) << "index ns/op"
+              << std::setw(12) << "speedup" << std::endl;
+    size_t checksum = 0;
+    for(int miss_percent : {0, 50, 90, 100}) {
+        std::vector<chord::key_t> keys(lookups);
+        for(auto &key : keys) {
+            key = static_cast<int>(rng() % 100) < miss_percent ? dist(rng) : present[rng() % present.size()];
+        }
+        double map_ns = nsPerLookup(keys, [&map](chord::key_t key) -> size_t {
+            try {
+                return map.at(key).getSize() + 1;
+            } catch(std::out_of_range &e) {
+                return 0;
+            }
+        }, checksum);
+        double index_ns = nsPerLookup(keys, [&index](chord::key_t key) -> size_t {
+            const mail::MailBox *box = index.find(key);
+            return box == nullptr ? 0 : box->getSize() + 1;
+        }, checksum);
+        std::cout << std::setw(9) << miss_percent << "%"
+                  << std::setw(16) << std::fixed << std::setprecision(1) << map_ns
+                  << std::setw(16) << index_ns
+                  << std::setw(11) << std::setprecision(2) << map_ns / index_ns << "x" << std::endl;
+    }
+    std::cerr << "checksum " << checksum << std::endl;
+    return 0;
+}
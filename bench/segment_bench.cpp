@@ -0,0 +1,120 @@
+#include <chord/mailbox_store.hpp>
+#include <chord/segment.hpp>
+#include <chord/wal.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Compares the startup of a node that replays a snapshot file into the heap with the startup of a node
+ * that maps a chord::Segment, then measures the reads of random mailboxes like Node::Receive does and
+ * the time needed to load the whole segment in background with a growing number of threads.
+ * The files are written in the current directory, run it on the disk used by the nodes.
+*/
+
+/**
+ * @returns the resident memory of the process in megabytes
+*/
+double residentMb() {
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024.0) / 1024.0;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+    const int boxes = argc > 1 ? std::atoi(argv[1]) : 10000, messages = argc > 2 ? std::atoi(argv[2]) : 10;
+    const std::string snap_file = "segment_bench.snap", seg_file = "segment_bench.seg";
+    std::filesystem::remove(snap_file);
+    std::filesystem::remove(seg_file);
+    {
+        std::string body(1024, 'x');
+        chord::WriteAheadLog log(snap_file, chord::WalMode::NO_SYNC);
+        chord::SegmentWriter writer(seg_file, 1, boxes);
+        std::string record;
+        for(chord::key_t key = 0; key < boxes; key++) {
+            mail::MailBox box("user" + std::to_string(key) + "@test.com", "psw");
+            for(int i = 0; i < messages; i++) {
+                box.insertMessage({box.getOwner(), "sender@test.com", "subject", body});
+            }
+            log.append(chord::WalRecord::snapshot(key, box));
+            record.clear();
+            chord::SegmentWriter::encode(chord::MailboxView(box), record);
+            writer.add(key, record);
+        }
+        writer.finish();
+    }
+    std::cout << boxes << " mailboxes of " << messages << " messages, "
+              << std::filesystem::file_size(seg_file) / (1 << 20) << " MB" << std::endl;
+    std::cout << std::setw(10) << "startup" << std::setw(14) << "load ms" << std::setw(14) << "rss +MB"
+              << std::setw(18) << "1000 reads ms" << std::endl;
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<chord::key_t> dist(0, boxes - 1);
+    auto reads = [&](chord::MailboxStore &store) {
+        auto start = std::chrono::steady_clock::now();
+        size_t bytes = 0;
+        for(int i = 0; i < 1000; i++) {
+            store.view(dist(rng), [&bytes](const chord::MailboxView &box) {
+                box.forEachMessage([&bytes](const chord::MessageView &msg) {
+                    // Copied once, like the body set in the reply of Node::Receive
+                    std::string body(msg.body);
+                    bytes += body.size();
+                });
+            });
+        }
+        return elapsedMs(start);
+    };
+
+    {
+        double before = residentMb();
+        auto start = std::chrono::steady_clock::now();
+        chord::MailboxStore store;
+        chord::WriteAheadLog::replay(snap_file, [&store](const chord::WalRecord &record) {
+            store.insert(record.key, record.box);
+        });
+        double load = elapsedMs(start), rss = residentMb() - before;
+        std::cout << std::setw(10) << "replay" << std::fixed << std::setprecision(1) << std::setw(14) << load
+                  << std::setw(14) << rss << std::setw(18) << reads(store) << std::endl;
+    }
+    {
+        double before = residentMb();
+        auto start = std::chrono::steady_clock::now();
+        chord::MailboxStore store;
+        store.attach(chord::Segment::open(seg_file));
+        double load = elapsedMs(start), rss = residentMb() - before;
+        std::cout << std::setw(10) << "segment" << std::fixed << std::setprecision(1) << std::setw(14) << load
+                  << std::setw(14) << rss << std::setw(18) << reads(store) << std::endl;
+    }
+    // Background load of the whole segment like Node::loadSegment, after the server has started
+    for(size_t threads : {1, 2, 4}) {
+        auto segment = chord::Segment::open(seg_file);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> loaders;
+        for(size_t part = 0; part < threads; part++) {
+            loaders.emplace_back([&segment, part, threads]() {
+                segment->load(segment->size() * part / threads, segment->size() * (part + 1) / threads);
+            });
+        }
+        for(auto &loader : loaders) {
+            loader.join();
+        }
+        std::cout << std::setw(10) << ("load x" + std::to_string(threads)) << std::fixed << std::setprecision(1)
+                  << std::setw(14) << elapsedMs(start) << std::endl;
+    }
+    std::filesystem::remove(snap_file);
+    std::filesystem::remove(seg_file);
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <chord/mailbox_store.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Measures the throughput of chord::MailboxStore with a growing number of worker threads and
+ * compares it with a single std::map protected by one mutex.
+ * Each worker performs a mix of reads and message insertions on random mailboxes.
+*/
+
+/**
+ * Single map behind one lock, the baseline for the store.
+*/
+struct LockedMap {
+    std::mutex mutex;
+    std::map<chord::key_t, mail::MailBox> boxes;
+
+    void read(chord::key_t key, size_t &checksum) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = boxes.find(key);
+        if(it != boxes.end()) {
+            checksum += it->second.getSize();
+        }
+    }
+
+    void write(chord::key_t key, const mail::Message &msg) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = boxes.find(key);
+        if(it != boxes.end()) {
+            it->second.insertMessage(msg);
+            it->second.clear();
+        }
+    }
+};
+
+struct ShardedStore {
+    chord::MailboxStore store;
+
+    void read(chord::key_t key, size_t &checksum) {
+        store.read(key, [&checksum](const mail::MailBox &box) { checksum += box.getSize(); });
+    }
+
+    void write(chord::key_t key, const mail::Message &msg) {
+        store.write(key, [&msg](mail::MailBox &box) {
+            box.insertMessage(msg);
+            box.clear();
+        });
+    }
+};
+
+/**
+ * @returns the operations per second executed by the workers
+*/
+template<class Store>
+double throughput(Store &store, int threads, int ops, int keys, int write_percent) {
+    std::atomic<size_t> checksum(0);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for(int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::uniform_int_distribution<chord::key_t> key_dist(0, keys - 1);
+            std::uniform_int_distribution<int> op_dist(0, 99);
+            mail::Message msg("to", "from", "subject", "body");
+            size_t local = 0;
+            for(int i = 0; i < ops; i++) {
+                chord::key_t key = key_dist(rng);
+                if(op_dist(rng) < write_percent) {
+                    store.write(key, msg);
+                } else {
+                    store.read(key, local);
+                }
+            }
+            checksum += local;
+        });
+    }
+    for(auto &worker : workers) {
+        worker.join();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    return static_cast<double>(threads) * ops / elapsed.count() * 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    int ops = argc > 1 ? std::atoi(argv[1]) : 200000;
+    int write_percent = argc > 2 ? std::atoi(argv[2]) : 20;
+    int max_threads = argc > 3 ? std::atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    const int keys = 4096;
+
+    LockedMap locked;
+    ShardedStore sharded;
+    for(chord::key_t key = 0; key < keys; key++) {
+        mail::MailBox box("user" + std::to_string(key), "psw");
+        locked.boxes.insert({key, box});
+        sharded.store.insert(key, box);
+    }
+
+    std::cout << ops << " operations per thread, " << write_percent << "% writes" << std::endl;
+    std::cout << std::setw(8) << "threads"
+              << std::setw(16) << "map ops/s"
+              << std::setw(16) << "store ops/s"
+              << std::setw(12) << "speedup" << std::endl;
+    for(int threads = 1; threads <= max_threads; threads *= 2) {
+        double map_ops = throughput(locked, threads, ops, keys, write_percent);
+        double store_ops = throughput(sharded, threads, ops, keys, write_percent);
+        std::cout << std::setw(8) << threads
+                  << std::setw(16) << std::fixed << std::setprecision(0) << map_ops
+                  << std::setw(16) << store_ops
+                  << std::setw(11) << std::setprecision(2) << store_ops / map_ops << "x" << std::endl;
+    }
+    return 0;
+}
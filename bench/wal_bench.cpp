@@ -0,0 +1,95 @@
+#include <chord/wal.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Measures throughput and latency of chord::WriteAheadLog::append for each chord::WalMode with a
+ * growing number of concurrent writers, every writer appends messages like Node::Send would.
+ * The log is written in the current directory, run it on the disk used by the nodes.
+*/
+
+struct Result {
+    double ops; /**< Appends per second */
+    double avg_us, p99_us; /**< Latency of a single append */
+    double per_batch; /**< Records written by each write */
+};
+
+Result run(chord::WalMode mode, int threads, int appends, const std::string &body) {
+    const std::string path = "wal_bench.wal";
+    std::filesystem::remove(path);
+    std::vector<std::vector<int64_t>> latencies(threads);
+    Result result;
+    {
+        chord::WriteAheadLog wal(path, mode);
+        std::vector<std::thread> writers;
+        auto start = std::chrono::steady_clock::now();
+        for(int t = 0; t < threads; t++) {
+            writers.emplace_back([&, t]() {
+                mail::Message msg("to@test.com", "from@test.com", "subject", body);
+                for(int i = 0; i < appends; i++) {
+                    msg.id = i + 1;
+                    auto before = std::chrono::steady_clock::now();
+                    wal.append(chord::WalRecord::send(t, msg));
+                    latencies[t].push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - before).count());
+                }
+            });
+        }
+        for(auto &writer : writers) {
+            writer.join();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        result.ops = static_cast<double>(threads) * appends / elapsed.count() * 1e6;
+        result.per_batch = static_cast<double>(wal.records()) / std::max<uint64_t>(wal.batches(), 1);
+    }
+    std::vector<int64_t> all;
+    for(auto &l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    std::sort(all.begin(), all.end());
+    double sum = 0;
+    for(auto l : all) {
+        sum += l;
+    }
+    result.avg_us = sum / all.size();
+    result.p99_us = all[all.size() * 99 / 100];
+    std::filesystem::remove(path);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    int appends = argc > 1 ? std::atoi(argv[1]) : 2000;
+    int max_threads = argc > 2 ? std::atoi(argv[2]) : 16;
+    std::string body(argc > 3 ? std::atoi(argv[3]) : 512, 'x');
+
+    std::cout << appends << " appends per writer, " << body.size() << " bytes bodies" << std::endl;
+    std::cout << std::setw(10) << "mode"
+              << std::setw(9) << "writers"
+              << std::setw(14) << "appends/s"
+              << std::setw(12) << "avg us"
+              << std::setw(12) << "p99 us"
+              << std::setw(14) << "recs/write" << std::endl;
+    std::vector<std::pair<const char *, chord::WalMode>> modes = {
+        {"no_sync", chord::WalMode::NO_SYNC},
+        {"interval", chord::WalMode::INTERVAL},
+        {"always", chord::WalMode::ALWAYS}
+    };
+    for(auto &[name, mode] : modes) {
+        for(int threads = 1; threads <= max_threads; threads *= 4) {
+            Result r = run(mode, threads, appends, body);
+            std::cout << std::setw(10) << name
+                      << std::setw(9) << threads
+                      << std::setw(14) << std::fixed << std::setprecision(0) << r.ops
+                      << std::setw(12) << std::setprecision(1) << r.avg_us
+                      << std::setw(12) << r.p99_us
+                      << std::setw(14) << r.per_batch << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,235 @@
+#ifndef CHORD_ASYNC_SERVER_HPP
+#define CHORD_ASYNC_SERVER_HPP
+
+#include "types.hpp"
+#include "watch_hub.hpp"
+#include "chord.grpc.pb.h"
+#include <grpcpp/grpcpp.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace chord {
+    class Node;
+    template<class T> struct Hop;
+
+    /**
+     * Service registered by a chord::Node running in asynchronous mode.
+     *
+     * The routed services (the ones that may forward the request to another node) are marked as asynchronous
+     * and served by chord::AsyncServer, the remaining services don't wait for other nodes so they're simply
+     * delegated to the node and served by the synchronous thread pool of gRPC.
+     * Node::Watch is asynchronous too, so the streams of the idle watchers don't hold any thread.
+    */
+    class AsyncNodeService final : public NodeService::WithAsyncMethod_SearchFinger<
+                                          NodeService::WithAsyncMethod_NodeJoin<
+                                          NodeService::WithAsyncMethod_InsertMailbox<
+                                          NodeService::WithAsyncMethod_LookupMailbox<
+                                          NodeService::WithAsyncMethod_Send<
+                                          NodeService::WithAsyncMethod_Delete<
+                                          NodeService::WithAsyncMethod_Watch<
+                                          NodeService::Service>>>>>>> {
+    public:
+        /**
+         * @param node node that will answer the synchronous services
+        */
+        AsyncNodeService(Node *node);
+
+        grpc::Status Ping(grpc::ServerContext *context, const PingRequest *request, PingReply *reply) override; /**< Delegates to Node::Ping */
+        grpc::Status Stabilize(grpc::ServerContext *context, const NodeInfoMessage *request, StabilizeReply *reply) override; /**< Delegates to Node::Stabilize */
+        grpc::Status Authenticate(grpc::ServerContext *context, const Authentication *request, Empty *reply) override; /**< Delegates to Node::Authenticate */
+        grpc::Status Receive(grpc::ServerContext *context, const Authentication *request, Mailbox *reply) override; /**< Delegates to Node::Receive */
+        grpc::Status Transfer(grpc::ServerContext *context, const TransferMailbox *request, Empty *reply) override; /**< Delegates to Node::Transfer */
+        grpc::Status FindSuccessor(grpc::ServerContext *context, const SuccessorQuery *request, NextHop *reply) override; /**< Delegates to Node::FindSuccessor */
+        grpc::Status ListHeaders(grpc::ServerContext *context, const Authentication *request, HeaderList *reply) override; /**< Delegates to Node::ListHeaders */
+        grpc::Status FetchBodies(grpc::ServerContext *context, const FetchRequest *request, BodyList *reply) override; /**< Delegates to Node::FetchBodies */
+        grpc::Status ReceiveStream(grpc::ServerContext *context, const ReceiveRequest *request, grpc::ServerWriter<MailboxChunk> *writer) override; /**< Delegates to Node::ReceiveStream */
+        grpc::Status Sync(grpc::ServerContext *context, const SyncRequest *request, SyncReply *reply) override; /**< Delegates to Node::Sync */
+
+    private:
+        Node *node_; /**< Node that answers the synchronous services */
+    };
+
+    /**
+     * Base class of a call served through a completion queue.
+     *
+     * Each call is used as the tag of his own events, when an event completes the thread that
+     * polls the queue calls AsyncCall::proceed to advance the call to the next state.
+    */
+    class AsyncCall {
+    public:
+        virtual ~AsyncCall() {}
+
+        /**
+         * Advances the call after one of his events has completed.
+         *
+         * @param ok false if the event failed, for example because the server is shutting down
+        */
+        virtual void proceed(bool ok) = 0;
+    };
+
+    /**
+     * Asynchronous server mode of a chord::Node.
+     *
+     * A request that must be forwarded to another node doesn't block the thread that received it:
+     * the request is sent to the next hop through the same completion queue and the thread is released
+     * until the answer arrives, when the answer is received it's relayed to the original caller.
+     * This way the number of requests in flight doesn't depend on the number of threads and long
+     * paths inside the ring can't exhaust the server's thread pool.
+     *
+     * Each completion queue is polled by his own thread, their number is set by NodeConfig::server_threads.
+    */
+    class AsyncServer {
+    public:
+        /**
+         * @param node node that owns the server
+         * @param threads number of completion queues and polling threads, at least one is always used
+        */
+        AsyncServer(Node *node, int threads);
+
+        /**
+         * Stops the server if it's still running.
+        */
+        ~AsyncServer();
+
+        /**
+         * Registers the service and the completion queues on the builder.
+         *
+         * Must be called before grpc::ServerBuilder::BuildAndStart.
+         *
+         * @param builder builder of the node's server
+        */
+        void registerService(grpc::ServerBuilder &builder);
+
+        /**
+         * Starts to accept requests and spawns the polling threads.
+         *
+         * Must be called after grpc::ServerBuilder::BuildAndStart.
+        */
+        void start();
+
+        /**
+         * Shuts down the completion queues and waits for the polling threads.
+         *
+         * Must be called after grpc::Server::Shutdown.
+        */
+        void shutdown();
+
+    private:
+        template<class T, class R> friend class RoutedCall;
+        friend class WatchCall;
+
+        /**
+         * Polls a completion queue until it's shut down.
+         *
+         * @param cq completion queue to poll
+        */
+        void poll(grpc::ServerCompletionQueue *cq);
+
+        /**
+         * Returns the stub used to forward a request, the request is counted in the node's statistics.
+         * 
+         * @tparam T type of the request to forward
+         * @param peer node to contact
+         * @returns the stub used to contact the peer, taken from the node's connection pool
+        */
+        template<class T>
+        std::shared_ptr<NodeService::Stub> stub(const NodeInfo &peer);
+
+        /**
+         * @tparam T type of the request to forward
+         * @param deadline deadline of the received request
+         * @returns a new context for a forwarded request, with the deadline chosen by Node::setDeadline
+        */
+        template<class T>
+        std::unique_ptr<grpc::ClientContext> context(std::chrono::system_clock::time_point deadline) const;
+
+        /**
+         * Lets the node remember the mailbox owner found by a forwarded request, see Node::cacheRoute.
+         * 
+         * @param request received request
+         * @param reply answer of the next hop
+        */
+        template<class T, class R>
+        void learn(const T &request, const R &reply);
+
+        /**
+         * Handles the answer of a next hop that failed.
+         * 
+         * If the next hop is dead he's dropped by the node, so the request can be routed again towards another node.
+         * 
+         * @param peer next hop that received the request
+         * @param context context of the call to the next hop
+         * @param status status returned by the next hop
+         * @param attempt number of next hops already tried
+         * @param deadline deadline of the received request, see Node::isUnreachable
+         * @returns true if the request must be routed again, false if the status must be relayed to the caller
+        */
+        bool retry(const NodeInfo &peer, const grpc::ClientContext &context, const grpc::Status &status, int attempt, std::chrono::system_clock::time_point deadline);
+
+        /**
+         * Searches the owner of a mailbox inside Node::routes_.
+         * 
+         * @param user address of the mailbox
+         * @param owner filled with the owner if found
+         * @returns true if the owner was found
+        */
+        bool owner(const std::string &user, NodeInfo &owner);
+
+        /**
+         * Removes the owner of a mailbox from Node::routes_, used when he turned out to be wrong.
+         * 
+         * @param user address of the mailbox
+        */
+        void forget(const std::string &user);
+
+        /**
+         * Executes locally the first routing step of Node::LookupMailbox, the lookup continues on the next hop.
+         * 
+         * @param user address of the mailbox
+         * @param hop filled with the next hop of the lookup
+         * @returns true if the lookup must be sent to Hop::node, false if the mailbox is on this node or can't be found
+        */
+        bool lookup(const std::string &user, Hop<QueryMailbox> &hop);
+
+        /**
+         * @param context context of the received call
+         * @param status status sent to the caller of a routed service
+         * @returns the status marked by Node::relayed
+        */
+        static grpc::Status relayed(grpc::ServerContext *context, const grpc::Status &status);
+
+        /**
+         * Registers the watcher of a mailbox on the node, see Node::Watch.
+         * 
+         * @param request authentication data of the mailbox
+         * @param watcher watcher to register
+         * @returns Status::OK if the watcher was registered, the errors of Node::checkWatcher or StatusCode::UNAVAILABLE
+         *          if the node is stopping
+        */
+        grpc::Status subscribe(const Authentication &request, Watcher *watcher);
+
+        /**
+         * Removes a watcher registered by AsyncServer::subscribe.
+         * 
+         * @param request authentication data of the mailbox
+         * @param watcher watcher to remove
+        */
+        void unsubscribe(const Authentication &request, Watcher *watcher);
+
+        /**
+         * @returns the maximum number of headers waiting to be sent to a single watcher, see NodeConfig::watch_queue_size
+        */
+        size_t watchQueueSize() const;
+
+        Node *node_; /**< Node that owns the server */
+        AsyncNodeService service_; /**< Service registered on the gRPC server */
+        int num_threads_; /**< Number of completion queues and polling threads */
+        std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_; /**< Completion queues, one for each thread */
+        std::vector<std::thread> threads_; /**< Threads that poll the completion queues */
+    };
+}
+
+#endif // CHORD_ASYNC_SERVER_HPP
@@ -0,0 +1,81 @@
+#ifndef CHORD_BLOB_STORE_HPP
+#define CHORD_BLOB_STORE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace chord {
+    /**
+     * Content addressed store of immutable strings, used to keep a single copy of the message bodies
+     * received by many mailboxes.
+     *
+     * BlobStore::intern returns the blob with the same content if one exists, otherwise the string becomes
+     * a new blob. Blobs are reference counted by their std::shared_ptr: the store only remembers them
+     * through weak references, indexed by their content, and a blob is removed from the store when the
+     * last reference is dropped. Blobs may outlive the store.
+     *
+     * The blobs are split between shards chosen by the hash of their content, each one with his own lock.
+     * All the methods are thread safe.
+    */
+    class BlobStore {
+    public:
+        using Blob = std::shared_ptr<const std::string>; /**< Reference to a blob */
+
+        /**
+         * Builds an empty store.
+         *
+         * @param shards number of shards, at least one is always used
+        */
+        BlobStore(size_t shards = 16);
+
+        BlobStore(const BlobStore &) = delete;
+        BlobStore& operator=(const BlobStore &) = delete;
+
+        /**
+         * Returns the blob with a given content, creating it if needed.
+         *
+         * @param data content of the blob, moved into the new blob if there is no blob with the same content
+         * @returns a reference to the blob
+        */
+        Blob intern(std::string &&data);
+
+        size_t size() const; /**< @returns the number of blobs */
+        uint64_t bytes() const; /**< @returns the total size of the blobs */
+        uint64_t hits() const; /**< @returns the number of calls to BlobStore::intern that found an existing blob */
+
+    private:
+        /**
+         * Group of blobs protected by the same lock
+        */
+        struct Shard {
+            std::mutex mutex; /**< Protects Shard::blobs */
+            std::unordered_map<std::string_view, std::weak_ptr<const std::string>> blobs; /**< Blobs by content, the keys point inside the blobs */
+        };
+
+        /**
+         * State shared with the blobs, so they can remove themselves after the store is destroyed
+        */
+        struct State {
+            std::vector<Shard> shards; /**< Shards of the store, their number never changes */
+            std::atomic<size_t> size{0}; /**< Number of blobs */
+            std::atomic<uint64_t> bytes{0}; /**< Total size of the blobs */
+            std::atomic<uint64_t> hits{0}; /**< Calls to BlobStore::intern that found an existing blob */
+
+            State(size_t shards) : shards(shards) {}
+
+            Shard& shardOf(std::string_view data) {
+                return shards[std::hash<std::string_view>()(data) % shards.size()];
+            }
+        };
+
+        std::shared_ptr<State> state_; /**< Blobs of the store */
+    };
+}
+
+#endif // CHORD_BLOB_STORE_HPP
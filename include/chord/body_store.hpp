@@ -0,0 +1,75 @@
+#ifndef CHORD_BODY_STORE_HPP
+#define CHORD_BODY_STORE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace chord {
+    /**
+     * Append only file that holds the message bodies moved out of memory by chord::MailboxStore.
+     *
+     * Bodies are only appended and read back by position, the file is emptied with BodyStore::reset
+     * once none of them is referenced anymore. The content doesn't survive a restart: the mailboxes
+     * are rebuilt from the snapshots and the write-ahead log, which contain the whole bodies.
+     *
+     * All the methods are thread safe.
+    */
+    class BodyStore {
+    public:
+        /**
+         * Creates the file, an existing file is emptied.
+         *
+         * @param path file of the store
+         * @throws std::runtime_error if the file can't be created
+        */
+        BodyStore(const std::string &path);
+
+        /**
+         * Closes and removes the file.
+        */
+        ~BodyStore();
+
+        BodyStore(const BodyStore &) = delete;
+        BodyStore& operator=(const BodyStore &) = delete;
+
+        /**
+         * Appends some bodies at the end of the file.
+         *
+         * @param data bodies to append, one after the other
+         * @param offset filled with the position of the first byte of the data
+         * @returns true if the data was written, false otherwise
+        */
+        bool append(const std::string &data, uint64_t &offset);
+
+        /**
+         * Reads a body.
+         *
+         * @param offset position of the body
+         * @param size size of the body
+         * @param body filled with the body
+         * @returns true if the body was read, false otherwise
+        */
+        bool read(uint64_t offset, uint32_t size, std::string &body) const;
+
+        /**
+         * Empties the file, the positions returned so far are not valid anymore.
+         *
+         * @returns true if the operation was successful
+        */
+        bool reset();
+
+        uint64_t bytes() const; /**< @returns the size of the file */
+        uint64_t reads() const; /**< @returns the number of bodies read since the store was created */
+
+    private:
+        std::string path_; /**< File of the store */
+        int fd_; /**< Descriptor of the file, opened for reading and writing */
+        std::mutex mutex_; /**< Serializes the appends */
+        std::atomic<uint64_t> end_; /**< Size of the file */
+        mutable std::atomic<uint64_t> reads_; /**< Bodies read */
+    };
+}
+
+#endif // CHORD_BODY_STORE_HPP
@@ -0,0 +1,20 @@
+#ifndef CHORD_CHECKSUM_HPP
+#define CHORD_CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chord {
+    /**
+     * Computes the CRC-32 (IEEE 802.3) checksum of a buffer, the one used by zlib and gzip.
+     *
+     * Eight bytes are processed at each step with precomputed tables, the function is thread safe.
+     *
+     * @param data first byte of the buffer
+     * @param size size of the buffer
+     * @returns the checksum
+    */
+    uint32_t crc32(const char *data, size_t size);
+}
+
+#endif // CHORD_CHECKSUM_HPP
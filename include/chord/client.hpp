@@ -2,6 +2,8 @@
 #define CHORD_CLIENT_HPP
 
 #include "types.hpp"
+#include "peer_pool.hpp"
+#include "route_cache.hpp"
 #include "chord.grpc.pb.h"
 #include <grpcpp/grpcpp.h>
 #include <google/protobuf/util/time_util.h>
@@ -9,6 +11,11 @@
 #include <string>
 #include <memory>
 #include <ctime>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace chord {
     /**
@@ -22,18 +29,24 @@ namespace chord {
          * Builds a new client from a connection string
          * 
          * @param conn_string in the format "address:port"
+         * @param routing strategy used to reach the successor node of a mailbox
         */
-        Client(const std::string &conn_string);
+        Client(const std::string &conn_string, RoutingMode routing = RoutingMode::RECURSIVE);
 
         /**
          * Builds a new client from a node's coordinates.
          * 
          * Is the equivalent of:
          * \code{.cpp}
-         * Client(node.conn_string());
+         * Client(node.conn_string(), routing);
          * \endcode
         */
-        Client(const NodeInfo &node) : Client(node.conn_string()) {}
+        Client(const NodeInfo &node, RoutingMode routing = RoutingMode::RECURSIVE) : Client(node.conn_string(), routing) {}
+
+        /**
+         * Stops watching the mailbox, see Client::unwatch.
+        */
+        ~Client();
 
         /**
          * Connects to a node, the current connection will be dropped.
@@ -54,6 +67,27 @@ namespace chord {
         */
         bool connectTo(const std::string &conn_string);
 
+        /**
+         * Sets the strategy used to reach the successor node of a mailbox.
+         * 
+         * With RoutingMode::RECURSIVE the requests are sent to the connected node that forwards them inside the ring,
+         * with RoutingMode::ITERATIVE the client walks the ring with Node::FindSuccessor and then sends the requests
+         * directly to the successor node, so the message bodies are transmitted only once.
+         * 
+         * @param routing the new strategy
+        */
+        void setRoutingMode(RoutingMode routing);
+
+        /**
+         * Returns the cache of the mailboxes' owners.
+         * 
+         * The client remembers the node that owns each mailbox it logs into or sends mail to, so the following
+         * requests are sent directly to that node instead of being routed through the ring.
+         * 
+         * @returns the cache used by the client
+        */
+        RouteCache& getOwnerCache();
+
         /**
          * @returns the mailbox handled by the client
          * @throw chord::NodeException if the client is not logged in to any account (via Client::accountLogin or Client::accountRegister);
@@ -152,7 +186,8 @@ namespace chord {
          * 
          * This method should only be called after Client::accountLogin or Client::accountRegister.
          * 
-         * See Node::Receive for more details on the server side.
+         * The messages are streamed by the node in chunks of bounded size and inserted in the box as they arrive,
+         * see Node::ReceiveStream for more details on the server side.
          * 
          * @returns true if the mailbox is updated and ready to be read, false otherwise.
          *          Normally if the login was successful and the client is still connected to the mailbox's successor
@@ -160,6 +195,106 @@ namespace chord {
         */
         bool getMessages();
 
+        /**
+         * Retrieves a page of messages from the node without touching the cached box.
+         * 
+         * This method should only be called after Client::accountLogin or Client::accountRegister.
+         * 
+         * \code{.cpp}
+         * std::vector<mail::Message> page;
+         * uint64_t next = 0;
+         * do {
+         *     page.clear();
+         *     client.getPage(next, 50, true, page, next);
+         * } while(next != 0);
+         * \endcode
+         * 
+         * See Node::ReceiveStream for more details on the server side.
+         * 
+         * @param start_id identifier of the first message of the page, 0 starts from the first (most recent) message
+         * @param limit maximum number of messages of the page, 0 means no limit
+         * @param newest_first true to list the messages from the most recent one
+         * @param messages vector the messages of the page are appended to
+         * @param next_id set to the start_id of the next page, 0 if there are no more messages
+         * @returns true if the page was received, false otherwise
+        */
+        bool getPage(uint64_t start_id, uint64_t limit, bool newest_first, std::vector<mail::Message> &messages, uint64_t &next_id);
+
+        /**
+         * Retrieves only the headers of the messages from the node, the bodies are downloaded with Client::fetchBodies.
+         * 
+         * The messages are cached inside the box like Client::getMessages does, the bodies that were not downloaded
+         * yet are empty while the ones already downloaded are kept, so refreshing a big mailbox only transfers
+         * the headers.
+         * 
+         * This method should only be called after Client::accountLogin or Client::accountRegister.
+         * 
+         * See Node::ListHeaders for more details on the server side.
+         * 
+         * @returns true if the mailbox is updated, false otherwise
+        */
+        bool getHeaders();
+
+        /**
+         * Brings the cached box up to date downloading only the messages added and removed since the last call.
+         * 
+         * The client remembers the version of the mailbox reached by the cached box, the first call (or the first one
+         * after the node restarted or lost the history of the mailbox) downloads the whole mailbox like
+         * Client::getMessages, the following ones only transfer the changes so refreshing costs as much as the new mail.
+         * 
+         * This method should only be called after Client::accountLogin or Client::accountRegister.
+         * 
+         * See Node::Sync for more details on the server side.
+         * 
+         * @returns true if the box is up to date, false otherwise
+        */
+        bool sync();
+
+        /**
+         * Saves the cached box and the version it reached, so a later session can resume with Client::sync.
+         * 
+         * The box is saved with mail::MailBox::saveBox, the version in a file with the same name and the ".sync" suffix.
+         * 
+         * @param filename name of the file to save the box to
+         * @returns true if the operation was successful, false otherwise
+        */
+        bool saveCache(const std::string &filename) const;
+
+        /**
+         * Replaces the cached box with one saved by Client::saveCache.
+         * 
+         * This method should only be called after Client::accountLogin or Client::accountRegister, the saved box must
+         * belong to the same account. If the version can't be read the next Client::sync downloads the whole mailbox.
+         * 
+         * @param filename name of the file the box was saved to
+         * @returns true if the box was loaded, false otherwise
+        */
+        bool loadCache(const std::string &filename);
+
+        /**
+         * Downloads the bodies of some messages listed by Client::getHeaders and marks the messages as read.
+         * 
+         * This method should only be called after Client::accountLogin or Client::accountRegister.
+         * 
+         * See Node::FetchBodies for more details on the server side.
+         * 
+         * @param ids identifiers of the messages, see mail::Message::id
+         * @returns true if the bodies were downloaded, false otherwise
+        */
+        bool fetchBodies(const std::vector<uint64_t> &ids);
+
+        /**
+         * @param id identifier of a message of the box
+         * @returns true if the body of the message has been downloaded
+        */
+        bool hasBody(uint64_t id) const;
+
+        /**
+         * @param id identifier of a message of the box
+         * @returns the size of the body of the message, even if it wasn't downloaded, 0 if the message is not known
+        */
+        uint64_t getBodySize(uint64_t id) const;
+
         /**
          * Sends a new mail.
          * 
@@ -179,11 +314,55 @@ namespace chord {
          * 
          * This method should only be called after Client::accountLogin or Client::accountRegister.
          * 
+         * The message is identified by the id it has in the mailbox cached by Client::getMessages,
+         * so the right message is deleted even if other messages arrived in the meantime.
+         * 
          * @throw chord::NodeException if the message was not sent succesfully.
          * @param idx index of the message to delete
         */
         void remove(int idx);
 
+        /**
+         * Deletes a mail from the mailbox using his id, see mail::Message::id.
+         * 
+         * This method should only be called after Client::accountLogin or Client::accountRegister.
+         * 
+         * @throw chord::NodeException if the message was not sent succesfully.
+         * @param id id of the message to delete
+        */
+        void removeById(uint64_t id);
+
+        /**
+         * Starts to watch the mailbox, a callback is invoked with the header of every new message.
+         * 
+         * The messages passed to the callback have an empty body, use Client::sync or Client::fetchBodies to
+         * download them. When the method returns the watch is already active, so no message sent afterwards
+         * can be missed. Only one watch is active at a time, a new call replaces the previous one.
+         * 
+         * The callbacks are invoked on a background thread of the client, they must not call the other methods
+         * of the client. When the stream ends on_end is invoked with his status: StatusCode::CANCELLED after
+         * Client::unwatch, StatusCode::UNAVAILABLE if the node is stopping or the mailbox moved to another node
+         * and StatusCode::RESOURCE_EXHAUSTED if the callback couldn't keep up with the new messages.
+         * In all cases the client may have missed some messages, Client::sync brings the box up to date.
+         * 
+         * This method should only be called after Client::accountLogin or Client::accountRegister.
+         * 
+         * See Node::Watch for more details on the server side.
+         * 
+         * @throw chord::NodeException if the routing is iterative and the owner of the mailbox can't be found
+         * @param on_message callback invoked as on_message(const mail::Message &) for each new message
+         * @param on_end callback invoked as on_end(const grpc::Status &) when the stream ends, can be empty
+         * @returns true if the mailbox is being watched, false otherwise
+        */
+        bool watch(std::function<void(const mail::Message &)> on_message, std::function<void(const grpc::Status &)> on_end = nullptr);
+
+        /**
+         * Stops watching the mailbox and waits for the callbacks of Client::watch to return.
+         * 
+         * Must not be called from the callbacks, does nothing if the mailbox is not watched.
+        */
+        void unwatch();
+
     private:
         /**
          * Convenience method to cast a google::protobuf::int64 to a time_t.
@@ -205,6 +384,19 @@ namespace chord {
         */
         static google::protobuf::int64 timeTToSeconds(time_t time);
 
+        /**
+         * Reads a page of messages streamed by Node::ReceiveStream one chunk at a time.
+         * 
+         * @param start_id identifier of the first message of the page, 0 starts from the first (most recent) message
+         * @param limit maximum number of messages of the page, 0 means no limit
+         * @param newest_first true to list the messages from the most recent one
+         * @param visitor callable invoked as visitor(const mail::Message &) for each message as soon as his chunk arrives
+         * @param next_id set to the start_id of the next page, 0 if there are no more messages
+         * @returns the grpc::Status of the call
+        */
+        template<class F>
+        grpc::Status receivePage(uint64_t start_id, uint64_t limit, bool newest_first, F visitor, uint64_t &next_id);
+
         /**
          * Fill a chord::MailboxMessage from a mail::Message.
          * 
@@ -220,8 +412,9 @@ namespace chord {
          * 
          * @param dst message to fill
          * @param idx index of the message to delete
+         * @param id id of the message to delete, 0 if unknown
         */
-        void fillDeleteMessage(DeleteMessage &dst, int idx);
+        void fillDeleteMessage(DeleteMessage &dst, int idx, uint64_t id = 0);
 
         /**
          * Authentication method.
@@ -235,6 +428,28 @@ namespace chord {
         */
         NodeInfo auth(const mail::MailBox &box, bool login = true);
 
+        /**
+         * Finds the node that owns a mailbox and stores it inside Client::owners_.
+         * 
+         * With iterative routing the successor of the mailbox's key is searched with Client::findSuccessor,
+         * otherwise the mailbox is searched by the connected node with Node::LookupMailbox.
+         * 
+         * @throw NodeException if the routing is iterative and the successor can't be found
+         * @param address address of the mailbox
+         * @param owner filled with the node that owns the mailbox
+         * @returns true if the owner was found, false otherwise
+        */
+        bool locate(const std::string &address, NodeInfo &owner);
+
+        /**
+         * Finds the successor node of a key walking the ring iteratively, starting from the connected node.
+         * 
+         * @throw NodeException if a node doesn't answer or the successor isn't found in chord::CHORD_MOD steps
+         * @param key key to search the successor for
+         * @returns the successor node of the key
+        */
+        NodeInfo findSuccessor(key_t key);
+
         /**
          * Shortcut used to send messages to a node.
          * 
@@ -251,8 +466,34 @@ namespace chord {
             return std::pair<grpc::Status, R>(status, rep);
         }
 
+        /**
+         * Shortcut used to send messages to a node different from the connected one.
+         * 
+         * @param request request to send to the node
+         * @param to node to send the message to
+         * @param rpc function pointer to the method to call on the remote node
+         * @returns a pair composed by the grpc::Status of the call and the reply message sent by the remote node.
+        */
+        template<class T, class R>
+        std::pair<grpc::Status, R> sendMessage(const T *request, const NodeInfo &to, grpc::Status (chord::NodeService::Stub::*rpc)(grpc_impl::ClientContext *, const T &, R *)) {
+            R rep;
+            grpc::ClientContext context;
+            auto stub = peers_.get(to);
+            grpc::Status status = (stub.get()->*rpc)(&context, *request, &rep);
+            return std::pair<grpc::Status, R>(status, rep);
+        }
+
         std::unique_ptr<chord::NodeService::Stub> stub_; /**< Stub used to send remote calls */
+        RoutingMode routing_; /**< Strategy used to reach the successor node of a mailbox */
+        PeerPool peers_; /**< Connections used to walk the ring when the routing is iterative and to contact the mailboxes' owners */
+        RouteCache owners_; /**< Nodes that own the mailboxes used by the client */
         std::shared_ptr<mail::MailBox> box_; /**< Mailbox handled by the client */
+        std::unordered_set<uint64_t> fetched_; /**< Messages of Client::box_ whose body has been downloaded */
+        std::unordered_map<uint64_t, uint64_t> sizes_; /**< Size of the body of each message of Client::box_ */
+        uint64_t epoch_; /**< Epoch of the node Client::version_ refers to, 0 if Client::box_ was never synchronized */
+        uint64_t version_; /**< Version of the mailbox reached by Client::box_, see Client::sync */
+        std::unique_ptr<grpc::ClientContext> watch_context_; /**< Context of the stream opened by Client::watch, used to cancel it */
+        std::unique_ptr<std::thread> watch_thread_; /**< Reads the stream opened by Client::watch and invokes the callbacks */
     };
 }
 
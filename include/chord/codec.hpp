@@ -0,0 +1,173 @@
+#ifndef CHORD_CODEC_HPP
+#define CHORD_CODEC_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace chord {
+    /**
+     * Compression algorithm applied to the message bodies.
+     *
+     * Every encoded body carries the identifier of his codec, so the identifier of a codec must never
+     * change once some bodies were written with it. A new codec is added by implementing this interface
+     * and listing an instance in Codec::find.
+    */
+    class Codec {
+    public:
+        virtual ~Codec() = default;
+
+        virtual uint8_t id() const = 0; /**< @returns the identifier written inside the encoded bodies */
+        virtual const char* name() const = 0; /**< @returns the name used in the configuration of the nodes */
+
+        /**
+         * Compresses a buffer.
+         *
+         * @param data bytes to compress
+         * @param out buffer the compressed bytes are appended to
+         * @returns true if the data was compressed, false otherwise
+        */
+        virtual bool compress(std::string_view data, std::string &out) const = 0;
+
+        /**
+         * Decompresses a buffer.
+         *
+         * @param data bytes written by Codec::compress
+         * @param size size of the original data
+         * @param out buffer the original data is appended to
+         * @returns true if the data was decompressed to exactly size bytes, false otherwise
+        */
+        virtual bool decompress(std::string_view data, size_t size, std::string &out) const = 0;
+
+        /**
+         * @param id identifier of a codec
+         * @returns the codec with the given identifier, nullptr if it's not known
+        */
+        static const Codec* find(uint8_t id);
+
+        /**
+         * @param name name of a codec
+         * @returns the codec with the given name, nullptr if it's not known
+        */
+        static const Codec* find(const std::string &name);
+    };
+
+    /**
+     * Codec that copies the data, used to mark the bodies that must not be compressed.
+    */
+    class IdentityCodec : public Codec {
+    public:
+        static constexpr uint8_t ID = 0; /**< Identifier of the codec */
+
+        uint8_t id() const override;
+        const char* name() const override;
+        bool compress(std::string_view data, std::string &out) const override;
+        bool decompress(std::string_view data, size_t size, std::string &out) const override;
+    };
+
+    /**
+     * Deflate codec of zlib, the library is built with gRPC.
+    */
+    class ZlibCodec : public Codec {
+    public:
+        static constexpr uint8_t ID = 1; /**< Identifier of the codec */
+
+        /**
+         * @param level compression level between 1 (fastest) and 9 (smallest), -1 uses the default of zlib
+        */
+        ZlibCodec(int level = -1);
+
+        uint8_t id() const override;
+        const char* name() const override;
+        bool compress(std::string_view data, std::string &out) const override;
+        bool decompress(std::string_view data, size_t size, std::string &out) const override;
+
+    private:
+        int level_; /**< Compression level */
+    };
+
+    /**
+     * Compresses the message bodies received by a node and decompresses them when they're read by their owner.
+     *
+     * An encoded body starts with a header of eight bytes: the three bytes "\0CZ", the identifier of the codec
+     * and the u32 size of the original body in the byte order of the host, followed by the compressed bytes.
+     * The encoded bodies are stored as any other body, so they travel unchanged through the write-ahead log,
+     * the segments and the transfers between nodes and they're never compressed twice.
+     * A body that starts with the same three bytes is wrapped with the chord::IdentityCodec, so it's never
+     * mistaken for an encoded one.
+     *
+     * The methods are thread safe once the codec has been configured.
+    */
+    class BodyCodec {
+    public:
+        static constexpr size_t HEADER_SIZE = 8; /**< Size of the header of an encoded body */
+
+        /**
+         * Builds a codec that doesn't compress.
+        */
+        BodyCodec();
+
+        /**
+         * Chooses the bodies to compress, must be called before the codec is used.
+         *
+         * @param codec algorithm used for the new bodies, nullptr disables the compression
+         * @param threshold minimum size of the compressed bodies
+        */
+        void configure(const Codec *codec, size_t threshold);
+
+        /**
+         * Compresses a body if it's long enough and the compression makes it shorter,
+         * the bodies that look like an encoded one are wrapped.
+         *
+         * @param body body sent by a client, replaced by his encoded form
+        */
+        void encode(std::string &body);
+
+        /**
+         * Decodes a body.
+         *
+         * @param body stored body, encoded or not
+         * @param out buffer the original body is appended to
+         * @returns true if the body was decoded, false if it's corrupted or uses an unknown codec
+        */
+        bool decode(std::string_view body, std::string &out) const;
+
+        /**
+         * @param body stored body
+         * @returns true if the body is encoded and must be decoded before being read
+        */
+        static bool encoded(std::string_view body);
+
+        /**
+         * @param body stored body
+         * @returns the codec of an encoded body, nullptr if the body is not encoded or the codec is not known
+        */
+        static const Codec* codecOf(std::string_view body);
+
+        /**
+         * @param body stored body
+         * @returns the size of the body once decoded
+        */
+        static size_t originalSize(std::string_view body);
+
+        uint64_t compressedBodies() const; /**< @returns the number of bodies stored compressed */
+        uint64_t inputBytes() const; /**< @returns the size of the bodies that were long enough to be compressed */
+        uint64_t outputBytes() const; /**< @returns the size of the same bodies as they were stored */
+        uint64_t compressUs() const; /**< @returns the CPU time in microseconds spent compressing */
+        uint64_t decompressedBodies() const; /**< @returns the number of bodies decompressed */
+        uint64_t decompressUs() const; /**< @returns the CPU time in microseconds spent decompressing */
+
+    private:
+        const Codec *codec_; /**< Algorithm used for the new bodies, nullptr if they're not compressed */
+        size_t threshold_; /**< Minimum size of the compressed bodies */
+        std::atomic<uint64_t> compressed_, /**< Bodies stored compressed */
+                              input_bytes_, /**< Size of the bodies long enough to be compressed */
+                              output_bytes_, /**< Size of the same bodies once stored */
+                              compress_ns_; /**< CPU time spent compressing */
+        mutable std::atomic<uint64_t> decompressed_, /**< Bodies decompressed */
+                                      decompress_ns_; /**< CPU time spent decompressing */
+    };
+}
+
+#endif // CHORD_CODEC_HPP
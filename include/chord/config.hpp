@@ -0,0 +1,129 @@
+#ifndef CHORD_CONFIG_HPP
+#define CHORD_CONFIG_HPP
+
+#include "types.hpp"
+#include <string>
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+
+namespace chord {
+    /**
+     * Reads an optional value from an archive.
+     *
+     * If the archive doesn't contain the given name the value is left untouched, this allows
+     * configuration files to specify only the parameters that differ from the defaults.
+     *
+     * @param archive archive to read from
+     * @param name name of the value inside the archive
+     * @param value reference to the value to fill
+    */
+    template<class Archive, class T>
+    void optional_nvp(Archive &archive, const char *name, T &value) {
+        try {
+            archive(cereal::make_nvp(name, value));
+        } catch (cereal::Exception &e) {}
+    }
+
+    /**
+     * Tunable parameters of a chord::Node.
+     *
+     * Every field has a default value so a default constructed configuration is always valid,
+     * when loaded from a json file only the fields that are present will be overwritten.
+    */
+    struct NodeConfig {
+        int peer_idle_timeout = 60000; /**< Milliseconds after which an unused connection to another node is closed */
+        bool async_server = false; /**< Serve the routed services through completion queues instead of blocking a thread per request */
+        int server_threads = 4; /**< Number of completion queues, each polled by his own thread, used by the asynchronous server */
+        RoutingMode routing = RoutingMode::RECURSIVE; /**< Strategy used by the node to reach the successor of a key */
+        int fix_fingers_batch = 4; /**< Fingers refreshed at each round of the stabilize procedure */
+        int successor_list_size = 4; /**< Number of successors known by the node, the ring survives the failure of as many consecutive nodes minus one */
+        int rpc_timeout = 5000; /**< Milliseconds after which a call to another node fails and the node is considered dead, 0 waits forever */
+        int lookup_timeout = 2000; /**< Deadline in milliseconds of the lookups (Ping, SearchFinger, LookupMailbox, FindSuccessor), 0 uses NodeConfig::rpc_timeout */
+        int transfer_timeout = 30000; /**< Deadline in milliseconds of the transfer of mailboxes between nodes, 0 uses NodeConfig::rpc_timeout */
+        bool hedge_lookups = false; /**< Send a second copy of a slow lookup through the next best finger, the first answer wins */
+        double hedge_percentile = 95; /**< Latency percentile of the past lookups after which the second copy is sent */
+        int route_cache_size = 1024; /**< Number of mailbox owners remembered by the node, 0 disables the cache */
+        int route_cache_ttl = 30000; /**< Milliseconds after which a remembered owner must be searched again */
+        WalMode wal_mode = WalMode::INTERVAL; /**< Durability of the mailbox mutations, see chord::WalMode */
+        int wal_sync_interval = 200; /**< Milliseconds between two synchronizations of the write-ahead log in WalMode::INTERVAL mode */
+        int snapshot_interval = 10000; /**< Milliseconds between two background snapshots of the mailboxes, 0 disables them */
+        int snapshot_full_ratio = 2; /**< A full snapshot replaces the incremental ones when the snapshot file grows this many times the segment, 0 makes every snapshot full */
+        int snapshot_threads = 2; /**< Threads that encode the mailboxes in parallel during a full snapshot */
+        int load_threads = 2; /**< Threads that read the segment in memory in background after the start, 0 leaves the mailboxes on disk until they're accessed */
+        int dedup_threshold = 256; /**< Bodies at least this long are kept once per node and shared by the messages with the same body, 0 disables the sharing */
+        int memory_budget = 0; /**< Megabytes of message bodies kept in memory, the coldest ones beyond it are moved to disk, 0 means no limit */
+        std::string compression_codec = "zlib"; /**< Name of the chord::Codec used to compress the bodies, "none" disables the compression */
+        int compression_threshold = 1024; /**< Bodies at least this long are compressed when they're received, 0 compresses all of them */
+        int receive_chunk_size = 1024; /**< Kilobytes of messages sent in each chunk of Node::ReceiveStream, a chunk always holds at least one message */
+        int receive_chunk_messages = 256; /**< Maximum number of messages sent in each chunk of Node::ReceiveStream */
+        int watch_queue_size = 256; /**< Notifications of Node::Watch waiting to be sent to a single watcher, a watcher that falls further behind is disconnected */
+
+        /**
+         * Method used to save the data structure.
+        */
+        template<class Archive>
+        void save(Archive &archive) const {
+            archive(CEREAL_NVP(peer_idle_timeout),
+                    CEREAL_NVP(async_server),
+                    CEREAL_NVP(server_threads),
+                    CEREAL_NVP(routing),
+                    CEREAL_NVP(fix_fingers_batch),
+                    CEREAL_NVP(successor_list_size),
+                    CEREAL_NVP(rpc_timeout),
+                    CEREAL_NVP(lookup_timeout),
+                    CEREAL_NVP(transfer_timeout),
+                    CEREAL_NVP(hedge_lookups),
+                    CEREAL_NVP(hedge_percentile),
+                    CEREAL_NVP(route_cache_size),
+                    CEREAL_NVP(route_cache_ttl),
+                    CEREAL_NVP(wal_mode),
+                    CEREAL_NVP(wal_sync_interval),
+                    CEREAL_NVP(snapshot_interval),
+                    CEREAL_NVP(snapshot_full_ratio),
+                    CEREAL_NVP(snapshot_threads),
+                    CEREAL_NVP(load_threads),
+                    CEREAL_NVP(dedup_threshold),
+                    CEREAL_NVP(memory_budget),
+                    CEREAL_NVP(compression_codec),
+                    CEREAL_NVP(compression_threshold),
+                    CEREAL_NVP(receive_chunk_size),
+                    CEREAL_NVP(receive_chunk_messages),
+                    CEREAL_NVP(watch_queue_size));
+        }
+
+        /**
+         * Method used to load the data structure, missing fields will keep their default value.
+        */
+        template<class Archive>
+        void load(Archive &archive) {
+            optional_nvp(archive, "peer_idle_timeout", peer_idle_timeout);
+            optional_nvp(archive, "async_server", async_server);
+            optional_nvp(archive, "server_threads", server_threads);
+            optional_nvp(archive, "routing", routing);
+            optional_nvp(archive, "fix_fingers_batch", fix_fingers_batch);
+            optional_nvp(archive, "successor_list_size", successor_list_size);
+            optional_nvp(archive, "rpc_timeout", rpc_timeout);
+            optional_nvp(archive, "lookup_timeout", lookup_timeout);
+            optional_nvp(archive, "transfer_timeout", transfer_timeout);
+            optional_nvp(archive, "hedge_lookups", hedge_lookups);
+            optional_nvp(archive, "hedge_percentile", hedge_percentile);
+            optional_nvp(archive, "route_cache_size", route_cache_size);
+            optional_nvp(archive, "route_cache_ttl", route_cache_ttl);
+            optional_nvp(archive, "wal_mode", wal_mode);
+            optional_nvp(archive, "wal_sync_interval", wal_sync_interval);
+            optional_nvp(archive, "snapshot_interval", snapshot_interval);
+            optional_nvp(archive, "snapshot_full_ratio", snapshot_full_ratio);
+            optional_nvp(archive, "snapshot_threads", snapshot_threads);
+            optional_nvp(archive, "load_threads", load_threads);
+            optional_nvp(archive, "dedup_threshold", dedup_threshold);
+            optional_nvp(archive, "memory_budget", memory_budget);
+            optional_nvp(archive, "compression_codec", compression_codec);
+            optional_nvp(archive, "compression_threshold", compression_threshold);
+            optional_nvp(archive, "receive_chunk_size", receive_chunk_size);
+            optional_nvp(archive, "receive_chunk_messages", receive_chunk_messages);
+            optional_nvp(archive, "watch_queue_size", watch_queue_size);
+        }
+    };
+}
+
+#endif // CHORD_CONFIG_HPP
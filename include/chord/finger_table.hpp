@@ -0,0 +1,107 @@
+#ifndef CHORD_FINGER_TABLE_HPP
+#define CHORD_FINGER_TABLE_HPP
+
+#include "types.hpp"
+#include <array>
+#include <cstdint>
+
+namespace chord {
+    /**
+     * Finger table of a chord::Node.
+     *
+     * The fingers of a node point to few distinct peers, so each peer is stored once in a small directory
+     * and every finger only keeps the index of his peer.
+     * The peers are also kept sorted by their clockwise distance from the owner of the table inside a
+     * contiguous array of keys, this way the closest finger that precedes a key is found with a binary
+     * search that never touches the peers' addresses.
+     *
+     * The arrays have a fixed size so the references returned by the table are never invalidated
+     * by a reallocation, updates are rare (one finger at a time during Node::stabilize) and pay for
+     * the sorting so that lookups, executed for every routed request, stay cheap.
+    */
+    class FingerTable {
+    public:
+        /**
+         * Builds an empty table.
+         *
+         * @param owner id of the node that owns the table
+        */
+        FingerTable(key_t owner = 0);
+
+        /**
+         * Sets the id of the node that owns the table, the distances of the peers are recomputed.
+         *
+         * @param owner new id of the owner
+        */
+        void setOwner(key_t owner);
+
+        /**
+         * @throw std::out_of_range if idx is negative or not smaller than chord::M
+         * @param idx finger index
+         * @returns the finger at index idx, a finger that is not known yet has an empty address
+        */
+        const NodeInfo& get(int idx) const;
+
+        /**
+         * Sets a finger.
+         *
+         * @throw std::out_of_range if idx is negative or not smaller than chord::M
+         * @param idx finger index
+         * @param peer new finger, a peer with an empty address clears the finger
+        */
+        void set(int idx, const NodeInfo &peer);
+
+        /**
+         * Clears all the fingers that point to a peer.
+         *
+         * @param peer peer to remove from the table
+        */
+        void remove(const NodeInfo &peer);
+
+        /**
+         * @returns the successor of the owner, stored at index 0
+        */
+        const NodeInfo& successor() const;
+
+        /**
+         * Searches the known peer with the greatest id inside the interval (owner, key).
+         *
+         * @param key key to search for
+         * @returns the closest peer that precedes the key, or the successor if there's none
+        */
+        const NodeInfo& closestPreceding(key_t key) const;
+
+        /**
+         * Searches the known peer with the greatest id inside the interval (owner, key), skipping a peer.
+         *
+         * @param key key to search for
+         * @param excluded peer that must not be returned
+         * @returns the closest peer that precedes the key other than the excluded one, a peer with an empty address if there's none
+        */
+        const NodeInfo& closestPreceding(key_t key, const NodeInfo &excluded) const;
+
+    private:
+        static constexpr uint8_t NONE = 0xFF; /**< Index of a finger that is not known yet */
+
+        /**
+         * @returns the clockwise distance between the owner and a key
+        */
+        key_t distance(key_t key) const;
+
+        /**
+         * Rebuilds FingerTable::distances_ and FingerTable::order_ from the directory.
+        */
+        void sort();
+
+        key_t owner_; /**< Id of the node that owns the table */
+        NodeInfo empty_; /**< Returned for the fingers that are not known yet */
+        std::array<NodeInfo, M> peers_; /**< Directory of the distinct peers pointed by the fingers */
+        std::array<uint8_t, M> refs_; /**< Number of fingers that point to each entry of the directory */
+        std::array<uint8_t, M> fingers_; /**< Index inside the directory of each finger */
+        std::array<key_t, M> distances_; /**< Sorted clockwise distances of the known peers from the owner */
+        std::array<uint8_t, M> order_; /**< Index inside the directory of the peer at the same position of FingerTable::distances_ */
+        int count_; /**< Number of valid entries inside FingerTable::distances_ */
+    };
+}
+
+#endif // CHORD_FINGER_TABLE_HPP
@@ -0,0 +1,217 @@
+#ifndef CHORD_FLAT_INDEX_HPP
+#define CHORD_FLAT_INDEX_HPP
+
+#include "types.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace chord {
+    /**
+     * Hash table from chord::key_t to values stored in flat arrays.
+     *
+     * The values are kept contiguous in insertion order (an erase moves the last value in the hole),
+     * while an open addressing table with linear probing maps each key to the position of his value.
+     * Every slot of the table stores the key next to the position, so a lookup only touches
+     * consecutive memory until it finds the key or an empty slot: a miss never allocates or throws.
+     * Erased slots are filled by shifting back the following entries, so the table never contains
+     * tombstones and long probe sequences can't build up.
+     *
+     * Pointers and references to the values are invalidated by any insertion or removal.
+     * The table is not thread safe.
+    */
+    template<class V>
+    class FlatIndex {
+    public:
+        using value_type = std::pair<key_t, V>;
+
+        /**
+         * Builds an empty index.
+         *
+         * @param capacity number of values that can be inserted before the table grows
+        */
+        FlatIndex(size_t capacity = 0) {
+            reserve(capacity);
+        }
+
+        /**
+         * Searches a key.
+         *
+         * @param key key to search
+         * @returns a pointer to the value, nullptr if the key is not present
+        */
+        V* find(key_t key) {
+            size_t slot = findSlot(key);
+            return slot == NONE ? nullptr : &values_[slots_[slot].pos - 1].second;
+        }
+
+        /**
+         * Const version of FlatIndex::find
+        */
+        const V* find(key_t key) const {
+            size_t slot = findSlot(key);
+            return slot == NONE ? nullptr : &values_[slots_[slot].pos - 1].second;
+        }
+
+        /**
+         * Adds a value if the key is not present.
+         *
+         * @param key key of the value
+         * @param value value to add
+         * @returns a pointer to the value associated to the key and true if it was added,
+         *          false if the key was already present
+        */
+        std::pair<V*, bool> insert(key_t key, const V &value) {
+            if(V *present = find(key)) {
+                return {present, false};
+            }
+            if((values_.size() + 1) * 8 > slots_.size() * 7) {
+                rehash(std::max<size_t>(slots_.size() * 2, 16));
+            }
+            values_.push_back({key, value});
+            place(key, values_.size());
+            return {&values_.back().second, true};
+        }
+
+        /**
+         * Removes a key.
+         *
+         * @param key key to remove
+         * @returns true if the key was removed, false if it wasn't present
+        */
+        bool erase(key_t key) {
+            size_t slot = findSlot(key);
+            if(slot == NONE) {
+                return false;
+            }
+            size_t pos = slots_[slot].pos;
+            removeSlot(slot);
+            if(pos != values_.size()) {
+                // The last value fills the hole, his slot must point to the new position
+                values_[pos - 1] = std::move(values_.back());
+                slots_[findSlot(values_[pos - 1].first)].pos = pos;
+            }
+            values_.pop_back();
+            return true;
+        }
+
+        /**
+         * Makes room for a number of values without growing the table.
+         *
+         * @param capacity number of values
+        */
+        void reserve(size_t capacity) {
+            size_t slots = 16;
+            while(slots * 7 < capacity * 8) {
+                slots *= 2;
+            }
+            if(slots > slots_.size()) {
+                values_.reserve(capacity);
+                rehash(slots);
+            }
+        }
+
+        /**
+         * Removes all the values, the table keeps his size.
+        */
+        void clear() {
+            values_.clear();
+            std::fill(slots_.begin(), slots_.end(), Slot{0, 0});
+        }
+
+        size_t size() const { return values_.size(); } /**< @returns the number of values */
+        bool empty() const { return values_.empty(); } /**< @returns true if there are no values */
+
+        /**
+         * Iterators over the key/value pairs, they're not ordered by key.
+        */
+        typename std::vector<value_type>::iterator begin() { return values_.begin(); }
+        typename std::vector<value_type>::iterator end() { return values_.end(); }
+        typename std::vector<value_type>::const_iterator begin() const { return values_.begin(); }
+        typename std::vector<value_type>::const_iterator end() const { return values_.end(); }
+
+    private:
+        /**
+         * Entry of the open addressing table
+        */
+        struct Slot {
+            key_t key; /**< Key stored in the slot */
+            uint32_t pos; /**< Position of the value plus one, zero if the slot is empty */
+        };
+
+        static constexpr size_t NONE = static_cast<size_t>(-1); /**< Slot not found */
+
+        /**
+         * @returns the preferred slot of a key
+        */
+        size_t home(key_t key) const {
+            uint64_t h = static_cast<uint64_t>(key);
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDULL;
+            h ^= h >> 33;
+            return h & (slots_.size() - 1);
+        }
+
+        /**
+         * @returns the slot containing a key, FlatIndex::NONE if the key is not present
+        */
+        size_t findSlot(key_t key) const {
+            if(slots_.empty()) {
+                return NONE;
+            }
+            size_t mask = slots_.size() - 1;
+            for(size_t slot = home(key);; slot = (slot + 1) & mask) {
+                if(slots_[slot].pos == 0) {
+                    return NONE;
+                }
+                if(slots_[slot].key == key) {
+                    return slot;
+                }
+            }
+        }
+
+        /**
+         * Stores a key in the first free slot starting from his preferred one.
+        */
+        void place(key_t key, size_t pos) {
+            size_t mask = slots_.size() - 1;
+            size_t slot = home(key);
+            while(slots_[slot].pos != 0) {
+                slot = (slot + 1) & mask;
+            }
+            slots_[slot] = {key, static_cast<uint32_t>(pos)};
+        }
+
+        /**
+         * Empties a slot, the following entries that would not be reachable anymore are shifted back.
+        */
+        void removeSlot(size_t hole) {
+            size_t mask = slots_.size() - 1;
+            for(size_t slot = (hole + 1) & mask; slots_[slot].pos != 0; slot = (slot + 1) & mask) {
+                // The entry can fill the hole only if the hole is between his preferred slot and his slot
+                size_t preferred = home(slots_[slot].key);
+                if(((slot - preferred) & mask) >= ((slot - hole) & mask)) {
+                    slots_[hole] = slots_[slot];
+                    hole = slot;
+                }
+            }
+            slots_[hole] = {0, 0};
+        }
+
+        /**
+         * Rebuilds the table with a new number of slots, it must be a power of two.
+        */
+        void rehash(size_t slots) {
+            slots_.assign(slots, Slot{0, 0});
+            for(size_t i = 0; i < values_.size(); i++) {
+                place(values_[i].first, i + 1);
+            }
+        }
+
+        std::vector<value_type> values_; /**< Values with their key, not ordered */
+        std::vector<Slot> slots_; /**< Open addressing table, his size is always zero or a power of two */
+    };
+}
+
+#endif // CHORD_FLAT_INDEX_HPP
@@ -0,0 +1,59 @@
+#ifndef CHORD_LATENCY_HPP
+#define CHORD_LATENCY_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace chord {
+    /**
+     * Keeps the latencies of the most recent calls and computes their percentiles.
+     *
+     * Only the last samples are kept, so the percentiles follow the current state of the ring.
+     * A percentile is computed again only after a number of new samples, so it can be asked
+     * before every call without sorting the window each time.
+     *
+     * All the methods are thread safe.
+    */
+    class LatencyTracker {
+    public:
+        /**
+         * @param window number of samples kept
+         * @param min_samples samples needed before a percentile is reported
+        */
+        LatencyTracker(size_t window = 1024, size_t min_samples = 32);
+
+        /**
+         * Adds a sample, the oldest one is discarded when the window is full.
+         *
+         * @param latency time taken by a call
+        */
+        void record(std::chrono::microseconds latency);
+
+        /**
+         * @param percentile percentile to compute, in the range (0, 100]
+         * @returns the latency under which fall the given percentage of the samples, zero if there are not enough samples
+        */
+        std::chrono::microseconds percentile(double percentile) const;
+
+        /**
+         * @returns the number of samples inside the window
+        */
+        size_t size() const;
+
+    private:
+        static const uint64_t REFRESH = 64; /**< New samples after which a cached percentile is computed again */
+
+        mutable std::mutex mutex_; /**< Protects all the other members */
+        std::vector<int64_t> samples_; /**< Circular buffer of latencies in microseconds */
+        size_t window_; /**< Maximum number of samples kept */
+        size_t min_samples_; /**< Samples needed before a percentile is reported */
+        uint64_t recorded_; /**< Number of samples ever recorded */
+        mutable double cached_percentile_; /**< Percentile stored in LatencyTracker::cached_value_ */
+        mutable int64_t cached_value_; /**< Last computed percentile */
+        mutable uint64_t cached_at_; /**< Value of LatencyTracker::recorded_ when the cached percentile was computed */
+    };
+}
+
+#endif // CHORD_LATENCY_HPP
@@ -0,0 +1,542 @@
+#ifndef CHORD_MAILBOX_STORE_HPP
+#define CHORD_MAILBOX_STORE_HPP
+
+#include "types.hpp"
+#include "mail.hpp"
+#include "flat_index.hpp"
+#include "segment.hpp"
+#include "body_store.hpp"
+#include "blob_store.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace chord {
+    /**
+     * Thread safe container of the mailboxes managed by a chord::Node.
+     *
+     * The mailboxes are split between a fixed number of shards chosen by the hash of their key,
+     * each shard is protected by his own reader/writer lock and stores his mailboxes in a chord::FlatIndex,
+     * so looking up a missing mailbox is as cheap as finding one. Readers of the same shard never block
+     * each other and writers only block the mailboxes of their shard, so requests for different
+     * mailboxes rarely contend.
+     *
+     * Mailboxes are never returned by reference: they're accessed through callbacks executed while
+     * the shard is locked, so a mailbox can't be removed while someone is using it.
+     * The callbacks must not access the store again, they would deadlock on their own shard.
+     *
+     * The store also remembers the keys of the mailboxes modified since the last call to
+     * MailboxStore::takeDirty, so snapshots only need to save what changed.
+     *
+     * A chord::Segment can be attached under the mailboxes on the heap: his mailboxes are read straight
+     * from the mapped file and are copied on the heap only when they're modified for the first time.
+     *
+     * The memory used by the bodies of the mailboxes on the heap can be bounded with MailboxStore::setBudget:
+     * when the budget is exceeded the bodies of the mailboxes accessed least recently are moved to a
+     * chord::BodyStore, while the rest of their messages stays in memory. The bodies are loaded back
+     * when the mailbox is read, the mailboxes of the segment are not accounted since the kernel
+     * can drop their pages whenever it needs memory.
+     *
+     * With MailboxStore::setDedup the long bodies of the mailboxes on the heap are moved to a chord::BlobStore,
+     * so a body received by many mailboxes is kept in memory only once. Like the bodies moved to disk,
+     * the shared bodies are put back in the mailboxes when they're read.
+    */
+    class MailboxStore {
+    public:
+        /**
+         * Builds an empty store.
+         *
+         * @param shards number of shards, at least one is always used
+        */
+        MailboxStore(size_t shards = 16);
+
+        /**
+         * Bounds the memory used by the bodies of the messages, must be called before adding any mailbox.
+         *
+         * @param bytes maximum size of the bodies kept in memory, 0 means no limit
+         * @param store file that receives the bodies beyond the limit, required if there is a limit
+        */
+        void setBudget(size_t bytes, std::shared_ptr<BodyStore> store);
+
+        /**
+         * Shares the bodies with the same content between the messages, must be called before adding any mailbox.
+         *
+         * @param threshold minimum size of the shared bodies, 0 disables the sharing
+        */
+        void setDedup(size_t threshold);
+
+        /**
+         * Adds a new mailbox.
+         *
+         * @param key key of the mailbox
+         * @param box mailbox to add
+         * @param before if set, called under the lock of the shard when the key is not present, before the mailbox
+         *               becomes visible. The mailbox is added only if it returns true
+         * @returns true if the mailbox was added, false if the key was already present or before returned false
+        */
+        bool insert(key_t key, const mail::MailBox &box, const std::function<bool()> &before = nullptr);
+
+        /**
+         * Removes a mailbox.
+         *
+         * @param key key of the mailbox
+         * @returns true if the mailbox was removed, false if it wasn't present
+        */
+        bool erase(key_t key);
+
+        /**
+         * Removes a mailbox only if it wasn't modified since a copy of it was taken.
+         *
+         * @param key key of the mailbox
+         * @param version version of the copy, see mail::MailBox::getVersion
+         * @returns true if the mailbox was removed, false if it wasn't present or his version changed
+        */
+        bool erase(key_t key, uint64_t version);
+
+        /**
+         * @param key key of the mailbox
+         * @returns true if the mailbox is present
+        */
+        bool contains(key_t key) const;
+
+        /**
+         * Reads a mailbox while holding a shared lock on his shard.
+         *
+         * A mailbox of the segment or with bodies moved to disk is copied for the duration of the call,
+         * MailboxStore::view doesn't copy it.
+         *
+         * @param key key of the mailbox
+         * @param reader callable invoked as reader(const mail::MailBox &)
+         * @returns true if the mailbox was found and read, false otherwise
+        */
+        template<class F>
+        bool read(key_t key, F reader) const {
+            const Shard &shard = shardOf(key);
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            const Resident *resident = shard.boxes.find(key);
+            if(resident != nullptr) {
+                touch(*resident);
+                if(!resident->external()) {
+                    reader(resident->box);
+                } else {
+                    reader(MailboxView(resident->box, loader(*resident)).toMailBox());
+                }
+                return true;
+            }
+            MailboxView view;
+            if(!findCold(shard, key, view)) {
+                return false;
+            }
+            reader(view.toMailBox());
+            return true;
+        }
+
+        /**
+         * Reads a mailbox without copying it while holding a shared lock on his shard.
+         *
+         * @param key key of the mailbox
+         * @param viewer callable invoked as viewer(const chord::MailboxView &)
+         * @returns true if the mailbox was found and read, false otherwise
+        */
+        template<class F>
+        bool view(key_t key, F viewer) const {
+            const Shard &shard = shardOf(key);
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            const Resident *resident = shard.boxes.find(key);
+            if(resident != nullptr) {
+                touch(*resident);
+                if(!resident->external()) {
+                    viewer(MailboxView(resident->box));
+                } else {
+                    // The shared bodies are not copied, the ones on disk are read one at a time while the messages are visited
+                    viewer(MailboxView(resident->box, loader(*resident)));
+                }
+                return true;
+            }
+            MailboxView view;
+            if(!findCold(shard, key, view)) {
+                return false;
+            }
+            viewer(view);
+            return true;
+        }
+
+        /**
+         * Modifies a mailbox while holding an exclusive lock on his shard.
+         *
+         * The bodies shared or moved to disk are empty inside the callback: the messages can be added,
+         * removed and compacted, but their bodies must not be read.
+         *
+         * @param key key of the mailbox
+         * @param writer callable invoked as writer(mail::MailBox &)
+         * @returns true if the mailbox was found and modified, false otherwise
+        */
+        template<class F>
+        bool write(key_t key, F writer) {
+            {
+                Shard &shard = shardOf(key);
+                std::unique_lock<std::shared_mutex> lock(shard.mutex);
+                Resident *resident = shard.boxes.find(key);
+                if(resident == nullptr && (resident = hydrate(shard, key)) == nullptr) {
+                    return false;
+                }
+                size_t before = resident->box.getBodyBytes();
+                uint64_t removals = resident->box.getRemovals();
+                writer(resident->box);
+                body_bytes_ += resident->box.getBodyBytes() - before;
+                touch(*resident);
+                prune(*resident, resident->box.getRemovals() != removals);
+                share(*resident);
+                shard.dirty.insert(key);
+            }
+            checkBudget();
+            return true;
+        }
+
+        /**
+         * Visits all the mailboxes, each shard is visited while holding his shared lock.
+         *
+         * The mailboxes are not visited in any particular order and the visit is not atomic:
+         * mailboxes added or removed during the visit may or may not be visited.
+         *
+         * @param visitor callable invoked as visitor(key_t, const mail::MailBox &)
+        */
+        template<class F>
+        void forEach(F visitor) const {
+            for(auto &shard : shards_) {
+                std::shared_lock<std::shared_mutex> lock(shard->mutex);
+                for(auto &pair : shard->boxes) {
+                    if(!pair.second.external()) {
+                        visitor(pair.first, pair.second.box);
+                    } else {
+                        visitor(pair.first, MailboxView(pair.second.box, loader(pair.second)).toMailBox());
+                    }
+                }
+            }
+            std::shared_ptr<const Segment> base = segment();
+            for(size_t i = 0; base && i < base->size(); i++) {
+                key_t key = base->keyAt(i);
+                const Shard &shard = shardOf(key);
+                std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                MailboxView view;
+                if(shard.boxes.find(key) == nullptr && shard.segment == base && findCold(shard, key, view)) {
+                    visitor(key, view.toMailBox());
+                }
+            }
+        }
+
+        /**
+         * Visits the mailboxes whose key is in [first, last] in ascending order of key.
+         *
+         * The keys are collected from the ordered index of every shard, then each mailbox is visited
+         * while holding the shared lock of his shard. Mailboxes removed during the visit are skipped,
+         * mailboxes added during the visit may or may not be visited.
+         *
+         * @param first smallest key to visit
+         * @param last biggest key to visit
+         * @param visitor callable invoked as visitor(key_t, const mail::MailBox &)
+        */
+        template<class F>
+        void forRange(key_t first, key_t last, F visitor) const {
+            for(key_t key : keys(first, last)) {
+                read(key, [&](const mail::MailBox &box) { visitor(key, box); });
+            }
+        }
+
+        /**
+         * @param first smallest key to return
+         * @param last biggest key to return
+         * @returns the keys in [first, last] in ascending order
+        */
+        std::vector<key_t> keys(key_t first, key_t last) const;
+
+        /**
+         * Adds many mailboxes, the mailboxes whose key is already present are left in the source.
+         *
+         * @param boxes mailboxes to add
+        */
+        void merge(std::map<key_t, mail::MailBox> &boxes);
+
+        /**
+         * @returns a copy of all the mailboxes ordered by key
+        */
+        std::map<key_t, mail::MailBox> snapshot() const;
+
+        /**
+         * Returns the keys of the mailboxes added, modified or removed since the previous call and
+         * starts recording again. Each shard is swapped atomically, so a modification is either
+         * returned by this call or recorded for the next one.
+         *
+         * @returns the modified keys, not ordered
+        */
+        std::vector<key_t> takeDirty();
+
+        /**
+         * Reclaims the space of the messages removed from the mailboxes, see mail::MailBox::compact.
+         *
+         * Each shard is locked exclusively only while his mailboxes are compacted.
+         *
+         * @returns the number of reclaimed messages
+        */
+        size_t compact();
+
+        /**
+         * Removes all the mailboxes, the segment is detached.
+        */
+        void clear();
+
+        /**
+         * Attaches a segment under the mailboxes on the heap, it replaces the previous one.
+         *
+         * The segment must contain the mailboxes as they were when the dirty keys were last taken
+         * with MailboxStore::takeDirty: the mailboxes on the heap that were not modified since then are
+         * dropped and read from the segment, the ones removed since then stay removed.
+         *
+         * @param segment segment to attach, nullptr only detaches the current one
+        */
+        void attach(std::shared_ptr<const Segment> segment);
+
+        /**
+         * @returns the attached segment, nullptr if there is none
+        */
+        std::shared_ptr<const Segment> segment() const;
+
+        /**
+         * @returns the number of mailboxes
+        */
+        size_t size() const;
+
+        /**
+         * @returns the number of mailboxes copied on the heap, the others are read from the segment
+        */
+        size_t resident() const;
+
+        /**
+         * @returns the total size of the bodies kept in memory
+        */
+        size_t bodyBytes() const;
+
+        /**
+         * @returns the number of bodies moved to disk that can still be read
+        */
+        size_t spilledBodies() const;
+
+        /**
+         * @returns the number of bodies shared through the chord::BlobStore
+        */
+        size_t sharedBodies() const;
+
+        /**
+         * @returns the total size of the shared bodies, counted once for each message
+        */
+        uint64_t sharedBytes() const;
+
+        /**
+         * @returns the chord::BlobStore that holds the shared bodies
+        */
+        const BlobStore& blobs() const;
+
+        /**
+         * @returns true if there are no mailboxes
+        */
+        bool empty() const;
+
+        /**
+         * Method used to save the data structure, the mailboxes are saved as a map ordered by key.
+        */
+        template<class Archive>
+        void save(Archive &archive) const {
+            archive(snapshot());
+        }
+
+        /**
+         * Method used to load the data structure, the loaded mailboxes replace the current ones.
+        */
+        template<class Archive>
+        void load(Archive &archive) {
+            std::map<key_t, mail::MailBox> boxes;
+            archive(boxes);
+            clear();
+            merge(boxes);
+        }
+
+    private:
+        /**
+         * Position of a body inside the chord::BodyStore
+        */
+        struct BodyRef {
+            uint64_t offset; /**< Position of the first byte */
+            uint32_t size; /**< Size of the body */
+        };
+
+        /**
+         * Mailbox on the heap.
+        */
+        struct Resident {
+            mail::MailBox box; /**< The mailbox, the bodies moved to disk are empty */
+            std::unordered_map<uint64_t, BodyRef> spilled; /**< Bodies moved to disk by message id, may contain removed messages */
+            std::unordered_map<uint64_t, BlobStore::Blob> shared; /**< Bodies shared by message id, may contain removed messages */
+            uint64_t shared_until; /**< Identifier of the last message considered for sharing */
+            mutable std::atomic<uint64_t> access; /**< Value of MailboxStore::clock_ at the last access */
+
+            Resident(const mail::MailBox &box = mail::MailBox())
+                : box(box)
+                , shared_until(0)
+                , access(0) {}
+
+            Resident(const Resident &other)
+                : box(other.box)
+                , spilled(other.spilled)
+                , shared(other.shared)
+                , shared_until(other.shared_until)
+                , access(other.access.load()) {}
+
+            Resident& operator=(const Resident &other) {
+                box = other.box;
+                spilled = other.spilled;
+                shared = other.shared;
+                shared_until = other.shared_until;
+                access = other.access.load();
+                return *this;
+            }
+
+            Resident(Resident &&other) noexcept
+                : box(std::move(other.box))
+                , spilled(std::move(other.spilled))
+                , shared(std::move(other.shared))
+                , shared_until(other.shared_until)
+                , access(other.access.load()) {}
+
+            Resident& operator=(Resident &&other) noexcept {
+                box = std::move(other.box);
+                spilled = std::move(other.spilled);
+                shared = std::move(other.shared);
+                shared_until = other.shared_until;
+                access = other.access.load();
+                return *this;
+            }
+
+            /**
+             * @returns true if some bodies are not inside the mailbox
+            */
+            bool external() const {
+                return !spilled.empty() || !shared.empty();
+            }
+        };
+
+        /**
+         * Group of mailboxes protected by the same lock.
+         *
+         * Shards are allocated separately and aligned so that the locks of different shards
+         * never share a cache line.
+        */
+        struct alignas(64) Shard {
+            mutable std::shared_mutex mutex; /**< Protects the fields of the shard */
+            FlatIndex<Resident> boxes; /**< Mailboxes of the shard on the heap, they hide the ones of the segment */
+            std::set<key_t> order; /**< Keys of Shard::boxes in ascending order, used by range visits */
+            std::unordered_set<key_t> dirty; /**< Keys modified since the last MailboxStore::takeDirty */
+            std::shared_ptr<const Segment> segment; /**< Segment attached to the store, the same for all the shards */
+            std::unordered_set<key_t> erased; /**< Keys removed and not inserted again since the segment was attached, they hide the ones of the segment */
+            size_t hidden = 0; /**< Keys of the segment hidden by Shard::boxes or Shard::erased */
+        };
+
+        /**
+         * Searches a mailbox that is only in the segment, the shard must be locked.
+         *
+         * @returns true if the mailbox was found
+        */
+        static bool findCold(const Shard &shard, key_t key, MailboxView &view) {
+            return shard.segment && shard.erased.count(key) == 0 && shard.segment->find(key, view);
+        }
+
+        /**
+         * Copies on the heap a mailbox that is only in the segment, the shard must be locked exclusively.
+         *
+         * @returns the mailbox on the heap, nullptr if the mailbox was not in the segment
+        */
+        Resident* hydrate(Shard &shard, key_t key);
+
+        /**
+         * Removes a mailbox, the shard must be locked exclusively.
+         *
+         * @returns true if the mailbox was removed, false if it wasn't present
+        */
+        bool eraseLocked(Shard &shard, key_t key);
+
+        /**
+         * Records an access to a mailbox, used to choose the bodies to move to disk.
+        */
+        void touch(const Resident &resident) const {
+            resident.access.store(clock_.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        /**
+         * @returns a loader of the bodies of a mailbox that are shared or on disk, valid while his shard is locked
+        */
+        BodyLoader loader(const Resident &resident) const;
+
+        /**
+         * Forgets the shared bodies and the bodies on disk of the removed messages, the shard must be locked exclusively.
+         *
+         * @param removed true if messages were just removed, their shared bodies are released immediately;
+         *                otherwise the references are dropped only once they're many, so the cost is amortized
+        */
+        void prune(Resident &resident, bool removed = false);
+
+        /**
+         * Moves to the chord::BlobStore the long bodies of the messages inserted since the last call,
+         * the shard must be locked exclusively.
+        */
+        void share(Resident &resident);
+
+        /**
+         * Removes a mailbox from the accounting of the bodies, the shard must be locked exclusively.
+        */
+        void forget(const Resident &resident);
+
+        /**
+         * Calls MailboxStore::spill if the budget is exceeded.
+        */
+        void checkBudget() {
+            if(budget_ > 0 && body_bytes_ + blobs_.bytes() > budget_) {
+                spill();
+            }
+        }
+
+        /**
+         * Moves to disk the bodies of the mailboxes accessed least recently until they use less than
+         * seven eighths of the budget, so the next spill doesn't happen at the next insertion.
+         * The shared bodies are moved too, the memory is released when no mailbox uses them anymore.
+         * Only one thread spills at a time, the others don't wait for it.
+        */
+        void spill();
+
+        /**
+         * @returns the shard that contains a key
+        */
+        Shard& shardOf(key_t key);
+        const Shard& shardOf(key_t key) const; /**< Const version of MailboxStore::shardOf */
+
+        std::vector<std::unique_ptr<Shard>> shards_; /**< Shards of the store, their number never changes */
+        size_t budget_; /**< Maximum size of the bodies in memory, 0 means no limit */
+        std::shared_ptr<BodyStore> bodies_; /**< Receives the bodies beyond the budget */
+        std::atomic<size_t> body_bytes_; /**< Size of the bodies in memory */
+        std::atomic<size_t> spilled_refs_; /**< Bodies on disk referenced by the mailboxes, removed messages included */
+        BlobStore blobs_; /**< Bodies shared between the messages */
+        size_t dedup_threshold_; /**< Minimum size of the shared bodies, 0 if the bodies are not shared */
+        std::atomic<size_t> shared_refs_; /**< Shared bodies referenced by the mailboxes, removed messages included */
+        std::atomic<uint64_t> shared_bytes_; /**< Size of the shared bodies referenced by the mailboxes */
+        mutable std::atomic<uint64_t> clock_; /**< Incremented at each access to a mailbox */
+        std::mutex spill_mutex_; /**< Held by the thread that is spilling */
+    };
+}
+
+#endif // CHORD_MAILBOX_STORE_HPP
@@ -0,0 +1,112 @@
+#ifndef CHORD_PEER_POOL_HPP
+#define CHORD_PEER_POOL_HPP
+
+#include "types.hpp"
+#include "chord.grpc.pb.h"
+#include <grpcpp/grpcpp.h>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+namespace chord {
+    /**
+     * Keeps the connections towards other nodes open so they can be reused between calls.
+     *
+     * Creating a gRPC channel for every call means paying the connection setup on every hop,
+     * the pool instead keeps a channel and a stub for each peer, identified by his connection string.
+     * Connections that are not used for a while are closed by PeerPool::evictIdle.
+     *
+     * All the methods are thread safe.
+    */
+    class PeerPool {
+    public:
+        /**
+         * Builds an empty pool.
+         *
+         * @param idle_timeout time after which an unused connection can be evicted
+        */
+        PeerPool(std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(60000));
+
+        /**
+         * Returns the stub used to contact a peer, opening a new connection if necessary.
+         *
+         * @param peer node to contact
+         * @returns a stub connected to the peer, the stub stays valid even if the connection is evicted
+        */
+        std::shared_ptr<NodeService::Stub> get(const NodeInfo &peer);
+
+        /**
+         * Makes sure that the connection with a peer is open and marks it as recently used.
+         *
+         * Used to keep the connections with fingers, successor and predecessor ready before they are needed,
+         * warming a connection is not counted as a hit or a miss.
+         *
+         * @param peer node to connect to
+        */
+        void warm(const NodeInfo &peer);
+
+        /**
+         * Closes the connection with a peer.
+         *
+         * @param peer node to disconnect from
+        */
+        void erase(const NodeInfo &peer);
+
+        /**
+         * Closes all the connections that were not used in the idle timeout.
+        */
+        void evictIdle();
+
+        /**
+         * Sets the time after which an unused connection can be evicted.
+         *
+         * @param idle_timeout new timeout
+        */
+        void setIdleTimeout(std::chrono::milliseconds idle_timeout);
+
+        /**
+         * @returns the number of open connections
+        */
+        size_t size() const;
+
+        /**
+         * @returns the number of calls that reused an open connection
+        */
+        uint64_t hits() const;
+
+        /**
+         * @returns the number of calls that had to open a new connection
+        */
+        uint64_t misses() const;
+
+    private:
+        /**
+         * Connection towards a peer
+        */
+        struct Entry {
+            std::shared_ptr<grpc::Channel> channel; /**< Channel connected to the peer */
+            std::shared_ptr<NodeService::Stub> stub; /**< Stub built on the channel */
+            std::chrono::steady_clock::time_point last_used; /**< Last time the connection was used */
+        };
+
+        /**
+         * Returns the connection to a peer creating it if necessary, PeerPool::mutex_ must be held by the caller.
+         *
+         * @param target connection string of the peer
+         * @param created set to true if the connection was created by this call
+         * @returns the entry associated to the peer
+        */
+        Entry& lookup(const std::string &target, bool &created);
+
+        mutable std::mutex mutex_; /**< Protects PeerPool::peers_ */
+        std::unordered_map<std::string, Entry> peers_; /**< Open connections, indexed by connection string */
+        std::chrono::milliseconds idle_timeout_; /**< Time after which an unused connection can be evicted */
+        std::atomic<uint64_t> hits_, /**< Calls that reused an open connection */
+                              misses_; /**< Calls that opened a new connection */
+    };
+}
+
+#endif // CHORD_PEER_POOL_HPP
@@ -0,0 +1,114 @@
+#ifndef CHORD_ROUTE_CACHE_HPP
+#define CHORD_ROUTE_CACHE_HPP
+
+#include "types.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace chord {
+    /**
+     * Bounded cache of the nodes that own a key.
+     *
+     * Remembering the owner of a key allows to contact him directly instead of routing the request
+     * through the ring. The cache holds at most a fixed number of entries: when it's full the least
+     * recently used entry is discarded. Each entry also expires after a timeout, so the cache can't
+     * keep pointing to a node for long after the ring has changed.
+     *
+     * An entry that turns out to be wrong must be removed with RouteCache::erase by whoever used it.
+     *
+     * All the methods are thread safe.
+    */
+    class RouteCache {
+    public:
+        /**
+         * Builds an empty cache.
+         *
+         * @param capacity maximum number of entries, a cache with no capacity never stores anything
+         * @param ttl time after which an entry expires
+        */
+        RouteCache(size_t capacity = 1024, std::chrono::milliseconds ttl = std::chrono::milliseconds(60000));
+
+        /**
+         * Searches the owner of a key, the entry becomes the most recently used.
+         *
+         * @param key key to search
+         * @param owner filled with the owner of the key if found
+         * @returns true if the owner was found and is not expired, false otherwise
+        */
+        bool get(key_t key, NodeInfo &owner);
+
+        /**
+         * Stores the owner of a key, replacing the previous one.
+         *
+         * @param key key to store
+         * @param owner node that owns the key
+        */
+        void put(key_t key, const NodeInfo &owner);
+
+        /**
+         * Removes the owner of a key.
+         *
+         * @param key key to remove
+        */
+        void erase(key_t key);
+
+        /**
+         * Removes all the keys owned by a node, used when the node leaves the ring.
+         *
+         * @param owner node to remove
+        */
+        void erase(const NodeInfo &owner);
+
+        /**
+         * Removes all the keys inside the interval (first, last] of the ring, used when the keys move to another node.
+         *
+         * @param first beginning of the interval, excluded
+         * @param last end of the interval, included
+        */
+        void eraseRange(key_t first, key_t last);
+
+        /**
+         * Removes all the entries.
+        */
+        void clear();
+
+        /**
+         * @returns the number of entries, expired entries included
+        */
+        size_t size() const;
+
+        /**
+         * @returns the number of calls to RouteCache::get that found the owner
+        */
+        uint64_t hits() const;
+
+        /**
+         * @returns the number of calls to RouteCache::get that didn't find the owner
+        */
+        uint64_t misses() const;
+
+    private:
+        /**
+         * Owner of a key
+        */
+        struct Entry {
+            key_t key; /**< Cached key */
+            NodeInfo owner; /**< Node that owns the key */
+            std::chrono::steady_clock::time_point expires; /**< Time after which the entry is not valid anymore */
+        };
+
+        mutable std::mutex mutex_; /**< Protects RouteCache::entries_ and RouteCache::index_ */
+        std::list<Entry> entries_; /**< Entries ordered from the most to the least recently used */
+        std::unordered_map<key_t, std::list<Entry>::iterator> index_; /**< Position of each key inside RouteCache::entries_ */
+        size_t capacity_; /**< Maximum number of entries */
+        std::chrono::milliseconds ttl_; /**< Time after which an entry expires */
+        std::atomic<uint64_t> hits_, /**< Lookups that found the owner */
+                              misses_; /**< Lookups that didn't find the owner */
+    };
+}
+
+#endif // CHORD_ROUTE_CACHE_HPP
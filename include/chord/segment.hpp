@@ -0,0 +1,483 @@
+#ifndef CHORD_SEGMENT_HPP
+#define CHORD_SEGMENT_HPP
+
+#include "types.hpp"
+#include "mail.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace chord {
+    /**
+     * Read only view of a mail::Message, the strings point to memory owned by someone else.
+    */
+    struct MessageView {
+        uint64_t id; /**< Identifier of the message inside his mailbox */
+        std::time_t date; /**< Date of the message */
+        std::string_view to, /**< Receiver of the message */
+                         from, /**< Sender of the message */
+                         subject, /**< Subject of the message */
+                         body; /**< Body of the message */
+
+        /**
+         * @returns a copy of the message
+        */
+        mail::Message toMessage() const;
+    };
+
+    /**
+     * Callable that fills the body of a message whose body is not in memory, invoked as loader(id, body).
+     * Returns true with an empty body if the message has no body elsewhere, false if the body couldn't be read.
+    */
+    using BodyLoader = std::function<bool(uint64_t, std::string &)>;
+
+    /**
+     * Read only view of a mailbox, either a mail::MailBox on the heap or a record of a chord::Segment.
+     *
+     * A view is valid as long as what it points to: the views handed out by chord::MailboxStore
+     * can only be used inside the callback that receives them.
+    */
+    class MailboxView {
+    public:
+        MailboxView(); /**< Builds the view of an empty mailbox */
+
+        /**
+         * Builds the view of a mailbox on the heap.
+         *
+         * @param box mailbox to view
+        */
+        explicit MailboxView(const mail::MailBox &box);
+
+        /**
+         * Builds the view of a mailbox on the heap whose empty bodies may have been moved somewhere else,
+         * the bodies are loaded while the messages are visited.
+         *
+         * @param box mailbox to view
+         * @param loader callable used to load the empty bodies
+        */
+        MailboxView(const mail::MailBox &box, BodyLoader loader);
+
+        /**
+         * Builds the view of a mailbox record, only the fixed part of the record is checked:
+         * the messages are checked while they're visited.
+         *
+         * @param record bytes of the record, see chord::Segment for the format
+         * @param view view to fill
+         * @param version version of the format of the segment that contains the record
+         * @returns true if the record is valid, false otherwise
+        */
+        static bool parse(std::string_view record, MailboxView &view, uint32_t version);
+
+        std::string_view owner() const; /**< @returns the owner of the mailbox */
+        long long int password() const; /**< @returns the hash of the password of the mailbox */
+        size_t size() const; /**< @returns the number of messages */
+
+        /**
+         * The records written before the version was stored report the identifier of their last message.
+         *
+         * @returns the version of the mailbox, see mail::MailBox::getVersion
+        */
+        uint64_t version() const;
+
+        /**
+         * Visits the removals that happened after a given version, see mail::MailBox::forEachRemoval.
+         * A record doesn't remember any removal.
+         *
+         * @param version version after which the removals are visited
+         * @param visitor callable invoked as visitor(uint64_t version, uint64_t id)
+         * @returns true if all the removals after the version were visited, false if some of them are not remembered
+        */
+        template<class F>
+        bool forEachRemoval(uint64_t version, F visitor) const {
+            if(box_ != nullptr) {
+                return box_->forEachRemoval(version, visitor);
+            }
+            return version >= this->version();
+        }
+
+        /**
+         * Visits the messages in the order they were inserted.
+         *
+         * The visit of a corrupted record stops at the first invalid message.
+         *
+         * @param visitor callable invoked as visitor(const chord::MessageView &)
+        */
+        template<class F>
+        void forEachMessage(F visitor) const {
+            if(box_ != nullptr) {
+                std::string loaded;
+                box_->forEachMessage([this, &visitor, &loaded](const mail::Message &msg) {
+                    visitor(viewOf(msg, loaded));
+                });
+                return;
+            }
+            std::string_view data = messages_;
+            MessageView msg;
+            for(uint32_t i = 0; i < count_ && nextMessage(data, msg); i++) {
+                visitor(msg);
+            }
+        }
+
+        /**
+         * Visits some messages, the bodies that are not in memory are loaded only for them.
+         *
+         * The messages of a mailbox on the heap are looked up by identifier while a record is scanned,
+         * so the messages are not visited in any particular order.
+         *
+         * @param ids identifiers of the messages to visit, the ones that are not in the mailbox are ignored
+         * @param visitor callable invoked as visitor(const chord::MessageView &)
+        */
+        template<class F>
+        void forEachMessage(const std::vector<uint64_t> &ids, F visitor) const {
+            std::unordered_set<uint64_t> wanted(ids.begin(), ids.end());
+            if(box_ != nullptr) {
+                std::string loaded;
+                for(uint64_t id : wanted) {
+                    const mail::Message *msg = box_->findMessage(id);
+                    if(msg != nullptr) {
+                        visitor(viewOf(*msg, loaded));
+                    }
+                }
+                return;
+            }
+            forEachMessage([&wanted, &visitor](const MessageView &msg) {
+                if(wanted.count(msg.id) > 0) {
+                    visitor(msg);
+                }
+            });
+        }
+
+        /**
+         * Visits at most max messages starting from a given one, see mail::MailBox::forEachMessageFrom.
+         *
+         * A record can only be scanned from the beginning: the messages before the first one are skipped
+         * without reading their bodies and, from the most recent one, the views of the last max messages
+         * are kept while the record is scanned, so max should stay small.
+         *
+         * @param id identifier of the first message to visit, 0 starts from the first (most recent) message
+         * @param newest_first true to visit the messages from the most recent one
+         * @param max maximum number of messages to visit
+         * @param visitor callable invoked as visitor(const chord::MessageView &), returns false to stop the visit
+        */
+        template<class F>
+        void forEachMessageFrom(uint64_t id, bool newest_first, size_t max, F visitor) const {
+            size_t visited = 0;
+            if(box_ != nullptr) {
+                std::string loaded;
+                box_->forEachMessageFrom(id, newest_first, [&](const mail::Message &msg) {
+                    return visited++ < max && visitor(viewOf(msg, loaded));
+                });
+                return;
+            }
+            std::string_view data = messages_;
+            MessageView msg;
+            if(!newest_first) {
+                for(uint32_t i = 0; i < count_ && visited < max && nextMessage(data, msg); i++) {
+                    if(msg.id < id) {
+                        continue;
+                    }
+                    visited++;
+                    if(!visitor(msg)) {
+                        return;
+                    }
+                }
+                return;
+            }
+            std::vector<MessageView> last;
+            last.reserve(std::min<size_t>(max, count_));
+            size_t next = 0;
+            for(uint32_t i = 0; i < count_ && max > 0 && nextMessage(data, msg); i++) {
+                if(id != 0 && msg.id > id) {
+                    continue;
+                }
+                if(last.size() < max) {
+                    last.push_back(msg);
+                } else {
+                    last[next] = msg;
+                    next = (next + 1) % max;
+                }
+            }
+            // The oldest view kept is at position next
+            for(size_t i = last.size(); i-- > 0;) {
+                if(!visitor(last[(next + i) % last.size()])) {
+                    return;
+                }
+            }
+        }
+
+        /**
+         * The bodies that couldn't be loaded are left empty, see MailboxView::lost.
+         *
+         * @returns a copy of the mailbox on the heap
+        */
+        mail::MailBox toMailBox() const;
+
+        /**
+         * @returns true if a body that is not in memory couldn't be loaded by the visits done so far,
+         *          the visited messages had an empty body instead
+        */
+        bool lost() const;
+
+    private:
+        /**
+         * Builds the view of a message of the mailbox on the heap, loading his body if it's not in memory.
+         *
+         * @param msg message to view
+         * @param loaded buffer that receives the loaded body, the view points to it
+        */
+        MessageView viewOf(const mail::Message &msg, std::string &loaded) const {
+            MessageView view{msg.id, msg.date, msg.to, msg.from, msg.subject, msg.body};
+            if(msg.body.empty() && loader_) {
+                if(loader_(msg.id, loaded)) {
+                    view.body = loaded;
+                } else {
+                    lost_ = true;
+                }
+            }
+            return view;
+        }
+
+        /**
+         * Reads the message at the beginning of a buffer and moves the buffer after it.
+         *
+         * @returns true if the message is valid, false otherwise
+        */
+        static bool nextMessage(std::string_view &data, MessageView &msg);
+
+        const mail::MailBox *box_; /**< Mailbox on the heap, nullptr if the view points to a record */
+        BodyLoader loader_; /**< Loads the bodies of the mailbox on the heap that are not in memory, may be empty */
+        std::string_view owner_; /**< Owner of the mailbox of the record */
+        long long int password_; /**< Password of the mailbox of the record */
+        uint32_t count_; /**< Number of messages of the record */
+        uint64_t next_id_; /**< Identifier of the next message of the mailbox of the record, 0 if the record doesn't store it */
+        std::string_view messages_; /**< Packed messages of the record */
+        mutable bool lost_; /**< Set when the loader fails, see MailboxView::lost */
+    };
+
+    /**
+     * Immutable file of mailboxes read through a memory mapping.
+     *
+     * The file starts with a fixed header, followed by an index of the mailboxes ordered by key and
+     * by the packed mailbox records. Opening a segment only maps the file: the index and the records
+     * are paged in by the kernel when they're accessed, so the startup time and the memory of a node
+     * don't depend on the amount of mail. All the integers are stored in the byte order of the host.
+     *
+     * Header: magic "CHORDSEG", u32 version, u32 reserved, u64 generation, u64 number of mailboxes.
+     * Index entry: i64 key, u64 offset of the record from the beginning of the file, u32 record length,
+     * u32 CRC-32 of the record (version 1 used a u64 length and had no checksum).
+     * Mailbox record: u32 owner length, owner, i64 password, u32 number of messages, u64 identifier of the next
+     * message (since version 3, so the version of the mailbox survives the removal of his last messages), messages.
+     * Message: u64 id, i64 date, u32 lengths of to, from, subject and body, followed by the four strings.
+     *
+     * Every record is checked independently the first time it's read, a corrupted record is reported
+     * as missing while the others are still served. Disjoint ranges of records can be checked in
+     * parallel by different threads with Segment::load.
+     *
+     * All the methods are thread safe.
+    */
+    class Segment {
+    public:
+        static constexpr uint32_t VERSION = 3; /**< Version of the format written by chord::SegmentWriter, older versions can be read */
+
+        /**
+         * Maps a segment file.
+         *
+         * @param path file of the segment
+         * @returns the segment, nullptr if the file doesn't exist
+         * @throws std::runtime_error if the file can't be mapped or is not a valid segment
+        */
+        static std::shared_ptr<const Segment> open(const std::string &path);
+
+        /**
+         * Unmaps the file.
+        */
+        ~Segment();
+
+        Segment(const Segment &) = delete;
+        Segment& operator=(const Segment &) = delete;
+
+        uint32_t version() const; /**< @returns the version of the format of the file */
+        uint64_t generation() const; /**< @returns the generation written in the header */
+        size_t size() const; /**< @returns the number of mailboxes */
+        uint64_t bytes() const; /**< @returns the size of the file */
+
+        /**
+         * Only the index is searched, the record of the mailbox may be corrupted.
+         *
+         * @param key key of the mailbox
+         * @returns true if the mailbox is in the segment
+        */
+        bool contains(key_t key) const;
+
+        /**
+         * Searches a mailbox.
+         *
+         * @param key key of the mailbox
+         * @param view view to fill, valid as long as the segment
+         * @returns true if the mailbox was found and his record is valid, false otherwise
+        */
+        bool find(key_t key, MailboxView &view) const;
+
+        /**
+         * Checks the record at a position of the index, the result is remembered so each record is
+         * checked only once.
+         *
+         * @param i position in the index
+         * @returns true if the record is inside the file, matches his checksum and contains valid messages
+        */
+        bool check(size_t i) const;
+
+        /**
+         * @returns the number of corrupted records found so far
+        */
+        size_t corrupt() const;
+
+        /**
+         * @param i position in the index
+         * @returns the key at a position of the index
+        */
+        key_t keyAt(size_t i) const;
+
+        /**
+         * @param key key to search
+         * @returns the position of the first key of the index not smaller than the given one
+        */
+        size_t lowerBound(key_t key) const;
+
+        /**
+         * Reads in memory and checks the records of a range of the index, so the following accesses
+         * don't wait for the disk.
+         *
+         * The records are written in the order of the index, so the range is read sequentially.
+         * Disjoint ranges can be loaded in parallel by different threads.
+         *
+         * @param first position of the first record to load
+         * @param last position after the last record to load
+         * @returns the number of valid records in the range
+        */
+        size_t load(size_t first, size_t last) const;
+
+    private:
+        /**
+         * Entry of the index, read from the mapping with memcpy since it has no alignment guarantees
+        */
+        struct Entry {
+            int64_t key; /**< Key of the mailbox */
+            uint64_t offset; /**< Position of the record */
+            uint64_t length; /**< Length of the record */
+            uint32_t checksum; /**< CRC-32 of the record, zero in version 1 */
+        };
+
+        /**
+         * Result of Segment::check for each record
+        */
+        enum State : uint8_t {
+            UNCHECKED = 0, /**< Not checked yet */
+            VALID = 1, /**< The record is valid */
+            CORRUPT = 2 /**< The record is corrupted */
+        };
+
+        Segment(const char *data, size_t size); /**< Takes ownership of a mapping */
+
+        Entry entryAt(size_t i) const; /**< @returns the entry at a position of the index */
+
+        const char *data_; /**< Mapped file */
+        size_t size_; /**< Size of the mapping */
+        uint32_t version_; /**< Version written in the header */
+        uint64_t generation_; /**< Generation written in the header */
+        size_t count_; /**< Number of entries of the index */
+        std::unique_ptr<std::atomic<uint8_t>[]> states_; /**< chord::Segment::State of each record */
+        mutable std::atomic<size_t> corrupt_; /**< Records found corrupted */
+    };
+
+    /**
+     * Writes a chord::Segment file.
+     *
+     * The mailboxes must be added in ascending order of key, the records are written while they're
+     * added and the index is written by SegmentWriter::finish, which makes the file durable.
+    */
+    class SegmentWriter {
+    public:
+        /**
+         * Creates a segment file, an existing file is replaced.
+         *
+         * @param path file of the segment
+         * @param generation generation written in the header
+         * @param capacity maximum number of mailboxes, room for their index entries is reserved after the header
+         * @throws std::runtime_error if the file can't be created
+        */
+        SegmentWriter(const std::string &path, uint64_t generation, size_t capacity);
+
+        /**
+         * Closes the file, if SegmentWriter::finish wasn't called the file is not a valid segment.
+        */
+        ~SegmentWriter();
+
+        SegmentWriter(const SegmentWriter &) = delete;
+        SegmentWriter& operator=(const SegmentWriter &) = delete;
+
+        /**
+         * Appends the record of a mailbox to a buffer.
+         *
+         * @param box mailbox to encode
+         * @param out buffer to append to
+        */
+        static void encode(const MailboxView &box, std::string &out);
+
+        /**
+         * Adds a mailbox record.
+         *
+         * @param key key of the mailbox, bigger than the keys already added
+         * @param record record built by SegmentWriter::encode
+         * @returns true if the record was added, false if the capacity is exhausted, the key is out of order,
+         *          the record is bigger than 4 GB or the write failed
+        */
+        bool add(key_t key, const std::string &record);
+
+        /**
+         * Adds a mailbox record whose checksum was already computed, so the checksums of many records can
+         * be computed in parallel while they're encoded.
+         *
+         * @param key key of the mailbox, bigger than the keys already added
+         * @param record record built by SegmentWriter::encode
+         * @param checksum chord::crc32 of the record
+         * @returns the same as SegmentWriter::add(key_t, const std::string &)
+        */
+        bool add(key_t key, const std::string &record, uint32_t checksum);
+
+        /**
+         * Writes the pending records, the header and the index, then synchronizes the file.
+         *
+         * @returns true if the segment is complete and durable
+        */
+        bool finish();
+
+    private:
+        /**
+         * Writes SegmentWriter::buffer_ at the end of the records.
+         *
+         * @returns true if the operation was successful
+        */
+        bool flush();
+
+        int fd_; /**< Descriptor of the file */
+        uint64_t generation_; /**< Generation written in the header */
+        size_t capacity_; /**< Maximum number of mailboxes */
+        uint64_t offset_; /**< Position of the next record */
+        std::string buffer_; /**< Records not written yet */
+        std::string index_; /**< Index entries of the records added so far */
+        size_t count_; /**< Number of records added so far */
+        key_t last_; /**< Key of the last record added */
+        bool failed_; /**< True if a write failed */
+    };
+}
+
+#endif // CHORD_SEGMENT_HPP
@@ -2,10 +2,27 @@
 #define CHORD_SERVER_HPP
 
 #include "types.hpp"
+#include "config.hpp"
+#include "stats.hpp"
+#include "peer_pool.hpp"
+#include "finger_table.hpp"
+#include "latency.hpp"
+#include "route_cache.hpp"
+#include "mailbox_store.hpp"
+#include "wal.hpp"
+#include "codec.hpp"
+#include "watch_hub.hpp"
 #include <grpcpp/grpcpp.h>
+#include <algorithm>
 #include <string>
 #include <thread>
+#include <chrono>
 #include <map>
+#include <unordered_set>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <type_traits>
 #include <exception>
 #include <cereal/archives/json.hpp>
 #include <cereal/types/string.hpp>
@@ -14,15 +31,28 @@
 #include "mail.hpp"
 
 namespace chord {
+    class AsyncServer;
+
     /**
-     * Hash function used to generate keys.
-     * The function uses a SHA-1 algorithm.
-     * These hashes are in the range [0, 2^M)
+     * Next hop chosen by a routed service.
+     * 
+     * Routed services either answer the request locally or choose the node that should receive
+     * the request next, in this case Hop::valid is set to true and the request to forward is stored
+     * in Hop::request, usually with a decreased TTL.
      * 
-     * @param str string to hash
-     * @return A key in the range [0, 2^M)
+     * A service that must authenticate a user whose mailbox is on another node sets Hop::authenticate instead:
+     * the caller of the step verifies Hop::credentials with the owner of the mailbox and executes the step
+     * again with Hop::authenticated set.
     */
-    key_t hashString(const std::string &str);
+    template<class T>
+    struct Hop {
+        bool valid = false; /**< True if the request must be forwarded */
+        NodeInfo node; /**< Node that will receive the forwarded request */
+        T request; /**< Request to forward */
+        bool authenticate = false; /**< True if Hop::credentials must be verified before executing the step again */
+        Authentication credentials; /**< Credentials to verify with the owner of their mailbox */
+        bool authenticated = false; /**< Set by the caller of the step once the credentials were verified */
+    };
 
     /**
      * Handles all node's backend operations.
@@ -44,8 +74,9 @@ namespace chord {
          * 
          * @param address ip address of the node
          * @param port ip port that the node will answer to 
+         * @param config tunable parameters of the node
         */
-        Node(const std::string &address, int port);
+        Node(const std::string &address, int port, const NodeConfig &config = NodeConfig());
         
         /**
          * Destructor, refer to Stop method to check the work done.
@@ -60,13 +91,18 @@ namespace chord {
         bool isRunning() const;
         /**
          * Start the server operations, from now on the server will answer his requests. 
+         * 
+         * The segment written by a previous run is mapped, so his mailboxes are read from the disk only
+         * when they're accessed. The incremental snapshots and the mutations recorded in the write-ahead
+         * log (see chord::NodeConfig::wal_mode) are replayed on top of it.
+         * Once the server is started the segment is read in memory by background threads, see Node::loadSegment.
         */
         void Run();
         /**
          * Stops the server, from now on the server won't answer his requests.
          * 
-         * This method will transfer his mailboxes to his successor before closing, if the successor
-         * doesn't answer the mailboxes will be dumped in a binary file named after his id.
+         * This method will transfer his mailboxes to his successor before closing, then a
+         * snapshot is written so the mailboxes that couldn't be transferred are found at the next start.
         */
         void Stop();
         /**
@@ -95,15 +131,16 @@ namespace chord {
          * This service will search for the finger for a given key inside the request.
          * 
          * A node is a finger for a key if is the left-nearest node of the ring.
-         * The request will be forwarded inside the ring if this node is not the finger and the reply 
-         * will be based on what the neighbour replied.
+         * If the key falls between this node and his successor the successor is the finger, otherwise the request
+         * is forwarded to the closest finger preceding the key, like the other routed services, so the finger is
+         * found in O(log N) steps. The reply will be based on what the neighbour replied.
          * 
          * This method shouldn't be called directly, is used by the nodes internally.
          * 
          * @param context metadata used by gRPC
          * @param request contains the key to search the finger for
          * @param reply contains the answer to the research
-         * @returns Status::OK if the finger was found, StatusCode::NOT_FOUND if the request made the entire loop.
+         * @returns Status::OK if the finger was found, StatusCode::NOT_FOUND if the TTL reaches 0.
         */
         grpc::Status SearchFinger(grpc::ServerContext *context, const FingerQuestion *request, NodeInfoMessage *reply) override;
 
@@ -134,10 +171,10 @@ namespace chord {
          * 
          * @param context metadata used by gRPC
          * @param request contains the info about the node that considers the executing node his successor
-         * @param reply contains the info about the node that the executing node considers his predecessor
+         * @param reply contains the info about the node that the executing node considers his predecessor and his successor list
          * @returns Status::OK every time 
         */
-        grpc::Status Stabilize(grpc::ServerContext *context, const NodeInfoMessage *request, NodeInfoMessage *reply) override;
+        grpc::Status Stabilize(grpc::ServerContext *context, const NodeInfoMessage *request, StabilizeReply *reply) override;
 
         /**
          * This service inserts a new mailbox inside the ring, this operations equals the account registration in a mail service.
@@ -209,10 +246,13 @@ namespace chord {
          * 
          * This service will check the authentication.
          * 
+         * The message is identified by his id, if the id is 0 the index of the message is used instead.
+         * Ids don't change when other messages are sent or deleted, while indexes do.
+         * 
          * This method shouldn't be called directly, use chord::Client to interact with this service.
          * 
          * @param context metadata used by gRPC
-         * @param request the index of the message to delete
+         * @param request the id or the index of the message to delete
          * @param reply empty reply
          * @returns Status::OK if the message was deleted successfully, StatusCode::OUT_OF_RANGE if the requested message's index
          *          is negative or bigger than the size of the mailbox, StatusCode::NOT_FOUND if the TTL reaches 0
@@ -229,13 +269,112 @@ namespace chord {
          * 
          * This method shouldn't be called directly, use chord::Client to interact with this service.
          * 
+         * The bodies compressed by the node are sent decompressed, see chord::BodyCodec.
+         * 
          * @param context metadata used by gRPC
          * @param request authentication data
          * @param reply containing all the necessary data of the mailbox
+         * @returns Status::OK if the mailbox was found, StatusCode::UNAUTHENTICATED if the authentication doesn't match,
+         *          StatusCode::NOT_FOUND if the mailbox wasn't found and StatusCode::DATA_LOSS if a body couldn't be decompressed.
+        */
+        grpc::Status Receive(grpc::ServerContext *context, const Authentication *request, Mailbox *reply);
+
+        /**
+         * Returns the headers of the messages of a given mailbox without their bodies.
+         * 
+         * Like Node::Receive this service must be called on the successor's node and checks the authentication.
+         * The bodies are read by the node only to report their size, they're downloaded with Node::FetchBodies.
+         * 
+         * This method shouldn't be called directly, use chord::Client to interact with this service.
+         * 
+         * @param context metadata used by gRPC
+         * @param request authentication data
+         * @param reply the headers of the messages in insertion order
          * @returns Status::OK if the mailbox was found, StatusCode::UNAUTHENTICATED if the authentication doesn't match
          *          and StatusCode::NOT_FOUND if the mailbox wasn't found.
         */
-        grpc::Status Receive(grpc::ServerContext *context, const Authentication *request, Mailbox *reply);
+        grpc::Status ListHeaders(grpc::ServerContext *context, const Authentication *request, HeaderList *reply) override;
+
+        /**
+         * Returns the bodies of some messages of a given mailbox, decompressed.
+         * 
+         * Like Node::Receive this service must be called on the successor's node and checks the authentication.
+         * 
+         * This method shouldn't be called directly, use chord::Client to interact with this service.
+         * 
+         * @param context metadata used by gRPC
+         * @param request authentication data and identifiers of the messages
+         * @param reply the bodies of the requested messages that are in the mailbox, in no particular order
+         * @returns Status::OK if the mailbox was found, StatusCode::UNAUTHENTICATED if the authentication doesn't match,
+         *          StatusCode::NOT_FOUND if the mailbox wasn't found and StatusCode::DATA_LOSS if a body couldn't be decompressed.
+        */
+        grpc::Status FetchBodies(grpc::ServerContext *context, const FetchRequest *request, BodyList *reply) override;
+
+        /**
+         * Streams a page of the messages of a given mailbox, decompressed, in chunks of bounded size.
+         *
+         * Like Node::Receive this service must be called on the successor's node and checks the authentication.
+         * Each chunk is filled inside his own visit of the mailbox and written after the visit, so the memory used by
+         * the call depends on NodeConfig::receive_chunk_size and not on the size of the mailbox, and the mailbox isn't
+         * locked while the chunk travels. The page starts from the message with identifier start_id (0 starts from the
+         * first or the most recent message) and every chunk carries in next_id the identifier of the message that follows
+         * it, 0 when the mailbox is over, to be used as start_id of the next page.
+         *
+         * This method shouldn't be called directly, use chord::Client to interact with this service.
+         *
+         * @param context metadata used by gRPC
+         * @param request authentication data, first message, maximum number of messages (0 means no limit) and order of the page
+         * @param writer stream that receives the chunks
+         * @returns Status::OK if the mailbox was found, StatusCode::UNAUTHENTICATED if the authentication doesn't match,
+         *          StatusCode::NOT_FOUND if the mailbox wasn't found, StatusCode::DATA_LOSS if a body couldn't be decompressed
+         *          and StatusCode::CANCELLED if the client went away.
+        */
+        grpc::Status ReceiveStream(grpc::ServerContext *context, const ReceiveRequest *request, grpc::ServerWriter<MailboxChunk> *writer) override;
+
+        /**
+         * Returns the changes of a given mailbox since a version already known by the client.
+         *
+         * Like Node::Receive this service must be called on the successor's node and checks the authentication.
+         * The messages inserted after the version are sent decompressed, at most NodeConfig::receive_chunk_size
+         * kilobytes and NodeConfig::receive_chunk_messages messages at a time: when more is set the client asks again
+         * from the returned version. The removals are sent as identifiers.
+         *
+         * The versions are valid only for the epoch of the node that gave them, the epoch changes when the node
+         * restarts. When the epoch doesn't match, the version is not known or the mailbox doesn't remember all
+         * the removals since then (see mail::MailBox::forEachRemoval) reset is set and the client must download
+         * the whole mailbox, starting from the returned version afterwards.
+         *
+         * This method shouldn't be called directly, use chord::Client to interact with this service.
+         *
+         * @param context metadata used by gRPC
+         * @param request authentication data, epoch and version known by the client
+         * @param reply the epoch of the node, the version reached by the changes, the added and the removed messages
+         * @returns Status::OK if the mailbox was found, StatusCode::UNAUTHENTICATED if the authentication doesn't match,
+         *          StatusCode::NOT_FOUND if the mailbox wasn't found and StatusCode::DATA_LOSS if a body couldn't be decompressed.
+        */
+        grpc::Status Sync(grpc::ServerContext *context, const SyncRequest *request, SyncReply *reply) override;
+
+        /**
+         * Streams the header of every message inserted in a given mailbox by Node::Send from now on.
+         *
+         * Like Node::Receive this service must be called on the successor's node and checks the authentication.
+         * The initial metadata carries chord::WATCH_METADATA once the watcher is registered, so the client knows
+         * that no message can be missed from that moment. The headers are shared by all the watchers of the mailbox
+         * through Node::watchers_, at most NodeConfig::watch_queue_size of them wait to be sent to each watcher.
+         *
+         * Here each stream keeps a server thread busy, with NodeConfig::async_server the streams are served by the
+         * completion queues and an idle watcher doesn't hold any thread.
+         *
+         * This method shouldn't be called directly, use chord::Client to interact with this service.
+         *
+         * @param context metadata used by gRPC
+         * @param request authentication data of the mailbox to watch
+         * @param writer stream the headers are written to
+         * @returns StatusCode::CANCELLED when the client goes away, StatusCode::UNAVAILABLE if the node is stopping or the mailbox
+         *          moved to another node, StatusCode::RESOURCE_EXHAUSTED if the client couldn't keep up with the new messages
+         *          and the errors of Node::checkWatcher.
+        */
+        grpc::Status Watch(grpc::ServerContext *context, const Authentication *request, grpc::ServerWriter<HeaderMessage> *writer) override;
 
         /**
          * Receives mailboxes from another node.
@@ -256,10 +395,29 @@ namespace chord {
         */
         grpc::Status Transfer(grpc::ServerContext *context, const TransferMailbox *request, Empty *reply);
 
+        /**
+         * Returns the next hop towards the successor node of a key.
+         * 
+         * This is the building block of the iterative routing: the request is never forwarded, the node
+         * answers with the successor node of the key if he knows it or with the closest node preceding the
+         * key in his finger table, the caller is then responsible for contacting the next hop.
+         * 
+         * This method shouldn't be called directly, use chord::Client with RoutingMode::ITERATIVE to interact with this service.
+         * 
+         * @param context metadata used by gRPC
+         * @param request the key to search the successor for
+         * @param reply the next hop, NextHop::owner is set if the node is the successor of the key
+         * @returns Status::OK every time
+        */
+        grpc::Status FindSuccessor(grpc::ServerContext *context, const SuccessorQuery *request, NextHop *reply) override;
+
         /* PUBLIC INTERFACE */
 
         /**
          * Starts the build of a new finger table.
+         * 
+         * Every finger is refreshed with Node::refreshFinger, during normal operations the table is kept
+         * updated incrementally by Node::stabilize so a full rebuild is only needed when the ring is built.
         */
         void buildFingerTable();
         
@@ -292,21 +450,41 @@ namespace chord {
         void setSuccessor(const NodeInfo &successor);
 
         /**
-         * @returns this node's successor
+         * @returns a copy of this node's successor
+        */
+        NodeInfo getSuccessor() const;
+
+        /**
+         * @returns a copy of this node's predecessor
         */
-        const NodeInfo& getSuccessor() const;
+        NodeInfo getPredecessor() const;
 
         /**
-         * @returns this node's predecessor
+         * Returns the successor list of the node.
+         * 
+         * The list contains up to NodeConfig::successor_list_size nodes that follow this one in the ring,
+         * the first one is the successor. The other nodes are used when the successor stops answering.
+         * 
+         * @returns a copy of the successor list
         */
-        const NodeInfo& getPredecessor() const;
+        std::vector<NodeInfo> getSuccessors() const;
 
         /**
          * @throw std::out_of_range if idx is negative or bigger than the size of the finger table 
          * @param idx finger index
-         * @returns this node's finger at index idx
+         * @returns a copy of this node's finger at index idx
+        */
+        NodeInfo getFinger(int idx) const;
+
+        /**
+         * @returns the configuration used by this node
+        */
+        const NodeConfig& getConfig() const;
+
+        /**
+         * @returns a snapshot of the counters collected by this node
         */
-        const NodeInfo& getFinger(int idx) const;
+        NodeStats getStats() const;
         
         /**
          * Method used to serialize the data structure.
@@ -320,31 +498,324 @@ namespace chord {
 
     private:
 
+        friend class AsyncServer;
+
+        /* ROUTING STEPS */
+
+        /*
+         * The following methods contain the logic of the routed services, they answer the request if
+         * this node can do it or fill the next hop otherwise.
+         * They're shared by the synchronous services, that forward the request with Node::route,
+         * and by chord::AsyncServer that forwards the request without blocking a thread.
+        */
+
+        grpc::Status stepSearchFinger(const FingerQuestion &request, NodeInfoMessage &reply, Hop<FingerQuestion> &hop); /**< Routing step of Node::SearchFinger */
+        grpc::Status stepNodeJoin(const JoinRequest &request, NodeInfoMessage &reply, Hop<JoinRequest> &hop); /**< Routing step of Node::NodeJoin */
+        grpc::Status stepInsertMailbox(const InsertMailboxMessage &request, NodeInfoMessage &reply, Hop<InsertMailboxMessage> &hop); /**< Routing step of Node::InsertMailbox */
+        grpc::Status stepLookupMailbox(const QueryMailbox &request, NodeInfoMessage &reply, Hop<QueryMailbox> &hop); /**< Routing step of Node::LookupMailbox */
+        grpc::Status stepSend(const MailboxMessage &request, Empty &reply, Hop<MailboxMessage> &hop); /**< Routing step of Node::Send */
+        grpc::Status stepDelete(const DeleteMessage &request, Empty &reply, Hop<DeleteMessage> &hop); /**< Routing step of Node::Delete */
+
         /* INTERNAL MANAGEMENT METHODS */
 
+        /**
+         * Executes a routing step and, if necessary, forwards the request to the next hop waiting for his answer.
+         * 
+         * @param request request received by the service
+         * @param reply reply to fill
+         * @param step routing step of the service
+         * @param rpc function pointer to the method to call on the next hop
+         * @param context context of the received request, the forwarded requests don't outlive his deadline.
+         *                Null for the requests started by the node itself
+         * @returns the status of the local step or the status returned by the next hop, marked with Node::relayed
+        */
+        template<class T, class R>
+        grpc::Status route(const T *request, R *reply, grpc::Status (Node::*step)(const T &, R &, Hop<T> &), grpc::Status (chord::NodeService::Stub::*rpc)(grpc::ClientContext *, const T &, R *),
+                           grpc::ServerContext *context = nullptr) {
+            auto deadline = context != nullptr ? context->deadline() : std::chrono::system_clock::time_point::max();
+            bool authenticated = false;
+            auto execute = [&](Hop<T> &hop) {
+                hop = Hop<T>();
+                hop.authenticated = authenticated;
+                grpc::Status status = (this->*step)(*request, *reply, hop);
+                if(hop.authenticate) {
+                    if(!checkAuthentication(hop.credentials)) {
+                        return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "Authentication failed");
+                    }
+                    authenticated = true;
+                    hop = Hop<T>();
+                    hop.authenticated = true;
+                    status = (this->*step)(*request, *reply, hop);
+                }
+                return status;
+            };
+            Hop<T> hop;
+            grpc::Status status = execute(hop);
+            // A dead next hop is dropped and the step is executed again, so the request goes to the next alive node
+            for(int attempt = 0; hop.valid && attempt <= config_.successor_list_size; attempt++) {
+                bool answered = false;
+                auto[result, rep] = (prepareAsync<T, R>() != nullptr && config_.hedge_lookups) ?
+                    sendHedged<T, R>(hop, prepareAsync<T, R>(), deadline, &answered) :
+                    sendMessage<T, R>(&hop.request, hop.node, rpc, deadline, &answered);
+                if(answered || !isUnreachable(result, deadline)) {
+                    if(result.ok()) {
+                        cacheRoute(hop.request, rep);
+                    }
+                    reply->CopyFrom(rep);
+                    return relayed(context, result);
+                }
+                dropPeer(hop.node);
+                status = execute(hop);
+            }
+            return relayed(context, hop.valid ? grpc::Status(grpc::StatusCode::UNAVAILABLE, "No next hop is answering") : status);
+        }
+
         /**
          * Shortcut used to send messages between nodes.
          * 
          * @param request request to send to the node
          * @param to node to send the message to
          * @param rpc function pointer to the method to call on the remote node
+         * @param deadline latest deadline of the call, see Node::setDeadline
+         * @param answered if not null, set to true if the error was answered by the remote node, see Node::answered
          * @returns a pair composed by the grpc::Status of the call and the reply message sent by the remote node.
         */
         template<class T, class R>
-        std::pair<grpc::Status, R> sendMessage(const T *request, const NodeInfo &to, grpc::Status (chord::NodeService::Stub::*rpc)(grpc::ClientContext *, const T &, R *)) {
+        std::pair<grpc::Status, R> sendMessage(const T *request, const NodeInfo &to, grpc::Status (chord::NodeService::Stub::*rpc)(grpc::ClientContext *, const T &, R *),
+                                               std::chrono::system_clock::time_point deadline = std::chrono::system_clock::time_point::max(), bool *answered = nullptr) {
             T req(*request);
             R rep;
             grpc::ClientContext context;
-            std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(to.conn_string(), grpc::InsecureChannelCredentials());
-            auto stub = chord::NodeService::NewStub(channel);
-            return std::pair<grpc::Status, R>((stub.get()->*rpc)(&context, req, &rep), rep);
+            setDeadline<T>(context, deadline);
+            countRpc<T>();
+            auto stub = peers_.get(to);
+            grpc::Status status = (stub.get()->*rpc)(&context, req, &rep);
+            countStatus(status);
+            if(answered != nullptr) {
+                *answered = Node::answered(context, status);
+            }
+            return std::pair<grpc::Status, R>(status, rep);
+        }
+
+        /** Stub method that starts an asynchronous call */
+        template<class T, class R>
+        using PrepareAsync = std::unique_ptr<grpc::ClientAsyncResponseReader<R>> (NodeService::Stub::*)(grpc::ClientContext *, const T &, grpc::CompletionQueue *);
+
+        /**
+         * Returns the asynchronous stub method of a lookup that can be hedged.
+         * 
+         * Only the lookups are hedged because they don't change the state of the ring,
+         * so they can be safely executed twice.
+         * 
+         * @tparam T type of the request
+         * @tparam R type of the reply
+         * @returns the method used to send the request asynchronously, nullptr if the request can't be hedged
+        */
+        template<class T, class R>
+        static constexpr PrepareAsync<T, R> prepareAsync() {
+            if constexpr (std::is_same<T, QueryMailbox>::value) {
+                return &NodeService::Stub::PrepareAsyncLookupMailbox;
+            } else if constexpr (std::is_same<T, FingerQuestion>::value) {
+                return &NodeService::Stub::PrepareAsyncSearchFinger;
+            } else {
+                return nullptr;
+            }
+        }
+
+        /**
+         * @param request lookup that can be hedged, see Node::prepareAsync
+         * @returns the key searched by the lookup
+        */
+        template<class T>
+        static key_t lookupKey(const T &request) {
+            if constexpr (std::is_same<T, QueryMailbox>::value) {
+                return hashString(request.owner());
+            } else if constexpr (std::is_same<T, FingerQuestion>::value) {
+                return request.finger_value();
+            } else {
+                // The other requests are never hedged
+                return 0;
+            }
+        }
+
+        /**
+         * Sends a lookup to the next hop and, if it doesn't answer in time, sends it again through the next best finger.
+         * 
+         * The second copy is sent after the NodeConfig::hedge_percentile of the latencies of the past lookups,
+         * the first successful answer is returned and the other call is cancelled.
+         * The copy is sent to the closest finger that precedes the key other than the next hop, so the path
+         * to the successor of the key doesn't cross the slow node. If there's no such finger the lookup is not hedged.
+         * 
+         * @param hop next hop chosen by the routing step
+         * @param prepare method used to send the request asynchronously
+         * @param deadline latest deadline of the two calls, see Node::setDeadline
+         * @param answered if not null, set to true if the returned error was answered by a remote node, see Node::answered
+         * @returns a pair composed by the grpc::Status of the call and the reply, if both calls fail the status of the first one is returned
+        */
+        template<class T, class R>
+        std::pair<grpc::Status, R> sendHedged(const Hop<T> &hop, PrepareAsync<T, R> prepare, std::chrono::system_clock::time_point deadline, bool *answered = nullptr);
+
+        /**
+         * Sets the deadline of a call to another node.
+         * 
+         * Lookups use NodeConfig::lookup_timeout, mailbox transfers NodeConfig::transfer_timeout and the other
+         * calls NodeConfig::rpc_timeout. A call made on behalf of a received request never outlives the deadline
+         * of the received one, so the whole path inside the ring shares the deadline chosen by the client.
+         * 
+         * @tparam T type of the request
+         * @param context context of the call
+         * @param deadline latest deadline of the call
+        */
+        template<class T>
+        void setDeadline(grpc::ClientContext &context, std::chrono::system_clock::time_point deadline = std::chrono::system_clock::time_point::max()) const {
+            int timeout = 0;
+            if constexpr (std::is_same<T, PingRequest>::value || std::is_same<T, FingerQuestion>::value ||
+                          std::is_same<T, QueryMailbox>::value || std::is_same<T, SuccessorQuery>::value) {
+                timeout = config_.lookup_timeout;
+            } else if constexpr (std::is_same<T, TransferMailbox>::value) {
+                timeout = config_.transfer_timeout;
+            }
+            if(timeout <= 0) {
+                timeout = config_.rpc_timeout;
+            }
+            if(timeout > 0) {
+                auto own = std::chrono::system_clock::now() + std::chrono::milliseconds(timeout);
+                deadline = std::min(deadline, std::chrono::time_point_cast<std::chrono::system_clock::duration>(own));
+            }
+            if(deadline != std::chrono::system_clock::time_point::max()) {
+                context.set_deadline(deadline);
+            }
+        }
+
+        /**
+         * Remembers the owner of a mailbox found by a forwarded request.
+         * 
+         * Only the lookups answer with the owner of the mailbox, the other requests are ignored.
+         * 
+         * @param request forwarded request
+         * @param reply answer to the request
+        */
+        template<class T, class R>
+        void cacheRoute(const T &request, const R &reply) {}
+        void cacheRoute(const QueryMailbox &request, const NodeInfoMessage &reply); /**< Remembers the owner found by Node::LookupMailbox */
+        void cacheRoute(const InsertMailboxMessage &request, const NodeInfoMessage &reply); /**< Remembers the owner chosen by Node::InsertMailbox */
+
+        /**
+         * Searches the node that owns a mailbox, the owner is remembered inside Node::routes_.
+         * 
+         * The mailbox is searched with Node::LookupMailbox or, if NodeConfig::routing is RoutingMode::ITERATIVE,
+         * with Node::findSuccessor. Node::routes_ is not checked, this method is used when the owner is not
+         * remembered or the remembered one was wrong.
+         * 
+         * @param address address of the mailbox
+         * @param owner filled with the node that owns the mailbox
+         * @returns true if the owner was found, false otherwise
+        */
+        bool locate(const std::string &address, NodeInfo &owner);
+
+        /**
+         * Returns the next hop of a request directed to a mailbox that is not managed by this node.
+         * 
+         * If the owner of the mailbox is remembered the request is sent directly to him, otherwise the node that
+         * received the request from the client (the one that sees the full TTL) searches the owner with Node::locate,
+         * so the following requests for the same mailbox take a single hop. The other nodes forward the request
+         * to the closest finger. With NodeConfig::async_server the owner is not searched, the step runs on a completion
+         * queue that can't wait for the search, and only the owners learned by the forwarded lookups are used.
+         * 
+         * @param address address of the mailbox
+         * @param ttl TTL of the received request
+         * @returns the node that will receive the request
+        */
+        NodeInfo ownerHop(const std::string &address, long long ttl);
+
+        /**
+         * Updates the counters of the failed calls.
+         * 
+         * @param status status returned by a call to another node
+        */
+        void countStatus(const grpc::Status &status);
+
+        /**
+         * Checks if a failed call means that the contacted node is not reachable anymore.
+         * 
+         * The errors answered by the node itself, including the ones relayed from the following hops,
+         * are marked by Node::relayed and must be excluded with Node::answered first: only the failures
+         * of the call towards the node count.
+         * 
+         * @param status status returned by the call
+         * @param deadline deadline of the request the call was made for, if it expired the node is not blamed
+         * @returns true if the node didn't answer (UNAVAILABLE) or didn't answer within his own timeout (DEADLINE_EXCEEDED)
+        */
+        static bool isUnreachable(const grpc::Status &status, std::chrono::system_clock::time_point deadline = std::chrono::system_clock::time_point::max());
+
+        /**
+         * Marks the status of a routed service answered by this node, see Node::isUnreachable.
+         * 
+         * The mark travels in the trailing metadata, so the status reaches the client unchanged.
+         * 
+         * @param context context of the received request, nothing is marked if null
+         * @param status status of the local step or of the next hop
+         * @returns the same status, if it's an error chord::RELAYED_METADATA is added to the trailing metadata
+        */
+        static grpc::Status relayed(grpc::ServerContext *context, const grpc::Status &status);
+
+        /**
+         * @param context context of a completed call to another node
+         * @param status status returned by the call
+         * @returns true if the call failed with an error answered by the other node, marked by Node::relayed
+        */
+        static bool answered(const grpc::ClientContext &context, const grpc::Status &status);
+
+        /**
+         * Removes a node that stopped answering from the successor list and from the finger table.
+         * 
+         * If the node was the successor the next node of the successor list takes his place, this way
+         * the following requests are routed around the dead node without waiting for Node::stabilize.
+         * 
+         * @param peer node that stopped answering
+        */
+        void dropPeer(const NodeInfo &peer);
+
+        /**
+         * Rebuilds the successor list with the one received from the successor.
+         * 
+         * The new list is made by the successor followed by his own list, the nodes are never repeated
+         * and this node is never part of the list, so small rings have shorter lists.
+         * 
+         * @param previous successor contacted in this round of Node::stabilize, kept after the new successor if it changed
+         * @param reply answer of the successor to Node::Stabilize
+        */
+        void updateSuccessors(const NodeInfo &previous, const StabilizeReply &reply);
+
+        /**
+         * Clears the predecessor if he stopped answering, so a new one can be accepted by Node::Stabilize.
+        */
+        void checkPredecessor();
+
+        /**
+         * Updates the counters of the requests sent to other nodes.
+         * 
+         * @tparam T type of the request sent
+        */
+        template<class T>
+        void countRpc() {
+            rpcs_sent_++;
+            if constexpr (std::is_same<T, FingerQuestion>::value) {
+                finger_rpcs_++;
+            }
         }
 
         /**
+         * Returns the next hop for a key.
+         * 
+         * The next hop is the successor if the key falls between this node and his successor, otherwise
+         * is the closest finger that precedes the key, found with FingerTable::closestPreceding.
+         * Fingers that are not known yet are skipped.
+         * 
          * @param key the key to find the finger for.
          * @returns the correct finger to contact for the given key
         */
-        const NodeInfo& getFingerForKey(key_t key);
+        NodeInfo getFingerForKey(key_t key);
 
         /**
          * @param key
@@ -360,17 +831,101 @@ namespace chord {
         */
         bool transferBoxes(const chord::NodeInfo &dest);
 
+        /**
+         * Checks if a mailbox is being moved by Node::transferBoxes, called by the writers while holding
+         * the lock of the mailbox so they're either copied by the transfer or rejected.
+         *
+         * @param key key of the mailbox
+         * @returns true if the mailbox can't be modified
+        */
+        bool isMoving(key_t key);
+
+        /**
+         * Fills the next hop towards the successor node of a key using only the local routing information.
+         * 
+         * @param key key to search the successor for
+         * @param hop next hop to fill
+        */
+        void nextHop(key_t key, NextHop &hop);
+
+        /**
+         * Finds the successor node of a key walking the ring iteratively with Node::FindSuccessor.
+         * 
+         * @param key key to search the successor for
+         * @param successor filled with the successor node if found
+         * @returns true if the successor was found in at most chord::CHORD_MOD steps, false otherwise
+        */
+        bool findSuccessor(key_t key, NodeInfo &successor);
+
         /**
          * Check the authentication of a given user.
          * 
          * This method will search for the successor node of the given address and then checks the 
          * authentication data passed as a parameter.
+         * The successor node is taken from Node::routes_ if possible, otherwise it's searched with Node::locate.
+         * It blocks until the other nodes answer, so it's only used by Node::route: chord::AsyncServer authenticates
+         * through his completion queues.
          * 
          * @param auth authentication data
          * @returns true if the authentication data is good, false otherwise
         */
         bool checkAuthentication(const chord::Authentication &auth);
 
+        /**
+         * Authentication stage of the routing steps that change a mailbox.
+         * 
+         * The credentials are verified here if the mailbox of the user is on this node, otherwise Hop::authenticate
+         * is set and the caller of the step asks the owner of the mailbox, see chord::Hop.
+         * 
+         * @param auth credentials of the user
+         * @param hop hop of the step
+         * @param status filled with the status that the step must return when the method returns false
+         * @returns true if the user is authenticated and the step can go on
+        */
+        template<class T>
+        bool authenticate(const Authentication &auth, Hop<T> &hop, grpc::Status &status) {
+            if(hop.authenticated) {
+                return true;
+            }
+            bool valid = false;
+            if(boxes_.view(hashString(auth.user()), [&](const MailboxView &box) { valid = box.password() == auth.psw(); })) {
+                status = valid ? grpc::Status::OK : grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "Authentication failed");
+                return valid;
+            }
+            hop.authenticate = true;
+            hop.credentials = auth;
+            status = grpc::Status::OK;
+            return false;
+        }
+
+        /**
+         * Checks that a client can watch a mailbox, used by Node::Watch and by chord::AsyncServer.
+         * 
+         * @param auth authentication data of the mailbox
+         * @returns Status::OK if the mailbox is on this node and the authentication matches, StatusCode::NOT_FOUND if the mailbox
+         *          wasn't found and StatusCode::UNAUTHENTICATED if the authentication doesn't match
+        */
+        grpc::Status checkWatcher(const chord::Authentication &auth);
+
+        /**
+         * Refreshes a single entry of the finger table.
+         * 
+         * If the start of the finger still falls between this node and the previous finger the entry
+         * is copied from the previous one without contacting other nodes, otherwise the finger is
+         * searched with Node::SearchFinger.
+         * 
+         * @param idx index of the finger to refresh, must be in the range [1, chord::M)
+        */
+        void refreshFinger(int idx);
+
+        /**
+         * Refreshes the next NodeConfig::fix_fingers_batch entries of the finger table.
+         * 
+         * The entries are visited in round-robin so the whole table is refreshed every
+         * (chord::M - 1) / NodeConfig::fix_fingers_batch rounds of Node::stabilize.
+        */
+        void fixFingers();
+
         /**
          * Method used to periodically run the stabilize procedure described at Node::Stabilize
          * 
@@ -379,24 +934,174 @@ namespace chord {
         void stabilize();
 
         /**
-         * Method used to dump on a file the managed mailboxes.
+         * Method used to periodically run Node::snapshot every NodeConfig::snapshot_interval milliseconds.
+         * 
+         * This is a blocking method so it should be ran by a separate thread.
+        */
+        void snapshotLoop();
+
+        /**
+         * Reads in memory a part of the segment attached at the start, so the first requests for his
+         * mailboxes don't wait for the disk. The segment is split in at most NodeConfig::load_threads parts of
+         * consecutive records, each one loaded by his own thread; the last thread that completes
+         * records the time to fully loaded.
+         *
+         * This is a blocking method so it should be ran by a separate thread.
+         *
+         * @param segment segment to load
+         * @param part part of the segment loaded by this thread, from zero to parts excluded
+         * @param parts number of parts, one for each thread
+        */
+        void loadSegment(std::shared_ptr<const Segment> segment, size_t part, size_t parts);
+
+        /**
+         * @returns the microseconds elapsed since the beginning of Node::Run
+        */
+        int64_t sinceStart() const;
+
+        /**
+         * Saves the managed mailboxes in a .snap file named after the node's id, requests are served meanwhile.
+         * 
+         * The write-ahead log is rotated first, then only the mailboxes modified since the previous snapshot
+         * are appended to the file, each one copied while his shard is locked. Once the snapshot is durable the
+         * rotated log is removed, so a restart never replays more than the mutations of a snapshot interval.
+         * When the file grows NodeConfig::snapshot_full_ratio times the segment, all the mailboxes are
+         * written to a new chord::Segment that replaces the old one and the .snap file starts again.
+         * 
+         * @param full write all the mailboxes even if the incremental snapshot would be enough
+         * @returns true if the snapshot was written, false otherwise
+        */
+        bool snapshot(bool full);
+
+        /**
+         * Appends an incremental snapshot to the .snap file, used by Node::snapshot.
+         * 
+         * @param keys keys of the mailboxes to save, the missing ones are saved as removed
+         * @param create true if the file is new and must start with the generation of the segment
+         * @param records incremented for every saved mailbox
+         * @returns true if the snapshot is durable
+        */
+        bool writeDelta(const std::vector<key_t> &keys, bool create, uint64_t &records);
+
+        /**
+         * Writes all the mailboxes in a new segment and attaches it to Node::boxes_, used by Node::snapshot.
+         * 
+         * @param records incremented for every saved mailbox
+         * @returns true if the segment and the empty .snap file that follows it are durable
+        */
+        bool writeSegment(uint64_t &records);
+
+        /**
+         * Records a mutation of the mailboxes in the write-ahead log, the mutation must be already applied.
+         * 
+         * @param record mutation to record
+         * @returns true if the mutation is durable or the log is disabled, false if it couldn't be written
+        */
+        bool logMutation(const WalRecord &record);
+
+        /**
+         * Queues a mutation in the write-ahead log without waiting for it, see Node::awaitMutation.
+         * 
+         * Called under the lock of the mailbox, so the records keep the order of the mutations
+         * without holding the lock during the write.
+         * 
+         * @param record mutation to record
+         * @param seq filled with the sequence number to wait for, 0 if the log is disabled
+         * @returns true if the record was queued or the log is disabled, false if the log can't be written anymore
+        */
+        bool queueMutation(const WalRecord &record, uint64_t &seq);
+
+        /**
+         * Waits for a mutation queued by Node::queueMutation, called once the lock of the mailbox is released.
+         * 
+         * @param seq sequence number of the record, 0 if there's nothing to wait for
+         * @returns true if the mutation is durable or the log is disabled, false if it couldn't be written
+        */
+        bool awaitMutation(uint64_t seq);
+
+        /**
+         * Applies to the mailboxes a mutation read from the write-ahead log, used by Node::Run.
+         * 
+         * @param record mutation to apply
+        */
+        void applyRecord(const WalRecord &record);
+
+        /**
+         * @returns the file of the write-ahead log, named after the node's id like the .dat file
+        */
+        std::string walPath() const;
+
+        /**
+         * @returns the file that keeps the rotated write-ahead log until the snapshot that covers it is durable
+        */
+        std::string walArchivePath() const;
+
+        /**
+         * @returns the file of the snapshots, named after the node's id like the .dat file
+        */
+        std::string snapPath() const;
+
+        /**
+         * @returns the file of the chord::Segment written by the full snapshots, named after the node's id like the .dat file
+        */
+        std::string segPath() const;
+
+        /**
+         * @returns the file of the chord::BodyStore that receives the bodies beyond the memory budget
+        */
+        std::string bodiesPath() const;
+
+        /**
+         * Opens the connections towards successor, predecessor and fingers and closes the ones that are not used anymore.
          * 
-         * This will create a .dat file named after the node's id that can be later loaded to 
-         * recover all the managed mailboxes.s
+         * Called at every round of Node::stabilize so the next hops are always ready to be contacted.
         */
-        bool dumpBoxes();
+        void refreshPeers();
 
         /* MANAGEMENT DATA */
 
+        NodeConfig config_; /**< Tunable parameters of the node */
         bool run_stabilize_; /**< Flag used to run and stop the Node::stabilize procedure */
         NodeInfo info_, /**< Coordinates of this node */
-                 predecessor_; /**< Coordinates of this node's predecessor */
+                 predecessor_; /**< Coordinates of this node's predecessor, protected by Node::successors_mutex_ */
         bool disable_transfer_; /**< Flag used to enable/disable the Node::Transfer procedure */
-        std::vector<NodeInfo> finger_table_; /**< Finger table, this node's successor resides at index 0 */
+        FingerTable finger_table_; /**< Finger table, this node's successor resides at index 0 */
+        std::vector<NodeInfo> successors_; /**< Successor list, the first entry is the same as the first finger */
+        mutable std::mutex successors_mutex_; /**< Protects Node::predecessor_, Node::successors_ and Node::finger_table_ */
+        int next_finger_; /**< Next entry of the finger table refreshed by Node::fixFingers */
         std::unique_ptr<grpc::Server> server_; /**< gRPC server used to handle services */
         std::unique_ptr<std::thread> node_thread_, /**< Used to run the Node::server_ */
-                                     stabilize_thread_; /**< Used to run the Node::stabilize procedure */
-        std::map<key_t, mail::MailBox> boxes_; /**< mail::Mailbox managed by the node */
+                                     stabilize_thread_, /**< Used to run the Node::stabilize procedure */
+                                     snapshot_thread_; /**< Used to run the Node::snapshotLoop procedure */
+        std::vector<std::thread> load_threads_; /**< Used to run the Node::loadSegment procedure */
+        std::atomic<bool> run_load_; /**< Flag used to stop the Node::loadSegment procedure */
+        std::atomic<size_t> loading_; /**< Threads still running Node::loadSegment */
+        std::chrono::steady_clock::time_point start_time_; /**< Beginning of Node::Run */
+        std::atomic<int64_t> ready_us_, /**< Microseconds between the beginning of Node::Run and the start of the server */
+                             loaded_us_; /**< Microseconds between the beginning of Node::Run and the end of the load of the segment, zero while loading */
+        MailboxStore boxes_; /**< mail::Mailbox managed by the node, shared between the server threads */
+        std::unique_ptr<WriteAheadLog> wal_; /**< Log of the mutations of Node::boxes_, nullptr if disabled or the node is not running */
+        std::shared_ptr<BodyStore> body_store_; /**< Bodies of Node::boxes_ beyond the memory budget, nullptr if there is no budget */
+        BodyCodec codec_; /**< Compresses the bodies received by the node, configured by Node::Run */
+        uint64_t epoch_; /**< Random number chosen by Node::Run, the versions of the mailboxes given to the clients are valid only inside it */
+        WatchHub watchers_; /**< Clients notified of the new messages of the mailboxes, see Node::Watch */
+        std::mutex moving_mutex_; /**< Protects Node::moving_ */
+        std::unordered_set<key_t> moving_; /**< Mailboxes sent by Node::transferBoxes and not yet removed, they can't be modified */
+        std::mutex snapshot_mutex_; /**< Serializes the calls to Node::snapshot and protects the three fields below */
+        bool full_snapshot_; /**< True if the next snapshot must be a full one, after a start or a failure */
+        uint64_t full_snapshot_bytes_; /**< Size of the segment written by the last full snapshot */
+        uint64_t segment_generation_; /**< Generation of the last segment written or loaded */
+        std::atomic<uint64_t> snapshots_, /**< Snapshots written */
+                              snapshot_records_; /**< Mailboxes written by the snapshots */
+        PeerPool peers_; /**< Connections towards the other nodes of the ring */
+        std::unique_ptr<AsyncServer> async_server_; /**< Completion queues used when NodeConfig::async_server is set */
+        std::atomic<uint64_t> rpcs_sent_, /**< Requests sent to other nodes */
+                              finger_rpcs_, /**< Node::SearchFinger requests sent to other nodes */
+                              deadlines_exceeded_, /**< Requests that didn't complete before their deadline */
+                              hedged_requests_, /**< Lookups sent a second time by Node::sendHedged */
+                              hedge_wins_; /**< Hedged lookups answered first by the second copy */
+        LatencyTracker lookup_latency_; /**< Latencies of the lookups sent by Node::sendHedged */
+        RouteCache routes_; /**< Owners of the mailboxes recently used, cleared for the nodes affected by a change of the neighbours */
     };
 
     /**
@@ -411,6 +1116,7 @@ namespace chord {
          * 
          * This file must contain an array named "entities" and each element of the array
          * must be an object with an "address" (string) field and a "port" field (number).
+         * An optional object named "config" can contain the chord::NodeConfig fields used by every node.
          *  
         */
         Ring(const std::string &json_file);
@@ -0,0 +1,69 @@
+#ifndef CHORD_STATS_HPP
+#define CHORD_STATS_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace chord {
+    /**
+     * Snapshot of the counters collected by a chord::Node.
+     *
+     * The values are copied when chord::Node::getStats is called so they can be read freely.
+    */
+    struct NodeStats {
+        uint64_t pool_hits = 0; /**< Calls that reused an already open connection */
+        uint64_t pool_misses = 0; /**< Calls that had to open a new connection */
+        size_t pool_size = 0; /**< Number of connections currently kept open */
+        uint64_t rpcs_sent = 0; /**< Requests sent to other nodes, forwarded requests included */
+        uint64_t finger_rpcs = 0; /**< Node::SearchFinger requests sent to other nodes */
+        uint64_t deadlines_exceeded = 0; /**< Requests sent to other nodes that didn't complete before their deadline */
+        uint64_t hedged_requests = 0; /**< Lookups that were sent a second time through another finger */
+        uint64_t hedge_wins = 0; /**< Hedged lookups answered first by the second copy */
+        int64_t hedge_delay_us = 0; /**< Current delay in microseconds after which a lookup is hedged, zero if there are not enough samples yet */
+        uint64_t route_hits = 0; /**< Requests sent directly to a remembered mailbox owner */
+        uint64_t route_misses = 0; /**< Requests whose mailbox owner wasn't remembered */
+        size_t route_cache_size = 0; /**< Number of mailbox owners currently remembered */
+        uint64_t wal_records = 0; /**< Mailbox mutations written to the write-ahead log */
+        uint64_t wal_batches = 0; /**< Writes to the write-ahead log, each one can contain many mutations */
+        uint64_t wal_syncs = 0; /**< Synchronizations of the write-ahead log with the disk */
+        uint64_t snapshots = 0; /**< Snapshots of the mailboxes written, full and incremental */
+        uint64_t snapshot_records = 0; /**< Mailboxes written by the snapshots */
+        size_t resident_mailboxes = 0; /**< Mailboxes copied on the heap, the others are read from the segment */
+        uint64_t segment_bytes = 0; /**< Size of the mapped segment */
+        size_t corrupt_mailboxes = 0; /**< Mailboxes of the segment skipped because their record is corrupted */
+        int64_t time_to_first_request_us = 0; /**< Microseconds between the start of the node and the moment it could answer the first request */
+        int64_t time_to_fully_loaded_us = 0; /**< Microseconds between the start of the node and the end of the background load of the segment, zero while loading */
+        size_t body_bytes = 0; /**< Size of the message bodies kept in memory, the ones of the segment excluded */
+        size_t spilled_bodies = 0; /**< Message bodies moved to disk because of the memory budget */
+        size_t shared_bodies = 0; /**< Message bodies kept in the blob store instead of the messages */
+        uint64_t blob_bytes = 0; /**< Size of the distinct bodies in the blob store */
+        uint64_t dedup_saved_bytes = 0; /**< Memory saved by keeping a single copy of the bodies received by many mailboxes */
+        uint64_t spill_file_bytes = 0; /**< Size of the file that holds the bodies moved to disk */
+        uint64_t spill_reads = 0; /**< Bodies read back from disk */
+        uint64_t compressed_bodies = 0; /**< Message bodies stored compressed */
+        uint64_t compression_input_bytes = 0; /**< Size of the bodies long enough to be compressed, before the compression */
+        uint64_t compression_output_bytes = 0; /**< Size of the same bodies as they were stored */
+        uint64_t compress_us = 0; /**< CPU time in microseconds spent compressing the bodies */
+        uint64_t decompressed_bodies = 0; /**< Message bodies decompressed to be sent to their owner */
+        uint64_t decompress_us = 0; /**< CPU time in microseconds spent decompressing the bodies */
+        size_t watchers = 0; /**< Streams of Node::Watch currently open */
+        uint64_t watch_notifications = 0; /**< Headers of new messages delivered to the watchers */
+
+        /**
+         * @returns the fraction of the requests that found the mailbox owner inside the node's cache, zero if there were none
+        */
+        double routeHitRatio() const {
+            uint64_t total = route_hits + route_misses;
+            return total == 0 ? 0 : static_cast<double>(route_hits) / total;
+        }
+
+        /**
+         * @returns how many times the bodies long enough to be compressed shrank, one if there were none
+        */
+        double compressionRatio() const {
+            return compression_output_bytes == 0 ? 1 : static_cast<double>(compression_input_bytes) / compression_output_bytes;
+        }
+    };
+}
+
+#endif // CHORD_STATS_HPP
@@ -11,6 +11,36 @@ namespace chord {
     const int M = 48; /**< Control parameter for key length keys will be in range [0, 2^M)*/
     const long long int CHORD_MOD = std::ceil(std::log(std::pow(2, M))); /**< Is proven that the algorithm will reach the successor in CHORD_MOD steps */
     typedef long long int key_t; /**< Type that contains an hashed key for the algorithm */
+    const char WATCH_METADATA[] = "chord-watch"; /**< Initial metadata sent by Node::Watch once the new messages are notified to the client */
+    const char RELAYED_METADATA[] = "chord-relayed"; /**< Trailing metadata of the errors answered by a node for a routed service, they never mean that the node is unreachable */
+
+    /**
+     * Hash function used to generate keys.
+     * The function uses a SHA-1 algorithm.
+     * These hashes are in the range [0, 2^M)
+     * 
+     * @param str string to hash
+     * @return A key in the range [0, 2^M)
+    */
+    key_t hashString(const std::string &str);
+
+    /**
+     * Strategy used to reach the successor node of a key.
+    */
+    enum class RoutingMode {
+        RECURSIVE, /**< The request is forwarded from node to node until it reaches the successor, each node waits for the next one */
+        ITERATIVE  /**< The caller asks each node for the next hop with Node::FindSuccessor and then contacts the successor directly */
+    };
+
+    /**
+     * Durability of the mailbox mutations recorded in the chord::WriteAheadLog
+    */
+    enum class WalMode {
+        DISABLED, /**< Mutations are not logged, they reach the disk only when the node stops */
+        NO_SYNC,  /**< Mutations are written to the log before answering but never synchronized, they survive a crash of the node but not of the machine */
+        INTERVAL, /**< Like WalMode::NO_SYNC but the log is synchronized periodically, a crash of the machine loses at most an interval of mutations */
+        ALWAYS    /**< The log is synchronized before answering, concurrent mutations share the same synchronization */
+    };
 
     /**
      * Models a node's coordinates.
@@ -56,18 +86,29 @@ namespace chord {
     }
 
     /**
-     * Checks if the given key is contained inside the interval (lhs.id, rhs.id].
+     * Checks if the given key is contained inside the interval (lhs, rhs] of the ring.
      * 
-     * Another way that a key can fall "between" two nodes is if the key is bigger than the
+     * Another way that a key can fall "between" two keys is if the key is bigger than the
      * last node inside the ring, this node's successor has a smaller id compared to the former,
      * in this case the key will fall on the smaller node.
      * The same applies if the key is smaller than the first node inside the ring.
      * 
+     * @returns true if lhs < key <= rhs or key falls between the biggest id and the lowest, false otherwise
+    */
+    inline bool between(key_t key, key_t lhs, key_t rhs) {
+        return (key > lhs && (key <= rhs || lhs > rhs)) ||
+                (key <= rhs && key < lhs && rhs < lhs);
+    }
+
+    /**
+     * Checks if the given key is contained inside the interval (lhs.id, rhs.id].
+     * 
+     * See between(key_t, key_t, key_t) for details.
+     * 
      * @returns true if lhs.id < key <= rhs.id or key falls between the biggest id and the lowest, false otherwise
     */
     inline bool between(key_t key, const NodeInfo &lhs, const NodeInfo &rhs) {
-        return (key > lhs.id && (key <= rhs.id || lhs.id > rhs.id)) ||
-                (key <= rhs.id && key < lhs.id && rhs.id < lhs.id);
+        return between(key, lhs.id, rhs.id);
     }
 
     /**
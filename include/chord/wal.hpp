@@ -0,0 +1,222 @@
+#ifndef CHORD_WAL_HPP
+#define CHORD_WAL_HPP
+
+#include "types.hpp"
+#include "mail.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace chord {
+    /**
+     * Mutation of the mailboxes of a node recorded inside the chord::WriteAheadLog.
+     *
+     * Only the fields used by the type of the record are meaningful.
+    */
+    struct WalRecord {
+        /**
+         * Kinds of mutation
+        */
+        enum class Type : uint8_t {
+            INSERT_MAILBOX = 1, /**< A new mailbox was created, WalRecord::box contains owner and password */
+            SEND = 2, /**< WalRecord::message was added to the mailbox, with his id */
+            DELETE = 3, /**< The message with id WalRecord::id was removed from the mailbox */
+            TRANSFER = 4, /**< WalRecord::box was received from another node with all his messages and his version */
+            ERASE = 5, /**< The mailbox was handed to another node */
+            SNAPSHOT = 6, /**< State and version of the mailbox at the time of a snapshot, it replaces the current one */
+            CLEAR = 7, /**< All the mailboxes were removed */
+            BASE = 8 /**< The following records apply to the chord::Segment whose generation is WalRecord::id */
+        };
+
+        Type type; /**< Kind of the mutation */
+        key_t key; /**< Key of the mailbox */
+        mail::MailBox box; /**< Mailbox created or received */
+        mail::Message message; /**< Message sent */
+        uint64_t id; /**< Id of the message deleted, generation of the segment of a WalRecord::Type::BASE record */
+
+        static WalRecord insertMailbox(key_t key, const mail::MailBox &box); /**< @returns a WalRecord::Type::INSERT_MAILBOX record */
+        static WalRecord send(key_t key, const mail::Message &message); /**< @returns a WalRecord::Type::SEND record */
+        static WalRecord remove(key_t key, uint64_t id); /**< @returns a WalRecord::Type::DELETE record */
+        static WalRecord transfer(key_t key, const mail::MailBox &box); /**< @returns a WalRecord::Type::TRANSFER record */
+        static WalRecord erase(key_t key); /**< @returns a WalRecord::Type::ERASE record */
+        static WalRecord snapshot(key_t key, const mail::MailBox &box); /**< @returns a WalRecord::Type::SNAPSHOT record */
+        static WalRecord clear(); /**< @returns a WalRecord::Type::CLEAR record */
+        static WalRecord base(uint64_t generation); /**< @returns a WalRecord::Type::BASE record */
+
+        /**
+         * Appends the binary representation of the record to a buffer.
+         *
+         * @param out buffer to append to
+        */
+        void encode(std::string &out) const;
+
+        /**
+         * Reads a record from his binary representation.
+         *
+         * @param data pointer to the binary representation
+         * @param size number of bytes of the binary representation
+         * @param record record to fill
+         * @returns true if the representation was valid, false otherwise
+        */
+        static bool decode(const char *data, size_t size, WalRecord &record);
+    };
+
+    /**
+     * Append only log of the mutations of the mailboxes of a node.
+     *
+     * Every record is written as a frame containing his length and a CRC-32 checksum, so a frame
+     * torn by a crash is recognized and discarded when the log is replayed.
+     *
+     * Concurrent writers are batched with group commit: the first writer that finds the log idle
+     * writes (and synchronizes, depending on the chord::WalMode) the records of all the writers
+     * that arrived in the meantime, while the others wait for him. Under load a single write
+     * and a single fsync serve many requests.
+     *
+     * All the methods are thread safe.
+    */
+    class WriteAheadLog {
+    public:
+        /**
+         * Opens a log, creating the file if it doesn't exist. New records are appended to the existing ones.
+         *
+         * @param path file of the log
+         * @param mode durability of the appended records, chord::WalMode::DISABLED behaves like chord::WalMode::NO_SYNC
+         * @param sync_interval time between two synchronizations in chord::WalMode::INTERVAL mode
+         * @throws std::runtime_error if the file can't be opened
+        */
+        WriteAheadLog(const std::string &path, WalMode mode = WalMode::INTERVAL, std::chrono::milliseconds sync_interval = std::chrono::milliseconds(200));
+
+        /**
+         * Writes the pending records and closes the log.
+        */
+        ~WriteAheadLog();
+
+        /**
+         * Appends a record and waits until it's durable according to the chord::WalMode.
+         *
+         * Same as WriteAheadLog::wait on the sequence number returned by WriteAheadLog::enqueue.
+         *
+         * @param record record to append
+         * @returns true if the record was written, false if the log couldn't be written
+        */
+        bool append(const WalRecord &record);
+
+        /**
+         * Queues a record without waiting for it to be written.
+         *
+         * The records are written in the order they're queued, so a caller can queue while holding his own lock
+         * to order the records like his mutations, and wait for them once the lock is released.
+         *
+         * @param record record to append
+         * @returns the sequence number of the record, 0 if the log couldn't be written and the record was not queued
+        */
+        uint64_t enqueue(const WalRecord &record);
+
+        /**
+         * Waits until a queued record is durable according to the chord::WalMode, writing the queued records
+         * if no other writer is doing it.
+         *
+         * @param seq sequence number returned by WriteAheadLog::enqueue
+         * @returns true if the record was written, false if the log couldn't be written
+        */
+        bool wait(uint64_t seq);
+
+        /**
+         * Reads all the records of a log in order, a torn or corrupted tail is removed from the file.
+         *
+         * Must be called before the log is opened for writing.
+         *
+         * @param path file of the log
+         * @param apply function invoked for each valid record
+         * @returns the number of records read, 0 if the file doesn't exist
+        */
+        static size_t replay(const std::string &path, const std::function<void(const WalRecord &)> &apply);
+
+        /**
+         * Removes all the records, used when the state of the node is safe somewhere else.
+         *
+         * @returns true if the log was emptied
+        */
+        bool reset();
+
+        /**
+         * Writes the pending records and synchronizes the file, whatever the chord::WalMode.
+         *
+         * @returns true if the operation was successful
+        */
+        bool sync();
+
+        /**
+         * Moves the records written so far to another file and continues on an empty log.
+         *
+         * The records appended before the call are in the archived file, the ones appended after it
+         * are in the log, so the archived file can be deleted once its records are safe somewhere else.
+         *
+         * @param archive file that receives the current records, if it exists they're appended to it
+         * @returns true if the operation was successful
+        */
+        bool rotate(const std::string &archive);
+
+        /**
+         * @returns the number of records appended since the log was opened
+        */
+        uint64_t records() const;
+
+        /**
+         * @returns the number of writes done since the log was opened, each one can contain many records
+        */
+        uint64_t batches() const;
+
+        /**
+         * @returns the number of fsync done since the log was opened
+        */
+        uint64_t syncs() const;
+
+    private:
+        /**
+         * Writes a buffer to the file and synchronizes it if requested.
+         *
+         * @returns true if the operation was successful
+        */
+        bool writeBatch(const std::string &batch, bool sync);
+
+        /**
+         * Marks the log as failed and drops the queued frames, must be called with WriteAheadLog::mutex_ held.
+        */
+        void fail();
+
+        /**
+         * Body of the thread that synchronizes the file in chord::WalMode::INTERVAL mode.
+        */
+        void syncLoop();
+
+        std::string path_; /**< File of the log */
+        int fd_; /**< Descriptor of the file, opened in append mode */
+        WalMode mode_; /**< Durability of the appended records */
+        std::chrono::milliseconds sync_interval_; /**< Time between two synchronizations in chord::WalMode::INTERVAL mode */
+
+        mutable std::mutex mutex_; /**< Protects the fields below */
+        std::condition_variable written_cv_; /**< Notified when a batch has been written */
+        std::string pending_; /**< Frames waiting to be written */
+        uint64_t appended_; /**< Sequence number of the last frame added to WriteAheadLog::pending_ */
+        uint64_t written_; /**< Sequence number of the last frame written */
+        uint64_t durable_; /**< Sequence number of the last frame written successfully */
+        bool writing_; /**< True while a writer is writing a batch or the file is being synchronized */
+        bool failed_; /**< True if a write failed, the following appends fail too and the queued frames are dropped */
+        bool dirty_; /**< True if some frames were written but not synchronized */
+
+        std::atomic<uint64_t> batches_, /**< Writes done */
+                              syncs_; /**< Synchronizations done */
+        std::atomic<bool> running_; /**< False when the synchronization thread must stop */
+        std::condition_variable stop_cv_; /**< Wakes up the synchronization thread when the log is closed */
+        std::unique_ptr<std::thread> sync_thread_; /**< Thread that synchronizes the file in chord::WalMode::INTERVAL mode */
+    };
+}
+
+#endif // CHORD_WAL_HPP
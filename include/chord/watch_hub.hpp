@@ -0,0 +1,168 @@
+#ifndef CHORD_WATCH_HUB_HPP
+#define CHORD_WATCH_HUB_HPP
+
+#include "types.hpp"
+#include "chord.pb.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace chord {
+    /**
+     * Receiver of the headers published by a chord::WatchHub.
+    */
+    class Watcher {
+    public:
+        virtual ~Watcher() {}
+
+        /**
+         * Called when a new message is inserted in the watched mailbox.
+         *
+         * The hub's lock is held during the call so it must not block, the header is shared by all the watchers
+         * of the mailbox and must not be modified.
+         *
+         * @param header header of the new message
+        */
+        virtual void notify(const std::shared_ptr<const HeaderMessage> &header) = 0;
+
+        /**
+         * Called when the watcher is removed by the hub, because the node is stopping or the mailbox moved
+         * to another node. No notification follows.
+        */
+        virtual void close() = 0;
+    };
+
+    /**
+     * Watcher that buffers the headers until a thread takes them with WatchQueue::pop.
+     *
+     * Used by the synchronous Node::Watch, where each stream is served by his own thread. The buffer is bounded:
+     * a watcher that falls behind is marked as overflowed and no header is buffered anymore, so a slow client
+     * can't make the node grow without limits.
+     *
+     * All the methods are thread safe.
+    */
+    class WatchQueue final : public Watcher {
+    public:
+        /**
+         * @param capacity maximum number of buffered headers, at least one is always buffered
+        */
+        WatchQueue(size_t capacity);
+
+        void notify(const std::shared_ptr<const HeaderMessage> &header) override; /**< Buffers the header and wakes up WatchQueue::pop */
+        void close() override; /**< Wakes up WatchQueue::pop, the buffered headers can still be taken */
+
+        /**
+         * Waits for the next buffered header.
+         *
+         * @param header filled with the oldest buffered header
+         * @param timeout maximum time to wait
+         * @returns true if a header was taken, false if the timeout expired or the queue is closed and empty
+        */
+        bool pop(std::shared_ptr<const HeaderMessage> &header, std::chrono::milliseconds timeout);
+
+        /**
+         * @returns true if the queue was closed by the hub
+        */
+        bool closed() const;
+
+        /**
+         * @returns true if some headers were dropped because the buffer was full
+        */
+        bool overflowed() const;
+
+    private:
+        mutable std::mutex mutex_; /**< Protects the fields below */
+        std::condition_variable ready_; /**< Signaled when a header is buffered or the queue is closed */
+        std::deque<std::shared_ptr<const HeaderMessage>> headers_; /**< Buffered headers, the oldest one first */
+        size_t capacity_; /**< Maximum number of buffered headers */
+        bool closed_; /**< Set by WatchQueue::close */
+        bool overflowed_; /**< Set when a header didn't fit in the buffer */
+    };
+
+    /**
+     * Keeps the watchers of the mailboxes of a node and delivers them the headers of the new messages.
+     *
+     * A header is built once and shared by all the watchers of the mailbox, so a new message costs a pointer
+     * for each watcher. When no mailbox is watched WatchHub::publish returns without taking the lock,
+     * so a node without watchers doesn't pay anything on Node::Send.
+     *
+     * All the methods are thread safe.
+    */
+    class WatchHub {
+    public:
+        /**
+         * Builds an open hub without watchers.
+        */
+        WatchHub();
+
+        /**
+         * Adds a watcher of a mailbox, the watcher receives the messages inserted from now on.
+         *
+         * @param key key of the mailbox
+         * @param watcher watcher to add, he must stay valid until he's removed
+         * @returns true if the watcher was added, false if the hub is closed
+        */
+        bool subscribe(key_t key, Watcher *watcher);
+
+        /**
+         * Removes a watcher, once the method returns the watcher won't be called anymore.
+         *
+         * Removing a watcher that was already removed by the hub does nothing.
+         *
+         * @param key key of the mailbox
+         * @param watcher watcher to remove
+        */
+        void unsubscribe(key_t key, Watcher *watcher);
+
+        /**
+         * Delivers the header of a new message to the watchers of his mailbox.
+         *
+         * @param key key of the mailbox
+         * @param header header of the new message
+         * @returns the number of watchers notified
+        */
+        size_t publish(key_t key, const HeaderMessage &header);
+
+        /**
+         * Removes and closes the watchers of a mailbox, used when the mailbox moves to another node.
+         *
+         * @param key key of the mailbox
+        */
+        void close(key_t key);
+
+        /**
+         * Removes and closes all the watchers, no watcher can be added until WatchHub::open is called.
+        */
+        void close();
+
+        /**
+         * Allows to add watchers again after WatchHub::close.
+        */
+        void open();
+
+        /**
+         * @returns the number of watchers
+        */
+        size_t size() const;
+
+        /**
+         * @returns the number of headers delivered to the watchers
+        */
+        uint64_t notifications() const;
+
+    private:
+        mutable std::mutex mutex_; /**< Protects WatchHub::watchers_ and WatchHub::closed_ */
+        std::unordered_map<key_t, std::vector<Watcher *>> watchers_; /**< Watchers of each mailbox */
+        bool closed_; /**< Set by WatchHub::close */
+        std::atomic<size_t> size_; /**< Number of watchers, read without the lock */
+        std::atomic<uint64_t> notifications_; /**< Headers delivered to the watchers */
+    };
+}
+
+#endif // CHORD_WATCH_HUB_HPP
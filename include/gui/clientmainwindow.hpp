@@ -37,6 +37,8 @@ public:
     /**
      * Login function, spawns a ClientLogin window and creates a new chord::Client
      * to use.
+     * 
+     * The mailbox is watched with chord::Client::watch, so the list is refreshed as soon as new mail arrives.
     */
     void login();
 
@@ -44,7 +46,8 @@ public slots:
     /**
      * Called when a new mail::Message is selected.
      * 
-     * Updates the data in the MailWidget showing the new selected message.
+     * Updates the data in the MailWidget showing the new selected message,
+     * his body is downloaded if it's the first time the message is shown.
      * 
      * @param currentRow the selected row of the QTableWidget.
     */
@@ -63,7 +66,8 @@ public slots:
     void logOutClicked();
 
     /**
-     * Refresh the QTableWidget asking the chord::Client to update the messages
+     * Refresh the QTableWidget asking the chord::Client to update the headers of the messages,
+     * does nothing while no client is logged in.
     */
     void updateMailbox();
 
@@ -5,6 +5,10 @@
 #include <vector>
 #include <chrono>
 #include <ctime>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <cereal/cereal.hpp>
 #include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
 
@@ -40,6 +44,7 @@ namespace mail {
                     body;
         std::time_t date;
         bool read; /**< If the message was read or not */
+        uint64_t id; /**< Identifier assigned by the mail::MailBox, 0 if the message is not in a mailbox */
 
         /**
          * Used mainly for testing purposes
@@ -51,11 +56,16 @@ namespace mail {
         bool compare(const Message &msg) const;
 
         /**
-         * Method used to serialize the data structure.         
+         * Method used to serialize the data structure.
+         * 
+         * Version 0 is the layout written before the identifiers existed, the identifier is left to 0.
         */
         template<class Archive>
-        void serialize(Archive &archive) {
+        void serialize(Archive &archive, const std::uint32_t version) {
             archive(to, from, subject, body, date);
+            if(version >= 1) {
+                archive(id);
+            }
         }
     };
 
@@ -63,9 +73,20 @@ namespace mail {
      * Container for mail::Message.
      * 
      * Messages are associated to an owner (address) and a password.
+     * 
+     * Every message inserted in the box receives an identifier that is never reused by the box,
+     * so a message can be removed by id even if other messages are added or removed in the meantime.
+     * Removing a message only marks it as removed (tombstone) in constant time, the space is reclaimed
+     * by MailBox::compact, which is also called automatically when tombstones outnumber the messages.
+     * Removed messages are never visible through the public methods.
+     * 
+     * The box has a version that grows with every insertion and removal, so the clients can ask only for
+     * what changed since the version they have, see MailBox::getVersion.
     */
     class MailBox {
     public:
+        static constexpr size_t REMOVAL_LOG = 64; /**< Number of removals remembered by the box */
+
         /**
          * Default constructor. The owner will be an empty string and the password will be 0
          * 
@@ -137,7 +158,7 @@ namespace mail {
         long long int getPassword() const;
 
         /**
-         * @returns the number of mail::Message in this mailbox
+         * @returns the number of mail::Message in this mailbox, removed messages excluded
         */
         int getSize() const;
 
@@ -159,29 +180,217 @@ namespace mail {
         void clear();
 
         /**
-         * @returns a reference to the mail::Message contained in this mailbox
+         * @returns a copy of the mail::Message contained in this mailbox in insertion order
         */
-        const std::vector<Message>& getMessages() const;
+        std::vector<Message> getMessages() const;
 
         /**
+         * Visits the mail::Message contained in this mailbox in insertion order without copying them.
+         * 
+         * @param visitor callable invoked as visitor(const mail::Message &)
+        */
+        template<class F>
+        void forEachMessage(F visitor) const {
+            for(auto &msg : box_) {
+                if(msg.id != 0) {
+                    visitor(msg);
+                }
+            }
+        }
+
+        /**
+         * Visits the mail::Message contained in this mailbox starting from a given message, either in insertion
+         * order or from the most recent one, until the visitor asks to stop.
+         *
+         * When the given message is in the box the visit starts from it in constant time, otherwise the messages
+         * are skipped until the first one whose identifier is not smaller (not bigger from the most recent one),
+         * so a removed message is still a valid starting point if the identifiers grow with the insertions.
+         * In insertion order the messages are skipped from the most recent one, so starting after the last
+         * version seen by a client costs as much as the messages inserted since then.
+         *
+         * @param id identifier of the first message to visit, 0 starts from the first (most recent) message
+         * @param newest_first true to visit the messages from the most recent one
+         * @param visitor callable invoked as visitor(const mail::Message &), returns false to stop the visit
+        */
+        template<class F>
+        void forEachMessageFrom(uint64_t id, bool newest_first, F visitor) const {
+            auto it = positions_.find(id);
+            if(!newest_first) {
+                size_t i = box_.size();
+                if(it != positions_.end()) {
+                    i = it->second;
+                } else {
+                    while(i > 0 && (box_[i - 1].id == 0 || box_[i - 1].id >= id)) {
+                        i--;
+                    }
+                }
+                for(; i < box_.size(); i++) {
+                    if(box_[i].id != 0 && !visitor(box_[i])) {
+                        return;
+                    }
+                }
+                return;
+            }
+            for(size_t i = it == positions_.end() ? box_.size() : it->second + 1; i-- > 0;) {
+                if(box_[i].id != 0 && (id == 0 || box_[i].id <= id) && !visitor(box_[i])) {
+                    return;
+                }
+            }
+        }
+
+        /**
+         * Visits the bodies of the mail::Message contained in this mailbox allowing to modify them,
+         * used by the nodes to move the bodies out of memory.
+         * 
+         * @param visitor callable invoked as visitor(uint64_t id, std::string &body)
+        */
+        template<class F>
+        void forEachBody(F visitor) {
+            for(auto &msg : box_) {
+                if(msg.id != 0) {
+                    size_t before = msg.body.size();
+                    visitor(msg.id, msg.body);
+                    body_bytes_ = body_bytes_ - before + msg.body.size();
+                }
+            }
+        }
+
+        /**
+         * Visits, starting from the most recent one, the bodies of the messages inserted after a given message
+         * allowing to modify them. The visit stops at the first message whose identifier is not bigger than the
+         * given one, so it's exact only if the identifiers grow with the insertions, like the ones assigned by the box.
+         * 
+         * @param id identifier of the last message that must not be visited
+         * @param visitor callable invoked as visitor(uint64_t id, std::string &body)
+        */
+        template<class F>
+        void forEachBodyAfter(uint64_t id, F visitor) {
+            for(auto it = box_.rbegin(); it != box_.rend(); it++) {
+                if(it->id == 0) {
+                    continue;
+                }
+                if(it->id <= id) {
+                    break;
+                }
+                size_t before = it->body.size();
+                visitor(it->id, it->body);
+                body_bytes_ = body_bytes_ - before + it->body.size();
+            }
+        }
+
+        /**
+         * @returns the total size of the bodies of the messages
+        */
+        size_t getBodyBytes() const;
+
+        /**
+         * @returns the number of messages removed from the box since it was created, it never decreases
+        */
+        uint64_t getRemovals() const;
+
+        /**
+         * The version grows every time a message is inserted or removed: the identifiers of the new messages
+         * and the removals are numbered by the same counter, so the messages inserted after a given version
+         * are the ones with a bigger identifier.
+         * 
+         * @returns the version of the mailbox
+        */
+        uint64_t getVersion() const;
+
+        /**
+         * Visits, from the oldest one, the removals that happened after a given version.
+         * 
+         * Only the last MailBox::REMOVAL_LOG removals are remembered, and none of the ones that happened
+         * before the box was loaded or restored, see MailBox::restoreVersion.
+         * 
+         * @param version version after which the removals are visited
+         * @param visitor callable invoked as visitor(uint64_t version, uint64_t id) with the version reached by the removal
+         * @returns true if all the removals after the version were visited, false if some of them are not remembered
+        */
+        template<class F>
+        bool forEachRemoval(uint64_t version, F visitor) const {
+            if(version < removed_floor_) {
+                return false;
+            }
+            for(auto &removal : removed_) {
+                if(removal.first > version) {
+                    visitor(removal.first, removal.second);
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Marks the box as rebuilt at a given version, used when the box is copied from a storage that only
+         * keeps his messages: the new messages will receive bigger identifiers and the removals before the
+         * version are not known.
+         * 
+         * @param version version of the original box, a smaller one than the current is ignored
+        */
+        void restoreVersion(uint64_t version);
+
+        /**
+         * The lookup is constant time only if there are no tombstones, see MailBox::compact.
+         * 
          * @param i message index
          * @returns a reference to the i-th message
+         * @throws std::out_of_range if the index is not valid
         */
         const Message& getMessage(int i) const;
 
+        /**
+         * @param id message identifier
+         * @returns a pointer to the message with the given identifier, nullptr if it's not in the box
+        */
+        const Message* findMessage(uint64_t id) const;
+
+        /**
+         * Replaces the body of a message, used by the clients that download the bodies on demand.
+         * 
+         * @param id message identifier
+         * @param body new body of the message
+         * @returns true if the body was replaced, false if the message is not in the box
+        */
+        bool setBody(uint64_t id, const std::string &body);
+
+        /**
+         * Marks a message as read or not read.
+         * 
+         * @param id message identifier
+         * @param read new value of mail::Message::read
+         * @returns true if the message was marked, false if it's not in the box
+        */
+        bool setRead(uint64_t id, bool read = true);
+
         /**
          * Removes the i-th message of the mailbox.
          * 
+         * The index of a message changes when the previous messages are removed,
+         * MailBox::removeMessageById should be preferred.
+         * 
          * @param i message index
+         * @returns true if the message was removed, false if the index is not valid
         */
         bool removeMessage(int i);
 
+        /**
+         * Removes a message in constant time.
+         * 
+         * @param id message identifier
+         * @returns true if the message was removed, false if it's not in the box
+        */
+        bool removeMessageById(uint64_t id);
+
         /**
          * Inserts a new message inside the box.
          * 
+         * The identifier of the message is kept if it's not used inside the box,
+         * otherwise (or if it's 0) the message receives a new one.
+         * 
          * @param msg message to insert
+         * @returns the identifier of the inserted message
         */
-        void insertMessage(const Message &msg);
+        uint64_t insertMessage(const Message &msg);
 
         /**
          * Inserts multiple messages inside the box.
@@ -190,6 +399,18 @@ namespace mail {
         */
         void insertMessages(const std::vector<Message> &msgs);
 
+        /**
+         * @returns the number of removed messages that still occupy space
+        */
+        size_t getTombstones() const;
+
+        /**
+         * Reclaims the space of the removed messages, the order of the messages is preserved.
+         * 
+         * @returns the number of reclaimed messages
+        */
+        size_t compact();
+
         /**
          * Saves a mailbox in a file with the given name.
          * 
@@ -215,20 +436,68 @@ namespace mail {
         static MailBox loadBox(const std::string &filename);
 
         /**
-         * Method used to serialize the data structure.
+         * Method used to save the data structure.
+         * 
+         * A header with MailBox::FORMAT_VERSION comes first, then owner, password, messages and the next identifier,
+         * removed messages are skipped.
+        */
+        template<class Archive>
+        void save(Archive &archive) const {
+            uint64_t header = FORMAT_TAG | FORMAT_VERSION;
+            archive(header, owner_, psw_, getMessages(), next_id_);
+        }
+
+        /**
+         * Method used to load the data structure.
          * 
-         * Owner, password and messages will be serialized.
+         * The boxes saved before the format had a header (version 0) start with the length of the owner and have
+         * neither identifiers nor next identifier, their messages are numbered again from 1.
         */
         template<class Archive>
-        void serialize(Archive &archive) {
-            archive(owner_, psw_, box_);
+        void load(Archive &archive) {
+            uint64_t header;
+            archive(header);
+            if((header & ~FORMAT_VERSION_MASK) == FORMAT_TAG) {
+                archive(owner_, psw_, box_, next_id_);
+            } else {
+                owner_.resize(header);
+                archive(cereal::binary_data(&owner_[0], header));
+                uint64_t count;
+                archive(psw_, count);
+                box_.assign(count, Message());
+                for(auto &msg : box_) {
+                    msg.serialize(archive, 0);
+                }
+                next_id_ = 1;
+            }
+            reindex();
+            removed_.clear();
+            removed_floor_ = getVersion();
         }
 
+        static constexpr uint64_t FORMAT_TAG = 0x4d424f5800000000; /**< High bits of the header saved by MailBox::save, no owner is that long */
+        static constexpr uint64_t FORMAT_VERSION_MASK = 0xffffffff; /**< Bits of the header that hold the version of the format */
+        static constexpr uint64_t FORMAT_VERSION = 1; /**< Version of the format written by MailBox::save */
+
     private:
+        /**
+         * Rebuilds MailBox::positions_ from MailBox::box_, messages without identifier receive one.
+        */
+        void reindex();
+
         std::string owner_; /**< Mailbox owner */
         long long int psw_; /**< Mailbox password */
-        std::vector<Message> box_; /**< mail::Message container */
+        std::vector<Message> box_; /**< mail::Message container, removed messages have identifier 0 */
+        std::unordered_map<uint64_t, size_t> positions_; /**< Position inside MailBox::box_ of each message identifier */
+        uint64_t next_id_; /**< Identifier of the next inserted message */
+        size_t tombstones_; /**< Removed messages still inside MailBox::box_ */
+        size_t body_bytes_; /**< Total size of the bodies of the messages */
+        uint64_t removals_; /**< Messages removed since the box was created */
+        std::vector<std::pair<uint64_t, uint64_t>> removed_; /**< Version and identifier of the last removals, from the oldest one */
+        uint64_t removed_floor_; /**< Version after which all the removals are in MailBox::removed_ */
     };
 }
 
+CEREAL_CLASS_VERSION(mail::Message, 1);
+
 #endif // MAIL_HPP
\ No newline at end of file
@@ -0,0 +1,556 @@
+#include "async_server.hpp"
+#include "server.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+
+template<class T>
+std::shared_ptr<chord::NodeService::Stub> chord::AsyncServer::stub(const NodeInfo &peer) {
+    node_->countRpc<T>();
+    return node_->peers_.get(peer);
+}
+
+template<class T, class R>
+void chord::AsyncServer::learn(const T &request, const R &reply) {
+    node_->cacheRoute(request, reply);
+}
+
+template<class T>
+std::unique_ptr<grpc::ClientContext> chord::AsyncServer::context(std::chrono::system_clock::time_point deadline) const {
+    std::unique_ptr<grpc::ClientContext> context(new grpc::ClientContext());
+    node_->setDeadline<T>(*context, deadline);
+    return context;
+}
+
+namespace chord {
+    /**
+     * A routed unary call served through a completion queue.
+     *
+     * The call goes through these states:
+     *  - PROCESS: the request has been received, the routing step is executed and either the reply is sent
+     *    back, the request is forwarded to the next hop or the sender is authenticated
+     *  - LOCATE: the owner of the mailbox of the sender was searched with Node::LookupMailbox
+     *  - AUTHENTICATE: the owner of the mailbox of the sender checked his credentials with Node::Authenticate,
+     *    if they're valid the routing step is executed again
+     *  - FORWARD: the next hop answered, his reply is relayed to the caller. If the next hop is dead
+     *    the routing step is executed again and the request goes to the next alive node
+     *  - FINISH: the reply was sent, the call is deleted
+     *
+     * A new call is spawned as soon as a request is received so the server is always ready for the next one.
+    */
+    template<class T, class R>
+    class RoutedCall final : public AsyncCall {
+    public:
+        /** AsyncNodeService method used to request a new call */
+        typedef void (AsyncNodeService::*RequestMethod)(grpc::ServerContext *, T *, grpc::ServerAsyncResponseWriter<R> *, grpc::CompletionQueue *, grpc::ServerCompletionQueue *, void *);
+        /** Routing step of the service */
+        typedef grpc::Status (Node::*Step)(const T &, R &, Hop<T> &);
+        /** Stub method used to forward the request */
+        typedef std::unique_ptr<grpc::ClientAsyncResponseReader<R>> (NodeService::Stub::*Prepare)(grpc::ClientContext *, const T &, grpc::CompletionQueue *);
+
+        /**
+         * Builds the call and waits for a request.
+         *
+         * @param server server that owns the call
+         * @param cq completion queue used by the call
+         * @param request method used to request a new call
+         * @param step routing step of the service
+         * @param prepare stub method used to forward the request
+        */
+        RoutedCall(AsyncServer *server, grpc::ServerCompletionQueue *cq, RequestMethod request, Step step, Prepare prepare)
+            : server_(server)
+            , cq_(cq)
+            , request_method_(request)
+            , step_(step)
+            , prepare_(prepare)
+            , responder_(&context_)
+            , attempt_(0)
+            , authenticated_(false)
+            , cached_owner_(false)
+            , state_(PROCESS) {
+            (server_->service_.*request_method_)(&context_, &request_, &responder_, cq_, cq_, this);
+        }
+
+        void proceed(bool ok) override {
+            switch(state_) {
+            case PROCESS:
+                if(!ok) {
+                    // The server is shutting down, no request was received
+                    delete this;
+                    return;
+                }
+                new RoutedCall<T, R>(server_, cq_, request_method_, step_, prepare_);
+                process();
+                break;
+            case LOCATE:
+                if(!owner_status_.ok()) {
+                    fail();
+                } else {
+                    server_->learn(lookup_, owner_reply_);
+                    NodeInfo owner;
+                    fillNodeInfo(owner, owner_reply_);
+                    cached_owner_ = false;
+                    authenticate(owner);
+                }
+                break;
+            case AUTHENTICATE:
+                if(auth_status_.ok()) {
+                    authenticated_ = true;
+                    process();
+                } else if(cached_owner_) {
+                    // The remembered owner may be wrong, the mailbox is searched again
+                    server_->forget(credentials_.user());
+                    locate();
+                } else {
+                    fail();
+                }
+                break;
+            case FORWARD:
+                if(server_->retry(next_hop_, *client_context_, forward_status_, ++attempt_, context_.deadline())) {
+                    reply_.Clear();
+                    process();
+                } else {
+                    if(forward_status_.ok()) {
+                        server_->learn(request_, reply_);
+                    }
+                    state_ = FINISH;
+                    responder_.Finish(reply_, AsyncServer::relayed(&context_, forward_status_), this);
+                }
+                break;
+            case FINISH:
+                delete this;
+                break;
+            }
+        }
+
+    private:
+        /**
+         * Executes the routing step, the reply is sent if the node can answer, otherwise the request
+         * is forwarded and the call waits for the answer.
+        */
+        void process() {
+            Hop<T> hop;
+            hop.authenticated = authenticated_;
+            grpc::Status status = (server_->node_->*step_)(request_, reply_, hop);
+            if(hop.authenticate) {
+                credentials_ = hop.credentials;
+                NodeInfo owner;
+                if((cached_owner_ = server_->owner(credentials_.user(), owner))) {
+                    authenticate(owner);
+                } else {
+                    locate();
+                }
+            } else if(hop.valid) {
+                state_ = FORWARD;
+                next_hop_ = hop.node;
+                stub_ = server_->stub<T>(hop.node);
+                // A context can't be reused, every attempt needs a new one
+                client_context_ = server_->context<T>(context_.deadline());
+                reader_ = ((*stub_).*prepare_)(client_context_.get(), hop.request, cq_);
+                reader_->StartCall();
+                reader_->Finish(&reply_, &forward_status_, this);
+            } else {
+                state_ = FINISH;
+                responder_.Finish(reply_, AsyncServer::relayed(&context_, status), this);
+            }
+        }
+
+        /**
+         * Searches the owner of the mailbox of the sender through the first hop of Node::LookupMailbox.
+        */
+        void locate() {
+            Hop<QueryMailbox> hop;
+            if(!server_->lookup(credentials_.user(), hop)) {
+                fail();
+                return;
+            }
+            state_ = LOCATE;
+            lookup_ = hop.request;
+            owner_reply_.Clear();
+            stub_ = server_->stub<QueryMailbox>(hop.node);
+            client_context_ = server_->context<QueryMailbox>(context_.deadline());
+            owner_reader_ = stub_->PrepareAsyncLookupMailbox(client_context_.get(), lookup_, cq_);
+            owner_reader_->StartCall();
+            owner_reader_->Finish(&owner_reply_, &owner_status_, this);
+        }
+
+        /**
+         * Asks the owner of the mailbox of the sender to check his credentials.
+         *
+         * @param owner node that owns the mailbox
+        */
+        void authenticate(const NodeInfo &owner) {
+            state_ = AUTHENTICATE;
+            stub_ = server_->stub<Authentication>(owner);
+            client_context_ = server_->context<Authentication>(context_.deadline());
+            auth_reader_ = stub_->PrepareAsyncAuthenticate(client_context_.get(), credentials_, cq_);
+            auth_reader_->StartCall();
+            auth_reader_->Finish(&auth_reply_, &auth_status_, this);
+        }
+
+        /**
+         * Answers the caller when the sender couldn't be authenticated.
+        */
+        void fail() {
+            state_ = FINISH;
+            reply_.Clear();
+            responder_.Finish(reply_, AsyncServer::relayed(&context_, grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "Authentication failed")), this);
+        }
+
+        AsyncServer *server_; /**< Server that owns the call */
+        grpc::ServerCompletionQueue *cq_; /**< Completion queue used by the call */
+        RequestMethod request_method_; /**< Method used to request a new call */
+        Step step_; /**< Routing step of the service */
+        Prepare prepare_; /**< Stub method used to forward the request */
+
+        grpc::ServerContext context_; /**< Context of the received call */
+        T request_; /**< Received request */
+        R reply_; /**< Reply sent to the caller */
+        grpc::ServerAsyncResponseWriter<R> responder_; /**< Used to answer the caller */
+
+        std::unique_ptr<grpc::ClientContext> client_context_; /**< Context of the forwarded call */
+        NodeInfo next_hop_; /**< Node that received the forwarded call */
+        int attempt_; /**< Number of next hops that failed */
+        std::shared_ptr<NodeService::Stub> stub_; /**< Stub connected to the next hop */
+        std::unique_ptr<grpc::ClientAsyncResponseReader<R>> reader_; /**< Used to read the next hop's answer */
+        grpc::Status forward_status_; /**< Status returned by the next hop */
+
+        Authentication credentials_; /**< Credentials of the sender, verified by the owner of his mailbox */
+        bool authenticated_; /**< True once the credentials were verified */
+        bool cached_owner_; /**< True if the owner that verifies the credentials was taken from Node::routes_ */
+        QueryMailbox lookup_; /**< Lookup of the owner of the mailbox of the sender */
+        NodeInfoMessage owner_reply_; /**< Owner found by the lookup */
+        grpc::Status owner_status_; /**< Status of the lookup */
+        std::unique_ptr<grpc::ClientAsyncResponseReader<NodeInfoMessage>> owner_reader_; /**< Used to read the answer of the lookup */
+        Empty auth_reply_; /**< Answer of Node::Authenticate */
+        grpc::Status auth_status_; /**< Status of Node::Authenticate */
+        std::unique_ptr<grpc::ClientAsyncResponseReader<Empty>> auth_reader_; /**< Used to read the answer of Node::Authenticate */
+
+        enum { PROCESS, LOCATE, AUTHENTICATE, FORWARD, FINISH } state_; /**< Current state of the call */
+    };
+
+    /**
+     * A Node::Watch stream served through a completion queue.
+     *
+     * The call is the chord::Watcher of his mailbox: the headers published by the node are queued and written
+     * one at a time, so a watcher waiting for new mail doesn't hold any thread. The call goes through these states:
+     *  - REQUEST: the request has been received, the watcher is registered and the initial metadata is sent
+     *  - STREAM: a write completed, the next queued header is written
+     *  - FINISH: the status was sent
+     *
+     * Besides his own events the call waits for WatchCall::done_, that completes when the stream ends for any
+     * reason, also when the client goes away without waiting for the status. The call is deleted when both
+     * the status was sent and WatchCall::done_ completed.
+    */
+    class WatchCall final : public AsyncCall, public Watcher {
+    public:
+        /**
+         * Builds the call and waits for a request.
+         *
+         * @param server server that owns the call
+         * @param cq completion queue used by the call
+        */
+        WatchCall(AsyncServer *server, grpc::ServerCompletionQueue *cq)
+            : server_(server)
+            , cq_(cq)
+            , writer_(&context_)
+            , done_(this)
+            , writing_(false)
+            , sent_metadata_(false)
+            , finishing_(false)
+            , finished_(false)
+            , ended_(false)
+            , state_(REQUEST) {
+            // Must be requested before the call starts
+            context_.AsyncNotifyWhenDone(static_cast<AsyncCall *>(&done_));
+            server_->service_.RequestWatch(&context_, &request_, &writer_, cq_, cq_, static_cast<AsyncCall *>(this));
+        }
+
+        void proceed(bool ok) override {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if(state_ == REQUEST) {
+                lock.unlock();
+                if(!ok) {
+                    // The server is shutting down, no request was received and WatchCall::done_ won't complete
+                    delete this;
+                    return;
+                }
+                new WatchCall(server_, cq_);
+                start();
+                return;
+            }
+            if(state_ == FINISH) {
+                finished_ = true;
+                if(ended_) {
+                    lock.unlock();
+                    delete this;
+                }
+                return;
+            }
+            // A write completed, the initial metadata is not in the queue
+            writing_ = false;
+            if(sent_metadata_) {
+                pending_.pop_front();
+            }
+            sent_metadata_ = true;
+            if(!ok) {
+                finish(grpc::Status(grpc::StatusCode::CANCELLED, "The client went away"));
+            } else if(finishing_) {
+                finish(status_);
+            } else {
+                writeNext();
+            }
+        }
+
+        void notify(const std::shared_ptr<const HeaderMessage> &header) override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(finishing_) {
+                return;
+            }
+            if(pending_.size() >= server_->watchQueueSize()) {
+                finish(grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Too many messages waiting to be notified"));
+                return;
+            }
+            pending_.push_back(header);
+            writeNext();
+        }
+
+        void close() override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finish(grpc::Status(grpc::StatusCode::UNAVAILABLE, "The mailbox is not served by this node anymore"));
+        }
+
+    private:
+        /**
+         * Completes when the stream ends, see WatchCall.
+        */
+        class Done final : public AsyncCall {
+        public:
+            Done(WatchCall *call) : call_(call) {}
+
+            void proceed(bool ok) override {
+                call_->end();
+            }
+
+        private:
+            WatchCall *call_; /**< Call that owns the tag */
+        };
+
+        /**
+         * Registers the watcher, the initial metadata tells the client that no message can be missed from now on.
+        */
+        void start() {
+            grpc::Status status = server_->subscribe(request_, this);
+            std::lock_guard<std::mutex> lock(mutex_);
+            state_ = STREAM;
+            if(!status.ok() || finishing_) {
+                finish(status);
+            } else {
+                // The headers queued in the meantime are written once the metadata is sent
+                context_.AddInitialMetadata(WATCH_METADATA, "subscribed");
+                writing_ = true;
+                writer_.SendInitialMetadata(static_cast<AsyncCall *>(this));
+            }
+        }
+
+        /**
+         * Called when WatchCall::done_ completes, the watcher is removed before the call can be deleted.
+        */
+        void end() {
+            server_->unsubscribe(request_, this);
+            std::unique_lock<std::mutex> lock(mutex_);
+            ended_ = true;
+            finish(grpc::Status(grpc::StatusCode::CANCELLED, "The client went away"));
+            if(finished_) {
+                lock.unlock();
+                delete this;
+            }
+        }
+
+        /**
+         * Writes the oldest queued header if the stream started and no other write is in flight,
+         * WatchCall::mutex_ must be held by the caller.
+        */
+        void writeNext() {
+            if(state_ == STREAM && !writing_ && !pending_.empty()) {
+                writing_ = true;
+                writer_.Write(*pending_.front(), static_cast<AsyncCall *>(this));
+            }
+        }
+
+        /**
+         * Sends the status as soon as no write is in flight, only the first status is kept.
+         * WatchCall::mutex_ must be held by the caller.
+         *
+         * @param status status sent to the client
+        */
+        void finish(const grpc::Status &status) {
+            if(!finishing_) {
+                finishing_ = true;
+                status_ = status;
+            }
+            if(!writing_ && state_ == STREAM) {
+                state_ = FINISH;
+                writer_.Finish(status_, static_cast<AsyncCall *>(this));
+            }
+        }
+
+        AsyncServer *server_; /**< Server that owns the call */
+        grpc::ServerCompletionQueue *cq_; /**< Completion queue used by the call */
+
+        grpc::ServerContext context_; /**< Context of the received call */
+        Authentication request_; /**< Received request */
+        grpc::ServerAsyncWriter<HeaderMessage> writer_; /**< Used to write the headers */
+        Done done_; /**< Tag that completes when the stream ends */
+
+        std::mutex mutex_; /**< Protects the fields below, the headers are queued by the threads that insert the messages */
+        std::deque<std::shared_ptr<const HeaderMessage>> pending_; /**< Headers waiting to be written, the first one is being written */
+        grpc::Status status_; /**< Status sent to the client */
+        bool writing_; /**< True while a write or the initial metadata is in flight */
+        bool sent_metadata_; /**< False while the initial metadata is in flight */
+        bool finishing_; /**< True once the status is chosen, no more headers are queued */
+        bool finished_; /**< True once the status was sent */
+        bool ended_; /**< True once WatchCall::done_ completed */
+
+        enum { REQUEST, STREAM, FINISH } state_; /**< Current state of the call */
+    };
+}
+
+bool chord::AsyncServer::retry(const NodeInfo &peer, const grpc::ClientContext &context, const grpc::Status &status, int attempt, std::chrono::system_clock::time_point deadline) {
+    node_->countStatus(status);
+    if(Node::answered(context, status) || !Node::isUnreachable(status, deadline) || attempt > node_->config_.successor_list_size) {
+        return false;
+    }
+    node_->dropPeer(peer);
+    return true;
+}
+
+bool chord::AsyncServer::owner(const std::string &user, NodeInfo &owner) {
+    return node_->routes_.get(hashString(user), owner);
+}
+
+void chord::AsyncServer::forget(const std::string &user) {
+    node_->routes_.erase(hashString(user));
+}
+
+bool chord::AsyncServer::lookup(const std::string &user, Hop<QueryMailbox> &hop) {
+    QueryMailbox query;
+    query.set_owner(user);
+    query.set_ttl(CHORD_MOD);
+    NodeInfoMessage reply;
+    node_->stepLookupMailbox(query, reply, hop);
+    return hop.valid;
+}
+
+grpc::Status chord::AsyncServer::relayed(grpc::ServerContext *context, const grpc::Status &status) {
+    return Node::relayed(context, status);
+}
+
+grpc::Status chord::AsyncServer::subscribe(const Authentication &request, Watcher *watcher) {
+    grpc::Status status = node_->checkWatcher(request);
+    if(status.ok() && !node_->watchers_.subscribe(hashString(request.user()), watcher)) {
+        return grpc::Status(grpc::StatusCode::UNAVAILABLE, "The node is stopping");
+    }
+    return status;
+}
+
+void chord::AsyncServer::unsubscribe(const Authentication &request, Watcher *watcher) {
+    node_->watchers_.unsubscribe(hashString(request.user()), watcher);
+}
+
+size_t chord::AsyncServer::watchQueueSize() const {
+    return static_cast<size_t>(std::max(node_->config_.watch_queue_size, 1));
+}
+
+chord::AsyncNodeService::AsyncNodeService(Node *node)
+    : node_(node) {}
+
+grpc::Status chord::AsyncNodeService::Ping(grpc::ServerContext *context, const PingRequest *request, PingReply *reply) {
+    return node_->Ping(context, request, reply);
+}
+
+grpc::Status chord::AsyncNodeService::Stabilize(grpc::ServerContext *context, const NodeInfoMessage *request, StabilizeReply *reply) {
+    return node_->Stabilize(context, request, reply);
+}
+
+grpc::Status chord::AsyncNodeService::Authenticate(grpc::ServerContext *context, const Authentication *request, Empty *reply) {
+    return node_->Authenticate(context, request, reply);
+}
+
+grpc::Status chord::AsyncNodeService::Receive(grpc::ServerContext *context, const Authentication *request, Mailbox *reply) {
+    return node_->Receive(context, request, reply);
+}
+
+grpc::Status chord::AsyncNodeService::Transfer(grpc::ServerContext *context, const TransferMailbox *request, Empty *reply) {
+    return node_->Transfer(context, request, reply);
+}
+
+grpc::Status chord::AsyncNodeService::FindSuccessor(grpc::ServerContext *context, const SuccessorQuery *request, NextHop *reply) {
+    return node_->FindSuccessor(context, request, reply);
+}
+
+grpc::Status chord::AsyncNodeService::ListHeaders(grpc::ServerContext *context, const Authentication *request, HeaderList *reply) {
+    return node_->ListHeaders(context, request, reply);
+}
+
+grpc::Status chord::AsyncNodeService::FetchBodies(grpc::ServerContext *context, const FetchRequest *request, BodyList *reply) {
+    return node_->FetchBodies(context, request, reply);
+}
+
+grpc::Status chord::AsyncNodeService::ReceiveStream(grpc::ServerContext *context, const ReceiveRequest *request, grpc::ServerWriter<MailboxChunk> *writer) {
+    return node_->ReceiveStream(context, request, writer);
+}
+
+grpc::Status chord::AsyncNodeService::Sync(grpc::ServerContext *context, const SyncRequest *request, SyncReply *reply) {
+    return node_->Sync(context, request, reply);
+}
+
+chord::AsyncServer::AsyncServer(Node *node, int threads)
+    : node_(node)
+    , service_(node)
+    , num_threads_(std::max(threads, 1)) {}
+
+chord::AsyncServer::~AsyncServer() {
+    shutdown();
+}
+
+void chord::AsyncServer::registerService(grpc::ServerBuilder &builder) {
+    builder.RegisterService(&service_);
+    for(int i = 0; i < num_threads_; i++) {
+        cqs_.push_back(builder.AddCompletionQueue());
+    }
+}
+
+void chord::AsyncServer::start() {
+    for(auto &cq : cqs_) {
+        new RoutedCall<FingerQuestion, NodeInfoMessage>(this, cq.get(), &AsyncNodeService::RequestSearchFinger, &Node::stepSearchFinger, &NodeService::Stub::PrepareAsyncSearchFinger);
+        new RoutedCall<JoinRequest, NodeInfoMessage>(this, cq.get(), &AsyncNodeService::RequestNodeJoin, &Node::stepNodeJoin, &NodeService::Stub::PrepareAsyncNodeJoin);
+        new RoutedCall<InsertMailboxMessage, NodeInfoMessage>(this, cq.get(), &AsyncNodeService::RequestInsertMailbox, &Node::stepInsertMailbox, &NodeService::Stub::PrepareAsyncInsertMailbox);
+        new RoutedCall<QueryMailbox, NodeInfoMessage>(this, cq.get(), &AsyncNodeService::RequestLookupMailbox, &Node::stepLookupMailbox, &NodeService::Stub::PrepareAsyncLookupMailbox);
+        new RoutedCall<MailboxMessage, Empty>(this, cq.get(), &AsyncNodeService::RequestSend, &Node::stepSend, &NodeService::Stub::PrepareAsyncSend);
+        new RoutedCall<DeleteMessage, Empty>(this, cq.get(), &AsyncNodeService::RequestDelete, &Node::stepDelete, &NodeService::Stub::PrepareAsyncDelete);
+        new WatchCall(this, cq.get());
+        threads_.emplace_back(&AsyncServer::poll, this, cq.get());
+    }
+}
+
+void chord::AsyncServer::shutdown() {
+    for(auto &cq : cqs_) {
+        cq->Shutdown();
+    }
+    for(auto &thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+    cqs_.clear();
+}
+
+
+void chord::AsyncServer::poll(grpc::ServerCompletionQueue *cq) {
+    void *tag;
+    bool ok;
+    while(cq->Next(&tag, &ok)) {
+        static_cast<AsyncCall *>(tag)->proceed(ok);
+    }
+}
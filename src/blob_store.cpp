@@ -0,0 +1,45 @@
+#include "blob_store.hpp"
+
+#include <algorithm>
+
+chord::BlobStore::BlobStore(size_t shards)
+    : state_(std::make_shared<State>(std::max<size_t>(shards, 1))) {}
+
+chord::BlobStore::Blob chord::BlobStore::intern(std::string &&data) {
+    Shard &shard = state_->shardOf(data);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.blobs.find(data);
+    if(it != shard.blobs.end()) {
+        if(Blob blob = it->second.lock()) {
+            state_->hits++;
+            return blob;
+        }
+        // The last reference is being dropped, his deleter won't find the entry anymore
+        shard.blobs.erase(it);
+    }
+    std::weak_ptr<State> state = state_;
+    Blob blob(new std::string(std::move(data)), [state](const std::string *data) {
+        if(std::shared_ptr<State> owner = state.lock()) {
+            Shard &shard = owner->shardOf(*data);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.blobs.find(*data);
+            // The entry may belong to a new blob with the same content
+            if(it != shard.blobs.end() && it->first.data() == data->data()) {
+                shard.blobs.erase(it);
+            }
+            owner->size--;
+            owner->bytes -= data->size();
+        }
+        delete data;
+    });
+    shard.blobs.emplace(*blob, blob);
+    state_->size++;
+    state_->bytes += blob->size();
+    return blob;
+}
+
+size_t chord::BlobStore::size() const { return state_->size; }
+
+uint64_t chord::BlobStore::bytes() const { return state_->bytes; }
+
+uint64_t chord::BlobStore::hits() const { return state_->hits; }
@@ -0,0 +1,78 @@
+#include "body_store.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+chord::BodyStore::BodyStore(const std::string &path)
+    : path_(path)
+    , fd_(::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+    , end_(0)
+    , reads_(0) {
+    if(fd_ < 0) {
+        throw std::runtime_error("Couldn't create the body store " + path);
+    }
+}
+
+chord::BodyStore::~BodyStore() {
+    ::close(fd_);
+    std::remove(path_.c_str());
+}
+
+bool chord::BodyStore::append(const std::string &data, uint64_t &offset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    offset = end_;
+    const char *p = data.data();
+    size_t size = data.size();
+    uint64_t position = offset;
+    while(size > 0) {
+        ssize_t n = ::pwrite(fd_, p, size, position);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+        position += n;
+    }
+    // No fsync: the bodies are durable in the snapshots and in the log, this file is only a cache
+    end_ = position;
+    return true;
+}
+
+bool chord::BodyStore::read(uint64_t offset, uint32_t size, std::string &body) const {
+    if(offset + size > end_) {
+        return false;
+    }
+    body.resize(size);
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = ::pread(fd_, &body[done], size - done, offset + done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    reads_++;
+    return true;
+}
+
+bool chord::BodyStore::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(::ftruncate(fd_, 0) != 0) {
+        return false;
+    }
+    end_ = 0;
+    return true;
+}
+
+uint64_t chord::BodyStore::bytes() const { return end_; }
+
+uint64_t chord::BodyStore::reads() const { return reads_; }
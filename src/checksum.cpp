@@ -0,0 +1,45 @@
+#include "checksum.hpp"
+
+#include <array>
+#include <cstring>
+
+namespace {
+    using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+    /**
+     * @returns the tables of the slicing-by-8 algorithm, the first one is the classic byte table
+    */
+    Tables buildTables() {
+        Tables tables;
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            }
+            tables[0][i] = c;
+        }
+        for(uint32_t i = 0; i < 256; i++) {
+            for(size_t t = 1; t < tables.size(); t++) {
+                tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+            }
+        }
+        return tables;
+    }
+}
+
+uint32_t chord::crc32(const char *data, size_t size) {
+    static const Tables tables = buildTables();
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    uint32_t crc = 0xFFFFFFFFU;
+    for(; size >= 8; size -= 8, p += 8) {
+        // The words are read in little endian order, like the bytes are consumed by the byte table
+        uint32_t low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24),
+                 high = p[4] | p[5] << 8 | p[6] << 16 | static_cast<uint32_t>(p[7]) << 24;
+        crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+              tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^ tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+    }
+    for(; size > 0; size--, p++) {
+        crc = tables[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFU;
+}
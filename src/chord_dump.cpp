@@ -0,0 +1,123 @@
+#include <chord/segment.hpp>
+#include <chord/codec.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Inspects and verifies the segment files written by the nodes (<id>.seg), without modifying them.
+ *
+ *  chord_dump info <segment>              prints the header
+ *  chord_dump verify <segment> [threads]  checks every mailbox in parallel, fails if one is corrupted
+ *  chord_dump list <segment>              prints key, owner and number of messages of every mailbox
+ *  chord_dump show <segment> <key>        prints the messages of a mailbox
+*/
+
+void usage() {
+    std::cerr << "Usage: chord_dump info <segment>" << std::endl
+              << "       chord_dump verify <segment> [threads]" << std::endl
+              << "       chord_dump list <segment>" << std::endl
+              << "       chord_dump show <segment> <key>" << std::endl;
+}
+
+void info(const chord::Segment &segment) {
+    std::cout << "version:    " << segment.version() << (segment.version() < 2 ? " (no checksums)" : "") << std::endl
+              << "generation: " << segment.generation() << std::endl
+              << "mailboxes:  " << segment.size() << std::endl
+              << "bytes:      " << segment.bytes() << std::endl;
+}
+
+bool verify(const chord::Segment &segment, size_t threads) {
+    threads = std::max<size_t>(1, std::min(threads, segment.size()));
+    std::vector<std::thread> checkers;
+    for(size_t t = 0; t < threads; t++) {
+        checkers.emplace_back([&segment, t, threads]() {
+            segment.load(segment.size() * t / threads, segment.size() * (t + 1) / threads);
+        });
+    }
+    for(auto &checker : checkers) {
+        checker.join();
+    }
+    // The results are remembered by the segment, the second pass doesn't read the records again
+    for(size_t i = 0; i < segment.size(); i++) {
+        if(!segment.check(i)) {
+            std::cout << "corrupted mailbox " << segment.keyAt(i) << " at position " << i << std::endl;
+        }
+    }
+    std::cout << segment.size() - segment.corrupt() << " valid, " << segment.corrupt() << " corrupted" << std::endl;
+    return segment.corrupt() == 0;
+}
+
+void list(const chord::Segment &segment) {
+    for(size_t i = 0; i < segment.size(); i++) {
+        chord::key_t key = segment.keyAt(i);
+        chord::MailboxView box;
+        std::cout << std::setw(20) << key << "  ";
+        if(segment.find(key, box)) {
+            std::cout << box.owner() << "  " << box.size() << " messages" << std::endl;
+        } else {
+            std::cout << "CORRUPTED" << std::endl;
+        }
+    }
+}
+
+bool show(const chord::Segment &segment, chord::key_t key) {
+    chord::MailboxView box;
+    if(!segment.find(key, box)) {
+        std::cerr << "Mailbox " << key << (segment.contains(key) ? " is corrupted" : " not found") << std::endl;
+        return false;
+    }
+    std::cout << box.owner() << ", " << box.size() << " messages" << std::endl;
+    box.forEachMessage([](const chord::MessageView &msg) {
+        std::cout << std::setw(8) << msg.id << "  " << std::put_time(std::localtime(&msg.date), "%F %T") << "  "
+                  << msg.from << "  " << msg.subject << "  (" << chord::BodyCodec::originalSize(msg.body) << " bytes";
+        // The compressed bodies show both their sizes
+        const chord::Codec *codec = chord::BodyCodec::codecOf(msg.body);
+        if(codec != nullptr && codec->id() != chord::IdentityCodec::ID) {
+            std::cout << ", " << msg.body.size() << " with " << codec->name();
+        } else if(chord::BodyCodec::encoded(msg.body) && codec == nullptr) {
+            std::cout << ", unknown codec";
+        }
+        std::cout << ")" << std::endl;
+    });
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    std::string command(argv[1]);
+    std::shared_ptr<const chord::Segment> segment;
+    try {
+        segment = chord::Segment::open(argv[2]);
+    } catch(const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(!segment) {
+        std::cerr << "File " << argv[2] << " not found" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(command == "info") {
+        info(*segment);
+    } else if(command == "verify") {
+        size_t threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : std::thread::hardware_concurrency();
+        return verify(*segment, threads) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if(command == "list") {
+        list(*segment);
+    } else if(command == "show" && argc > 3) {
+        return show(*segment, std::strtoll(argv[3], nullptr, 10)) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        usage();
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,14 +1,24 @@
 #include "client.hpp"
+#include <cereal/archives/binary.hpp>
+#include <fstream>
 
-chord::Client::Client(const std::string &conn_string)
+chord::Client::Client(const std::string &conn_string, RoutingMode routing)
     : stub_(NodeService::NewStub(grpc::CreateChannel(conn_string, grpc::InsecureChannelCredentials())))
-    , box_(nullptr) {
+    , routing_(routing)
+    , owners_(256)
+    , box_(nullptr)
+    , epoch_(0)
+    , version_(0) {
     
     if(!ping()) {
         throw chord::NodeException("The node is not online");
     }
 }
 
+chord::Client::~Client() {
+    unwatch();
+}
+
 bool chord::Client::connectTo(const NodeInfo &node) {
     return connectTo(node.conn_string());
 }
@@ -19,6 +29,10 @@ bool chord::Client::connectTo(const std::string &conn_string) {
     return true;
 }
 
+void chord::Client::setRoutingMode(RoutingMode routing) { routing_ = routing; }
+
+chord::RouteCache& chord::Client::getOwnerCache() { return owners_; }
+
 mail::MailBox& chord::Client::getBox() { 
     if(box_) return *box_;
     else throw chord::NodeException("You must login first");
@@ -33,22 +47,43 @@ bool chord::Client::ping(int p) {
 
 chord::NodeInfo chord::Client::auth(const mail::MailBox &box, bool login) {
     NodeInfo manager;
+    key_t key = hashString(box.getOwner());
+    long long int ttl = CHORD_MOD;
+    bool cached = false;
 
-    if(login) {
+    if(login && owners_.get(key, manager)) {
+        // The cached owner is asked directly, the request must not be forwarded
         QueryMailbox request;
         request.set_owner(box.getOwner());
-        request.set_ttl(CHORD_MOD);
+        request.set_ttl(0);
+        auto[result, _] = sendMessage<QueryMailbox, NodeInfoMessage>(&request, manager, &NodeService::Stub::LookupMailbox);
+        cached = result.ok();
+        if(!cached) {
+            owners_.erase(key);
+        }
+    }
+
+    if(!cached && routing_ == RoutingMode::ITERATIVE) {
+        // The request is sent directly to the successor node, it must not be forwarded
+        connectTo(findSuccessor(key));
+        ttl = 0;
+    }
+
+    if(login && !cached) {
+        QueryMailbox request;
+        request.set_owner(box.getOwner());
+        request.set_ttl(ttl);
         auto[result, reply] = sendMessage<QueryMailbox, NodeInfoMessage>(&request, &NodeService::Stub::LookupMailbox);
         if(result.ok()) {
             fillNodeInfo(manager, reply);
         } else {
             throw NodeException("Address not found");
         }
-    } else {
+    } else if(!login) {
         InsertMailboxMessage request;
         request.set_owner(box.getOwner());
         request.set_password(box.getPassword());
-        request.set_ttl(CHORD_MOD);
+        request.set_ttl(ttl);
         auto[result, reply] = sendMessage<InsertMailboxMessage, NodeInfoMessage>(&request, &NodeService::Stub::InsertMailbox);
         if(!result.ok()) {
             throw NodeException(result.error_message());
@@ -65,32 +100,228 @@ chord::NodeInfo chord::Client::auth(const mail::MailBox &box, bool login) {
     authentication.set_psw(box.getPassword());
     auto[result, _] = sendMessage<Authentication, Empty>(&authentication, &NodeService::Stub::Authenticate);
     if(result.ok()) {
+        unwatch();
         box_.reset(new mail::MailBox(box));
+        fetched_.clear();
+        sizes_.clear();
+        epoch_ = version_ = 0;
+        owners_.put(key, manager);
         return manager;
     } else {
         throw NodeException("Invalid password");
     }
 }
 
+template<class F>
+grpc::Status chord::Client::receivePage(uint64_t start_id, uint64_t limit, bool newest_first, F visitor, uint64_t &next_id) {
+    ReceiveRequest request;
+    Authentication *auth = new Authentication;
+    auth->set_user(box_->getOwner());
+    auth->set_psw(box_->getPassword());
+    request.set_allocated_auth(auth);
+    request.set_start_id(start_id);
+    request.set_limit(limit);
+    request.set_newest_first(newest_first);
+    grpc::ClientContext context;
+    std::unique_ptr<grpc::ClientReader<MailboxChunk>> reader(stub_->ReceiveStream(&context, request));
+    // The same chunk is reused, only one chunk at a time is kept in memory
+    MailboxChunk chunk;
+    next_id = 0;
+    while(reader->Read(&chunk)) {
+        for(const MailboxMessage &msg : chunk.messages()) {
+            mail::Message message(msg.to(), msg.from(), msg.subject(), msg.body(), secondsToTimeT(msg.date()));
+            message.id = msg.id();
+            visitor(message);
+        }
+        next_id = chunk.next_id();
+    }
+    return reader->Finish();
+}
+
 bool chord::Client::getMessages() {
+    if(!box_) return false;
+    mail::MailBox box(box_->getOwner(), box_->getPassword());
+    std::unordered_set<uint64_t> fetched;
+    std::unordered_map<uint64_t, uint64_t> sizes;
+    uint64_t next_id;
+    grpc::Status status = receivePage(0, 0, false, [&](const mail::Message &message) {
+        box.insertMessage(message);
+        fetched.insert(message.id);
+        sizes[message.id] = message.body.size();
+    }, next_id);
+    if(!status.ok()) return false;
+    *box_ = std::move(box);
+    fetched_.swap(fetched);
+    sizes_.swap(sizes);
+    epoch_ = version_ = 0;
+    return true;
+}
+
+bool chord::Client::getPage(uint64_t start_id, uint64_t limit, bool newest_first, std::vector<mail::Message> &messages, uint64_t &next_id) {
+    if(!box_) return false;
+    return receivePage(start_id, limit, newest_first, [&messages](const mail::Message &message) {
+        messages.push_back(message);
+    }, next_id).ok();
+}
+
+bool chord::Client::getHeaders() {
     if(!box_) return false;
     Authentication request;
     request.set_user(box_->getOwner());
     request.set_psw(box_->getPassword());
-    auto[status, mailbox] = sendMessage<Authentication, Mailbox>(&request, &NodeService::Stub::Receive);
+    auto[status, list] = sendMessage<Authentication, HeaderList>(&request, &NodeService::Stub::ListHeaders);
     if(!status.ok()) return false;
-    box_->clear();
-    for(int i = 0; i < mailbox.messages_size(); i++) {
-        const MailboxMessage &msg = mailbox.messages().at(i);
-        box_->insertMessage({msg.to(), msg.from(), msg.subject(), msg.body(), secondsToTimeT(msg.date())});
+    mail::MailBox box(box_->getOwner(), box_->getPassword());
+    std::unordered_set<uint64_t> fetched;
+    sizes_.clear();
+    for(const HeaderMessage &header : list.headers()) {
+        mail::Message message(box.getOwner(), header.from(), header.subject(), "", secondsToTimeT(header.date()));
+        message.id = header.id();
+        message.read = header.read();
+        const mail::Message *cached = box_->findMessage(header.id());
+        if(cached != nullptr && fetched_.count(header.id()) > 0) {
+            // Bodies never change, the one already downloaded is still valid
+            message.body = cached->body;
+            message.read = message.read || cached->read;
+            fetched.insert(message.id);
+        }
+        box.insertMessage(message);
+        sizes_[message.id] = header.size();
+    }
+    *box_ = std::move(box);
+    fetched_.swap(fetched);
+    epoch_ = version_ = 0;
+    return true;
+}
+
+bool chord::Client::sync() {
+    if(!box_) return false;
+    SyncRequest request;
+    Authentication *auth = new Authentication;
+    auth->set_user(box_->getOwner());
+    auth->set_psw(box_->getPassword());
+    request.set_allocated_auth(auth);
+    bool more = true;
+    while(more) {
+        request.set_epoch(epoch_);
+        request.set_since_version(version_);
+        auto[status, reply] = sendMessage<SyncRequest, SyncReply>(&request, &NodeService::Stub::Sync);
+        if(!status.ok()) return false;
+        if(reply.reset()) {
+            // The changes can't be computed, the whole mailbox is downloaded and the next call starts from his version
+            uint64_t epoch = reply.epoch(), version = reply.version();
+            if(!getMessages()) return false;
+            epoch_ = epoch;
+            version_ = version;
+            return true;
+        }
+        // Applying the same changes twice is harmless, a message is never added or removed twice
+        for(uint64_t id : reply.removed()) {
+            box_->removeMessageById(id);
+            fetched_.erase(id);
+            sizes_.erase(id);
+        }
+        for(const MailboxMessage &msg : reply.added()) {
+            if(box_->findMessage(msg.id()) == nullptr) {
+                mail::Message message(msg.to(), msg.from(), msg.subject(), msg.body(), secondsToTimeT(msg.date()));
+                message.id = msg.id();
+                box_->insertMessage(message);
+            }
+            fetched_.insert(msg.id());
+            sizes_[msg.id()] = msg.body().size();
+        }
+        epoch_ = reply.epoch();
+        version_ = reply.version();
+        more = reply.more();
     }
     return true;
 }
 
+bool chord::Client::saveCache(const std::string &filename) const {
+    if(!box_ || !box_->saveBox(filename)) return false;
+    std::ofstream os(filename + ".sync");
+    if(!os.is_open()) {
+        return false;
+    }
+    cereal::BinaryOutputArchive oarchive(os);
+    oarchive(epoch_, version_);
+    return true;
+}
+
+bool chord::Client::loadCache(const std::string &filename) {
+    if(!box_) return false;
+    mail::MailBox box = mail::MailBox::loadBox(filename);
+    if(box.getOwner() != box_->getOwner() || box.getPassword() != box_->getPassword()) {
+        return false;
+    }
+    uint64_t epoch = 0, version = 0;
+    std::ifstream is(filename + ".sync");
+    if(is.is_open()) {
+        cereal::BinaryInputArchive iarchive(is);
+        iarchive(epoch, version);
+    }
+    *box_ = std::move(box);
+    fetched_.clear();
+    sizes_.clear();
+    for(const mail::Message &message : box_->getMessages()) {
+        fetched_.insert(message.id);
+        sizes_[message.id] = message.body.size();
+    }
+    epoch_ = epoch;
+    version_ = version;
+    return true;
+}
+
+bool chord::Client::fetchBodies(const std::vector<uint64_t> &ids) {
+    if(!box_) return false;
+    FetchRequest request;
+    Authentication *auth = new Authentication;
+    auth->set_user(box_->getOwner());
+    auth->set_psw(box_->getPassword());
+    request.set_allocated_auth(auth);
+    for(uint64_t id : ids) {
+        request.add_ids(id);
+    }
+    auto[status, reply] = sendMessage<FetchRequest, BodyList>(&request, &NodeService::Stub::FetchBodies);
+    if(!status.ok()) return false;
+    for(const BodyMessage &body : reply.bodies()) {
+        if(box_->setBody(body.id(), body.body())) {
+            box_->setRead(body.id());
+            fetched_.insert(body.id());
+        }
+    }
+    return true;
+}
+
+bool chord::Client::hasBody(uint64_t id) const {
+    return fetched_.count(id) > 0;
+}
+
+uint64_t chord::Client::getBodySize(uint64_t id) const {
+    auto it = sizes_.find(id);
+    return it == sizes_.end() ? 0 : it->second;
+}
+
 void chord::Client::send(const mail::Message &message) {
     if(!box_) return;
     chord::MailboxMessage msg;
     fillMailboxMessage(msg, message);
+    key_t key = hashString(message.to);
+    NodeInfo owner;
+    if(owners_.get(key, owner) || locate(message.to, owner)) {
+        // The body travels only to the owner, if the ring changed in the meantime
+        // the entry is dropped and the message is sent again through the connected node
+        msg.set_ttl(0);
+        auto[status, _] = sendMessage<MailboxMessage, Empty>(&msg, owner, &NodeService::Stub::Send);
+        if(status.error_code() != grpc::StatusCode::NOT_FOUND && status.error_code() != grpc::StatusCode::UNAVAILABLE) {
+            if(!status.ok()) {
+                throw NodeException(status.error_message());
+            }
+            return;
+        }
+        owners_.erase(key);
+        msg.set_ttl(CHORD_MOD);
+    }
     auto[status, _] = sendMessage<MailboxMessage, Empty>(&msg, &NodeService::Stub::Send);
     if(!status.ok()) {
         throw NodeException(status.error_message());
@@ -100,11 +331,105 @@ void chord::Client::send(const mail::Message &message) {
 void chord::Client::remove(int idx) {
     if(!box_) return;
     chord::DeleteMessage msg;
-    fillDeleteMessage(msg, idx);
+    uint64_t id = idx >= 0 && idx < box_->getSize() ? box_->getMessage(idx).id : 0;
+    fillDeleteMessage(msg, idx, id);
     auto[status, _] = sendMessage<DeleteMessage, Empty>(&msg, &NodeService::Stub::Delete);
     if(!status.ok()) {
         throw NodeException(status.error_message());
     }
+    if(id != 0) {
+        box_->removeMessageById(id);
+    }
+}
+
+void chord::Client::removeById(uint64_t id) {
+    if(!box_) return;
+    chord::DeleteMessage msg;
+    fillDeleteMessage(msg, 0, id);
+    auto[status, _] = sendMessage<DeleteMessage, Empty>(&msg, &NodeService::Stub::Delete);
+    if(!status.ok()) {
+        throw NodeException(status.error_message());
+    }
+    box_->removeMessageById(id);
+}
+
+bool chord::Client::watch(std::function<void(const mail::Message &)> on_message, std::function<void(const grpc::Status &)> on_end) {
+    if(!box_) return false;
+    unwatch();
+    NodeInfo owner;
+    if(!owners_.get(hashString(box_->getOwner()), owner) && !locate(box_->getOwner(), owner)) {
+        return false;
+    }
+    Authentication request;
+    request.set_user(box_->getOwner());
+    request.set_psw(box_->getPassword());
+    std::shared_ptr<NodeService::Stub> stub = peers_.get(owner);
+    std::unique_ptr<grpc::ClientContext> context(new grpc::ClientContext());
+    std::unique_ptr<grpc::ClientReader<HeaderMessage>> reader(stub->Watch(context.get(), request));
+    // The node sends the metadata once the watcher is registered, otherwise only the status arrives
+    reader->WaitForInitialMetadata();
+    if(context->GetServerInitialMetadata().count(WATCH_METADATA) == 0) {
+        reader->Finish();
+        return false;
+    }
+    watch_context_ = std::move(context);
+    watch_thread_.reset(new std::thread([stub, reader = std::move(reader), address = box_->getOwner(), on_message, on_end]() {
+        HeaderMessage header;
+        while(reader->Read(&header)) {
+            mail::Message message(address, header.from(), header.subject(), "", secondsToTimeT(header.date()));
+            message.id = header.id();
+            message.read = header.read();
+            on_message(message);
+        }
+        grpc::Status status = reader->Finish();
+        if(on_end) {
+            on_end(status);
+        }
+    }));
+    return true;
+}
+
+void chord::Client::unwatch() {
+    if(!watch_thread_) return;
+    watch_context_->TryCancel();
+    watch_thread_->join();
+    watch_thread_.reset();
+    watch_context_.reset();
+}
+
+bool chord::Client::locate(const std::string &address, NodeInfo &owner) {
+    key_t key = hashString(address);
+    if(routing_ == RoutingMode::ITERATIVE) {
+        owner = findSuccessor(key);
+    } else {
+        QueryMailbox request;
+        request.set_owner(address);
+        request.set_ttl(CHORD_MOD);
+        auto[result, reply] = sendMessage<QueryMailbox, NodeInfoMessage>(&request, &NodeService::Stub::LookupMailbox);
+        if(!result.ok()) {
+            return false;
+        }
+        fillNodeInfo(owner, reply);
+    }
+    owners_.put(key, owner);
+    return true;
+}
+
+chord::NodeInfo chord::Client::findSuccessor(key_t key) {
+    SuccessorQuery query;
+    query.set_key(key);
+    std::pair<grpc::Status, NextHop> hop = sendMessage<SuccessorQuery, NextHop>(&query, &NodeService::Stub::FindSuccessor);
+    for(int i = 0; hop.first.ok() && !hop.second.owner() && i < CHORD_MOD; i++) {
+        NodeInfo next;
+        fillNodeInfo(next, hop.second.node());
+        hop = sendMessage<SuccessorQuery, NextHop>(&query, next, &NodeService::Stub::FindSuccessor);
+    }
+    if(!hop.first.ok() || !hop.second.owner()) {
+        throw NodeException("Couldn't find the successor node");
+    }
+    NodeInfo successor;
+    fillNodeInfo(successor, hop.second.node());
+    return successor;
 }
 
 time_t chord::Client::secondsToTimeT(google::protobuf::int64 secs) {
@@ -127,11 +452,12 @@ void chord::Client::fillMailboxMessage(MailboxMessage &dst, const mail::Message
     dst.set_ttl(CHORD_MOD);
 }
 
-void chord::Client::fillDeleteMessage(DeleteMessage &dst, int idx) {
+void chord::Client::fillDeleteMessage(DeleteMessage &dst, int idx, uint64_t id) {
     Authentication *auth = new Authentication;
     auth->set_user(box_->getOwner());
     auth->set_psw(box_->getPassword());
     dst.set_allocated_auth(auth);
     dst.set_idx(idx);
+    dst.set_id(id);
     dst.set_ttl(CHORD_MOD);
 }
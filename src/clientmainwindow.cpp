@@ -34,11 +34,24 @@ void ClientMainWindow::login() {
         }
     }
     updateMailbox();
+    // The callback runs on a thread of the client, the list is refreshed by the event loop
+    client_->watch([this](const mail::Message &) {
+        QMetaObject::invokeMethod(this, "updateMailbox", Qt::QueuedConnection);
+    });
 }
 
 void ClientMainWindow::mailChanged(int currentRow) {
-    auto &msg = client_->getBox().getMessage(currentRow);
-    ui->mailwidget->showMessage(msg);
+    auto &box = client_->getBox();
+    if(currentRow < 0 || currentRow >= box.getSize()) {
+        return;
+    }
+    // Only the headers are downloaded by updateMailbox, the body is downloaded the first time the message is shown
+    uint64_t id = box.getMessage(currentRow).id;
+    if(!client_->hasBody(id) && !client_->fetchBodies({id})) {
+        QMessageBox::critical(this, "Error", "Couldn't download this message");
+        return;
+    }
+    ui->mailwidget->showMessage(box.getMessage(currentRow));
 }
 
 void ClientMainWindow::sendMessageClicked() {
@@ -56,11 +69,14 @@ void ClientMainWindow::logOutClicked() {
 }
 
 void ClientMainWindow::updateMailbox() {
+    if(!client_) {
+        return;
+    }
     ui->mailbox->blockSignals(true);
     ui->mailbox->setRowCount(0);
     ui->mailbox->blockSignals(false);
     ui->mailwidget->clearContent();
-    client_->getMessages();
+    client_->getHeaders();
     auto &box = client_->getBox();
     for(auto &msg : box.getMessages()) {
         int row = ui->mailbox->rowCount();
@@ -0,0 +1,187 @@
+#include "codec.hpp"
+
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <zlib.h>
+
+namespace {
+    const char MAGIC[3] = {'\0', 'C', 'Z'}; /**< First bytes of every encoded body */
+
+    /**
+     * @returns the CPU time used by the calling thread in nanoseconds
+    */
+    uint64_t threadCpuNs() {
+        timespec ts;
+        ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    /**
+     * Writes the header and the payload of an encoded body.
+    */
+    std::string frame(uint8_t id, uint32_t size, std::string_view payload) {
+        std::string body(MAGIC, sizeof(MAGIC));
+        body.push_back(static_cast<char>(id));
+        body.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        body.append(payload);
+        return body;
+    }
+}
+
+const chord::Codec* chord::Codec::find(uint8_t id) {
+    static const IdentityCodec identity;
+    static const ZlibCodec zlib;
+    static const Codec *codecs[] = {&identity, &zlib};
+    for(const Codec *codec : codecs) {
+        if(codec->id() == id) {
+            return codec;
+        }
+    }
+    return nullptr;
+}
+
+const chord::Codec* chord::Codec::find(const std::string &name) {
+    for(unsigned id = 0; id <= std::numeric_limits<uint8_t>::max(); id++) {
+        const Codec *codec = find(static_cast<uint8_t>(id));
+        if(codec != nullptr && name == codec->name()) {
+            return codec;
+        }
+    }
+    return nullptr;
+}
+
+uint8_t chord::IdentityCodec::id() const { return ID; }
+
+const char* chord::IdentityCodec::name() const { return "none"; }
+
+bool chord::IdentityCodec::compress(std::string_view data, std::string &out) const {
+    out.append(data);
+    return true;
+}
+
+bool chord::IdentityCodec::decompress(std::string_view data, size_t size, std::string &out) const {
+    if(data.size() != size) {
+        return false;
+    }
+    out.append(data);
+    return true;
+}
+
+chord::ZlibCodec::ZlibCodec(int level)
+    : level_(level) {}
+
+uint8_t chord::ZlibCodec::id() const { return ID; }
+
+const char* chord::ZlibCodec::name() const { return "zlib"; }
+
+bool chord::ZlibCodec::compress(std::string_view data, std::string &out) const {
+    size_t start = out.size();
+    uLongf length = ::compressBound(data.size());
+    out.resize(start + length);
+    int result = ::compress2(reinterpret_cast<Bytef *>(&out[start]), &length,
+                             reinterpret_cast<const Bytef *>(data.data()), data.size(), level_);
+    out.resize(result == Z_OK ? start + length : start);
+    return result == Z_OK;
+}
+
+bool chord::ZlibCodec::decompress(std::string_view data, size_t size, std::string &out) const {
+    size_t start = out.size();
+    uLongf length = size;
+    out.resize(start + size);
+    // One extra byte in the destination would be needed to detect a longer output, zlib reports it as Z_BUF_ERROR
+    int result = ::uncompress(reinterpret_cast<Bytef *>(&out[start]), &length,
+                              reinterpret_cast<const Bytef *>(data.data()), data.size());
+    if(result != Z_OK || length != size) {
+        out.resize(start);
+        return false;
+    }
+    return true;
+}
+
+chord::BodyCodec::BodyCodec()
+    : codec_(nullptr)
+    , threshold_(0)
+    , compressed_(0)
+    , input_bytes_(0)
+    , output_bytes_(0)
+    , compress_ns_(0)
+    , decompressed_(0)
+    , decompress_ns_(0) {}
+
+void chord::BodyCodec::configure(const Codec *codec, size_t threshold) {
+    codec_ = codec;
+    threshold_ = threshold;
+}
+
+void chord::BodyCodec::encode(std::string &body) {
+    bool ambiguous = body.size() >= sizeof(MAGIC) && std::memcmp(body.data(), MAGIC, sizeof(MAGIC)) == 0;
+    if(body.size() > std::numeric_limits<uint32_t>::max()) {
+        return;
+    }
+    if(codec_ != nullptr && codec_->id() != IdentityCodec::ID && body.size() >= threshold_) {
+        uint64_t start = threadCpuNs();
+        size_t size = body.size();
+        std::string compressed;
+        if(codec_->compress(body, compressed) && compressed.size() + HEADER_SIZE < size) {
+            body = frame(codec_->id(), size, compressed);
+            compressed_++;
+        } else if(ambiguous) {
+            body = frame(IdentityCodec::ID, size, body);
+        }
+        compress_ns_ += threadCpuNs() - start;
+        input_bytes_ += size;
+        output_bytes_ += body.size();
+        return;
+    }
+    if(ambiguous) {
+        body = frame(IdentityCodec::ID, body.size(), body);
+    }
+}
+
+bool chord::BodyCodec::decode(std::string_view body, std::string &out) const {
+    if(!encoded(body)) {
+        out.append(body);
+        return true;
+    }
+    const Codec *codec = codecOf(body);
+    if(codec == nullptr) {
+        return false;
+    }
+    uint64_t start = threadCpuNs();
+    bool decoded = codec->decompress(body.substr(HEADER_SIZE), originalSize(body), out);
+    if(codec->id() != IdentityCodec::ID) {
+        decompress_ns_ += threadCpuNs() - start;
+        decompressed_++;
+    }
+    return decoded;
+}
+
+bool chord::BodyCodec::encoded(std::string_view body) {
+    return body.size() >= HEADER_SIZE && std::memcmp(body.data(), MAGIC, sizeof(MAGIC)) == 0;
+}
+
+const chord::Codec* chord::BodyCodec::codecOf(std::string_view body) {
+    return encoded(body) ? Codec::find(static_cast<uint8_t>(body[sizeof(MAGIC)])) : nullptr;
+}
+
+size_t chord::BodyCodec::originalSize(std::string_view body) {
+    if(!encoded(body)) {
+        return body.size();
+    }
+    uint32_t size;
+    std::memcpy(&size, body.data() + sizeof(MAGIC) + 1, sizeof(size));
+    return size;
+}
+
+uint64_t chord::BodyCodec::compressedBodies() const { return compressed_; }
+
+uint64_t chord::BodyCodec::inputBytes() const { return input_bytes_; }
+
+uint64_t chord::BodyCodec::outputBytes() const { return output_bytes_; }
+
+uint64_t chord::BodyCodec::compressUs() const { return compress_ns_ / 1000; }
+
+uint64_t chord::BodyCodec::decompressedBodies() const { return decompressed_; }
+
+uint64_t chord::BodyCodec::decompressUs() const { return decompress_ns_ / 1000; }
@@ -0,0 +1,127 @@
+#include "finger_table.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+chord::FingerTable::FingerTable(key_t owner)
+    : owner_(owner)
+    , empty_({"", 0, 0})
+    , peers_()
+    , refs_()
+    , distances_()
+    , order_()
+    , count_(0) {
+    fingers_.fill(NONE);
+}
+
+void chord::FingerTable::setOwner(key_t owner) {
+    owner_ = owner;
+    sort();
+}
+
+const chord::NodeInfo& chord::FingerTable::get(int idx) const {
+    if(idx < 0 || idx >= M) {
+        throw std::out_of_range("Finger index out of range");
+    }
+    return fingers_[idx] == NONE ? empty_ : peers_[fingers_[idx]];
+}
+
+void chord::FingerTable::set(int idx, const NodeInfo &peer) {
+    if(idx < 0 || idx >= M) {
+        throw std::out_of_range("Finger index out of range");
+    }
+    // The peer may reference the entry released below, so it's copied first
+    NodeInfo target(peer);
+    // The old entry is released before taking the new one, so with every finger pointing to a distinct peer
+    // the entry of this finger is free again
+    uint8_t old = fingers_[idx];
+    bool released = old != NONE && --refs_[old] == 0;
+    uint8_t entry = NONE;
+    bool created = false;
+    if(!target.address.empty()) {
+        for(int i = 0; i < M && entry == NONE; i++) {
+            if(refs_[i] > 0 && peers_[i] == target) {
+                entry = i;
+            }
+        }
+        // There are as many entries as fingers and this finger holds none, so a free one always exists
+        for(int i = 0; i < M && entry == NONE; i++) {
+            if(refs_[i] == 0) {
+                peers_[i] = target;
+                entry = i;
+                created = true;
+            }
+        }
+        refs_[entry]++;
+    }
+    fingers_[idx] = entry;
+    if(created || released) {
+        sort();
+    }
+}
+
+void chord::FingerTable::remove(const NodeInfo &peer) {
+    // The peer may reference the directory, so it's copied before the entry is released
+    NodeInfo removed(peer);
+    for(int i = 0; i < M; i++) {
+        if(fingers_[i] != NONE && peers_[fingers_[i]] == removed) {
+            set(i, empty_);
+        }
+    }
+}
+
+const chord::NodeInfo& chord::FingerTable::successor() const {
+    return get(0);
+}
+
+const chord::NodeInfo& chord::FingerTable::closestPreceding(key_t key) const {
+    key_t target = distance(key);
+    if(count_ == 0) {
+        return successor();
+    }
+    // Branchless binary search of the last distance smaller than the target
+    const key_t *base = distances_.data();
+    int n = count_;
+    while(n > 1) {
+        int half = n / 2;
+        base = base[half] < target ? base + half : base;
+        n -= half;
+    }
+    if(*base < target) {
+        return peers_[order_[base - distances_.data()]];
+    }
+    return successor();
+}
+
+const chord::NodeInfo& chord::FingerTable::closestPreceding(key_t key, const NodeInfo &excluded) const {
+    key_t target = distance(key);
+    // The peers are distinct, so at most the closest one is skipped
+    for(int i = std::lower_bound(distances_.begin(), distances_.begin() + count_, target) - distances_.begin(); i-- > 0;) {
+        const NodeInfo &peer = peers_[order_[i]];
+        if(!(peer == excluded)) {
+            return peer;
+        }
+    }
+    return empty_;
+}
+
+chord::key_t chord::FingerTable::distance(key_t key) const {
+    key_t d = key - owner_;
+    return d < 0 ? d + (1LL << M) : d;
+}
+
+void chord::FingerTable::sort() {
+    count_ = 0;
+    for(int i = 0; i < M; i++) {
+        // A finger that points to the owner itself never precedes a key
+        if(refs_[i] > 0 && peers_[i].id != owner_) {
+            order_[count_++] = i;
+        }
+    }
+    std::sort(order_.begin(), order_.begin() + count_, [this](uint8_t lhs, uint8_t rhs) {
+        return distance(peers_[lhs].id) < distance(peers_[rhs].id);
+    });
+    for(int i = 0; i < count_; i++) {
+        distances_[i] = distance(peers_[order_[i]].id);
+    }
+}
@@ -0,0 +1,46 @@
+#include "latency.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+chord::LatencyTracker::LatencyTracker(size_t window, size_t min_samples)
+    : window_(std::max<size_t>(window, 1))
+    , min_samples_(min_samples)
+    , recorded_(0)
+    , cached_percentile_(-1)
+    , cached_value_(0)
+    , cached_at_(0) {
+    samples_.reserve(window_);
+}
+
+void chord::LatencyTracker::record(std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(samples_.size() < window_) {
+        samples_.push_back(latency.count());
+    } else {
+        samples_[recorded_ % window_] = latency.count();
+    }
+    recorded_++;
+}
+
+std::chrono::microseconds chord::LatencyTracker::percentile(double percentile) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(samples_.size() < std::max<size_t>(min_samples_, 1)) {
+        return std::chrono::microseconds(0);
+    }
+    if(percentile != cached_percentile_ || recorded_ - cached_at_ >= REFRESH) {
+        std::vector<int64_t> sorted(samples_);
+        size_t rank = static_cast<size_t>(std::ceil(std::clamp(percentile, 0.0, 100.0) / 100 * sorted.size()));
+        auto nth = sorted.begin() + std::clamp<size_t>(rank, 1, sorted.size()) - 1;
+        std::nth_element(sorted.begin(), nth, sorted.end());
+        cached_percentile_ = percentile;
+        cached_value_ = *nth;
+        cached_at_ = recorded_;
+    }
+    return std::chrono::microseconds(cached_value_);
+}
+
+size_t chord::LatencyTracker::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return samples_.size();
+}
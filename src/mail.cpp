@@ -1,6 +1,8 @@
 #include "mail.hpp"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <stdexcept>
 #include <gcrypt.h>
 #include <cereal/archives/binary.hpp>
 
@@ -10,7 +12,8 @@ mail::Message::Message()
     , subject("")
     , body("")
     , date(std::time(nullptr))
-    , read(false) {}
+    , read(false)
+    , id(0) {}
 
 mail::Message::Message(const std::string &to_, const std::string &from_, const std::string &subject_, const std::string &body_, std::time_t date_)
     : to(to_)
@@ -18,7 +21,8 @@ mail::Message::Message(const std::string &to_, const std::string &from_, const s
     , subject(subject_)
     , body(body_)
     , date(date_)
-    , read(false) {}
+    , read(false)
+    , id(0) {}
 
 bool mail::Message::compare(const mail::Message &msg) const {
     return (to.compare(msg.to) == 0) &&
@@ -31,17 +35,32 @@ bool mail::Message::compare(const mail::Message &msg) const {
 mail::MailBox::MailBox()
     : owner_("")
     , psw_(0)
-    , box_() {}
+    , box_()
+    , next_id_(1)
+    , tombstones_(0)
+    , body_bytes_(0)
+    , removals_(0)
+    , removed_floor_(0) {}
 
 mail::MailBox::MailBox(const std::string &owner, const std::string &psw)
     : owner_(owner)
     , psw_(hashPsw(psw))
-    , box_() {}
+    , box_()
+    , next_id_(1)
+    , tombstones_(0)
+    , body_bytes_(0)
+    , removals_(0)
+    , removed_floor_(0) {}
 
 mail::MailBox::MailBox(const std::string &owner, long long int psw)
     : owner_(owner)
     , psw_(psw)
-    , box_() {}
+    , box_()
+    , next_id_(1)
+    , tombstones_(0)
+    , body_bytes_(0)
+    , removals_(0)
+    , removed_floor_(0) {}
 
 void mail::MailBox::setOwner(const std::string &owner) {
     owner_.assign(owner.begin(), owner.end());
@@ -55,37 +74,153 @@ void mail::MailBox::setPassword(long long int psw) { psw_ = psw; }
 
 long long int mail::MailBox::getPassword() const { return psw_; }
 
-int mail::MailBox::getSize() const { return box_.size(); }
+int mail::MailBox::getSize() const { return positions_.size(); }
 
-bool mail::MailBox::empty() const { return box_.empty(); }
+bool mail::MailBox::empty() const { return positions_.empty(); }
 
-void mail::MailBox::clear() { box_.clear(); }
+void mail::MailBox::clear() {
+    removals_ += positions_.size();
+    // The removed messages are not remembered one by one, the clients behind must start over
+    removed_.clear();
+    removed_floor_ = next_id_++;
+    box_.clear();
+    positions_.clear();
+    tombstones_ = 0;
+    body_bytes_ = 0;
+}
 
-const std::vector<mail::Message>& mail::MailBox::getMessages() const {
-    return box_;
+std::vector<mail::Message> mail::MailBox::getMessages() const {
+    std::vector<Message> messages;
+    messages.reserve(positions_.size());
+    forEachMessage([&messages](const Message &msg) { messages.push_back(msg); });
+    return messages;
 }
 
 const mail::Message& mail::MailBox::getMessage(int i) const {
-    return box_.at(i);
+    if(i < 0 || i >= getSize()) {
+        throw std::out_of_range("Message index out of range");
+    }
+    if(tombstones_ == 0) {
+        return box_[i];
+    }
+    for(auto &msg : box_) {
+        if(msg.id != 0 && i-- == 0) {
+            return msg;
+        }
+    }
+    throw std::out_of_range("Message index out of range");
+}
+
+const mail::Message* mail::MailBox::findMessage(uint64_t id) const {
+    auto it = positions_.find(id);
+    return it == positions_.end() ? nullptr : &box_[it->second];
+}
+
+bool mail::MailBox::setBody(uint64_t id, const std::string &body) {
+    auto it = positions_.find(id);
+    if(it == positions_.end()) {
+        return false;
+    }
+    Message &msg = box_[it->second];
+    body_bytes_ = body_bytes_ - msg.body.size() + body.size();
+    msg.body = body;
+    return true;
+}
+
+bool mail::MailBox::setRead(uint64_t id, bool read) {
+    auto it = positions_.find(id);
+    if(it == positions_.end()) {
+        return false;
+    }
+    box_[it->second].read = read;
+    return true;
 }
 
 bool mail::MailBox::removeMessage(int i) {
-    auto it = std::next(box_.begin(), i);
-    if(it != box_.end()) {
-        box_.erase(it);
-        return true;
-    } else {
+    if(i < 0 || i >= getSize()) {
         return false;
     }
+    return removeMessageById(getMessage(i).id);
 }
 
-void mail::MailBox::insertMessage(const mail::Message &msg) {
+bool mail::MailBox::removeMessageById(uint64_t id) {
+    auto it = positions_.find(id);
+    if(it == positions_.end()) {
+        return false;
+    }
+    body_bytes_ -= box_[it->second].body.size();
+    box_[it->second] = Message();
+    positions_.erase(it);
+    tombstones_++;
+    removals_++;
+    // The removal takes a version like an insertion, the identifier is never assigned
+    if(removed_.size() == REMOVAL_LOG) {
+        removed_floor_ = removed_.front().first;
+        removed_.erase(removed_.begin());
+    }
+    removed_.emplace_back(next_id_++, id);
+    // Keeps the memory bounded if nobody compacts the box, the cost is amortized over the removals
+    if(tombstones_ > positions_.size() + 64) {
+        compact();
+    }
+    return true;
+}
+
+uint64_t mail::MailBox::insertMessage(const mail::Message &msg) {
+    uint64_t id = msg.id;
+    if(id == 0 || positions_.count(id) > 0) {
+        id = next_id_;
+    }
+    next_id_ = std::max(next_id_, id + 1);
+    body_bytes_ += msg.body.size();
     box_.push_back(msg);
+    box_.back().id = id;
+    positions_[id] = box_.size() - 1;
+    return id;
 }
 
 void mail::MailBox::insertMessages(const std::vector<Message> &msgs) {
     for(auto &msg : msgs) {
-        box_.push_back(msg);
+        insertMessage(msg);
+    }
+}
+
+size_t mail::MailBox::getTombstones() const { return tombstones_; }
+
+size_t mail::MailBox::getBodyBytes() const { return body_bytes_; }
+
+uint64_t mail::MailBox::getRemovals() const { return removals_; }
+
+uint64_t mail::MailBox::getVersion() const { return next_id_ - 1; }
+
+void mail::MailBox::restoreVersion(uint64_t version) {
+    next_id_ = std::max(next_id_, version + 1);
+    removed_floor_ = std::max(removed_floor_, getVersion());
+}
+
+size_t mail::MailBox::compact() {
+    size_t reclaimed = tombstones_;
+    if(reclaimed > 0) {
+        box_.erase(std::remove_if(box_.begin(), box_.end(), [](const Message &msg) { return msg.id == 0; }), box_.end());
+        reindex();
+    }
+    return reclaimed;
+}
+
+void mail::MailBox::reindex() {
+    positions_.clear();
+    positions_.reserve(box_.size());
+    tombstones_ = 0;
+    body_bytes_ = 0;
+    for(auto &msg : box_) {
+        next_id_ = std::max(next_id_, msg.id + 1);
+        body_bytes_ += msg.body.size();
+    }
+    for(size_t i = 0; i < box_.size(); i++) {
+        if(box_[i].id == 0 || positions_.count(box_[i].id) > 0) {
+            box_[i].id = next_id_++;
+        }
+        positions_[box_[i].id] = i;
     }
 }
 
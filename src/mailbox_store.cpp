@@ -0,0 +1,429 @@
+#include "mailbox_store.hpp"
+
+#include <algorithm>
+
+chord::MailboxStore::MailboxStore(size_t shards)
+    : budget_(0)
+    , body_bytes_(0)
+    , spilled_refs_(0)
+    , dedup_threshold_(0)
+    , shared_refs_(0)
+    , shared_bytes_(0)
+    , clock_(0) {
+    shards = std::max<size_t>(shards, 1);
+    for(size_t i = 0; i < shards; i++) {
+        shards_.emplace_back(new Shard());
+    }
+}
+
+void chord::MailboxStore::setBudget(size_t bytes, std::shared_ptr<BodyStore> store) {
+    budget_ = store ? bytes : 0;
+    bodies_ = store;
+}
+
+void chord::MailboxStore::setDedup(size_t threshold) {
+    dedup_threshold_ = threshold;
+}
+
+bool chord::MailboxStore::insert(key_t key, const mail::MailBox &box, const std::function<bool()> &before) {
+    {
+        Shard &shard = shardOf(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        MailboxView view;
+        if(shard.boxes.find(key) != nullptr || findCold(shard, key, view)) {
+            return false;
+        }
+        if(before && !before()) {
+            return false;
+        }
+        Resident *resident = shard.boxes.insert(key, box).first;
+        touch(*resident);
+        body_bytes_ += box.getBodyBytes();
+        share(*resident);
+        shard.erased.erase(key);
+        shard.order.insert(key);
+        shard.dirty.insert(key);
+    }
+    checkBudget();
+    return true;
+}
+
+bool chord::MailboxStore::erase(key_t key) {
+    Shard &shard = shardOf(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return eraseLocked(shard, key);
+}
+
+bool chord::MailboxStore::erase(key_t key, uint64_t version) {
+    Shard &shard = shardOf(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    MailboxView view;
+    if(const Resident *resident = shard.boxes.find(key)) {
+        if(resident->box.getVersion() != version) {
+            return false;
+        }
+    } else if(!findCold(shard, key, view) || view.version() != version) {
+        return false;
+    }
+    return eraseLocked(shard, key);
+}
+
+bool chord::MailboxStore::eraseLocked(Shard &shard, key_t key) {
+    if(const Resident *resident = shard.boxes.find(key)) {
+        forget(*resident);
+        shard.boxes.erase(key);
+        shard.order.erase(key);
+    } else if(shard.segment && shard.erased.count(key) == 0 && shard.segment->contains(key)) {
+        shard.hidden++;
+    } else {
+        return false;
+    }
+    // Every removal is remembered: the key may be in the segment that replaces the current one
+    shard.erased.insert(key);
+    shard.dirty.insert(key);
+    return true;
+}
+
+bool chord::MailboxStore::contains(key_t key) const {
+    const Shard &shard = shardOf(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.boxes.find(key) != nullptr ||
+           (shard.segment && shard.erased.count(key) == 0 && shard.segment->contains(key));
+}
+
+void chord::MailboxStore::merge(std::map<key_t, mail::MailBox> &boxes) {
+    for(auto it = boxes.begin(); it != boxes.end();) {
+        if(insert(it->first, it->second)) {
+            it = boxes.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+std::vector<chord::key_t> chord::MailboxStore::keys(key_t first, key_t last) const {
+    std::vector<key_t> keys;
+    if(first > last) {
+        return keys;
+    }
+    for(auto &shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard->mutex);
+        auto begin = shard->order.lower_bound(first), end = shard->order.upper_bound(last);
+        size_t sorted = keys.size();
+        keys.insert(keys.end(), begin, end);
+        std::inplace_merge(keys.begin(), keys.begin() + sorted, keys.end());
+    }
+    std::shared_ptr<const Segment> base = segment();
+    size_t sorted = keys.size();
+    for(size_t i = base ? base->lowerBound(first) : 0; base && i < base->size() && base->keyAt(i) <= last; i++) {
+        key_t key = base->keyAt(i);
+        const Shard &shard = shardOf(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        if(shard.segment == base && shard.boxes.find(key) == nullptr && shard.erased.count(key) == 0) {
+            keys.push_back(key);
+        }
+    }
+    std::inplace_merge(keys.begin(), keys.begin() + sorted, keys.end());
+    return keys;
+}
+
+std::map<chord::key_t, mail::MailBox> chord::MailboxStore::snapshot() const {
+    std::map<key_t, mail::MailBox> boxes;
+    forEach([&boxes](key_t key, const mail::MailBox &box) {
+        boxes.insert({key, box});
+    });
+    return boxes;
+}
+
+std::vector<chord::key_t> chord::MailboxStore::takeDirty() {
+    std::vector<key_t> keys;
+    for(auto &shard : shards_) {
+        std::unordered_set<key_t> dirty;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard->mutex);
+            dirty.swap(shard->dirty);
+        }
+        keys.insert(keys.end(), dirty.begin(), dirty.end());
+    }
+    return keys;
+}
+
+size_t chord::MailboxStore::compact() {
+    size_t reclaimed = 0;
+    for(auto &shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard->mutex);
+        for(auto &pair : shard->boxes) {
+            if(pair.second.box.getTombstones() > 0) {
+                reclaimed += pair.second.box.compact();
+            }
+        }
+    }
+    return reclaimed;
+}
+
+void chord::MailboxStore::clear() {
+    std::shared_ptr<const Segment> base = segment();
+    for(auto &shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard->mutex);
+        for(key_t key : shard->order) {
+            shard->dirty.insert(key);
+        }
+        for(auto &pair : shard->boxes) {
+            forget(pair.second);
+        }
+        shard->boxes.clear();
+        shard->order.clear();
+        shard->segment.reset();
+        shard->erased.clear();
+        shard->hidden = 0;
+    }
+    // The mailboxes of the segment were removed too
+    for(size_t i = 0; base && i < base->size(); i++) {
+        Shard &shard = shardOf(base->keyAt(i));
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        shard.dirty.insert(base->keyAt(i));
+    }
+}
+
+void chord::MailboxStore::attach(std::shared_ptr<const Segment> segment) {
+    for(auto &shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard->mutex);
+        if(segment) {
+            // The copies of the mailboxes not modified since the segment was written are not needed anymore
+            std::vector<key_t> clean;
+            for(auto &pair : shard->boxes) {
+                if(shard->dirty.count(pair.first) == 0 && segment->contains(pair.first)) {
+                    clean.push_back(pair.first);
+                }
+            }
+            for(key_t key : clean) {
+                forget(*shard->boxes.find(key));
+                shard->boxes.erase(key);
+                shard->order.erase(key);
+            }
+        }
+        for(auto it = shard->erased.begin(); it != shard->erased.end();) {
+            if(segment && shard->boxes.find(*it) == nullptr && segment->contains(*it)) {
+                it++;
+            } else {
+                it = shard->erased.erase(it);
+            }
+        }
+        shard->hidden = shard->erased.size();
+        for(auto &pair : shard->boxes) {
+            if(segment && segment->contains(pair.first)) {
+                shard->hidden++;
+            }
+        }
+        shard->segment = segment;
+    }
+}
+
+std::shared_ptr<const chord::Segment> chord::MailboxStore::segment() const {
+    std::shared_lock<std::shared_mutex> lock(shards_.front()->mutex);
+    return shards_.front()->segment;
+}
+
+size_t chord::MailboxStore::size() const {
+    size_t size = 0, hidden = 0;
+    for(auto &shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard->mutex);
+        size += shard->boxes.size();
+        hidden += shard->hidden;
+    }
+    std::shared_ptr<const Segment> base = segment();
+    return size + (base ? base->size() : 0) - hidden;
+}
+
+size_t chord::MailboxStore::resident() const {
+    size_t size = 0;
+    for(auto &shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard->mutex);
+        size += shard->boxes.size();
+    }
+    return size;
+}
+
+size_t chord::MailboxStore::bodyBytes() const { return body_bytes_; }
+
+size_t chord::MailboxStore::spilledBodies() const { return spilled_refs_; }
+
+size_t chord::MailboxStore::sharedBodies() const { return shared_refs_; }
+
+uint64_t chord::MailboxStore::sharedBytes() const { return shared_bytes_; }
+
+const chord::BlobStore& chord::MailboxStore::blobs() const { return blobs_; }
+
+chord::MailboxStore::Resident* chord::MailboxStore::hydrate(Shard &shard, key_t key) {
+    MailboxView view;
+    if(!findCold(shard, key, view)) {
+        return nullptr;
+    }
+    Resident *resident = shard.boxes.insert(key, view.toMailBox()).first;
+    body_bytes_ += resident->box.getBodyBytes();
+    share(*resident);
+    shard.order.insert(key);
+    shard.hidden++;
+    return resident;
+}
+
+chord::BodyLoader chord::MailboxStore::loader(const Resident &resident) const {
+    const BodyStore *store = bodies_.get();
+    const Resident *owner = &resident;
+    return [store, owner](uint64_t id, std::string &body) {
+        auto shared = owner->shared.find(id);
+        if(shared != owner->shared.end()) {
+            body = *shared->second;
+            return true;
+        }
+        auto it = owner->spilled.find(id);
+        if(it == owner->spilled.end()) {
+            // The body is really empty
+            body.clear();
+            return true;
+        }
+        return store->read(it->second.offset, it->second.size, body);
+    };
+}
+
+void chord::MailboxStore::prune(Resident &resident, bool removed) {
+    size_t live = resident.box.getSize();
+    if(resident.spilled.size() > live + live / 2 + 64) {
+        // The refs of the removed messages are dropped in one pass, so the cost is amortized over the removals
+        std::unordered_map<uint64_t, BodyRef> kept;
+        for(auto &pair : resident.spilled) {
+            if(resident.box.findMessage(pair.first) != nullptr) {
+                kept.insert(pair);
+            }
+        }
+        spilled_refs_ -= resident.spilled.size() - kept.size();
+        resident.spilled.swap(kept);
+    }
+    if(removed && !resident.shared.empty()) {
+        // A shared body can be released only when the last message that uses it is removed, so it's done immediately
+        for(auto it = resident.shared.begin(); it != resident.shared.end();) {
+            if(resident.box.findMessage(it->first) == nullptr) {
+                shared_refs_--;
+                shared_bytes_ -= it->second->size();
+                it = resident.shared.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+}
+
+void chord::MailboxStore::share(Resident &resident) {
+    if(dedup_threshold_ == 0) {
+        return;
+    }
+    size_t before = resident.box.getBodyBytes();
+    uint64_t last = resident.shared_until;
+    resident.box.forEachBodyAfter(resident.shared_until, [&](uint64_t id, std::string &body) {
+        last = std::max(last, id);
+        if(body.size() < dedup_threshold_) {
+            return;
+        }
+        BlobStore::Blob blob = blobs_.intern(std::move(body));
+        std::string().swap(body);
+        auto inserted = resident.shared.insert({id, blob});
+        if(!inserted.second) {
+            shared_bytes_ -= inserted.first->second->size();
+            inserted.first->second = blob;
+        } else {
+            shared_refs_++;
+        }
+        shared_bytes_ += blob->size();
+    });
+    resident.shared_until = last;
+    body_bytes_ -= before - resident.box.getBodyBytes();
+}
+
+void chord::MailboxStore::forget(const Resident &resident) {
+    body_bytes_ -= resident.box.getBodyBytes();
+    spilled_refs_ -= resident.spilled.size();
+    shared_refs_ -= resident.shared.size();
+    for(auto &pair : resident.shared) {
+        shared_bytes_ -= pair.second->size();
+    }
+}
+
+void chord::MailboxStore::spill() {
+    std::unique_lock<std::mutex> spilling(spill_mutex_, std::try_to_lock);
+    if(!spilling.owns_lock()) {
+        return;
+    }
+    if(spilled_refs_ == 0) {
+        // Nothing on disk is referenced anymore, the file can start again from the beginning
+        bodies_->reset();
+    }
+    std::vector<std::pair<uint64_t, key_t>> candidates;
+    for(auto &shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard->mutex);
+        for(auto &pair : shard->boxes) {
+            if(pair.second.box.getBodyBytes() > 0 || !pair.second.shared.empty()) {
+                candidates.push_back({pair.second.access.load(std::memory_order_relaxed), pair.first});
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    const size_t target = budget_ - budget_ / 8;
+    std::string data;
+    for(auto &candidate : candidates) {
+        if(body_bytes_ + blobs_.bytes() <= target) {
+            break;
+        }
+        Shard &shard = shardOf(candidate.second);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        Resident *resident = shard.boxes.find(candidate.second);
+        if(resident == nullptr) {
+            continue;
+        }
+        // All the bodies of the mailbox are written at once, they're usually read together
+        data.clear();
+        resident->box.forEachMessage([&](const mail::Message &msg) {
+            auto shared = resident->shared.find(msg.id);
+            data.append(shared != resident->shared.end() ? *shared->second : msg.body);
+        });
+        uint64_t offset;
+        if(data.empty() || !bodies_->append(data, offset)) {
+            continue;
+        }
+        resident->box.forEachBody([&](uint64_t id, std::string &body) {
+            size_t size = body.size();
+            auto shared = resident->shared.find(id);
+            if(shared != resident->shared.end()) {
+                size = shared->second->size();
+                shared_refs_--;
+                shared_bytes_ -= size;
+                resident->shared.erase(shared);
+            }
+            if(size == 0) {
+                return;
+            }
+            auto inserted = resident->spilled.insert({id, {offset, static_cast<uint32_t>(size)}});
+            if(inserted.second) {
+                spilled_refs_++;
+            } else {
+                inserted.first->second = {offset, static_cast<uint32_t>(size)};
+            }
+            offset += size;
+            body_bytes_ -= body.size();
+            std::string().swap(body);
+        });
+    }
+}
+
+bool chord::MailboxStore::empty() const {
+    return size() == 0;
+}
+
+chord::MailboxStore::Shard& chord::MailboxStore::shardOf(key_t key) {
+    return const_cast<Shard &>(static_cast<const MailboxStore *>(this)->shardOf(key));
+}
+
+const chord::MailboxStore::Shard& chord::MailboxStore::shardOf(key_t key) const {
+    // Keys are already hashes, the multiplication only spreads consecutive keys used by tests and benchmarks
+    uint64_t mixed = static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL;
+    return *shards_[(mixed >> 32) % shards_.size()];
+}
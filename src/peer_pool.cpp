@@ -0,0 +1,92 @@
+#include "peer_pool.hpp"
+
+#include <vector>
+
+chord::PeerPool::PeerPool(std::chrono::milliseconds idle_timeout)
+    : idle_timeout_(idle_timeout)
+    , hits_(0)
+    , misses_(0) {}
+
+std::shared_ptr<chord::NodeService::Stub> chord::PeerPool::get(const NodeInfo &peer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Entry &entry = lookup(peer.conn_string(), created);
+    if(created) {
+        misses_++;
+    } else {
+        hits_++;
+    }
+    return entry.stub;
+}
+
+void chord::PeerPool::warm(const NodeInfo &peer) {
+    if(peer.address.empty()) {
+        return;
+    }
+    std::shared_ptr<grpc::Channel> channel;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool created;
+        channel = lookup(peer.conn_string(), created).channel;
+    }
+    // Starts the connection without waiting for it
+    channel->GetState(true);
+}
+
+void chord::PeerPool::erase(const NodeInfo &peer) {
+    // Like in PeerPool::evictIdle the channel is destroyed after the lock is released
+    Entry erased;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = peers_.find(peer.conn_string());
+        if(it == peers_.end()) {
+            return;
+        }
+        erased = std::move(it->second);
+        peers_.erase(it);
+    }
+}
+
+void chord::PeerPool::evictIdle() {
+    auto now = std::chrono::steady_clock::now();
+    // Channels are destroyed outside the lock since closing a connection can take a while
+    std::vector<Entry> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto it = peers_.begin(); it != peers_.end();) {
+            if(now - it->second.last_used > idle_timeout_) {
+                evicted.push_back(std::move(it->second));
+                it = peers_.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+}
+
+void chord::PeerPool::setIdleTimeout(std::chrono::milliseconds idle_timeout) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_timeout_ = idle_timeout;
+}
+
+size_t chord::PeerPool::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peers_.size();
+}
+
+uint64_t chord::PeerPool::hits() const { return hits_; }
+
+uint64_t chord::PeerPool::misses() const { return misses_; }
+
+chord::PeerPool::Entry& chord::PeerPool::lookup(const std::string &target, bool &created) {
+    auto it = peers_.find(target);
+    created = it == peers_.end();
+    if(created) {
+        Entry entry;
+        entry.channel = grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
+        entry.stub = NodeService::NewStub(entry.channel);
+        it = peers_.emplace(target, std::move(entry)).first;
+    }
+    it->second.last_used = std::chrono::steady_clock::now();
+    return it->second;
+}
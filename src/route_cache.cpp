@@ -0,0 +1,95 @@
+#include "route_cache.hpp"
+
+chord::RouteCache::RouteCache(size_t capacity, std::chrono::milliseconds ttl)
+    : capacity_(capacity)
+    , ttl_(ttl)
+    , hits_(0)
+    , misses_(0) {}
+
+bool chord::RouteCache::get(key_t key, NodeInfo &owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if(it == index_.end()) {
+        misses_++;
+        return false;
+    }
+    if(it->second->expires < std::chrono::steady_clock::now()) {
+        entries_.erase(it->second);
+        index_.erase(it);
+        misses_++;
+        return false;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    owner = it->second->owner;
+    hits_++;
+    return true;
+}
+
+void chord::RouteCache::put(key_t key, const NodeInfo &owner) {
+    if(capacity_ == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto expires = std::chrono::steady_clock::now() + ttl_;
+    auto it = index_.find(key);
+    if(it != index_.end()) {
+        it->second->owner = owner;
+        it->second->expires = expires;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+    if(entries_.size() >= capacity_) {
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+    }
+    entries_.push_front({key, owner, expires});
+    index_[key] = entries_.begin();
+}
+
+void chord::RouteCache::erase(key_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if(it != index_.end()) {
+        entries_.erase(it->second);
+        index_.erase(it);
+    }
+}
+
+void chord::RouteCache::erase(const NodeInfo &owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto it = entries_.begin(); it != entries_.end();) {
+        if(it->owner == owner) {
+            index_.erase(it->key);
+            it = entries_.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+void chord::RouteCache::eraseRange(key_t first, key_t last) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto it = entries_.begin(); it != entries_.end();) {
+        if(between(it->key, first, last)) {
+            index_.erase(it->key);
+            it = entries_.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+void chord::RouteCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+}
+
+size_t chord::RouteCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+uint64_t chord::RouteCache::hits() const { return hits_; }
+
+uint64_t chord::RouteCache::misses() const { return misses_; }
@@ -0,0 +1,407 @@
+#include "segment.hpp"
+#include "checksum.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+    const char MAGIC[8] = {'C', 'H', 'O', 'R', 'D', 'S', 'E', 'G'}; /**< First bytes of every segment */
+    const size_t HEADER_SIZE = 32; /**< Magic, version, reserved, generation and number of mailboxes */
+    const size_t ENTRY_SIZE = 24; /**< Key, offset, length and checksum of a record */
+    const size_t MESSAGE_HEADER = 32; /**< Id, date and the four lengths that precede the strings of a message */
+    const size_t FLUSH_SIZE = 1 << 20; /**< Records are written in batches of this size */
+
+    template<class T>
+    void put(std::string &out, T value) {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template<class T>
+    T get(const char *data) {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    /**
+     * Writes a whole buffer at a position of a file.
+     *
+     * @returns true if the operation was successful
+    */
+    bool writeAt(int fd, const char *data, size_t size, uint64_t offset) {
+        while(size > 0) {
+            ssize_t n = ::pwrite(fd, data, size, offset);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                return false;
+            }
+            data += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+}
+
+mail::Message chord::MessageView::toMessage() const {
+    mail::Message msg(std::string(to), std::string(from), std::string(subject), std::string(body), date);
+    msg.id = id;
+    return msg;
+}
+
+chord::MailboxView::MailboxView()
+    : box_(nullptr)
+    , password_(0)
+    , count_(0)
+    , next_id_(0)
+    , lost_(false) {}
+
+chord::MailboxView::MailboxView(const mail::MailBox &box)
+    : box_(&box)
+    , owner_(box.getOwner())
+    , password_(box.getPassword())
+    , count_(box.getSize())
+    , next_id_(0)
+    , lost_(false) {}
+
+chord::MailboxView::MailboxView(const mail::MailBox &box, BodyLoader loader)
+    : box_(&box)
+    , loader_(std::move(loader))
+    , owner_(box.getOwner())
+    , password_(box.getPassword())
+    , count_(box.getSize())
+    , next_id_(0)
+    , lost_(false) {}
+
+bool chord::MailboxView::parse(std::string_view record, MailboxView &view, uint32_t version) {
+    if(record.size() < sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t owner_length = get<uint32_t>(record.data());
+    size_t fixed = sizeof(uint32_t) + owner_length + sizeof(int64_t) + sizeof(uint32_t) + (version < 3 ? 0 : sizeof(uint64_t));
+    if(record.size() < fixed) {
+        return false;
+    }
+    const char *p = record.data() + sizeof(uint32_t);
+    view = MailboxView();
+    view.owner_ = std::string_view(p, owner_length);
+    p += owner_length;
+    view.password_ = get<int64_t>(p);
+    p += sizeof(int64_t);
+    view.count_ = get<uint32_t>(p);
+    p += sizeof(uint32_t);
+    if(version >= 3) {
+        view.next_id_ = get<uint64_t>(p);
+        p += sizeof(uint64_t);
+    }
+    view.messages_ = std::string_view(p, record.data() + record.size() - p);
+    return true;
+}
+
+std::string_view chord::MailboxView::owner() const { return owner_; }
+
+long long int chord::MailboxView::password() const { return password_; }
+
+size_t chord::MailboxView::size() const { return count_; }
+
+uint64_t chord::MailboxView::version() const {
+    if(box_ != nullptr) {
+        return box_->getVersion();
+    }
+    if(next_id_ > 0) {
+        return next_id_ - 1;
+    }
+    uint64_t last = 0;
+    forEachMessage([&last](const MessageView &msg) { last = std::max(last, msg.id); });
+    return last;
+}
+
+mail::MailBox chord::MailboxView::toMailBox() const {
+    if(box_ != nullptr) {
+        mail::MailBox box = *box_;
+        if(loader_) {
+            box.forEachBody([this](uint64_t id, std::string &body) {
+                if(body.empty() && !loader_(id, body)) {
+                    lost_ = true;
+                }
+            });
+        }
+        return box;
+    }
+    mail::MailBox box(std::string(owner_), password_);
+    forEachMessage([&box](const MessageView &msg) { box.insertMessage(msg.toMessage()); });
+    box.restoreVersion(version());
+    return box;
+}
+
+bool chord::MailboxView::lost() const { return lost_; }
+
+bool chord::MailboxView::nextMessage(std::string_view &data, MessageView &msg) {
+    if(data.size() < MESSAGE_HEADER) {
+        return false;
+    }
+    const char *p = data.data();
+    msg.id = get<uint64_t>(p);
+    msg.date = static_cast<std::time_t>(get<int64_t>(p + 8));
+    uint64_t lengths[4], total = MESSAGE_HEADER;
+    for(int i = 0; i < 4; i++) {
+        lengths[i] = get<uint32_t>(p + 16 + 4 * i);
+        total += lengths[i];
+    }
+    if(data.size() < total) {
+        return false;
+    }
+    p += MESSAGE_HEADER;
+    std::string_view *fields[4] = {&msg.to, &msg.from, &msg.subject, &msg.body};
+    for(int i = 0; i < 4; i++) {
+        *fields[i] = std::string_view(p, lengths[i]);
+        p += lengths[i];
+    }
+    data.remove_prefix(total);
+    return true;
+}
+
+std::shared_ptr<const chord::Segment> chord::Segment::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        if(errno == ENOENT) {
+            return nullptr;
+        }
+        throw std::runtime_error("Couldn't open the segment " + path);
+    }
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < HEADER_SIZE) {
+        ::close(fd);
+        throw std::runtime_error("Invalid segment " + path);
+    }
+    size_t size = st.st_size;
+    void *data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file alive, the descriptor is not needed anymore
+    ::close(fd);
+    if(data == MAP_FAILED) {
+        throw std::runtime_error("Couldn't map the segment " + path);
+    }
+    std::shared_ptr<const Segment> segment(new Segment(static_cast<const char *>(data), size));
+    const char *header = segment->data_;
+    if(std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0 || segment->version_ == 0 || segment->version_ > VERSION ||
+       !segment->states_) {
+        throw std::runtime_error("Invalid segment " + path);
+    }
+    // The index is read by binary searches, the kernel may read it in advance
+    ::madvise(const_cast<char *>(segment->data_), HEADER_SIZE + segment->count_ * ENTRY_SIZE, MADV_WILLNEED);
+    return segment;
+}
+
+chord::Segment::Segment(const char *data, size_t size)
+    : data_(data)
+    , size_(size)
+    , version_(get<uint32_t>(data + 8))
+    , generation_(get<uint64_t>(data + 16))
+    , count_(get<uint64_t>(data + 24))
+    , corrupt_(0) {
+    // An index bigger than the file is not allocated, Segment::open rejects the file
+    if(count_ <= (size - HEADER_SIZE) / ENTRY_SIZE) {
+        states_.reset(new std::atomic<uint8_t>[count_]);
+        for(size_t i = 0; i < count_; i++) {
+            states_[i].store(UNCHECKED, std::memory_order_relaxed);
+        }
+    }
+}
+
+chord::Segment::~Segment() {
+    ::munmap(const_cast<char *>(data_), size_);
+}
+
+uint32_t chord::Segment::version() const { return version_; }
+
+uint64_t chord::Segment::generation() const { return generation_; }
+
+size_t chord::Segment::size() const { return count_; }
+
+uint64_t chord::Segment::bytes() const { return size_; }
+
+bool chord::Segment::contains(key_t key) const {
+    size_t i = lowerBound(key);
+    return i < count_ && keyAt(i) == key;
+}
+
+bool chord::Segment::find(key_t key, MailboxView &view) const {
+    size_t i = lowerBound(key);
+    if(i == count_ || keyAt(i) != key || !check(i)) {
+        return false;
+    }
+    Entry entry = entryAt(i);
+    return MailboxView::parse(std::string_view(data_ + entry.offset, entry.length), view, version_);
+}
+
+bool chord::Segment::check(size_t i) const {
+    uint8_t state = states_[i].load(std::memory_order_acquire);
+    if(state != UNCHECKED) {
+        return state == VALID;
+    }
+    Entry entry = entryAt(i);
+    bool valid = entry.offset <= size_ && entry.length <= size_ - entry.offset;
+    std::string_view record(data_ + (valid ? entry.offset : 0), valid ? entry.length : 0);
+    valid = valid && (version_ < 2 || crc32(record.data(), record.size()) == entry.checksum);
+    MailboxView view;
+    if(valid && (valid = MailboxView::parse(record, view, version_))) {
+        size_t messages = 0;
+        view.forEachMessage([&messages](const MessageView &) { messages++; });
+        valid = messages == view.size();
+    }
+    // Threads checking the same record reach the same result, only the first one counts it
+    uint8_t expected = UNCHECKED;
+    if(states_[i].compare_exchange_strong(expected, valid ? VALID : CORRUPT) && !valid) {
+        corrupt_++;
+    }
+    return valid;
+}
+
+size_t chord::Segment::corrupt() const { return corrupt_; }
+
+chord::key_t chord::Segment::keyAt(size_t i) const {
+    return get<int64_t>(data_ + HEADER_SIZE + i * ENTRY_SIZE);
+}
+
+size_t chord::Segment::lowerBound(key_t key) const {
+    size_t first = 0, count = count_;
+    while(count > 0) {
+        size_t step = count / 2;
+        if(keyAt(first + step) < key) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    return first;
+}
+
+size_t chord::Segment::load(size_t first, size_t last) const {
+    last = std::min(last, count_);
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t valid = 0;
+    unsigned char sum = 0;
+    for(size_t i = first; i < last; i++) {
+        Entry entry = entryAt(i);
+        if(version_ < 2 && entry.offset <= size_ && entry.length <= size_ - entry.offset) {
+            // Without a checksum the bodies are not read by the check, one byte per page faults in the whole record
+            const char *record = data_ + entry.offset;
+            for(uint64_t j = 0; j < entry.length; j += page) {
+                sum += record[j];
+            }
+            if(entry.length > 0) {
+                sum += record[entry.length - 1];
+            }
+        }
+        valid += check(i);
+    }
+    // Keeps the reads from being optimized away
+    volatile unsigned char sink = sum;
+    (void) sink;
+    return valid;
+}
+
+chord::Segment::Entry chord::Segment::entryAt(size_t i) const {
+    const char *p = data_ + HEADER_SIZE + i * ENTRY_SIZE;
+    if(version_ < 2) {
+        return {get<int64_t>(p), get<uint64_t>(p + 8), get<uint64_t>(p + 16), 0};
+    }
+    return {get<int64_t>(p), get<uint64_t>(p + 8), get<uint32_t>(p + 16), get<uint32_t>(p + 20)};
+}
+
+chord::SegmentWriter::SegmentWriter(const std::string &path, uint64_t generation, size_t capacity)
+    : fd_(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+    , generation_(generation)
+    , capacity_(capacity)
+    , offset_(HEADER_SIZE + capacity * ENTRY_SIZE)
+    , count_(0)
+    , last_(0)
+    , failed_(false) {
+    if(fd_ < 0) {
+        throw std::runtime_error("Couldn't create the segment " + path);
+    }
+    index_.reserve(capacity * ENTRY_SIZE);
+}
+
+chord::SegmentWriter::~SegmentWriter() {
+    if(fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void chord::SegmentWriter::encode(const MailboxView &box, std::string &out) {
+    put<uint32_t>(out, box.owner().size());
+    out.append(box.owner());
+    put<int64_t>(out, box.password());
+    size_t count_pos = out.size();
+    put<uint32_t>(out, 0);
+    put<uint64_t>(out, box.version() + 1);
+    uint32_t count = 0;
+    box.forEachMessage([&out, &count](const MessageView &msg) {
+        put<uint64_t>(out, msg.id);
+        put<int64_t>(out, msg.date);
+        put<uint32_t>(out, msg.to.size());
+        put<uint32_t>(out, msg.from.size());
+        put<uint32_t>(out, msg.subject.size());
+        put<uint32_t>(out, msg.body.size());
+        out.append(msg.to);
+        out.append(msg.from);
+        out.append(msg.subject);
+        out.append(msg.body);
+        count++;
+    });
+    // The number of messages visited, a corrupted record is written without his invalid tail
+    std::memcpy(&out[count_pos], &count, sizeof(count));
+}
+
+bool chord::SegmentWriter::add(key_t key, const std::string &record) {
+    return add(key, record, crc32(record.data(), record.size()));
+}
+
+bool chord::SegmentWriter::add(key_t key, const std::string &record, uint32_t checksum) {
+    if(failed_ || count_ == capacity_ || (count_ > 0 && key <= last_) || record.size() > std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+    put<int64_t>(index_, key);
+    put<uint64_t>(index_, offset_ + buffer_.size());
+    put<uint32_t>(index_, record.size());
+    put<uint32_t>(index_, checksum);
+    buffer_.append(record);
+    count_++;
+    last_ = key;
+    return buffer_.size() < FLUSH_SIZE || flush();
+}
+
+bool chord::SegmentWriter::finish() {
+    if(failed_ || !flush()) {
+        return false;
+    }
+    std::string header(MAGIC, sizeof(MAGIC));
+    put<uint32_t>(header, Segment::VERSION);
+    put<uint32_t>(header, 0);
+    put<uint64_t>(header, generation_);
+    put<uint64_t>(header, count_);
+    header.append(index_);
+    failed_ = !writeAt(fd_, header.data(), header.size(), 0) || ::fdatasync(fd_) != 0;
+    return !failed_;
+}
+
+bool chord::SegmentWriter::flush() {
+    if(!writeAt(fd_, buffer_.data(), buffer_.size(), offset_)) {
+        failed_ = true;
+        return false;
+    }
+    offset_ += buffer_.size();
+    buffer_.clear();
+    return true;
+}
@@ -1,13 +1,20 @@
 #include "server.hpp"
+#include "async_server.hpp"
+#include "checksum.hpp"
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <gcrypt.h>
 #include <cmath>
+#include <cstdio>
 #include <chrono>
 #include <utility>
 #include <iomanip>
+#include <set>
+#include <algorithm>
+#include <limits>
+#include <random>
 #include <cereal/archives/binary.hpp>
 #include <cereal/types/map.hpp>
 #include <google/protobuf/util/time_util.h>
@@ -39,6 +46,7 @@ namespace chord {
         using google::protobuf::Timestamp;
         dst.to = src.to(); dst.from = src.from(); dst.subject = src.subject();
         dst.body = src.body(); dst.date = TimeUtil::TimestampToTimeT(TimeUtil::SecondsToTimestamp(src.date()));
+        dst.id = src.id();
     }
 
     /**
@@ -53,6 +61,38 @@ namespace chord {
         dst.set_to(src.to); dst.set_from(src.from); dst.set_subject(src.subject);
         dst.set_body(src.body);
         dst.set_date(TimeUtil::TimestampToSeconds(TimeUtil::TimeTToTimestamp(src.date)));
+        dst.set_id(src.id);
+    }
+
+    /**
+     * Fills a chord::MailboxMessage from a chord::MessageView.
+     * 
+     * @param dst chord::MailboxMessage destination reference
+     * @param src chord::MessageView source reference
+    */
+    void fillMailboxMessage(chord::MailboxMessage &dst, const chord::MessageView &src) {
+        using google::protobuf::util::TimeUtil;
+        using google::protobuf::Timestamp;
+        dst.set_to(src.to.data(), src.to.size()); dst.set_from(src.from.data(), src.from.size());
+        dst.set_subject(src.subject.data(), src.subject.size());
+        dst.set_body(src.body.data(), src.body.size());
+        dst.set_date(TimeUtil::TimestampToSeconds(TimeUtil::TimeTToTimestamp(src.date)));
+        dst.set_id(src.id);
+    }
+
+    /**
+     * Fills a chord::HeaderMessage from a chord::MessageView, the size is the one of the decompressed body.
+     * 
+     * @param dst chord::HeaderMessage destination reference
+     * @param src chord::MessageView source reference
+    */
+    void fillHeaderMessage(chord::HeaderMessage &dst, const chord::MessageView &src) {
+        using google::protobuf::util::TimeUtil;
+        dst.set_id(src.id);
+        dst.set_from(src.from.data(), src.from.size());
+        dst.set_subject(src.subject.data(), src.subject.size());
+        dst.set_date(TimeUtil::TimestampToSeconds(TimeUtil::TimeTToTimestamp(src.date)));
+        dst.set_size(BodyCodec::originalSize(src.body));
     }
 }
 
@@ -76,14 +116,50 @@ chord::Node::Node()
     : info_({.address = "", .port = 0})
     , predecessor_({"", 0, -1})
     , disable_transfer_(false)
-    , finger_table_(chord::M) {}
+    , next_finger_(1)
+    , run_load_(false)
+    , loading_(0)
+    , ready_us_(0)
+    , loaded_us_(0)
+    , epoch_(0)
+    , full_snapshot_(true)
+    , full_snapshot_bytes_(0)
+    , segment_generation_(0)
+    , snapshots_(0)
+    , snapshot_records_(0)
+    , peers_(std::chrono::milliseconds(config_.peer_idle_timeout))
+    , rpcs_sent_(0)
+    , finger_rpcs_(0)
+    , deadlines_exceeded_(0)
+    , hedged_requests_(0)
+    , hedge_wins_(0)
+    , routes_(config_.route_cache_size, std::chrono::milliseconds(config_.route_cache_ttl)) {}
 
-chord::Node::Node(const std::string &address, int port) 
-    : info_({.address = address, .port = port})
+chord::Node::Node(const std::string &address, int port, const NodeConfig &config) 
+    : config_(config)
+    , info_({.address = address, .port = port})
     , predecessor_({"", 0, -1})
     , disable_transfer_(false)
-    , finger_table_(chord::M) {
+    , next_finger_(1)
+    , run_load_(false)
+    , loading_(0)
+    , ready_us_(0)
+    , loaded_us_(0)
+    , epoch_(0)
+    , full_snapshot_(true)
+    , full_snapshot_bytes_(0)
+    , segment_generation_(0)
+    , snapshots_(0)
+    , snapshot_records_(0)
+    , peers_(std::chrono::milliseconds(config.peer_idle_timeout))
+    , rpcs_sent_(0)
+    , finger_rpcs_(0)
+    , deadlines_exceeded_(0)
+    , hedged_requests_(0)
+    , hedge_wins_(0)
+    , routes_(config.route_cache_size, std::chrono::milliseconds(config.route_cache_ttl)) {
     info_.id = hashString(info_.conn_string());
+    finger_table_.setOwner(info_.id);
     Run();
 }
 
@@ -94,21 +170,106 @@ chord::Node::~Node() {
 bool chord::Node::isRunning() const { return node_thread_ != nullptr; }
 
 void chord::Node::Run() {
+    start_time_ = std::chrono::steady_clock::now();
+    ready_us_ = 0;
+    loaded_us_ = 0;
+    // The versions given to the clients before are not trusted anymore, the mutations of the last run may be lost
+    std::random_device random;
+    epoch_ = std::max<uint64_t>((static_cast<uint64_t>(random()) << 32) | random(), 1);
+    std::shared_ptr<const Segment> segment;
+    try {
+        // Only the header is read, the mailboxes are paged in when they're accessed
+        segment = Segment::open(segPath());
+        const Codec *codec = Codec::find(config_.compression_codec);
+        if(codec == nullptr) {
+            throw NodeException("Unknown compression codec " + config_.compression_codec);
+        }
+        codec_.configure(codec, std::max(config_.compression_threshold, 0));
+        boxes_.setDedup(std::max(config_.dedup_threshold, 0));
+        if(config_.memory_budget > 0) {
+            // The budget is enforced during the replay too, so the node can start with more mail than memory
+            body_store_ = std::make_shared<BodyStore>(bodiesPath());
+            boxes_.setBudget(static_cast<size_t>(config_.memory_budget) << 20, body_store_);
+        }
+    } catch(const std::runtime_error &e) {
+        throw NodeException(e.what());
+    }
     std::stringstream filename;
     filename << info_.id << ".dat";
     std::ifstream is(filename.str());
-    if(is.is_open()) {
-        cereal::BinaryInputArchive archive(is);
-        archive(boxes_);
+    bool legacy = !segment && is.is_open();
+    if(legacy) {
+        // Dump written by the versions that didn't take snapshots, replaced by the first full snapshot
+        try {
+            cereal::BinaryInputArchive archive(is);
+            archive(boxes_);
+        } catch(const std::exception &e) {
+            std::cerr << info_.id << " couldn't load " << filename.str() << ": " << e.what() << std::endl;
+        }
+    }
+    boxes_.attach(segment);
+    uint64_t generation = segment ? segment->generation() : 0;
+    bool first = true, stale = false;
+    WriteAheadLog::replay(snapPath(), [&](const WalRecord &record) {
+        // A snapshot file that belongs to an older segment is already contained in the current one
+        stale = stale || (first && record.type == WalRecord::Type::BASE && record.id != generation);
+        first = false;
+        if(!stale) {
+            applyRecord(record);
+        }
+    });
+    if(stale) {
+        std::remove(snapPath().c_str());
+    }
+    auto apply = [this](const WalRecord &record) { applyRecord(record); };
+    if(config_.wal_mode != WalMode::DISABLED) {
+        // The logs contain the mutations that happened after the snapshot, the rotated one comes first.
+        // Replaying a mutation already contained in the snapshot doesn't change the mailboxes.
+        WriteAheadLog::replay(walArchivePath(), apply);
+        std::string wal_file = walPath();
+        WriteAheadLog::replay(wal_file, apply);
+        wal_.reset(new WriteAheadLog(wal_file, config_.wal_mode, std::chrono::milliseconds(config_.wal_sync_interval)));
     }
+    {
+        // The replayed mailboxes are dirty, the first incremental snapshot saves them
+        std::lock_guard<std::mutex> lock(snapshot_mutex_);
+        segment_generation_ = generation;
+        full_snapshot_bytes_ = segment ? segment->bytes() : 0;
+        full_snapshot_ = legacy;
+    }
+    watchers_.open();
     ServerBuilder builder;
     builder.AddListeningPort(info_.conn_string(), grpc::InsecureServerCredentials());
-    builder.RegisterService(this);
+    if(config_.async_server) {
+        async_server_.reset(new AsyncServer(this, config_.server_threads));
+        async_server_->registerService(builder);
+    } else {
+        builder.RegisterService(this);
+    }
     server_ = builder.BuildAndStart();
     if (server_ != nullptr) {
+        if(async_server_) {
+            async_server_->start();
+        }
         node_thread_.reset(new std::thread(&Server::Wait, server_.get()));
+        ready_us_ = sinceStart();
+        // The mailboxes of the segment are already served from the mapping, the threads only warm it up
+        segment = boxes_.segment();
+        size_t parts = segment ? std::min<size_t>(std::max(config_.load_threads, 0), segment->size()) : 0;
+        if(parts > 0) {
+            run_load_ = true;
+            loading_ = parts;
+            for(size_t part = 0; part < parts; part++) {
+                load_threads_.emplace_back(&Node::loadSegment, this, segment, part, parts);
+            }
+        } else {
+            loaded_us_ = ready_us_.load();
+        }
         run_stabilize_ = true;
         stabilize_thread_.reset(new std::thread(&Node::stabilize, this));
+        if(config_.snapshot_interval > 0) {
+            snapshot_thread_.reset(new std::thread(&Node::snapshotLoop, this));
+        }
     } else {
         throw NodeException(std::string("Couldn't build node ") + info_.conn_string());
     }
@@ -117,22 +278,45 @@ void chord::Node::Run() {
 void chord::Node::Stop() {
     if (node_thread_) {
         disable_transfer_ = true;
-        if(!transferBoxes(finger_table_.front())) {
+        run_load_ = false;
+        for(auto &thread : load_threads_) {
+            thread.join();
+        }
+        load_threads_.clear();
+        // The successors are tried in order, so the mail survives even if the first one is dead
+        bool transferred = false;
+        for(auto &successor : getSuccessors()) {
+            if(transferBoxes(successor)) {
+                transferred = true;
+                break;
+            }
+        }
+        if(!transferred) {
             std::cerr << info_.id << " couldn't transfer mail, trying to dump boxes to file...";
             std::flush(std::cerr);
-            if(dumpBoxes()) {
-                std::cerr << " Done." << std::endl;
-            } else {
-                std::cerr << " FAILED: DATA WILL BE LOST" << std::endl;
-            }
+        }
+        // The transferred mailboxes were removed, so they won't come back at the next start
+        bool saved = snapshot(false);
+        if(!transferred) {
+            std::cerr << (saved ? " Done." : " FAILED: DATA WILL BE LOST") << std::endl;
         }
         run_stabilize_ = false;
         stabilize_thread_->join();
+        if(snapshot_thread_) {
+            snapshot_thread_->join();
+            snapshot_thread_.reset();
+        }
+        // The streams never end by themselves, the server would wait for them forever
+        watchers_.close();
         server_->Shutdown();
+        if(async_server_) {
+            async_server_->shutdown();
+        }
         server_.release();
         node_thread_->join();
         node_thread_.release();
         stabilize_thread_.release();
+        wal_.reset();
         disable_transfer_ = true;
     }
 }
@@ -156,178 +340,296 @@ grpc::Status chord::Node::Ping(grpc::ServerContext *context, const PingRequest *
 }
 
 grpc::Status chord::Node::SearchFinger(grpc::ServerContext *context, const FingerQuestion *request, NodeInfoMessage *reply) {
-    if(info_.id >= request->finger_value() || (info_.id < request->sender_id() && info_.id < request->finger_value())) {
-        // This node is the right finger
-        fillNodeInfoMessage(*reply, info_);
-        return Status::OK;
-    } else if(request->sender_id() == info_.id) {
-        // Finger request made the entire loop
-        return Status(StatusCode::NOT_FOUND, "The request made the entire loop");
-    } else {
-        // Forward the call to the successor
-        auto[result, rep] = sendMessage<FingerQuestion, NodeInfoMessage>(request, finger_table_.front(), &chord::NodeService::Stub::SearchFinger);
-        reply->CopyFrom(rep);
-        return result;
-    }
+    return route(request, reply, &Node::stepSearchFinger, &chord::NodeService::Stub::SearchFinger, context);
 }
 
 grpc::Status chord::Node::NodeJoin(grpc::ServerContext *context, const JoinRequest *request, NodeInfoMessage *reply) {
-    if(info_.id > request->node_id() && (predecessor_.id < request->node_id() || predecessor_.id > info_.id) ) {
-        // The joining node is smaller than me and either my predecessor is smaller than the joining node
-        // or I have the smallest id of the ring
-        fillNodeInfoMessage(*reply, info_);
-    } else if (info_.id < request->node_id()) {
-        // The joining node has a bigger id than mine so I forward the call
-        // to the appropriate finger
-        auto[result, rep] = sendMessage<JoinRequest, NodeInfoMessage>(request, getFingerForKey(request->node_id()), &chord::NodeService::Stub::NodeJoin);
-        reply->CopyFrom(rep);
-    } else {
-        // Forward the call to the predecessor
-        // This method should not be exploited for the normal lookup for performance
-        // reasons, however this is not a frequent operation so we can slow down
-        // the protocol in order to make it easier
-        auto[result, rep] = sendMessage<JoinRequest, NodeInfoMessage>(request, predecessor_, &chord::NodeService::Stub::NodeJoin);
-        reply->CopyFrom(rep);
-    }
+    route(request, reply, &Node::stepNodeJoin, &chord::NodeService::Stub::NodeJoin, context);
     return Status::OK;
 }
 
-grpc::Status chord::Node::Stabilize(grpc::ServerContext *context, const NodeInfoMessage *request, NodeInfoMessage *reply) {
-    if(request->id() > predecessor_.id) {
-        fillNodeInfo(predecessor_, *request);
+grpc::Status chord::Node::Stabilize(grpc::ServerContext *context, const NodeInfoMessage *request, StabilizeReply *reply) {
+    NodeInfo previous;
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock(successors_mutex_);
+        if(request->id() > predecessor_.id) {
+            previous = predecessor_;
+            fillNodeInfo(predecessor_, *request);
+            changed = true;
+        }
+        fillNodeInfoMessage(*reply->mutable_predecessor(), predecessor_);
+    }
+    if(changed) {
+        // The keys between the old and the new predecessor moved to the new one
+        routes_.eraseRange(previous.id, request->id());
+    }
+    for(auto &successor : getSuccessors()) {
+        fillNodeInfoMessage(*reply->add_successors(), successor);
     }
-    fillNodeInfoMessage(*reply, predecessor_);
     return Status::OK;
 }
 
 grpc::Status chord::Node::InsertMailbox(grpc::ServerContext *context, const InsertMailboxMessage * request, NodeInfoMessage *reply) {
-    key_t key = hashString(request->owner());
-    if(isSuccessor(key)) {
-        fillNodeInfoMessage(*reply, info_);
-        mail::MailBox box(request->owner(), request->password());
-        // If the box is already present the insert function will return false, checks are not necessary
-        auto[it, success] = boxes_.insert({key, {request->owner(), request->password()}});
-        if(success) {
-            return Status::OK;
-        } else {
-            return Status(StatusCode::ALREADY_EXISTS, "User already registered");
-        }
-    } else {
-        if(request->ttl() > 0) {
-            InsertMailboxMessage req;
-            req.set_owner(request->owner());
-            req.set_password(request->password());
-            req.set_ttl(request->ttl() - 1);
-            auto[result, rep] = sendMessage<InsertMailboxMessage, NodeInfoMessage>(&req, getFingerForKey(key), &chord::NodeService::Stub::InsertMailbox);
-            reply->CopyFrom(rep);
-            return result;
-        } else {
-            fillNodeInfoMessage(*reply, info_);
-            return Status(StatusCode::NOT_FOUND, "Couldn't find the correct node");
-        }
-    }
+    return route(request, reply, &Node::stepInsertMailbox, &chord::NodeService::Stub::InsertMailbox, context);
 }
 
 grpc::Status chord::Node::Authenticate(grpc::ServerContext *context, const Authentication *request, Empty *reply) {
     key_t key = hashString(request->user());
-    try {
-        auto &box = boxes_.at(key);
-        return box.getPassword() == request->psw() ?
-            Status::OK : 
-            Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
-    } catch (std::out_of_range &e) {
+    bool authenticated = false;
+    bool found = boxes_.view(key, [&](const MailboxView &box) {
+        authenticated = box.password() == request->psw();
+    });
+    if(!found) {
         return Status(StatusCode::UNAUTHENTICATED, "Couldn't find the mailbox");
     }
+    return authenticated ?
+        Status::OK :
+        Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
 }
 
 grpc::Status chord::Node::LookupMailbox(grpc::ServerContext *context, const QueryMailbox *request, NodeInfoMessage *reply) {
-    key_t key = hashString(request->owner());
-    try {
-        boxes_.at(key);
-        fillNodeInfoMessage(*reply, info_);
-        return Status::OK;
-    } catch (std::out_of_range &e) {
-        if(request->ttl() > 0) {
-            QueryMailbox req;
-            req.set_owner(request->owner());
-            req.set_ttl(request->ttl() - 1);
-            auto[result, rep] = sendMessage<QueryMailbox, NodeInfoMessage>(&req, getFingerForKey(key), &chord::NodeService::Stub::LookupMailbox);
-            reply->CopyFrom(rep);
-            return result;
-        } else {
-            return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
-        }
-    }
+    return route(request, reply, &Node::stepLookupMailbox, &chord::NodeService::Stub::LookupMailbox, context);
 }
 
 grpc::Status chord::Node::Send(grpc::ServerContext *context, const MailboxMessage *request, Empty *reply) {
-    if(request->from().compare(request->auth().user()) != 0) {
-        return Status(StatusCode::UNAUTHENTICATED, "Authentication doesn't match sender");
+    return route(request, reply, &Node::stepSend, &chord::NodeService::Stub::Send, context);
+}
+
+grpc::Status chord::Node::Delete(grpc::ServerContext *context, const DeleteMessage *request, Empty *reply) {
+    return route(request, reply, &Node::stepDelete, &chord::NodeService::Stub::Delete, context);
+}
+
+grpc::Status chord::Node::Receive(grpc::ServerContext *context, const Authentication *request, Mailbox *reply) {
+    key_t key = hashString(request->user());
+    bool authenticated = false, decoded = true, lost = false;
+    // The messages of a mailbox of the segment are copied straight from the mapped file into the reply
+    bool found = boxes_.view(key, [&](const MailboxView &box) {
+        authenticated = box.password() == request->psw();
+        if(authenticated) {
+            Authentication *auth = new Authentication();
+            auth->set_user(box.owner().data(), box.owner().size());
+            auth->set_psw(box.password());
+            reply->set_allocated_auth(auth);
+            std::string body;
+            box.forEachMessage([&](const MessageView &msg) {
+                MailboxMessage *message = reply->add_messages();
+                fillMailboxMessage(*message, msg);
+                if(BodyCodec::encoded(msg.body)) {
+                    body.clear();
+                    decoded = codec_.decode(msg.body, body) && decoded;
+                    message->set_body(body);
+                }
+            });
+            lost = box.lost();
+        }
+    });
+    if(!found) {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
     }
-    key_t key = hashString(request->to());
-    try {
-        mail::MailBox &box = boxes_.at(key);
-        if(checkAuthentication(request->auth())) {
-            mail::Message msg;
-            fillMessage(msg, *request);
-            box.insertMessage(msg);
-            return Status::OK;
-        } else {
-            return Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
+    if(!authenticated) {
+        return Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
+    }
+    if(lost) {
+        return Status(StatusCode::DATA_LOSS, "Couldn't load a message");
+    }
+    return decoded ? Status::OK : Status(StatusCode::DATA_LOSS, "Couldn't decompress a message");
+}
+
+grpc::Status chord::Node::ListHeaders(grpc::ServerContext *context, const Authentication *request, HeaderList *reply) {
+    key_t key = hashString(request->user());
+    bool authenticated = false, lost = false;
+    bool found = boxes_.view(key, [&](const MailboxView &box) {
+        authenticated = box.password() == request->psw();
+        if(authenticated) {
+            box.forEachMessage([reply](const MessageView &msg) {
+                fillHeaderMessage(*reply->add_headers(), msg);
+            });
+            lost = box.lost();
         }
-    } catch (std::out_of_range &e) {
-        if(request->ttl() > 0) {
-            MailboxMessage req(*request);
-            req.set_ttl(req.ttl() - 1);
-            auto[rep, _] = sendMessage<MailboxMessage, Empty>(&req, getFingerForKey(key), &NodeService::Stub::Send);
-            return rep;
-        } else {
-            return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+    });
+    if(!found) {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+    }
+    if(!authenticated) {
+        return Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
+    }
+    return lost ? Status(StatusCode::DATA_LOSS, "Couldn't load a message") : Status::OK;
+}
+
+grpc::Status chord::Node::FetchBodies(grpc::ServerContext *context, const FetchRequest *request, BodyList *reply) {
+    key_t key = hashString(request->auth().user());
+    std::vector<uint64_t> ids(request->ids().begin(), request->ids().end());
+    bool authenticated = false, decoded = true, lost = false;
+    bool found = boxes_.view(key, [&](const MailboxView &box) {
+        authenticated = box.password() == request->auth().psw();
+        if(authenticated) {
+            // Only the requested bodies are loaded if they're not in memory
+            box.forEachMessage(ids, [&](const MessageView &msg) {
+                BodyMessage *body = reply->add_bodies();
+                body->set_id(msg.id);
+                decoded = codec_.decode(msg.body, *body->mutable_body()) && decoded;
+            });
+            lost = box.lost();
         }
+    });
+    if(!found) {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+    }
+    if(!authenticated) {
+        return Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
+    }
+    if(lost) {
+        return Status(StatusCode::DATA_LOSS, "Couldn't load a message");
     }
+    return decoded ? Status::OK : Status(StatusCode::DATA_LOSS, "Couldn't decompress a message");
 }
 
-grpc::Status chord::Node::Delete(grpc::ServerContext *context, const DeleteMessage *request, Empty *reply) {
+grpc::Status chord::Node::ReceiveStream(grpc::ServerContext *context, const ReceiveRequest *request, grpc::ServerWriter<MailboxChunk> *writer) {
     key_t key = hashString(request->auth().user());
-    try {
-        mail::MailBox &box = boxes_.at(key);
-        if(checkAuthentication(request->auth())) {
-            return box.removeMessage(request->idx()) ? Status::OK : Status(StatusCode::OUT_OF_RANGE, "Index out of range");
-        } else {
+    const size_t chunk_bytes = static_cast<size_t>(std::max(config_.receive_chunk_size, 1)) * 1024;
+    const size_t chunk_messages = std::max(config_.receive_chunk_messages, 1);
+    uint64_t remaining = request->limit() == 0 ? std::numeric_limits<uint64_t>::max() : request->limit();
+    uint64_t start = request->start_id();
+    do {
+        MailboxChunk chunk;
+        size_t bytes = 0, count = std::min<uint64_t>(remaining, chunk_messages);
+        uint64_t next = 0;
+        bool authenticated = false, decoded = true, lost = false;
+        bool found = boxes_.view(key, [&](const MailboxView &box) {
+            authenticated = box.password() == request->auth().psw();
+            if(!authenticated) {
+                return;
+            }
+            // One message more than the chunk can hold is visited to know where the next chunk starts
+            box.forEachMessageFrom(start, request->newest_first(), count + 1, [&](const MessageView &msg) {
+                size_t size = msg.to.size() + msg.from.size() + msg.subject.size() + BodyCodec::originalSize(msg.body);
+                size_t added = chunk.messages_size();
+                if(added == count || (added > 0 && bytes + size > chunk_bytes)) {
+                    next = msg.id;
+                    return false;
+                }
+                MailboxMessage *message = chunk.add_messages();
+                fillMailboxMessage(*message, msg);
+                if(BodyCodec::encoded(msg.body)) {
+                    message->clear_body();
+                    decoded = codec_.decode(msg.body, *message->mutable_body()) && decoded;
+                }
+                bytes += size;
+                return true;
+            });
+            lost = box.lost();
+        });
+        if(!found) {
+            return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+        }
+        if(!authenticated) {
             return Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
         }
-    } catch (std::out_of_range &e) {
-        if(request->ttl() > 0) {
-            DeleteMessage req(*request);
-            req.set_ttl(req.ttl() - 1);
-            auto[rep, _] = sendMessage<DeleteMessage, Empty>(&req, getFingerForKey(key), &NodeService::Stub::Delete);
-            return rep;
-        } else {
-            return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+        if(lost) {
+            return Status(StatusCode::DATA_LOSS, "Couldn't load a message");
+        }
+        if(!decoded) {
+            return Status(StatusCode::DATA_LOSS, "Couldn't decompress a message");
+        }
+        chunk.set_next_id(next);
+        remaining -= chunk.messages_size();
+        if(!writer->Write(chunk)) {
+            return Status(StatusCode::CANCELLED, "The client closed the stream");
+        }
+        start = next;
+    } while(start != 0 && remaining > 0);
+    return Status::OK;
+}
+
+grpc::Status chord::Node::Sync(grpc::ServerContext *context, const SyncRequest *request, SyncReply *reply) {
+    key_t key = hashString(request->auth().user());
+    const size_t chunk_bytes = static_cast<size_t>(std::max(config_.receive_chunk_size, 1)) * 1024;
+    const int chunk_messages = std::max(config_.receive_chunk_messages, 1);
+    bool authenticated = false, decoded = true, lost = false;
+    bool found = boxes_.view(key, [&](const MailboxView &box) {
+        authenticated = box.password() == request->auth().psw();
+        if(!authenticated) {
+            return;
         }
+        uint64_t since = request->since_version(), until = box.version();
+        reply->set_epoch(epoch_);
+        reply->set_version(until);
+        if(request->epoch() != epoch_ || since > until || !box.forEachRemoval(since, [](uint64_t, uint64_t) {})) {
+            reply->set_reset(true);
+            return;
+        }
+        if(since == until) {
+            return;
+        }
+        // The new messages are the ones with an identifier bigger than the version, found from the most recent one
+        size_t bytes = 0;
+        box.forEachMessageFrom(since + 1, false, std::numeric_limits<size_t>::max(), [&](const MessageView &msg) {
+            size_t size = msg.to.size() + msg.from.size() + msg.subject.size() + BodyCodec::originalSize(msg.body);
+            if(reply->added_size() == chunk_messages || (reply->added_size() > 0 && bytes + size > chunk_bytes)) {
+                // The changes stop right before this message, the client asks again for the rest
+                until = msg.id - 1;
+                reply->set_version(until);
+                reply->set_more(true);
+                return false;
+            }
+            MailboxMessage *message = reply->add_added();
+            fillMailboxMessage(*message, msg);
+            if(BodyCodec::encoded(msg.body)) {
+                message->clear_body();
+                decoded = codec_.decode(msg.body, *message->mutable_body()) && decoded;
+            }
+            bytes += size;
+            return true;
+        });
+        box.forEachRemoval(since, [&](uint64_t version, uint64_t id) {
+            if(version <= until) {
+                reply->add_removed(id);
+            }
+        });
+        lost = box.lost();
+    });
+    if(!found) {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
     }
+    if(!authenticated) {
+        return Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
+    }
+    if(lost) {
+        return Status(StatusCode::DATA_LOSS, "Couldn't load a message");
+    }
+    return decoded ? Status::OK : Status(StatusCode::DATA_LOSS, "Couldn't decompress a message");
 }
 
-grpc::Status chord::Node::Receive(grpc::ServerContext *context, const Authentication *request, Mailbox *reply) {
-    try {
-        key_t key = hashString(request->user());
-        mail::MailBox &box = boxes_.at(key);
-        if(box.getPassword() == request->psw()) {
-            Authentication *auth = new Authentication();
-            auth->set_user(box.getOwner());
-            auth->set_psw(box.getPassword());
-            reply->set_allocated_auth(auth);
-            for(auto msg : box.getMessages()) {
-                MailboxMessage *message = reply->add_messages();
-                fillMailboxMessage(*message, msg);
+grpc::Status chord::Node::Watch(grpc::ServerContext *context, const Authentication *request, grpc::ServerWriter<HeaderMessage> *writer) {
+    Status status = checkWatcher(*request);
+    if(!status.ok()) {
+        return status;
+    }
+    key_t key = hashString(request->user());
+    WatchQueue queue(config_.watch_queue_size);
+    if(!watchers_.subscribe(key, &queue)) {
+        return Status(StatusCode::UNAVAILABLE, "The node is stopping");
+    }
+    context->AddInitialMetadata(WATCH_METADATA, "subscribed");
+    writer->SendInitialMetadata();
+    // The queue is polled so a client that went away is noticed even if no message arrives
+    std::shared_ptr<const HeaderMessage> header;
+    while(status.ok()) {
+        if(context->IsCancelled()) {
+            status = Status(StatusCode::CANCELLED, "The client went away");
+        } else if(queue.overflowed()) {
+            status = Status(StatusCode::RESOURCE_EXHAUSTED, "Too many messages waiting to be notified");
+        } else if(queue.pop(header, std::chrono::milliseconds(200))) {
+            if(!writer->Write(*header)) {
+                status = Status(StatusCode::CANCELLED, "The client went away");
             }
-            return Status::OK;
-        } else {
-            return Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
+        } else if(queue.closed()) {
+            status = Status(StatusCode::UNAVAILABLE, "The mailbox is not served by this node anymore");
         }
-    } catch (std::out_of_range &e) {
-        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
     }
+    watchers_.unsubscribe(key, &queue);
+    return status;
 }
 
 grpc::Status chord::Node::Transfer(grpc::ServerContext *context, const TransferMailbox *request, Empty *reply) {
@@ -344,34 +646,269 @@ grpc::Status chord::Node::Transfer(grpc::ServerContext *context, const TransferM
                 fillMessage(message, msg);
                 b->second.insertMessage(message);
             }
+            b->second.restoreVersion(box.version());
         } else {
             return Status(StatusCode::INTERNAL, "Something went wrong when transfering mailboxes");
         }
     }
-    boxes_.merge(new_boxes);
+    // Each record is queued before his box becomes visible, so no message sent to the box is logged before it.
+    // The boxes already present are skipped
+    bool logged = true;
+    uint64_t last = 0;
+    for(auto &pair : new_boxes) {
+        boxes_.insert(pair.first, pair.second, [&]() {
+            uint64_t seq = 0;
+            logged = logged && queueMutation(WalRecord::transfer(pair.first, pair.second), seq);
+            last = logged ? seq : last;
+            return logged;
+        });
+    }
+    // The records are written in order, the last one is durable only if all the others are
+    if(!logged || !awaitMutation(last)) {
+        // The sender keeps the boxes and will try again, the boxes already added are found on the next attempt
+        return Status(StatusCode::INTERNAL, "Couldn't log the transfer");
+    }
     return Status::OK;
 }
 
-void chord::Node::buildFingerTable() {
-    const NodeInfo &successor = finger_table_.front();
-    key_t mod = std::pow(2, chord::M);
-    for(int i = 1; i < M; i++) {
-        key_t finger_val = static_cast<key_t>(info_.id + std::pow(2, i)) % mod;
-        FingerQuestion request;
-        request.set_sender_id(info_.id);
-        request.set_finger_value(finger_val);
-        auto[result, reply] = sendMessage<FingerQuestion, NodeInfoMessage>(&request, successor, &chord::NodeService::Stub::SearchFinger);
-        if(result.ok()) {
-            fillNodeInfo(finger_table_[i], reply);
+grpc::Status chord::Node::stepSearchFinger(const FingerQuestion &request, NodeInfoMessage &reply, Hop<FingerQuestion> &hop) {
+    NodeInfo successor = getSuccessor();
+    if(between(request.finger_value(), info_, successor)) {
+        // My successor is the right finger
+        fillNodeInfoMessage(reply, successor);
+        return Status::OK;
+    } else if(request.ttl() > 0) {
+        // Forward the call to the closest finger preceding the value
+        hop = {true, getFingerForKey(request.finger_value()), request};
+        hop.request.set_ttl(request.ttl() - 1);
+        return Status::OK;
+    } else {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the finger");
+    }
+}
+
+grpc::Status chord::Node::stepNodeJoin(const JoinRequest &request, NodeInfoMessage &reply, Hop<JoinRequest> &hop) {
+    NodeInfo predecessor = getPredecessor();
+    if(info_.id > request.node_id() && (predecessor.id < request.node_id() || predecessor.id > info_.id) ) {
+        // The joining node is smaller than me and either my predecessor is smaller than the joining node
+        // or I have the smallest id of the ring
+        fillNodeInfoMessage(reply, info_);
+    } else if (info_.id < request.node_id()) {
+        // The joining node has a bigger id than mine so I forward the call
+        // to the appropriate finger
+        hop = {true, getFingerForKey(request.node_id()), request};
+    } else {
+        // Forward the call to the predecessor
+        // This method should not be exploited for the normal lookup for performance
+        // reasons, however this is not a frequent operation so we can slow down
+        // the protocol in order to make it easier
+        hop = {true, predecessor, request};
+    }
+    return Status::OK;
+}
+
+grpc::Status chord::Node::stepInsertMailbox(const InsertMailboxMessage &request, NodeInfoMessage &reply, Hop<InsertMailboxMessage> &hop) {
+    key_t key = hashString(request.owner());
+    if(isSuccessor(key)) {
+        fillNodeInfoMessage(reply, info_);
+        // If the box is already present the insert function will return false, checks are not necessary
+        mail::MailBox box(request.owner(), request.password());
+        // The record is queued before the box becomes visible, so no message sent to the box is logged before it
+        bool logged = true;
+        uint64_t seq = 0;
+        bool inserted = boxes_.insert(key, box, [&]() {
+            return (logged = queueMutation(WalRecord::insertMailbox(key, box), seq));
+        });
+        if(!logged || !awaitMutation(seq)) {
+            return Status(StatusCode::INTERNAL, "Couldn't log the mailbox");
+        }
+        if(inserted) {
+            return Status::OK;
         } else {
-            std::cout << "No finger found" << std::endl;
+            return Status(StatusCode::ALREADY_EXISTS, "User already registered");
+        }
+    } else if(request.ttl() > 0) {
+        hop = {true, getFingerForKey(key), request};
+        hop.request.set_ttl(request.ttl() - 1);
+        return Status::OK;
+    } else {
+        fillNodeInfoMessage(reply, info_);
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the correct node");
+    }
+}
+
+grpc::Status chord::Node::stepLookupMailbox(const QueryMailbox &request, NodeInfoMessage &reply, Hop<QueryMailbox> &hop) {
+    key_t key = hashString(request.owner());
+    NodeInfo owner;
+    if(boxes_.contains(key)) {
+        fillNodeInfoMessage(reply, info_);
+        return Status::OK;
+    } else if(request.ttl() > 0) {
+        hop = {true, routes_.get(key, owner) ? owner : getFingerForKey(key), request};
+        hop.request.set_ttl(request.ttl() - 1);
+        return Status::OK;
+    } else {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+    }
+}
+
+grpc::Status chord::Node::stepSend(const MailboxMessage &request, Empty &reply, Hop<MailboxMessage> &hop) {
+    if(request.from().compare(request.auth().user()) != 0) {
+        return Status(StatusCode::UNAUTHENTICATED, "Authentication doesn't match sender");
+    }
+    key_t key = hashString(request.to());
+    if(boxes_.contains(key)) {
+        // The sender is authenticated before locking the mailbox, his mailbox may be on another node
+        Status status;
+        if(!authenticate(request.auth(), hop, status)) {
+            return status;
+        }
+        mail::Message msg;
+        fillMessage(msg, request);
+        // A new message always gets a new identifier, so it's found by the clients that sync from an older version
+        msg.id = 0;
+        // Compressed outside the lock of the mailbox, the compressed body is logged and stored
+        codec_.encode(msg.body);
+        // Queued under the lock of the mailbox, so the log keeps the order of his identifiers,
+        // and waited for once the lock is released, so the writers of the shard can join the same commit
+        bool logged = false, moving = false;
+        uint64_t seq = 0;
+        bool found = boxes_.write(key, [&](mail::MailBox &box) {
+            if((moving = isMoving(key))) {
+                return;
+            }
+            msg.id = box.insertMessage(msg);
+            logged = queueMutation(WalRecord::send(key, msg), seq);
+            if(!logged) {
+                box.removeMessageById(msg.id);
+            }
+        });
+        if(!found) {
+            return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+        }
+        if(moving) {
+            return Status(StatusCode::UNAVAILABLE, "The mailbox is moving to another node");
+        }
+        if(logged && !awaitMutation(seq)) {
+            // The log refuses the records queued after a failed write, so no later record refers to the message
+            boxes_.write(key, [&msg](mail::MailBox &box) { box.removeMessageById(msg.id); });
+            logged = false;
+        }
+        if(!logged) {
+            return Status(StatusCode::INTERNAL, "Couldn't log the message");
+        }
+        if(watchers_.size() > 0) {
+            HeaderMessage header;
+            fillHeaderMessage(header, MessageView{msg.id, msg.date, msg.to, msg.from, msg.subject, msg.body});
+            watchers_.publish(key, header);
+        }
+        return Status::OK;
+    } else if(request.ttl() > 0) {
+        hop = {true, ownerHop(request.to(), request.ttl()), request};
+        hop.request.set_ttl(request.ttl() - 1);
+        return Status::OK;
+    } else {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+    }
+}
+
+grpc::Status chord::Node::stepDelete(const DeleteMessage &request, Empty &reply, Hop<DeleteMessage> &hop) {
+    key_t key = hashString(request.auth().user());
+    if(boxes_.contains(key)) {
+        Status status;
+        if(!authenticate(request.auth(), hop, status)) {
+            return status;
+        }
+        uint64_t id = 0, seq = 0;
+        bool logged = false, moving = false;
+        bool found = boxes_.write(key, [&](mail::MailBox &box) {
+            if((moving = isMoving(key))) {
+                return;
+            }
+            // Messages are addressed by id, the index is only used by clients that don't know the ids
+            id = request.id();
+            if(id == 0 && request.idx() >= 0 && request.idx() < box.getSize()) {
+                id = box.getMessage(request.idx()).id;
+            }
+            if(box.findMessage(id) == nullptr) {
+                id = 0;
+                return;
+            }
+            // Queued before removing under the lock of the mailbox: the deletion follows the insertion
+            // in the log and a log that already failed leaves the message in place
+            logged = queueMutation(WalRecord::remove(key, id), seq);
+            if(logged) {
+                box.removeMessageById(id);
+            }
+        });
+        if(!found) {
+            return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
         }
+        if(moving) {
+            return Status(StatusCode::UNAVAILABLE, "The mailbox is moving to another node");
+        }
+        if(id == 0) {
+            return Status(StatusCode::OUT_OF_RANGE, "Index out of range");
+        }
+        return logged && awaitMutation(seq) ? Status::OK : Status(StatusCode::INTERNAL, "Couldn't log the deletion");
+    } else if(request.ttl() > 0) {
+        hop = {true, ownerHop(request.auth().user(), request.ttl()), request};
+        hop.request.set_ttl(request.ttl() - 1);
+        return Status::OK;
+    } else {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+    }
+}
+
+grpc::Status chord::Node::FindSuccessor(grpc::ServerContext *context, const SuccessorQuery *request, NextHop *reply) {
+    nextHop(request->key(), *reply);
+    return Status::OK;
+}
+
+void chord::Node::buildFingerTable() {
+    for(int i = 1; i < M; i++) {
+        refreshFinger(i);
+    }
+}
+
+void chord::Node::refreshFinger(int idx) {
+    key_t mod = std::pow(2, chord::M);
+    key_t finger_val = static_cast<key_t>(info_.id + std::pow(2, idx)) % mod;
+    NodeInfo previous = getFinger(idx - 1);
+    if(!previous.address.empty() && between(finger_val, info_, previous)) {
+        // No node can fall between the previous finger's value and this one
+        std::lock_guard<std::mutex> lock(successors_mutex_);
+        finger_table_.set(idx, previous);
+        return;
+    }
+    FingerQuestion request;
+    request.set_sender_id(info_.id);
+    request.set_finger_value(finger_val);
+    request.set_ttl(CHORD_MOD);
+    NodeInfoMessage reply;
+    // The first step is executed locally, so the request is sent only if the finger is not my successor
+    grpc::Status result = route(&request, &reply, &Node::stepSearchFinger, &chord::NodeService::Stub::SearchFinger);
+    if(result.ok()) {
+        NodeInfo finger;
+        fillNodeInfo(finger, reply);
+        std::lock_guard<std::mutex> lock(successors_mutex_);
+        finger_table_.set(idx, finger);
+    } else {
+        std::cout << "No finger found" << std::endl;
+    }
+}
+
+void chord::Node::fixFingers() {
+    for(int i = 0; i < config_.fix_fingers_batch; i++) {
+        refreshFinger(next_finger_);
+        next_finger_ = next_finger_ % (M - 1) + 1;
     }
 }
 
 void chord::Node::setInfo(const NodeInfo &info) {
     info_ = NodeInfo(info);
     info_.id = hashString(info_.conn_string());
+    finger_table_.setOwner(info_.id);
 }
 
 const chord::NodeInfo& chord::Node::getInfo() const { return info_; }
@@ -379,40 +916,172 @@ const chord::NodeInfo& chord::Node::getInfo() const { return info_; }
 int chord::Node::numMailbox() const { return boxes_.size(); }
 
 void chord::Node::setSuccessor(const NodeInfo &successor) {
-    NodeInfo &successor_ = finger_table_.front();
-    successor_.address = successor.address;
-    successor_.port = successor.port;
-    successor_.id = successor.id;
+    NodeInfo previous;
+    {
+        std::lock_guard<std::mutex> lock(successors_mutex_);
+        previous = finger_table_.successor();
+        finger_table_.set(0, successor);
+        // The rest of the list is received from the successor at the next round of Node::stabilize
+        successors_.assign(1, successor);
+    }
+    if(!(previous == successor)) {
+        routes_.erase(previous);
+    }
     NodeInfoMessage notification;
     fillNodeInfoMessage(notification, info_);
-    sendMessage<NodeInfoMessage, NodeInfoMessage>(&notification, successor_, &chord::NodeService::Stub::Stabilize);
+    sendMessage<NodeInfoMessage, StabilizeReply>(&notification, successor, &chord::NodeService::Stub::Stabilize);
 }
 
-const chord::NodeInfo& chord::Node::getSuccessor() const {
-    return finger_table_.front();
+chord::NodeInfo chord::Node::getSuccessor() const {
+    std::lock_guard<std::mutex> lock(successors_mutex_);
+    return finger_table_.successor();
 }
 
-const chord::NodeInfo& chord::Node::getPredecessor() const {
+chord::NodeInfo chord::Node::getPredecessor() const {
+    std::lock_guard<std::mutex> lock(successors_mutex_);
     return predecessor_;
 }
 
-const chord::NodeInfo& chord::Node::getFinger(int idx) const {
-    return finger_table_.at(idx);
+std::vector<chord::NodeInfo> chord::Node::getSuccessors() const {
+    std::lock_guard<std::mutex> lock(successors_mutex_);
+    if(successors_.empty() && !finger_table_.successor().address.empty()) {
+        return {finger_table_.successor()};
+    }
+    return successors_;
+}
+
+chord::NodeInfo chord::Node::getFinger(int idx) const {
+    std::lock_guard<std::mutex> lock(successors_mutex_);
+    return finger_table_.get(idx);
 }
 
-const chord::NodeInfo& chord::Node::getFingerForKey(key_t key) {
-    if(between(key, info_, finger_table_.front())) {
-        return finger_table_.front();
+const chord::NodeConfig& chord::Node::getConfig() const { return config_; }
+
+bool chord::Node::logMutation(const WalRecord &record) {
+    return !wal_ || wal_->append(record);
+}
+
+bool chord::Node::queueMutation(const WalRecord &record, uint64_t &seq) {
+    seq = wal_ ? wal_->enqueue(record) : 0;
+    return !wal_ || seq != 0;
+}
+
+bool chord::Node::awaitMutation(uint64_t seq) {
+    return !wal_ || seq == 0 || wal_->wait(seq);
+}
+
+void chord::Node::applyRecord(const WalRecord &record) {
+    switch(record.type) {
+        case WalRecord::Type::INSERT_MAILBOX:
+        case WalRecord::Type::TRANSFER:
+            boxes_.insert(record.key, record.box);
+            break;
+        case WalRecord::Type::SEND:
+            boxes_.write(record.key, [&record](mail::MailBox &box) {
+                // The message may be already contained in the snapshot
+                if(box.findMessage(record.message.id) == nullptr) {
+                    box.insertMessage(record.message);
+                }
+            });
+            break;
+        case WalRecord::Type::DELETE:
+            boxes_.write(record.key, [&record](mail::MailBox &box) { box.removeMessageById(record.id); });
+            break;
+        case WalRecord::Type::ERASE:
+            boxes_.erase(record.key);
+            break;
+        case WalRecord::Type::SNAPSHOT:
+            boxes_.erase(record.key);
+            boxes_.insert(record.key, record.box);
+            break;
+        case WalRecord::Type::CLEAR:
+            boxes_.clear();
+            break;
+        case WalRecord::Type::BASE:
+            // Checked by Node::Run before the records are applied
+            break;
     }
-    for(auto finger = finger_table_.begin(); finger != std::prev(finger_table_.end(), 1); finger++) {
-        if(between(key, *finger, *std::next(finger, 1))) {
-            return *finger;
-        }
+}
+
+std::string chord::Node::walPath() const {
+    return std::to_string(info_.id) + ".wal";
+}
+
+std::string chord::Node::walArchivePath() const {
+    return walPath() + ".old";
+}
+
+std::string chord::Node::snapPath() const {
+    return std::to_string(info_.id) + ".snap";
+}
+
+std::string chord::Node::segPath() const {
+    return std::to_string(info_.id) + ".seg";
+}
+
+std::string chord::Node::bodiesPath() const {
+    return std::to_string(info_.id) + ".bodies";
+}
+
+chord::NodeStats chord::Node::getStats() const {
+    NodeStats stats;
+    stats.pool_hits = peers_.hits();
+    stats.pool_misses = peers_.misses();
+    stats.pool_size = peers_.size();
+    stats.rpcs_sent = rpcs_sent_;
+    stats.finger_rpcs = finger_rpcs_;
+    stats.deadlines_exceeded = deadlines_exceeded_;
+    stats.hedged_requests = hedged_requests_;
+    stats.hedge_wins = hedge_wins_;
+    stats.hedge_delay_us = lookup_latency_.percentile(config_.hedge_percentile).count();
+    stats.route_hits = routes_.hits();
+    stats.route_misses = routes_.misses();
+    stats.route_cache_size = routes_.size();
+    if(wal_) {
+        stats.wal_records = wal_->records();
+        stats.wal_batches = wal_->batches();
+        stats.wal_syncs = wal_->syncs();
     }
-    return finger_table_.back();
+    stats.snapshots = snapshots_;
+    stats.snapshot_records = snapshot_records_;
+    stats.resident_mailboxes = boxes_.resident();
+    std::shared_ptr<const Segment> segment = boxes_.segment();
+    stats.segment_bytes = segment ? segment->bytes() : 0;
+    stats.corrupt_mailboxes = segment ? segment->corrupt() : 0;
+    stats.time_to_first_request_us = ready_us_;
+    stats.time_to_fully_loaded_us = loaded_us_;
+    stats.body_bytes = boxes_.bodyBytes();
+    stats.spilled_bodies = boxes_.spilledBodies();
+    stats.shared_bodies = boxes_.sharedBodies();
+    stats.blob_bytes = boxes_.blobs().bytes();
+    // The two counters are read at different times, the difference may be briefly negative
+    stats.dedup_saved_bytes = boxes_.sharedBytes() > stats.blob_bytes ? boxes_.sharedBytes() - stats.blob_bytes : 0;
+    if(body_store_) {
+        stats.spill_file_bytes = body_store_->bytes();
+        stats.spill_reads = body_store_->reads();
+    }
+    stats.compressed_bodies = codec_.compressedBodies();
+    stats.compression_input_bytes = codec_.inputBytes();
+    stats.compression_output_bytes = codec_.outputBytes();
+    stats.compress_us = codec_.compressUs();
+    stats.decompressed_bodies = codec_.decompressedBodies();
+    stats.decompress_us = codec_.decompressUs();
+    stats.watchers = watchers_.size();
+    stats.watch_notifications = watchers_.notifications();
+    return stats;
+}
+
+chord::NodeInfo chord::Node::getFingerForKey(key_t key) {
+    std::lock_guard<std::mutex> lock(successors_mutex_);
+    const NodeInfo &successor = finger_table_.successor();
+    if(between(key, info_, successor)) {
+        return successor;
+    }
+    return finger_table_.closestPreceding(key);
 }
 
 bool chord::Node::isSuccessor(key_t key) {
+    std::lock_guard<std::mutex> lock(successors_mutex_);
     return between(key, predecessor_, info_);
 }
 
@@ -430,80 +1099,574 @@ bool chord::Node::transferBoxes(const chord::NodeInfo &dest) {
     TransferMailbox transfer_message;
     std::vector<key_t> to_transfer;
 
-    for(auto &pair : boxes_) {
-        if(pair.first <= dest.id) {
-            to_transfer.push_back(pair.first);
+    std::vector<uint64_t> versions;
+
+    bool lost = false;
+
+    // The mailboxes are marked while their shard is locked: a write that comes later is rejected
+    // until the mailbox is removed, so the copy sent is never older than the one removed
+    for(key_t key : boxes_.keys(std::numeric_limits<key_t>::min(), dest.id)) {
+        boxes_.view(key, [&](const MailboxView &box) {
+            {
+                std::lock_guard<std::mutex> lock(moving_mutex_);
+                moving_.insert(key);
+            }
+            to_transfer.push_back(key);
+            versions.push_back(box.version());
             chord::Mailbox *new_box = transfer_message.add_boxes();
-            mail::MailBox &box = pair.second;
             Authentication *auth = new Authentication;
-            auth->set_user(box.getOwner());
-            auth->set_psw(box.getPassword());
+            auth->set_user(box.owner().data(), box.owner().size());
+            auth->set_psw(box.password());
             new_box->set_allocated_auth(auth);
-            for(auto &msg : box.getMessages()) {
-                chord::MailboxMessage *new_msg = new_box->add_messages();
-                fillMailboxMessage(*new_msg, msg);
-            }
-        }
+            new_box->set_version(box.version());
+            box.forEachMessage([new_box](const MessageView &msg) {
+                fillMailboxMessage(*new_box->add_messages(), msg);
+            });
+            lost = lost || box.lost();
+        });
     }
-    if(!to_transfer.empty()) {
-        auto[result, _] = sendMessage<TransferMailbox, Empty>(&transfer_message, dest, &chord::NodeService::Stub::Transfer);
-        if(result.ok()) {
-            for(key_t key : to_transfer) {
-                boxes_.erase(key);
+    if(to_transfer.empty()) {
+        return true;
+    }
+    bool moved = false;
+    if(!lost) {
+        auto[sent, _] = sendMessage<TransferMailbox, Empty>(&transfer_message, dest, &chord::NodeService::Stub::Transfer);
+        moved = sent.ok();
+    } else {
+        // The mailboxes stay here rather than leaving without some of their bodies
+        std::cerr << info_.id << " couldn't load the mail to transfer" << std::endl;
+    }
+    if(moved) {
+        for(size_t i = 0; i < to_transfer.size(); i++) {
+            key_t key = to_transfer[i];
+            if(!boxes_.erase(key, versions[i])) {
+                // Modified by somebody that doesn't check Node::isMoving, the mailbox is kept
+                std::cerr << info_.id << " mailbox " << key << " changed during the transfer" << std::endl;
+                moved = false;
+                continue;
             }
+            logMutation(WalRecord::erase(key));
+            // The watchers look for the new owner
+            watchers_.close(key);
         }
-        return result.ok();
+    }
+    std::lock_guard<std::mutex> lock(moving_mutex_);
+    for(key_t key : to_transfer) {
+        moving_.erase(key);
+    }
+    return moved;
+}
+
+bool chord::Node::isMoving(key_t key) {
+    std::lock_guard<std::mutex> lock(moving_mutex_);
+    return moving_.count(key) > 0;
+}
+
+void chord::Node::nextHop(key_t key, NextHop &hop) {
+    NodeInfo successor = getSuccessor();
+    if(isSuccessor(key)) {
+        fillNodeInfoMessage(*hop.mutable_node(), info_);
+        hop.set_owner(true);
+    } else if(between(key, info_, successor)) {
+        fillNodeInfoMessage(*hop.mutable_node(), successor);
+        hop.set_owner(true);
     } else {
-        return true;
+        fillNodeInfoMessage(*hop.mutable_node(), getFingerForKey(key));
+        hop.set_owner(false);
+    }
+}
+
+bool chord::Node::findSuccessor(key_t key, NodeInfo &successor) {
+    SuccessorQuery query;
+    query.set_key(key);
+    NextHop hop;
+    nextHop(key, hop);
+    for(int i = 0; !hop.owner() && i < CHORD_MOD; i++) {
+        NodeInfo next;
+        fillNodeInfo(next, hop.node());
+        auto[result, reply] = sendMessage<SuccessorQuery, NextHop>(&query, next, &chord::NodeService::Stub::FindSuccessor);
+        if(!result.ok()) {
+            return false;
+        }
+        hop = reply;
     }
+    fillNodeInfo(successor, hop.node());
+    return hop.owner();
 }
 
 bool chord::Node::checkAuthentication(const chord::Authentication &auth) {
     key_t key = hashString(auth.user());
-    QueryMailbox query;
-    query.set_owner(auth.user());
-    query.set_ttl(CHORD_MOD);
-    auto[res, n] = sendMessage<QueryMailbox, NodeInfoMessage>(&query, getFingerForKey(key), &chord::NodeService::Stub::LookupMailbox);
     NodeInfo node;
-    fillNodeInfo(node, n);
+    if(routes_.get(key, node)) {
+        auto[result, _] = sendMessage<Authentication, Empty>(&auth, node, &chord::NodeService::Stub::Authenticate);
+        if(result.ok()) {
+            return true;
+        }
+        // The remembered owner may be wrong, the mailbox is searched again
+        routes_.erase(key);
+    }
+    if(!locate(auth.user(), node)) {
+        return false;
+    }
     auto[result, _] = sendMessage<Authentication, Empty>(&auth, node, &chord::NodeService::Stub::Authenticate);
     return result.ok();
 }
 
+grpc::Status chord::Node::checkWatcher(const chord::Authentication &auth) {
+    bool authenticated = false;
+    bool found = boxes_.view(hashString(auth.user()), [&](const MailboxView &box) {
+        authenticated = box.password() == auth.psw();
+    });
+    if(!found) {
+        return Status(StatusCode::NOT_FOUND, "Couldn't find the mailbox");
+    }
+    return authenticated ? Status::OK : Status(StatusCode::UNAUTHENTICATED, "Authentication failed");
+}
+
+bool chord::Node::locate(const std::string &address, NodeInfo &owner) {
+    key_t key = hashString(address);
+    if(config_.routing == RoutingMode::ITERATIVE) {
+        if(!findSuccessor(key, owner)) {
+            return false;
+        }
+    } else {
+        QueryMailbox query;
+        query.set_owner(address);
+        query.set_ttl(CHORD_MOD);
+        NodeInfoMessage reply;
+        if(!route(&query, &reply, &Node::stepLookupMailbox, &chord::NodeService::Stub::LookupMailbox).ok()) {
+            return false;
+        }
+        fillNodeInfo(owner, reply);
+    }
+    if(owner.id != info_.id) {
+        routes_.put(key, owner);
+    }
+    return true;
+}
+
+chord::NodeInfo chord::Node::ownerHop(const std::string &address, long long ttl) {
+    key_t key = hashString(address);
+    NodeInfo owner;
+    // Node::locate blocks until the owner answers, the completion queues of chord::AsyncServer must not wait for it
+    if(routes_.get(key, owner) || (ttl == CHORD_MOD && !config_.async_server && locate(address, owner) && owner.id != info_.id)) {
+        return owner;
+    }
+    return getFingerForKey(key);
+}
+
+void chord::Node::cacheRoute(const QueryMailbox &request, const NodeInfoMessage &reply) {
+    NodeInfo owner;
+    fillNodeInfo(owner, reply);
+    routes_.put(hashString(request.owner()), owner);
+}
+
+void chord::Node::cacheRoute(const InsertMailboxMessage &request, const NodeInfoMessage &reply) {
+    NodeInfo owner;
+    fillNodeInfo(owner, reply);
+    routes_.put(hashString(request.owner()), owner);
+}
+
 void chord::Node::stabilize() {
     NodeInfoMessage request;
     fillNodeInfoMessage(request, info_);
     while(run_stabilize_) {
-        auto[result, reply] = sendMessage<NodeInfoMessage, NodeInfoMessage>(&request, finger_table_.front(), &chord::NodeService::Stub::Stabilize);
-        if(reply.id() > info_.id) {
-            fillNodeInfo(finger_table_.front(), reply);
-            buildFingerTable();
+        NodeInfo successor = getSuccessor();
+        auto[result, reply] = sendMessage<NodeInfoMessage, StabilizeReply>(&request, successor, &chord::NodeService::Stub::Stabilize);
+        if(result.ok()) {
+            if(reply.predecessor().id() > info_.id) {
+                NodeInfo new_successor;
+                fillNodeInfo(new_successor, reply.predecessor());
+                // Part of the keys of the old successor moved to the new one
+                routes_.erase(successor);
+                std::lock_guard<std::mutex> lock(successors_mutex_);
+                finger_table_.set(0, new_successor);
+                // The closest fingers are the most likely to change, restart the refresh from them
+                next_finger_ = 1;
+            }
+            updateSuccessors(successor, reply);
+        } else if(!successor.address.empty() && isUnreachable(result)) {
+            dropPeer(successor);
+            next_finger_ = 1;
         }
-        if(info_.id > predecessor_.id) {
-            transferBoxes(predecessor_);
+        checkPredecessor();
+        fixFingers();
+        NodeInfo predecessor = getPredecessor();
+        if(info_.id > predecessor.id) {
+            transferBoxes(predecessor);
         }
+        refreshPeers();
+        boxes_.compact();
         std::this_thread::sleep_for(std::chrono::milliseconds(1000));
     }
 }
 
-bool chord::Node::dumpBoxes() {
-    std::stringstream filename;
-    filename << info_.id << ".dat";
-    std::ofstream os(filename.str());
-    if(!os) {
+void chord::Node::loadSegment(std::shared_ptr<const Segment> segment, size_t part, size_t parts) {
+    const size_t batch = 256;
+    size_t first = segment->size() * part / parts, last = segment->size() * (part + 1) / parts;
+    for(size_t i = first; i < last && run_load_; i += batch) {
+        if(boxes_.segment() != segment) {
+            // Replaced by a full snapshot, the new segment was just written and is already in the page cache
+            break;
+        }
+        segment->load(i, std::min(i + batch, last));
+    }
+    if(--loading_ == 0 && run_load_) {
+        loaded_us_ = sinceStart();
+        if(segment->corrupt() > 0) {
+            std::cerr << info_.id << " skipped " << segment->corrupt() << " corrupted mailboxes of " << segPath() << std::endl;
+        }
+    }
+}
+
+int64_t chord::Node::sinceStart() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time_).count();
+}
+
+void chord::Node::snapshotLoop() {
+    auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.snapshot_interval);
+    while(run_stabilize_) {
+        // Short sleeps, so Node::Stop doesn't wait for a whole interval
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if(run_stabilize_ && std::chrono::steady_clock::now() >= next) {
+            snapshot(false);
+            next = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.snapshot_interval);
+        }
+    }
+}
+
+bool chord::Node::snapshot(bool full) {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    std::string snap_file = snapPath(), archive_file = walArchivePath();
+    uint64_t snap_bytes = 0;
+    {
+        std::ifstream is(snap_file, std::ios::binary | std::ios::ate);
+        if(is.is_open()) {
+            snap_bytes = static_cast<uint64_t>(is.tellg());
+        }
+    }
+    // The incremental snapshots of small nodes are allowed to grow up to a megabyte
+    full = full || full_snapshot_ || config_.snapshot_full_ratio <= 0 ||
+           snap_bytes > static_cast<uint64_t>(config_.snapshot_full_ratio) * std::max<uint64_t>(full_snapshot_bytes_, 1 << 20);
+    // The mutations logged from now on go in a new log, the dirty keys taken after the rotation include all
+    // the mutations of the archived log: the archive can be removed once the snapshot is durable
+    if(wal_ && !wal_->rotate(archive_file)) {
+        full_snapshot_ = true;
         return false;
     }
-    cereal::BinaryOutputArchive archive(os);
-    archive(boxes_);
+    std::vector<key_t> dirty = boxes_.takeDirty();
+    uint64_t records = 0;
+    bool ok = full ? writeSegment(records) : writeDelta(dirty, snap_bytes == 0, records);
+    if(!ok) {
+        // The dirty keys are lost, only a full snapshot can cover the archived log now
+        full_snapshot_ = true;
+        return false;
+    }
+    std::remove(archive_file.c_str());
+    full_snapshot_ = false;
+    snapshots_++;
+    snapshot_records_ += records;
+    return true;
+}
+
+bool chord::Node::writeDelta(const std::vector<key_t> &keys, bool create, uint64_t &records) {
+    try {
+        WriteAheadLog log(snapPath(), WalMode::NO_SYNC);
+        bool ok = !create || log.append(WalRecord::base(segment_generation_));
+        for(auto it = keys.begin(); ok && it != keys.end(); it++) {
+            // Each mailbox is copied while his shard is locked, the requests for the others are served meanwhile
+            mail::MailBox copy;
+            bool lost = false;
+            bool present = boxes_.view(*it, [&](const MailboxView &box) {
+                copy = box.toMailBox();
+                lost = box.lost();
+            });
+            // A body that couldn't be loaded would be persisted empty
+            ok = !lost && log.append(present ? WalRecord::snapshot(*it, copy) : WalRecord::erase(*it));
+            records++;
+        }
+        return ok && log.sync();
+    } catch(const std::runtime_error &) {
+        return false;
+    }
+}
+
+bool chord::Node::writeSegment(uint64_t &records) {
+    // A failed attempt still consumes his generation, so a file left behind by it is never taken for the new one
+    uint64_t generation = ++segment_generation_;
+    std::string seg_file = segPath(), snap_file = snapPath();
+    std::shared_ptr<const Segment> segment;
+    try {
+        std::vector<key_t> keys = boxes_.keys(std::numeric_limits<key_t>::min(), std::numeric_limits<key_t>::max());
+        SegmentWriter writer(seg_file + ".tmp", generation, keys.size());
+        // The mailboxes are encoded and checksummed in parallel by batches, then written in order of key
+        const size_t threads = std::max(config_.snapshot_threads, 1), batch = 256;
+        std::vector<std::string> encoded(threads * batch);
+        std::vector<uint32_t> checksums(encoded.size());
+        std::vector<char> present(encoded.size());
+        std::atomic<bool> lost(false);
+        for(size_t first = 0; first < keys.size(); first += encoded.size()) {
+            size_t count = std::min(encoded.size(), keys.size() - first);
+            auto encode = [&](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; i++) {
+                    encoded[i].clear();
+                    // Each mailbox is encoded while his shard is locked, the requests for the others are served meanwhile
+                    present[i] = boxes_.view(keys[first + i], [&](const MailboxView &box) {
+                        SegmentWriter::encode(box, encoded[i]);
+                        if(box.lost()) {
+                            lost = true;
+                        }
+                    });
+                    checksums[i] = present[i] ? crc32(encoded[i].data(), encoded[i].size()) : 0;
+                }
+            };
+            std::vector<std::thread> encoders;
+            for(size_t t = 1; t < threads && t * batch < count; t++) {
+                encoders.emplace_back(encode, t * batch, std::min((t + 1) * batch, count));
+            }
+            encode(0, std::min(batch, count));
+            for(auto &encoder : encoders) {
+                encoder.join();
+            }
+            // A body that couldn't be loaded would be persisted empty
+            if(lost) {
+                return false;
+            }
+            for(size_t i = 0; i < count; i++) {
+                if(present[i] && !writer.add(keys[first + i], encoded[i], checksums[i])) {
+                    return false;
+                }
+                records += present[i];
+            }
+        }
+        // The incremental snapshots start again from the new segment
+        std::remove((snap_file + ".tmp").c_str());
+        WriteAheadLog log(snap_file + ".tmp", WalMode::NO_SYNC);
+        if(!writer.finish() || !log.append(WalRecord::base(generation)) || !log.sync()) {
+            return false;
+        }
+        // Until the snapshot file is replaced his records are ignored, they belong to the previous segment
+        if(std::rename((seg_file + ".tmp").c_str(), seg_file.c_str()) != 0 ||
+           std::rename((snap_file + ".tmp").c_str(), snap_file.c_str()) != 0) {
+            return false;
+        }
+        segment = Segment::open(seg_file);
+        if(!segment) {
+            return false;
+        }
+    } catch(const std::runtime_error &) {
+        return false;
+    }
+    boxes_.attach(segment);
+    full_snapshot_bytes_ = segment->bytes();
+    std::stringstream legacy;
+    legacy << info_.id << ".dat";
+    std::remove(legacy.str().c_str());
     return true;
 }
 
+void chord::Node::countStatus(const grpc::Status &status) {
+    if(status.error_code() == StatusCode::DEADLINE_EXCEEDED) {
+        deadlines_exceeded_++;
+    }
+}
+
+template<class T, class R>
+std::pair<grpc::Status, R> chord::Node::sendHedged(const Hop<T> &hop, PrepareAsync<T, R> prepare, std::chrono::system_clock::time_point deadline, bool *answered) {
+    /**
+     * One of the two copies of the request
+    */
+    struct Call {
+        std::unique_ptr<grpc::ClientContext> context; /**< Context of the call, cancelled if the other copy wins */
+        std::shared_ptr<NodeService::Stub> stub; /**< Stub connected to the node that receives the copy */
+        std::unique_ptr<grpc::ClientAsyncResponseReader<R>> reader; /**< Used to read the answer */
+        R reply; /**< Answer of the node */
+        grpc::Status status; /**< Status of the call */
+    } calls[2];
+    grpc::CompletionQueue cq;
+    auto send = [&](int idx, const NodeInfo &peer) {
+        Call &call = calls[idx];
+        call.context.reset(new grpc::ClientContext());
+        setDeadline<T>(*call.context, deadline);
+        countRpc<T>();
+        call.stub = peers_.get(peer);
+        call.reader = (call.stub.get()->*prepare)(call.context.get(), hop.request, &cq);
+        call.reader->StartCall();
+        // The tag is the index of the call plus one, so it's never null
+        call.reader->Finish(&call.reply, &call.status, reinterpret_cast<void *>(static_cast<intptr_t>(idx + 1)));
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::microseconds delay = lookup_latency_.percentile(config_.hedge_percentile);
+    NodeInfo backup;
+    {
+        std::lock_guard<std::mutex> lock(successors_mutex_);
+        backup = finger_table_.closestPreceding(lookupKey(hop.request), hop.node);
+    }
+    bool can_hedge = delay.count() > 0 && !backup.address.empty() && backup.id != info_.id;
+
+    send(0, hop.node);
+    int pending = 1, winner = -1;
+    void *tag;
+    bool ok;
+    auto complete = [&](void *done) {
+        int idx = static_cast<int>(reinterpret_cast<intptr_t>(done)) - 1;
+        pending--;
+        if(winner < 0 || (!calls[winner].status.ok() && calls[idx].status.ok())) {
+            winner = idx;
+        }
+    };
+    if(can_hedge) {
+        if(cq.AsyncNext(&tag, &ok, std::chrono::system_clock::now() + delay) == grpc::CompletionQueue::GOT_EVENT) {
+            complete(tag);
+        } else {
+            hedged_requests_++;
+            send(1, backup);
+            pending++;
+        }
+    }
+    while(pending > 0 && (winner < 0 || !calls[winner].status.ok())) {
+        cq.Next(&tag, &ok);
+        complete(tag);
+    }
+    // The losing copy is cancelled, his completion must still be collected before the queue is destroyed
+    for(auto &call : calls) {
+        if(call.context) {
+            call.context->TryCancel();
+        }
+    }
+    while(pending > 0) {
+        cq.Next(&tag, &ok);
+        pending--;
+    }
+    cq.Shutdown();
+    while(cq.Next(&tag, &ok)) {}
+
+    if(!calls[winner].status.ok()) {
+        winner = 0;
+    }
+    if(calls[winner].status.ok()) {
+        lookup_latency_.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+        if(winner == 1) {
+            hedge_wins_++;
+        }
+    }
+    countStatus(calls[winner].status);
+    if(answered != nullptr) {
+        *answered = Node::answered(*calls[winner].context, calls[winner].status);
+    }
+    return std::pair<grpc::Status, R>(calls[winner].status, calls[winner].reply);
+}
+
+bool chord::Node::isUnreachable(const grpc::Status &status, std::chrono::system_clock::time_point deadline) {
+    if(status.error_code() == StatusCode::DEADLINE_EXCEEDED) {
+        // Only the timeout of the single call blames the node, the expired deadline of the request doesn't
+        return std::chrono::system_clock::now() < deadline;
+    }
+    return status.error_code() == StatusCode::UNAVAILABLE;
+}
+
+grpc::Status chord::Node::relayed(grpc::ServerContext *context, const grpc::Status &status) {
+    if(context != nullptr && !status.ok()) {
+        context->AddTrailingMetadata(RELAYED_METADATA, "1");
+    }
+    return status;
+}
+
+bool chord::Node::answered(const grpc::ClientContext &context, const grpc::Status &status) {
+    if(status.ok()) {
+        return false;
+    }
+    auto &metadata = context.GetServerTrailingMetadata();
+    return metadata.find(RELAYED_METADATA) != metadata.end();
+}
+
+void chord::Node::dropPeer(const NodeInfo &peer) {
+    if(peer.address.empty() || peer.id == info_.id) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(successors_mutex_);
+        successors_.erase(std::remove(successors_.begin(), successors_.end(), peer), successors_.end());
+        finger_table_.remove(peer);
+        if(finger_table_.successor().address.empty()) {
+            if(!successors_.empty()) {
+                finger_table_.set(0, successors_.front());
+            } else {
+                // Without other successors the closest finger is the best guess
+                for(int i = 1; i < M && finger_table_.successor().address.empty(); i++) {
+                    finger_table_.set(0, finger_table_.get(i));
+                }
+            }
+        }
+    }
+    peers_.erase(peer);
+    routes_.erase(peer);
+}
+
+void chord::Node::updateSuccessors(const NodeInfo &previous, const StabilizeReply &reply) {
+    std::lock_guard<std::mutex> lock(successors_mutex_);
+    std::vector<NodeInfo> successors;
+    auto add = [this, &successors](const NodeInfo &node) {
+        if(static_cast<int>(successors.size()) < config_.successor_list_size && !node.address.empty() && node.id != info_.id &&
+           std::find(successors.begin(), successors.end(), node) == successors.end()) {
+            successors.push_back(node);
+        }
+    };
+    add(finger_table_.successor());
+    add(previous);
+    for(auto &msg : reply.successors()) {
+        NodeInfo node;
+        fillNodeInfo(node, msg);
+        add(node);
+    }
+    successors_ = successors;
+}
+
+void chord::Node::checkPredecessor() {
+    NodeInfo predecessor = getPredecessor();
+    if(predecessor.address.empty()) {
+        return;
+    }
+    PingRequest ping;
+    auto[result, _] = sendMessage<PingRequest, PingReply>(&ping, predecessor, &chord::NodeService::Stub::Ping);
+    if(isUnreachable(result)) {
+        {
+            // A new predecessor may have been accepted by Node::Stabilize during the ping
+            std::lock_guard<std::mutex> lock(successors_mutex_);
+            if(predecessor_ == predecessor) {
+                predecessor_ = {"", 0, -1};
+            }
+        }
+        peers_.erase(predecessor);
+        routes_.erase(predecessor);
+    }
+}
+
+void chord::Node::refreshPeers() {
+    std::set<std::string> warmed;
+    auto warm = [this, &warmed](const NodeInfo &peer) {
+        if(peer.id != info_.id && warmed.insert(peer.conn_string()).second) {
+            peers_.warm(peer);
+        }
+    };
+    warm(getPredecessor());
+    for(auto &successor : getSuccessors()) {
+        warm(successor);
+    }
+    for(int i = 0; i < M; i++) {
+        warm(getFinger(i));
+    }
+    peers_.evictIdle();
+}
+
 chord::Ring::Ring() {}
 
 chord::Ring::Ring(const std::string &json_file) {
     gpr_set_log_function(BlackholeLogger);
 
     std::vector<NodeInfo> nodes;
+    NodeConfig config;
     {
         std::ifstream is(json_file);
         if(!is.is_open()) {
@@ -511,11 +1674,12 @@ chord::Ring::Ring(const std::string &json_file) {
         }
         cereal::JSONInputArchive archive(is);
         archive(cereal::make_nvp("entities", nodes));
+        optional_nvp(archive, "config", config);
     }
 
     for(auto &node : nodes) {
         try {
-            chord::Node *new_node = new chord::Node(node.address, node.port);
+            chord::Node *new_node = new chord::Node(node.address, node.port, config);
             ring_.push_back(new_node);
         } catch (chord::NodeException &e) {
             std::cout << e.what() << std::endl;
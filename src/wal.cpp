@@ -0,0 +1,475 @@
+#include "wal.hpp"
+#include "checksum.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    template<class T>
+    void put(std::string &out, T value) {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void putString(std::string &out, const std::string &value) {
+        put<uint32_t>(out, value.size());
+        out.append(value);
+    }
+
+    void putMessage(std::string &out, const mail::Message &msg) {
+        putString(out, msg.to);
+        putString(out, msg.from);
+        putString(out, msg.subject);
+        putString(out, msg.body);
+        put<int64_t>(out, msg.date);
+        put<uint64_t>(out, msg.id);
+    }
+
+    /**
+     * Sequential reader of a binary record, every read fails once the data is exhausted
+    */
+    struct Reader {
+        const char *data;
+        size_t size;
+
+        template<class T>
+        bool get(T &value) {
+            if(size < sizeof(T)) {
+                return false;
+            }
+            std::memcpy(&value, data, sizeof(T));
+            data += sizeof(T);
+            size -= sizeof(T);
+            return true;
+        }
+
+        bool getString(std::string &value) {
+            uint32_t length;
+            if(!get(length) || size < length) {
+                return false;
+            }
+            value.assign(data, length);
+            data += length;
+            size -= length;
+            return true;
+        }
+
+        bool getMessage(mail::Message &msg) {
+            int64_t date;
+            if(!getString(msg.to) || !getString(msg.from) || !getString(msg.subject) || !getString(msg.body) ||
+               !get(date) || !get(msg.id)) {
+                return false;
+            }
+            msg.date = date;
+            return true;
+        }
+    };
+
+    const size_t FRAME_HEADER = 2 * sizeof(uint32_t); /**< Length and checksum that precede every record */
+
+    /**
+     * Appends the content of a file to another one and synchronizes it.
+     *
+     * @returns true if the operation was successful
+    */
+    bool appendFile(const std::string &src, const std::string &dst) {
+        int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        if(in < 0) {
+            return false;
+        }
+        int out = ::open(dst.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if(out < 0) {
+            ::close(in);
+            return false;
+        }
+        char chunk[1 << 16];
+        ssize_t n;
+        bool ok = true;
+        while(ok && (n = ::read(in, chunk, sizeof(chunk))) > 0) {
+            ok = ::write(out, chunk, n) == n;
+        }
+        ok = ok && n == 0 && ::fdatasync(out) == 0;
+        ::close(in);
+        ::close(out);
+        return ok;
+    }
+}
+
+chord::WalRecord chord::WalRecord::insertMailbox(key_t key, const mail::MailBox &box) {
+    return {Type::INSERT_MAILBOX, key, mail::MailBox(box.getOwner(), box.getPassword()), {}, 0};
+}
+
+chord::WalRecord chord::WalRecord::send(key_t key, const mail::Message &message) {
+    return {Type::SEND, key, {}, message, 0};
+}
+
+chord::WalRecord chord::WalRecord::remove(key_t key, uint64_t id) {
+    return {Type::DELETE, key, {}, {}, id};
+}
+
+chord::WalRecord chord::WalRecord::transfer(key_t key, const mail::MailBox &box) {
+    return {Type::TRANSFER, key, box, {}, 0};
+}
+
+chord::WalRecord chord::WalRecord::erase(key_t key) {
+    return {Type::ERASE, key, {}, {}, 0};
+}
+
+chord::WalRecord chord::WalRecord::snapshot(key_t key, const mail::MailBox &box) {
+    return {Type::SNAPSHOT, key, box, {}, 0};
+}
+
+chord::WalRecord chord::WalRecord::clear() {
+    return {Type::CLEAR, 0, {}, {}, 0};
+}
+
+chord::WalRecord chord::WalRecord::base(uint64_t generation) {
+    return {Type::BASE, 0, {}, {}, generation};
+}
+
+void chord::WalRecord::encode(std::string &out) const {
+    put<uint8_t>(out, static_cast<uint8_t>(type));
+    put<int64_t>(out, key);
+    switch(type) {
+        case Type::INSERT_MAILBOX:
+            putString(out, box.getOwner());
+            put<int64_t>(out, box.getPassword());
+            break;
+        case Type::SEND:
+            putMessage(out, message);
+            break;
+        case Type::DELETE:
+        case Type::BASE:
+            put<uint64_t>(out, id);
+            break;
+        case Type::TRANSFER:
+        case Type::SNAPSHOT:
+            putString(out, box.getOwner());
+            put<int64_t>(out, box.getPassword());
+            put<uint32_t>(out, box.getSize());
+            box.forEachMessage([&out](const mail::Message &msg) { putMessage(out, msg); });
+            // The removed messages are not logged, the version keeps their identifiers from being given again
+            put<uint64_t>(out, box.getVersion());
+            break;
+        case Type::ERASE:
+        case Type::CLEAR:
+            break;
+    }
+}
+
+bool chord::WalRecord::decode(const char *data, size_t size, WalRecord &record) {
+    Reader reader{data, size};
+    uint8_t type;
+    int64_t key;
+    if(!reader.get(type) || !reader.get(key)) {
+        return false;
+    }
+    record = WalRecord();
+    record.type = static_cast<Type>(type);
+    record.key = key;
+    std::string owner;
+    int64_t psw;
+    uint32_t count;
+    switch(record.type) {
+        case Type::INSERT_MAILBOX:
+            if(!reader.getString(owner) || !reader.get(psw)) {
+                return false;
+            }
+            record.box = mail::MailBox(owner, static_cast<long long int>(psw));
+            break;
+        case Type::SEND:
+            if(!reader.getMessage(record.message)) {
+                return false;
+            }
+            break;
+        case Type::DELETE:
+        case Type::BASE:
+            if(!reader.get(record.id)) {
+                return false;
+            }
+            break;
+        case Type::TRANSFER:
+        case Type::SNAPSHOT:
+            if(!reader.getString(owner) || !reader.get(psw) || !reader.get(count)) {
+                return false;
+            }
+            record.box = mail::MailBox(owner, static_cast<long long int>(psw));
+            for(uint32_t i = 0; i < count; i++) {
+                mail::Message msg;
+                if(!reader.getMessage(msg)) {
+                    return false;
+                }
+                record.box.insertMessage(msg);
+            }
+            // The records written before the version was logged end after the messages
+            if(reader.size > 0) {
+                uint64_t version;
+                if(!reader.get(version)) {
+                    return false;
+                }
+                record.box.restoreVersion(version);
+            }
+            break;
+        case Type::ERASE:
+        case Type::CLEAR:
+            break;
+        default:
+            return false;
+    }
+    return reader.size == 0;
+}
+
+chord::WriteAheadLog::WriteAheadLog(const std::string &path, WalMode mode, std::chrono::milliseconds sync_interval)
+    : path_(path)
+    , fd_(::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644))
+    , mode_(mode)
+    , sync_interval_(sync_interval)
+    , appended_(0)
+    , written_(0)
+    , durable_(0)
+    , writing_(false)
+    , failed_(false)
+    , dirty_(false)
+    , batches_(0)
+    , syncs_(0)
+    , running_(true) {
+    if(fd_ < 0) {
+        throw std::runtime_error("Couldn't open the write-ahead log " + path);
+    }
+    if(mode_ == WalMode::INTERVAL) {
+        sync_thread_.reset(new std::thread(&WriteAheadLog::syncLoop, this));
+    }
+}
+
+chord::WriteAheadLog::~WriteAheadLog() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        running_ = false;
+        written_cv_.wait(lock, [this]() { return !writing_; });
+        if(!pending_.empty()) {
+            writeBatch(pending_, mode_ != WalMode::NO_SYNC);
+            pending_.clear();
+        } else if(dirty_ && mode_ == WalMode::INTERVAL) {
+            ::fdatasync(fd_);
+        }
+    }
+    stop_cv_.notify_all();
+    if(sync_thread_) {
+        sync_thread_->join();
+    }
+    ::close(fd_);
+}
+
+bool chord::WriteAheadLog::append(const WalRecord &record) {
+    return wait(enqueue(record));
+}
+
+uint64_t chord::WriteAheadLog::enqueue(const WalRecord &record) {
+    std::string frame(FRAME_HEADER, '\0');
+    record.encode(frame);
+    uint32_t length = frame.size() - FRAME_HEADER,
+             checksum = chord::crc32(frame.data() + FRAME_HEADER, length);
+    std::memcpy(&frame[0], &length, sizeof(length));
+    std::memcpy(&frame[sizeof(length)], &checksum, sizeof(checksum));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(failed_) {
+        // The caller undoes the mutation, the frame must not reach the file later
+        return 0;
+    }
+    pending_ += frame;
+    return ++appended_;
+}
+
+bool chord::WriteAheadLog::wait(uint64_t seq) {
+    if(seq == 0) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(written_ < seq && !failed_) {
+        if(writing_) {
+            // Another writer is busy, he or the next leader will write this frame too
+            written_cv_.wait(lock);
+            continue;
+        }
+        // Leader: writes everything accumulated so far outside the lock
+        writing_ = true;
+        std::string batch;
+        batch.swap(pending_);
+        uint64_t last = appended_;
+        lock.unlock();
+        bool ok = writeBatch(batch, mode_ == WalMode::ALWAYS);
+        lock.lock();
+        writing_ = false;
+        written_ = last;
+        if(ok) {
+            durable_ = last;
+        } else {
+            fail();
+        }
+        dirty_ = dirty_ || mode_ != WalMode::ALWAYS;
+        written_cv_.notify_all();
+    }
+    return durable_ >= seq;
+}
+
+size_t chord::WriteAheadLog::replay(const std::string &path, const std::function<void(const WalRecord &)> &apply) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return 0;
+    }
+    std::vector<char> data;
+    char chunk[1 << 16];
+    ssize_t n;
+    while((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    ::close(fd);
+
+    size_t offset = 0, count = 0;
+    WalRecord record;
+    while(data.size() - offset >= FRAME_HEADER) {
+        uint32_t length, checksum;
+        std::memcpy(&length, &data[offset], sizeof(length));
+        std::memcpy(&checksum, &data[offset + sizeof(length)], sizeof(checksum));
+        const char *payload = data.data() + offset + FRAME_HEADER;
+        if(data.size() - offset - FRAME_HEADER < length || chord::crc32(payload, length) != checksum ||
+           !WalRecord::decode(payload, length, record)) {
+            break;
+        }
+        apply(record);
+        offset += FRAME_HEADER + length;
+        count++;
+    }
+    if(offset < data.size()) {
+        // The tail was torn by a crash, new records must not be appended after it
+        if(::truncate(path.c_str(), offset) != 0) {
+            throw std::runtime_error("Couldn't truncate the write-ahead log " + path);
+        }
+    }
+    return count;
+}
+
+bool chord::WriteAheadLog::reset() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    written_cv_.wait(lock, [this]() { return !writing_; });
+    pending_.clear();
+    written_ = durable_ = appended_;
+    dirty_ = false;
+    failed_ = ::ftruncate(fd_, 0) != 0 || ::fsync(fd_) != 0;
+    return !failed_;
+}
+
+bool chord::WriteAheadLog::sync() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    written_cv_.wait(lock, [this]() { return !writing_; });
+    bool ok = writeBatch(pending_, true);
+    pending_.clear();
+    written_ = appended_;
+    dirty_ = false;
+    if(ok) {
+        durable_ = appended_;
+    } else {
+        fail();
+    }
+    written_cv_.notify_all();
+    return ok;
+}
+
+bool chord::WriteAheadLog::rotate(const std::string &archive) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    written_cv_.wait(lock, [this]() { return !writing_; });
+    bool ok = writeBatch(pending_, true);
+    pending_.clear();
+    written_ = appended_;
+    dirty_ = false;
+    if(ok) {
+        durable_ = appended_;
+    }
+    written_cv_.notify_all();
+    if(ok && ::access(archive.c_str(), F_OK) == 0) {
+        // The archive was not consumed yet, the records are appended to it so none is lost
+        ok = appendFile(path_, archive) && ::ftruncate(fd_, 0) == 0;
+        if(!ok) {
+            fail();
+        }
+        return ok;
+    }
+    if(!ok || ::rename(path_.c_str(), archive.c_str()) != 0) {
+        fail();
+        return false;
+    }
+    int fd = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        // The old descriptor still points to the archived file, it's better than losing the records
+        fail();
+        return false;
+    }
+    ::close(fd_);
+    fd_ = fd;
+    return true;
+}
+
+uint64_t chord::WriteAheadLog::records() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return appended_;
+}
+
+uint64_t chord::WriteAheadLog::batches() const { return batches_; }
+
+uint64_t chord::WriteAheadLog::syncs() const { return syncs_; }
+
+void chord::WriteAheadLog::fail() {
+    failed_ = true;
+    // The writers of the queued frames are told they failed, so the frames are never written
+    pending_.clear();
+}
+
+bool chord::WriteAheadLog::writeBatch(const std::string &batch, bool sync) {
+    const char *data = batch.data();
+    size_t left = batch.size();
+    while(left > 0) {
+        ssize_t n = ::write(fd_, data, left);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        left -= n;
+    }
+    if(!batch.empty()) {
+        batches_++;
+    }
+    if(sync) {
+        syncs_++;
+        return ::fdatasync(fd_) == 0;
+    }
+    return true;
+}
+
+void chord::WriteAheadLog::syncLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(running_) {
+        stop_cv_.wait_for(lock, sync_interval_, [this]() { return !running_; });
+        if(dirty_ && !writing_) {
+            // Writers wait like for a batch, so the descriptor can't be replaced by WriteAheadLog::rotate
+            dirty_ = false;
+            writing_ = true;
+            lock.unlock();
+            syncs_++;
+            bool ok = ::fdatasync(fd_) == 0;
+            lock.lock();
+            writing_ = false;
+            if(!ok) {
+                fail();
+            }
+            written_cv_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#include "watch_hub.hpp"
+
+#include <algorithm>
+
+chord::WatchQueue::WatchQueue(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1))
+    , closed_(false)
+    , overflowed_(false) {}
+
+void chord::WatchQueue::notify(const std::shared_ptr<const HeaderMessage> &header) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(headers_.size() >= capacity_) {
+            overflowed_ = true;
+            return;
+        }
+        headers_.push_back(header);
+    }
+    ready_.notify_one();
+}
+
+void chord::WatchQueue::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    ready_.notify_one();
+}
+
+bool chord::WatchQueue::pop(std::shared_ptr<const HeaderMessage> &header, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait_for(lock, timeout, [this]() { return !headers_.empty() || closed_; });
+    if(headers_.empty()) {
+        return false;
+    }
+    header = std::move(headers_.front());
+    headers_.pop_front();
+    return true;
+}
+
+bool chord::WatchQueue::closed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+}
+
+bool chord::WatchQueue::overflowed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return overflowed_;
+}
+
+chord::WatchHub::WatchHub()
+    : closed_(false)
+    , size_(0)
+    , notifications_(0) {}
+
+bool chord::WatchHub::subscribe(key_t key, Watcher *watcher) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(closed_) {
+        return false;
+    }
+    watchers_[key].push_back(watcher);
+    size_++;
+    return true;
+}
+
+void chord::WatchHub::unsubscribe(key_t key, Watcher *watcher) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = watchers_.find(key);
+    if(it == watchers_.end()) {
+        return;
+    }
+    auto &list = it->second;
+    auto pos = std::find(list.begin(), list.end(), watcher);
+    if(pos == list.end()) {
+        return;
+    }
+    // The order of the watchers doesn't matter
+    *pos = list.back();
+    list.pop_back();
+    size_--;
+    if(list.empty()) {
+        watchers_.erase(it);
+    }
+}
+
+size_t chord::WatchHub::publish(key_t key, const HeaderMessage &header) {
+    if(size_ == 0) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = watchers_.find(key);
+    if(it == watchers_.end()) {
+        return 0;
+    }
+    auto shared = std::make_shared<const HeaderMessage>(header);
+    for(Watcher *watcher : it->second) {
+        watcher->notify(shared);
+    }
+    notifications_ += it->second.size();
+    return it->second.size();
+}
+
+void chord::WatchHub::close(key_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = watchers_.find(key);
+    if(it == watchers_.end()) {
+        return;
+    }
+    for(Watcher *watcher : it->second) {
+        watcher->close();
+    }
+    size_ -= it->second.size();
+    watchers_.erase(it);
+}
+
+void chord::WatchHub::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    for(auto &pair : watchers_) {
+        for(Watcher *watcher : pair.second) {
+            watcher->close();
+        }
+    }
+    watchers_.clear();
+    size_ = 0;
+}
+
+void chord::WatchHub::open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = false;
+}
+
+size_t chord::WatchHub::size() const { return size_; }
+
+uint64_t chord::WatchHub::notifications() const { return notifications_; }
@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <chord/blob_store.hpp>
+
+TEST(BlobStoreTest, Intern) {
+    chord::BlobStore store;
+    chord::BlobStore::Blob first = store.intern(std::string(1000, 'a')), second = store.intern(std::string(1000, 'a'));
+    ASSERT_EQ(first.get(), second.get());
+    ASSERT_EQ(*first, std::string(1000, 'a'));
+    ASSERT_EQ(store.size(), 1);
+    ASSERT_EQ(store.bytes(), 1000);
+    ASSERT_EQ(store.hits(), 1);
+
+    chord::BlobStore::Blob other = store.intern(std::string(500, 'b'));
+    ASSERT_NE(other.get(), first.get());
+    ASSERT_EQ(store.size(), 2);
+    ASSERT_EQ(store.bytes(), 1500);
+
+    // A blob is removed with his last reference
+    first.reset();
+    ASSERT_EQ(store.size(), 2);
+    second.reset();
+    ASSERT_EQ(store.size(), 1);
+    ASSERT_EQ(store.bytes(), 500);
+    chord::BlobStore::Blob again = store.intern(std::string(1000, 'a'));
+    ASSERT_EQ(store.hits(), 1);
+    ASSERT_EQ(store.bytes(), 1500);
+}
+
+TEST(BlobStoreTest, OutlivesStore) {
+    chord::BlobStore::Blob blob;
+    {
+        chord::BlobStore store;
+        blob = store.intern("body");
+    }
+    ASSERT_EQ(*blob, "body");
+}
+
+TEST(BlobStoreTest, ConcurrentIntern) {
+    chord::BlobStore store(4);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([&store]() {
+            for(int i = 0; i < 10000; i++) {
+                // References are dropped immediately, so blobs are continuously removed and created again
+                chord::BlobStore::Blob blob = store.intern(std::to_string(i % 100));
+                ASSERT_EQ(*blob, std::to_string(i % 100));
+            }
+        });
+    }
+    for(auto &thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(store.size(), 0);
+    ASSERT_EQ(store.bytes(), 0);
+}
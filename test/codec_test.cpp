@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include <chord/codec.hpp>
+
+TEST(CodecTest, Find) {
+    ASSERT_EQ(chord::Codec::find("zlib")->id(), chord::ZlibCodec::ID);
+    ASSERT_EQ(chord::Codec::find("none")->id(), chord::IdentityCodec::ID);
+    ASSERT_EQ(chord::Codec::find(chord::ZlibCodec::ID)->name(), std::string("zlib"));
+    ASSERT_EQ(chord::Codec::find("lz4"), nullptr);
+    ASSERT_EQ(chord::Codec::find(200), nullptr);
+}
+
+TEST(CodecTest, Zlib) {
+    chord::ZlibCodec codec;
+    std::string data, compressed = "prefix", decompressed;
+    for(int i = 0; i < 1000; i++) {
+        data += "line " + std::to_string(i % 10) + " of a message\n";
+    }
+    ASSERT_TRUE(codec.compress(data, compressed));
+    ASSERT_LT(compressed.size(), data.size() / 4);
+    ASSERT_TRUE(codec.decompress(std::string_view(compressed).substr(6), data.size(), decompressed));
+    ASSERT_EQ(decompressed, data);
+    // The original size must match
+    decompressed.clear();
+    ASSERT_FALSE(codec.decompress(std::string_view(compressed).substr(6), data.size() - 1, decompressed));
+    ASSERT_FALSE(codec.decompress(std::string_view(compressed).substr(6), data.size() + 1, decompressed));
+    ASSERT_TRUE(decompressed.empty());
+    ASSERT_FALSE(codec.decompress("not compressed data", 100, decompressed));
+}
+
+TEST(CodecTest, EncodeAndDecode) {
+    chord::BodyCodec codec;
+    codec.configure(chord::Codec::find("zlib"), 100);
+    std::string short_body(99, 'a'), long_body(10000, 'b'), random, decoded;
+    uint32_t state = 7;
+    for(int i = 0; i < 1000; i++) {
+        state = state * 1103515245 + 12345;
+        random.push_back(static_cast<char>(state >> 24));
+    }
+
+    std::string body = short_body;
+    codec.encode(body);
+    ASSERT_EQ(body, short_body);
+    ASSERT_FALSE(chord::BodyCodec::encoded(body));
+
+    body = long_body;
+    codec.encode(body);
+    ASSERT_TRUE(chord::BodyCodec::encoded(body));
+    ASSERT_LT(body.size(), 200);
+    ASSERT_EQ(chord::BodyCodec::codecOf(body)->id(), chord::ZlibCodec::ID);
+    ASSERT_EQ(chord::BodyCodec::originalSize(body), long_body.size());
+    ASSERT_TRUE(codec.decode(body, decoded));
+    ASSERT_EQ(decoded, long_body);
+
+    // A body that doesn't shrink is stored as it is
+    body = random;
+    codec.encode(body);
+    ASSERT_EQ(body, random);
+
+    ASSERT_EQ(codec.compressedBodies(), 1);
+    ASSERT_EQ(codec.inputBytes(), long_body.size() + random.size());
+    ASSERT_LT(codec.outputBytes(), 200 + random.size());
+    ASSERT_EQ(codec.decompressedBodies(), 1);
+}
+
+TEST(CodecTest, Ambiguous) {
+    chord::BodyCodec codec;
+    // Even without compression a body that starts like an encoded one is wrapped
+    const std::string raw = std::string("\0CZ\1\0\0\0\0", 8) + "not really compressed";
+    std::string body = raw, decoded;
+    codec.encode(body);
+    ASSERT_NE(body, raw);
+    ASSERT_EQ(chord::BodyCodec::codecOf(body)->id(), chord::IdentityCodec::ID);
+    ASSERT_EQ(chord::BodyCodec::originalSize(body), raw.size());
+    ASSERT_TRUE(codec.decode(body, decoded));
+    ASSERT_EQ(decoded, raw);
+    ASSERT_EQ(codec.decompressedBodies(), 0);
+
+    // Bodies sent before the compression existed are read as they are
+    decoded.clear();
+    ASSERT_TRUE(codec.decode("plain body", decoded));
+    ASSERT_EQ(decoded, "plain body");
+
+    // Unknown codecs and corrupted bodies are reported
+    std::string unknown = std::string("\0CZ\x7f\x04\0\0\0", 8) + "data";
+    ASSERT_FALSE(codec.decode(unknown, decoded));
+    codec.configure(chord::Codec::find("zlib"), 0);
+    body = std::string(1000, 'c');
+    codec.encode(body);
+    body[body.size() / 2] ^= 0x55;
+    decoded.clear();
+    ASSERT_FALSE(codec.decode(body, decoded));
+}
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <chord/finger_table.hpp>
+
+class FingerTableTest : public ::testing::Test {
+protected:
+    /**
+     * Reference implementation, scans the fingers from the farthest to the closest
+    */
+    static chord::NodeInfo linearScan(const std::vector<chord::NodeInfo> &fingers, chord::key_t owner, chord::key_t key) {
+        for(auto finger = fingers.rbegin(); finger != fingers.rend(); finger++) {
+            if(!finger->address.empty() && finger->id != key && chord::between(finger->id, owner, key)) {
+                return *finger;
+            }
+        }
+        return fingers.front();
+    }
+
+    static chord::NodeInfo randomPeer(std::mt19937_64 &rng) {
+        static std::uniform_int_distribution<chord::key_t> dist(0, (1LL << chord::M) - 1);
+        chord::key_t id = dist(rng);
+        return {"127.0.0.1", static_cast<int>(id % 65536), id};
+    }
+};
+
+TEST_F(FingerTableTest, EmptyFingers) {
+    chord::FingerTable table(100);
+    for(int i = 0; i < chord::M; i++) {
+        EXPECT_TRUE(table.get(i).address.empty());
+    }
+    EXPECT_TRUE(table.closestPreceding(50).address.empty());
+    EXPECT_THROW(table.get(-1), std::out_of_range);
+    EXPECT_THROW(table.get(chord::M), std::out_of_range);
+    EXPECT_THROW(table.set(chord::M, {"127.0.0.1", 1, 1}), std::out_of_range);
+}
+
+TEST_F(FingerTableTest, SharedPeers) {
+    chord::FingerTable table(100);
+    chord::NodeInfo successor = {"127.0.0.1", 1, 200},
+                    far = {"127.0.0.1", 2, 1000};
+    for(int i = 0; i < chord::M; i++) {
+        table.set(i, i < 10 ? successor : far);
+    }
+    EXPECT_EQ(table.successor(), successor);
+    EXPECT_EQ(table.closestPreceding(500), successor);
+    EXPECT_EQ(table.closestPreceding(2000), far);
+    // Keys that wrap around the ring are preceded by the farthest peer
+    EXPECT_EQ(table.closestPreceding(50), far);
+    // The peer is removed from the lookups only when no finger points to it anymore
+    for(int i = 10; i < chord::M - 1; i++) {
+        table.set(i, successor);
+    }
+    EXPECT_EQ(table.closestPreceding(2000), far);
+    table.set(chord::M - 1, {"", 0, 0});
+    EXPECT_EQ(table.closestPreceding(2000), successor);
+
+    // The second best peer, if any, replaces the excluded one
+    table.set(chord::M - 1, far);
+    EXPECT_EQ(table.closestPreceding(2000, far), successor);
+    EXPECT_EQ(table.closestPreceding(2000, successor), far);
+    EXPECT_TRUE(table.closestPreceding(500, successor).address.empty());
+}
+
+TEST_F(FingerTableTest, FullDirectory) {
+    chord::FingerTable table(0);
+    for(int i = 0; i < chord::M; i++) {
+        table.set(i, {"127.0.0.1", i + 1, (i + 1) * 10});
+    }
+    // Every entry of the directory is taken, moving a finger to a new peer reuses his own entry
+    chord::NodeInfo moved = {"127.0.0.1", 1000, 10000};
+    table.set(chord::M - 1, moved);
+    EXPECT_EQ(table.get(chord::M - 1), moved);
+    EXPECT_EQ(table.closestPreceding(20000), moved);
+    // A finger moved to the peer he already points to keeps it
+    table.set(0, table.get(0));
+    EXPECT_EQ(table.get(0).id, 10);
+}
+
+TEST_F(FingerTableTest, MatchesLinearScan) {
+    std::mt19937_64 rng(42);
+    for(int round = 0; round < 50; round++) {
+        chord::key_t owner = randomPeer(rng).id;
+        chord::FingerTable table(owner);
+        std::vector<chord::NodeInfo> fingers(chord::M, {"", 0, 0});
+        // Random updates, some of them reuse peers that are already inside the table
+        for(int update = 0; update < 200; update++) {
+            int idx = rng() % chord::M;
+            chord::NodeInfo peer = (rng() % 3 == 0) ? fingers[rng() % chord::M] : randomPeer(rng);
+            fingers[idx] = peer;
+            table.set(idx, peer);
+        }
+        for(int i = 0; i < chord::M; i++) {
+            ASSERT_EQ(table.get(i), fingers[i]);
+        }
+        for(int lookup = 0; lookup < 200; lookup++) {
+            chord::key_t key = randomPeer(rng).id;
+            chord::NodeInfo expected = linearScan(fingers, owner, key),
+                            found = table.closestPreceding(key);
+            // The scan returns the farthest index, the table the farthest peer: they differ only if the fingers are not ordered
+            EXPECT_TRUE(found == expected || (chord::between(found.id, owner, key) && chord::between(expected.id, owner, found.id)))
+                << "Wrong finger for key " << key << " of node " << owner;
+        }
+    }
+}
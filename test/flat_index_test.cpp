@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <string>
+
+#include <chord/flat_index.hpp>
+
+TEST(FlatIndexTest, Basic) {
+    chord::FlatIndex<std::string> index;
+    ASSERT_EQ(index.find(1), nullptr);
+    auto[value, inserted] = index.insert(1, "one");
+    ASSERT_TRUE(inserted);
+    ASSERT_EQ(*value, "one");
+    ASSERT_FALSE(index.insert(1, "other").second);
+    ASSERT_EQ(*index.find(1), "one");
+    *index.find(1) = "uno";
+    ASSERT_EQ(*index.find(1), "uno");
+    ASSERT_TRUE(index.erase(1));
+    ASSERT_FALSE(index.erase(1));
+    ASSERT_EQ(index.find(1), nullptr);
+    ASSERT_TRUE(index.empty());
+}
+
+TEST(FlatIndexTest, MatchesMap) {
+    // Few distinct keys so that inserts, erases and long probe sequences mix together
+    chord::FlatIndex<int> index;
+    std::map<chord::key_t, int> reference;
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<chord::key_t> keys(0, 2000);
+    for(int i = 0; i < 100000; i++) {
+        chord::key_t key = keys(rng);
+        if(rng() % 3 == 0) {
+            ASSERT_EQ(index.erase(key), reference.erase(key) > 0);
+        } else {
+            ASSERT_EQ(index.insert(key, i).second, reference.insert({key, i}).second);
+        }
+    }
+    ASSERT_EQ(index.size(), reference.size());
+    for(chord::key_t key = 0; key <= 2000; key++) {
+        const int *value = index.find(key);
+        auto it = reference.find(key);
+        if(it == reference.end()) {
+            ASSERT_EQ(value, nullptr);
+        } else {
+            ASSERT_NE(value, nullptr);
+            ASSERT_EQ(*value, it->second);
+        }
+    }
+    size_t visited = 0;
+    for(auto &pair : index) {
+        ASSERT_EQ(reference.at(pair.first), pair.second);
+        visited++;
+    }
+    ASSERT_EQ(visited, reference.size());
+}
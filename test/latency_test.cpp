@@ -0,0 +1,34 @@
+#include <gtest/gtest.h>
+#include <chrono>
+
+#include <chord/latency.hpp>
+
+TEST(LatencyTrackerTest, Percentiles) {
+    chord::LatencyTracker tracker(100, 10);
+    for(int i = 1; i < 10; i++) {
+        tracker.record(std::chrono::microseconds(i));
+    }
+    // Not enough samples yet
+    ASSERT_EQ(tracker.percentile(50).count(), 0);
+    for(int i = 10; i <= 100; i++) {
+        tracker.record(std::chrono::microseconds(i));
+    }
+    ASSERT_EQ(tracker.size(), 100);
+    ASSERT_EQ(tracker.percentile(50).count(), 50);
+    ASSERT_EQ(tracker.percentile(95).count(), 95);
+    ASSERT_EQ(tracker.percentile(100).count(), 100);
+}
+
+TEST(LatencyTrackerTest, Window) {
+    chord::LatencyTracker tracker(100, 10);
+    for(int i = 0; i < 100; i++) {
+        tracker.record(std::chrono::microseconds(1000));
+    }
+    ASSERT_EQ(tracker.percentile(99).count(), 1000);
+    // The old samples are replaced, the cached percentile follows them
+    for(int i = 0; i < 100; i++) {
+        tracker.record(std::chrono::microseconds(10));
+    }
+    ASSERT_EQ(tracker.size(), 100);
+    ASSERT_EQ(tracker.percentile(99).count(), 10);
+}
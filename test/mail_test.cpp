@@ -1,10 +1,12 @@
 #include <gtest/gtest.h>
 #include <cereal/archives/json.hpp>
+#include <cereal/archives/binary.hpp>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/string.hpp>
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <cstdio>
 #include <random>
 #include <vector>
 #include <mail.hpp>
@@ -102,4 +104,202 @@ TEST_F(MailTest, SaveAndLoadBox) {
     for(int i = 0; i < box.getSize(); i++) {
         ASSERT_TRUE(box.getMessage(i).compare(box_loaded.getMessage(i)));
     }
-}
\ No newline at end of file
+}
+TEST_F(MailTest, LoadLegacyBox) {
+    // Layout written before the format had a header: owner, password and messages without identifiers
+    std::vector<mail::Message> messages = getRandomMessages();
+    {
+        std::ofstream os("legacy_box.dat", std::ios::binary);
+        cereal::BinaryOutputArchive archive(os);
+        uint64_t count = messages.size();
+        archive(std::string("legacy@test.com"), static_cast<long long int>(42), count);
+        for(auto &msg : messages) {
+            archive(msg.to, msg.from, msg.subject, msg.body, msg.date);
+        }
+    }
+    mail::MailBox box = mail::MailBox::loadBox("legacy_box.dat");
+    ASSERT_EQ(box.getOwner(), "legacy@test.com");
+    ASSERT_EQ(box.getPassword(), 42);
+    ASSERT_EQ(box.getSize(), messages.size());
+    for(size_t i = 0; i < messages.size(); i++) {
+        ASSERT_TRUE(box.getMessage(i).compare(messages[i]));
+        ASSERT_EQ(box.getMessage(i).id, i + 1);
+    }
+    // Saved again with the current format, the identifiers survive
+    box.removeMessageById(1);
+    ASSERT_TRUE(box.saveBox("legacy_box.dat"));
+    mail::MailBox loaded = mail::MailBox::loadBox("legacy_box.dat");
+    ASSERT_EQ(loaded.getSize(), messages.size() - 1);
+    ASSERT_EQ(loaded.getMessage(0).id, 2);
+    ASSERT_EQ(loaded.getVersion(), box.getVersion());
+    std::remove("legacy_box.dat");
+}
+
+TEST_F(MailTest, StableIds) {
+    mail::MailBox box = getRandomMailbox();
+    uint64_t first = box.insertMessage(getRandomMessage()),
+             second = box.insertMessage(getRandomMessage()),
+             third = box.insertMessage(getRandomMessage());
+    ASSERT_LT(first, second);
+    ASSERT_LT(second, third);
+
+    // Ids don't change when previous messages are removed and are never reused
+    mail::Message msg = *box.findMessage(third);
+    ASSERT_TRUE(box.removeMessageById(first));
+    ASSERT_FALSE(box.removeMessageById(first));
+    ASSERT_EQ(box.getSize(), 2);
+    ASSERT_TRUE(box.findMessage(third)->compare(msg));
+    ASSERT_TRUE(box.getMessage(1).compare(msg));
+    ASSERT_EQ(box.getMessages().size(), 2);
+    ASSERT_GT(box.insertMessage(getRandomMessage()), third);
+
+    // Compaction keeps ids and order
+    ASSERT_EQ(box.getTombstones(), 1);
+    ASSERT_EQ(box.compact(), 1);
+    ASSERT_EQ(box.getTombstones(), 0);
+    ASSERT_EQ(box.getMessage(0).id, second);
+    ASSERT_EQ(box.getMessage(1).id, third);
+
+    // Ids of messages coming from another box are kept unless already used
+    mail::MailBox copy = getRandomMailbox();
+    ASSERT_EQ(copy.insertMessage(*box.findMessage(third)), third);
+    ASSERT_NE(copy.insertMessage(*box.findMessage(third)), third);
+}
+
+TEST_F(MailTest, BodyBytes) {
+    mail::MailBox box = getRandomMailbox();
+    mail::Message first = getRandomMessage(), second = getRandomMessage();
+    uint64_t id = box.insertMessage(first);
+    box.insertMessage(second);
+    ASSERT_EQ(box.getBodyBytes(), first.body.size() + second.body.size());
+    box.removeMessageById(id);
+    ASSERT_EQ(box.getBodyBytes(), second.body.size());
+    ASSERT_EQ(box.getRemovals(), 1);
+
+    // Bodies changed through the visitor are accounted
+    box.forEachBody([](uint64_t id, std::string &body) { body = "short"; });
+    ASSERT_EQ(box.getBodyBytes(), 5);
+    ASSERT_EQ(box.getMessage(0).body, "short");
+    box.compact();
+    ASSERT_EQ(box.getBodyBytes(), 5);
+
+    // Only the messages inserted after the given one are visited
+    uint64_t third = box.insertMessage(first);
+    std::vector<uint64_t> visited;
+    box.forEachBodyAfter(id, [&visited](uint64_t id, std::string &body) { visited.push_back(id); });
+    ASSERT_EQ(visited, std::vector<uint64_t>({third, box.getMessage(0).id}));
+    visited.clear();
+    box.forEachBodyAfter(third, [&visited](uint64_t id, std::string &body) { visited.push_back(id); });
+    ASSERT_TRUE(visited.empty());
+    ASSERT_EQ(box.getRemovals(), 1);
+}
+
+TEST_F(MailTest, SetBodyAndRead) {
+    mail::MailBox box = getRandomMailbox();
+    mail::Message msg = getRandomMessage();
+    msg.body = "";
+    uint64_t id = box.insertMessage(msg);
+    // Bodies downloaded on demand are filled in place
+    ASSERT_TRUE(box.setBody(id, "downloaded body"));
+    ASSERT_EQ(box.findMessage(id)->body, "downloaded body");
+    ASSERT_EQ(box.getBodyBytes(), 15);
+    ASSERT_FALSE(box.findMessage(id)->read);
+    ASSERT_TRUE(box.setRead(id));
+    ASSERT_TRUE(box.findMessage(id)->read);
+    ASSERT_FALSE(box.setBody(id + 1, "missing"));
+    ASSERT_FALSE(box.setRead(id + 1));
+}
+
+TEST_F(MailTest, VisitFrom) {
+    mail::MailBox box = getRandomMailbox();
+    std::vector<uint64_t> ids, visited;
+    for(int i = 0; i < 6; i++) {
+        ids.push_back(box.insertMessage({"to", "from", "subject", std::to_string(i)}));
+    }
+    auto visit = [&box, &visited](uint64_t id, bool newest_first, size_t max) {
+        visited.clear();
+        box.forEachMessageFrom(id, newest_first, [&visited, max](const mail::Message &msg) {
+            visited.push_back(msg.id);
+            return visited.size() < max;
+        });
+    };
+    visit(0, false, 3);
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[0], ids[1], ids[2]}));
+    visit(0, true, 2);
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[5], ids[4]}));
+    visit(ids[3], false, 10);
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[3], ids[4], ids[5]}));
+    visit(ids[3], true, 10);
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[3], ids[2], ids[1], ids[0]}));
+    // A removed message is still a valid starting point
+    ASSERT_TRUE(box.removeMessageById(ids[3]));
+    visit(ids[3], false, 10);
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[4], ids[5]}));
+    visit(ids[3], true, 10);
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[2], ids[1], ids[0]}));
+}
+
+TEST_F(MailTest, Version) {
+    mail::MailBox box = getRandomMailbox();
+    uint64_t start = box.getVersion();
+    std::vector<uint64_t> ids;
+    for(int i = 0; i < 3; i++) {
+        ids.push_back(box.insertMessage({"to", "from", "subject", std::to_string(i)}));
+    }
+    ASSERT_EQ(box.getVersion(), ids.back());
+    // Every removal is a new version, the removals after a version are visited in order
+    ASSERT_TRUE(box.removeMessageById(ids[1]));
+    uint64_t removed = box.getVersion();
+    ASSERT_GT(removed, ids.back());
+    std::vector<uint64_t> visited;
+    ASSERT_TRUE(box.forEachRemoval(start, [&visited, removed](uint64_t version, uint64_t id) {
+        ASSERT_EQ(version, removed);
+        visited.push_back(id);
+    }));
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[1]}));
+    visited.clear();
+    ASSERT_TRUE(box.forEachRemoval(removed, [&visited](uint64_t, uint64_t id) { visited.push_back(id); }));
+    ASSERT_TRUE(visited.empty());
+
+    // Only the last removals are remembered, older versions can't be brought up to date
+    uint64_t before = box.getVersion();
+    for(int i = 0; i < 2 * static_cast<int>(mail::MailBox::REMOVAL_LOG); i++) {
+        ASSERT_TRUE(box.removeMessageById(box.insertMessage({"to", "from", "subject", "body"})));
+    }
+    ASSERT_FALSE(box.forEachRemoval(before, [](uint64_t, uint64_t) {}));
+    ASSERT_TRUE(box.forEachRemoval(box.getVersion() - 10, [](uint64_t, uint64_t) {}));
+
+    // A restored version is never lower than the current one and forgets the removals
+    uint64_t version = box.getVersion();
+    box.restoreVersion(version - 5);
+    ASSERT_EQ(box.getVersion(), version);
+    box.restoreVersion(version + 100);
+    ASSERT_EQ(box.getVersion(), version + 100);
+    ASSERT_GT(box.insertMessage({"to", "from", "subject", "body"}), version + 100);
+    ASSERT_FALSE(box.forEachRemoval(version, [](uint64_t, uint64_t) {}));
+
+    version = box.getVersion();
+    box.clear();
+    ASSERT_GT(box.getVersion(), version);
+    ASSERT_FALSE(box.forEachRemoval(version, [](uint64_t, uint64_t) {}));
+}
+
+TEST_F(MailTest, RemoveLargeMailbox) {
+    const int size = 50000;
+    mail::MailBox box = getRandomMailbox();
+    std::vector<uint64_t> ids;
+    for(int i = 0; i < size; i++) {
+        ids.push_back(box.insertMessage({"to", "from", "subject", std::to_string(i)}));
+    }
+    // Removes the even messages, automatic compaction keeps the tombstones bounded
+    for(int i = 0; i < size; i += 2) {
+        ASSERT_TRUE(box.removeMessageById(ids[i]));
+        ASSERT_LE(box.getTombstones(), static_cast<size_t>(box.getSize()) + 65);
+    }
+    ASSERT_EQ(box.getSize(), size / 2);
+    for(int i = 1; i < size; i += 2) {
+        ASSERT_EQ(box.findMessage(ids[i])->body, std::to_string(i));
+    }
+    box.compact();
+    ASSERT_EQ(box.getMessage(0).body, "1");
+}
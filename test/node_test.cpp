@@ -11,6 +11,9 @@
 #include <fstream>
 #include <vector>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <random>
 #include <filesystem>
 #include <google/protobuf/util/time_util.h>
@@ -50,9 +53,84 @@ protected:
     }
 
     static void TearDownTestCase() {
+        std::vector<chord::key_t> ids;
+        for(auto node : ring_->getNodes()) {
+            ids.push_back(node->getInfo().id);
+        }
         delete ring_;
         std::filesystem::path bck = "181147151130138.dat";
         std::filesystem::remove(bck);
+        for(auto id : ids) {
+            removeFiles(id);
+        }
+    }
+
+    /**
+     * Stops the nodes started by the test and removes their files, even when the test failed.
+    */
+    void TearDown() override {
+        nodes_.clear();
+        for(auto id : ids_) {
+            removeFiles(id);
+        }
+    }
+
+    /**
+     * Removes all the files a node writes next to the executable.
+     *
+     * @param id id of the node
+    */
+    static void removeFiles(chord::key_t id) {
+        std::string prefix = std::to_string(id);
+        for(const char *suffix : {".dat", ".wal", ".wal.old", ".snap", ".snap.tmp", ".seg", ".seg.tmp", ".bodies"}) {
+            std::filesystem::remove(prefix + suffix);
+        }
+    }
+
+    /**
+     * Starts a node alone in his ring, he's stopped by NodeTest::TearDown or NodeTest::stopNodes.
+     *
+     * @param port port of the node
+     * @param config configuration of the node
+     * @returns the started node
+    */
+    chord::Node* startNode(int port, const chord::NodeConfig &config) {
+        chord::Node *node = addNode(port, config);
+        node->setSuccessor(node->getInfo());
+        node->buildFingerTable();
+        return node;
+    }
+
+    /**
+     * Starts a ring of nodes on consecutive ports, each node knows his successor and has his finger table.
+     *
+     * @param port port of the first node
+     * @param count number of nodes
+     * @param config configuration of the nodes
+     * @returns the nodes sorted by id
+    */
+    std::vector<chord::Node*> startRing(int port, int count, const chord::NodeConfig &config) {
+        std::vector<chord::Node*> ring;
+        for(int i = 0; i < count; i++) {
+            ring.push_back(addNode(port + i, config));
+        }
+        std::sort(ring.begin(), ring.end(), [](chord::Node *lhs, chord::Node *rhs) {
+            return lhs->getInfo().id < rhs->getInfo().id;
+        });
+        for(size_t i = 0; i < ring.size(); i++) {
+            ring[i]->setSuccessor(ring[(i + 1) % ring.size()]->getInfo());
+        }
+        for(auto node : ring) {
+            node->buildFingerTable();
+        }
+        return ring;
+    }
+
+    /**
+     * Stops the nodes started by the test, their files are kept so they can be started again.
+    */
+    void stopNodes() {
+        nodes_.clear();
     }
 
     static mail::Message getRandomMessage(const std::string &from) {
@@ -95,6 +173,15 @@ protected:
         return mail::MailBox(users_[dist_users(rng)], passwords_[dist_passwords(rng)]);
     }
 
+    chord::Node* addNode(int port, const chord::NodeConfig &config) {
+        nodes_.emplace_back(new chord::Node("127.0.0.1", port, config));
+        ids_.push_back(nodes_.back()->getInfo().id);
+        return nodes_.back().get();
+    }
+
+    std::vector<std::unique_ptr<chord::Node>> nodes_; /**< Nodes started by the test */
+    std::vector<chord::key_t> ids_; /**< Ids of the nodes started by the test, their files are removed at the end */
+
     static chord::Ring *ring_;
     static chord::Node *node0_;
     static std::vector<std::string> users_,
@@ -234,4 +321,601 @@ TEST_F(NodeTest, SendGetMessages) {
     for(int i = 0; i < messages_rec.size(); i++) {    
         ASSERT_TRUE(messages_rec[i].compare(messages[i]));
     }
-}
\ No newline at end of file
+}
+
+TEST_F(NodeTest, DeleteMessages) {
+    chord::Client client_receiver(node0_->getInfo()),
+                  client_sender(node0_->getInfo());
+    client_receiver.accountRegister({"delete_receiver@test.com", "test_psw"});
+    client_sender.accountRegister({"delete_sender@test.com", "test_psw"});
+    for(int i = 0; i < 3; i++) {
+        mail::Message msg = getRandomMessage("delete_sender@test.com");
+        msg.to = "delete_receiver@test.com";
+        client_sender.send(msg);
+    }
+    ASSERT_TRUE(client_receiver.getMessages());
+    auto messages = client_receiver.getBox().getMessages();
+    ASSERT_EQ(messages.size(), 3);
+
+    // Deleting the first message doesn't change the id of the others
+    client_receiver.removeById(messages[0].id);
+    client_receiver.removeById(messages[2].id);
+    ASSERT_THROW(client_receiver.removeById(messages[0].id), chord::NodeException);
+    ASSERT_TRUE(client_receiver.getMessages());
+    ASSERT_EQ(client_receiver.getBox().getSize(), 1);
+    ASSERT_EQ(client_receiver.getBox().getMessage(0).id, messages[1].id);
+    ASSERT_TRUE(client_receiver.getBox().getMessage(0).compare(messages[1]));
+
+    // Removing by index deletes the message shown by the client even if the mailbox changed
+    mail::Message msg = getRandomMessage("delete_sender@test.com");
+    msg.to = "delete_receiver@test.com";
+    client_sender.send(msg);
+    client_receiver.remove(0);
+    ASSERT_TRUE(client_receiver.getMessages());
+    ASSERT_EQ(client_receiver.getBox().getSize(), 1);
+    ASSERT_TRUE(client_receiver.getBox().getMessage(0).compare(msg));
+}
+
+TEST_F(NodeTest, ConnectionPool) {
+    auto pool_hits = [&]() {
+        uint64_t hits = 0;
+        for(auto node : ring_->getNodes()) {
+            hits += node->getStats().pool_hits;
+        }
+        return hits;
+    };
+    chord::Client client(node0_->getInfo());
+    client.accountRegister({"connection_pool@test.com", "test_psw"});
+    // The first message opens the connections that the following ones reuse
+    mail::Message first = getRandomMessage("connection_pool@test.com");
+    first.to = "connection_pool@test.com";
+    client.send(first);
+    uint64_t before = pool_hits();
+    for(int i = 0; i < 10; i++) {
+        mail::Message msg = getRandomMessage("connection_pool@test.com");
+        msg.to = "connection_pool@test.com";
+        client.send(msg);
+    }
+    ASSERT_GE(pool_hits() - before, 10);
+}
+
+TEST_F(NodeTest, AsyncServer) {
+    chord::NodeConfig config;
+    config.async_server = true;
+    config.server_threads = 2;
+    std::vector<chord::Node*> nodes = startRing(50100, 4, config);
+
+    chord::Client client(nodes.front()->getInfo());
+    for(int i = 0; i < 10; i++) {
+        chord::NodeInfo reg = client.accountRegister({"async_" + std::to_string(i) + "@test.com", "test_psw"}),
+                        log = client.accountLogin({"async_" + std::to_string(i) + "@test.com", "test_psw"});
+        ASSERT_EQ(reg.id, log.id);
+        mail::Message msg = getRandomMessage("async_" + std::to_string(i) + "@test.com");
+        msg.to = "async_0@test.com";
+        client.send(msg);
+        client.connectTo(nodes.back()->getInfo());
+    }
+    client.accountLogin({"async_0@test.com", "test_psw"});
+    ASSERT_TRUE(client.getMessages());
+    ASSERT_EQ(client.getBox().getSize(), 10);
+}
+
+TEST_F(NodeTest, IterativeRouting) {
+    chord::Client client_receiver(node0_->getInfo(), chord::RoutingMode::ITERATIVE),
+                  client_sender(node0_->getInfo(), chord::RoutingMode::ITERATIVE);
+    chord::NodeInfo reg = client_receiver.accountRegister({"iterative_receiver@test.com", "test_psw"});
+    client_sender.accountRegister({"iterative_sender@test.com", "test_psw"});
+
+    chord::Client recursive(node0_->getInfo());
+    ASSERT_EQ(recursive.accountLogin({"iterative_receiver@test.com", "test_psw"}).id, reg.id);
+
+    std::vector<mail::Message> messages;
+    for(int i = 0; i < 10; i++) {
+        mail::Message msg = getRandomMessage("iterative_sender@test.com");
+        msg.to = "iterative_receiver@test.com";
+        messages.push_back(msg);
+        client_sender.send(msg);
+    }
+    ASSERT_TRUE(client_receiver.getMessages());
+    auto messages_rec = client_receiver.getBox().getMessages();
+    ASSERT_EQ(messages_rec.size(), 10);
+    for(int i = 0; i < messages_rec.size(); i++) {
+        ASSERT_TRUE(messages_rec[i].compare(messages[i]));
+    }
+}
+
+TEST_F(NodeTest, SuccessorList) {
+    chord::NodeConfig config;
+    config.successor_list_size = 3;
+    config.rpc_timeout = 1000;
+    std::vector<chord::Node*> nodes = startRing(50110, 5, config);
+    // The lists grow by one node at each round of stabilize
+    std::this_thread::sleep_for(std::chrono::milliseconds(3500));
+    for(size_t i = 0; i < nodes.size(); i++) {
+        auto successors = nodes[i]->getSuccessors();
+        ASSERT_EQ(successors.size(), 3);
+        for(size_t j = 0; j < successors.size(); j++) {
+            ASSERT_EQ(successors[j], nodes[(i + 1 + j) % nodes.size()]->getInfo());
+        }
+    }
+
+    // The successor of the second node dies, the next one in the list takes his place
+    std::vector<chord::key_t> ids;
+    for(auto node : nodes) {
+        ids.push_back(node->getInfo().id);
+    }
+    nodes[2]->Stop();
+    const chord::NodeInfo &expected = nodes[3]->getInfo();
+    for(int i = 0; i < 10 && !(nodes[1]->getSuccessor() == expected && nodes[3]->getPredecessor() == nodes[1]->getInfo()); i++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    ASSERT_EQ(nodes[1]->getSuccessor(), expected);
+    ASSERT_EQ(nodes[3]->getPredecessor(), nodes[1]->getInfo());
+
+    // Requests are routed around the dead node
+    chord::Client client(nodes[0]->getInfo());
+    for(int i = 0; i < 5; i++) {
+        std::string user = "successor_list_" + std::to_string(i) + "@test.com";
+        chord::NodeInfo reg = client.accountRegister({user, "test_psw"});
+        ASSERT_FALSE(reg.id == ids[2]);
+        ASSERT_EQ(client.accountLogin({user, "test_psw"}).id, reg.id);
+    }
+}
+
+TEST_F(NodeTest, HedgedLookups) {
+    chord::NodeConfig config;
+    config.hedge_lookups = true;
+    config.hedge_percentile = 50;
+    std::vector<chord::Node*> nodes = startRing(50120, 4, config);
+
+    // Whichever copy answers first, every node must find the same mailbox
+    chord::Client client(nodes.front()->getInfo());
+    for(int i = 0; i < 20; i++) {
+        std::string user = "hedged_" + std::to_string(i) + "@test.com";
+        chord::NodeInfo reg = client.accountRegister({user, "test_psw"});
+        for(auto node : nodes) {
+            client.connectTo(node->getInfo());
+            ASSERT_EQ(client.accountLogin({user, "test_psw"}).id, reg.id);
+        }
+    }
+    uint64_t hedged = 0, wins = 0;
+    for(auto node : nodes) {
+        chord::NodeStats stats = node->getStats();
+        ASSERT_EQ(stats.deadlines_exceeded, 0);
+        hedged += stats.hedged_requests;
+        wins += stats.hedge_wins;
+    }
+    ASSERT_LE(wins, hedged);
+}
+
+TEST_F(NodeTest, OwnerCache) {
+    chord::Client client_receiver(node0_->getInfo()),
+                  client_sender(node0_->getInfo());
+    client_receiver.accountRegister({"cache_receiver@test.com", "test_psw"});
+    client_sender.accountRegister({"cache_sender@test.com", "test_psw"});
+
+    // Only the first message needs to look for the receiver's node
+    for(int i = 0; i < 10; i++) {
+        mail::Message msg = getRandomMessage("cache_sender@test.com");
+        msg.to = "cache_receiver@test.com";
+        client_sender.send(msg);
+    }
+    chord::RouteCache &cache = client_sender.getOwnerCache();
+    ASSERT_EQ(cache.hits(), 9);
+    ASSERT_TRUE(client_receiver.getMessages());
+    ASSERT_EQ(client_receiver.getBox().getSize(), 10);
+
+    // A wrong entry is dropped and the message is routed through the ring
+    cache.put(chord::hashString("cache_receiver@test.com"), node0_->getSuccessor());
+    mail::Message msg = getRandomMessage("cache_sender@test.com");
+    msg.to = "cache_receiver@test.com";
+    client_sender.send(msg);
+    ASSERT_TRUE(client_receiver.getMessages());
+    ASSERT_EQ(client_receiver.getBox().getSize(), 11);
+}
+
+TEST_F(NodeTest, NodeRouteCache) {
+    auto route_hits = [&]() {
+        uint64_t hits = 0;
+        for(auto node : ring_->getNodes()) {
+            hits += node->getStats().route_hits;
+        }
+        return hits;
+    };
+    // The receiver's node must ask another node to authenticate the sender
+    chord::Client client_sender(node0_->getInfo());
+    chord::NodeInfo sender_node = client_sender.accountRegister({"route_cache_sender@test.com", "test_psw"}),
+                    receiver_node;
+    std::string receiver;
+    for(int i = 0; receiver.empty() || receiver_node.id == sender_node.id; i++) {
+        receiver = "route_cache_receiver_" + std::to_string(i) + "@test.com";
+        chord::Client client_receiver(node0_->getInfo());
+        receiver_node = client_receiver.accountRegister({receiver, "test_psw"});
+    }
+
+    uint64_t before = route_hits();
+    for(int i = 0; i < 10; i++) {
+        mail::Message msg = getRandomMessage("route_cache_sender@test.com");
+        msg.to = receiver;
+        client_sender.send(msg);
+    }
+    // Only the first message needs to search the sender's node
+    ASSERT_GE(route_hits() - before, 9);
+
+    chord::Client client_receiver(node0_->getInfo());
+    client_receiver.accountLogin({receiver, "test_psw"});
+    ASSERT_TRUE(client_receiver.getMessages());
+    ASSERT_EQ(client_receiver.getBox().getSize(), 10);
+
+    chord::NodeStats stats = ring_->getNodes().front()->getStats();
+    ASSERT_GE(stats.routeHitRatio(), 0);
+    ASSERT_LE(stats.routeHitRatio(), 1);
+}
+
+TEST_F(NodeTest, Snapshots) {
+    chord::NodeConfig config;
+    config.snapshot_interval = 200;
+    chord::Node *node = startNode(50130, config);
+    chord::key_t id = node->getInfo().id;
+
+    chord::Client client(node->getInfo());
+    client.accountRegister({"snapshot_receiver@test.com", "test_psw"});
+    std::vector<mail::Message> messages;
+    for(int i = 0; i < 5; i++) {
+        mail::Message msg = getRandomMessage("snapshot_receiver@test.com");
+        msg.to = "snapshot_receiver@test.com";
+        messages.push_back(msg);
+        client.send(msg);
+    }
+    for(int i = 0; i < 20 && node->getStats().snapshots == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    chord::NodeStats stats = node->getStats();
+    ASSERT_GE(stats.snapshots, 1);
+    ASSERT_GE(stats.snapshot_records, 1);
+    ASSERT_TRUE(std::filesystem::exists(std::to_string(id) + ".snap"));
+    // Once the snapshot is durable the rotated log is not needed anymore
+    ASSERT_FALSE(std::filesystem::exists(std::to_string(id) + ".wal.old"));
+
+    // The last mutations are only in the log, a restart finds both
+    ASSERT_TRUE(client.getMessages());
+    client.remove(0);
+    stopNodes();
+    node = startNode(50130, config);
+    client.connectTo(node->getInfo());
+    client.accountLogin({"snapshot_receiver@test.com", "test_psw"});
+    ASSERT_TRUE(client.getMessages());
+    ASSERT_EQ(client.getBox().getSize(), 4);
+    for(int i = 0; i < 4; i++) {
+        ASSERT_TRUE(client.getBox().getMessage(i).compare(messages[i + 1]));
+    }
+
+    // Every snapshot writes a segment, after a restart the mailbox is read from the mapped file
+    config.snapshot_full_ratio = 0;
+    stopNodes();
+    node = startNode(50130, config);
+    stopNodes();
+    node = startNode(50130, config);
+    ASSERT_TRUE(std::filesystem::exists(std::to_string(id) + ".seg"));
+    ASSERT_GT(node->getStats().segment_bytes, 0);
+    ASSERT_EQ(node->getStats().resident_mailboxes, 0);
+    // The node answers before the segment is loaded in background
+    ASSERT_GT(node->getStats().time_to_first_request_us, 0);
+    for(int i = 0; i < 20 && node->getStats().time_to_fully_loaded_us == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_GE(node->getStats().time_to_fully_loaded_us, node->getStats().time_to_first_request_us);
+    client.connectTo(node->getInfo());
+    client.accountLogin({"snapshot_receiver@test.com", "test_psw"});
+    ASSERT_TRUE(client.getMessages());
+    ASSERT_EQ(client.getBox().getSize(), 4);
+    ASSERT_TRUE(client.getBox().getMessage(0).compare(messages[1]));
+    ASSERT_EQ(node->getStats().resident_mailboxes, 0);
+}
+
+TEST_F(NodeTest, MemoryBudget) {
+    chord::NodeConfig config;
+    config.memory_budget = 1;
+    config.snapshot_interval = 0;
+    // The bodies repeat a single character, compressed they would fit in the budget
+    config.compression_codec = "none";
+    chord::Node *node = startNode(50131, config);
+    chord::key_t id = node->getInfo().id;
+
+    chord::Client client(node->getInfo());
+    client.accountRegister({"budget_receiver@test.com", "test_psw"});
+    std::vector<mail::Message> messages;
+    for(int i = 0; i < 12; i++) {
+        mail::Message msg = getRandomMessage("budget_receiver@test.com");
+        msg.to = "budget_receiver@test.com";
+        msg.body = std::string(200 * 1024, 'a' + i);
+        messages.push_back(msg);
+        client.send(msg);
+    }
+    // The bodies beyond the budget are on disk, Receive reads them back
+    chord::NodeStats stats = node->getStats();
+    ASSERT_LE(stats.body_bytes, 1 << 20);
+    ASSERT_GT(stats.spilled_bodies, 0);
+    ASSERT_GT(stats.spill_file_bytes, 0);
+    ASSERT_TRUE(std::filesystem::exists(std::to_string(id) + ".bodies"));
+    ASSERT_TRUE(client.getMessages());
+    ASSERT_EQ(client.getBox().getSize(), messages.size());
+    for(size_t i = 0; i < messages.size(); i++) {
+        ASSERT_TRUE(client.getBox().getMessage(i).compare(messages[i]));
+    }
+    ASSERT_GT(node->getStats().spill_reads, 0);
+
+    stopNodes();
+    ASSERT_FALSE(std::filesystem::exists(std::to_string(id) + ".bodies"));
+}
+
+TEST_F(NodeTest, Compression) {
+    chord::NodeConfig config;
+    config.compression_threshold = 512;
+    config.snapshot_interval = 0;
+    chord::Node *node = startNode(50132, config);
+
+    chord::Client client(node->getInfo());
+    client.accountRegister({"compression_receiver@test.com", "test_psw"});
+    std::vector<mail::Message> messages;
+    for(int i = 0; i < 4; i++) {
+        mail::Message msg = getRandomMessage("compression_receiver@test.com");
+        msg.to = "compression_receiver@test.com";
+        msg.body = i % 2 == 0 ? std::string(100, 'a' + i) : std::string(64 * 1024, 'a' + i);
+        messages.push_back(msg);
+        client.send(msg);
+    }
+    // A body that looks compressed is received as it was sent
+    mail::Message tricky = getRandomMessage("compression_receiver@test.com");
+    tricky.to = "compression_receiver@test.com";
+    tricky.body = std::string("\0CZ\1", 4) + std::string(20, 'x');
+    messages.push_back(tricky);
+    client.send(tricky);
+
+    chord::NodeStats stats = node->getStats();
+    ASSERT_EQ(stats.compressed_bodies, 2);
+    ASSERT_EQ(stats.compression_input_bytes, 2 * 64 * 1024);
+    ASSERT_GT(stats.compressionRatio(), 10);
+    ASSERT_LT(stats.body_bytes, 64 * 1024);
+    ASSERT_TRUE(client.getMessages());
+    ASSERT_EQ(client.getBox().getSize(), messages.size());
+    for(size_t i = 0; i < messages.size(); i++) {
+        ASSERT_TRUE(client.getBox().getMessage(i).compare(messages[i]));
+    }
+    ASSERT_EQ(node->getStats().decompressed_bodies, 2);
+
+    // The snapshot keeps the compressed bodies, they're still decompressed after a restart
+    stopNodes();
+    node = startNode(50132, config);
+    client.connectTo(node->getInfo());
+    client.accountLogin({"compression_receiver@test.com", "test_psw"});
+    ASSERT_TRUE(client.getMessages());
+    ASSERT_EQ(client.getBox().getSize(), messages.size());
+    ASSERT_TRUE(client.getBox().getMessage(1).compare(messages[1]));
+    ASSERT_EQ(node->getStats().compressed_bodies, 0);
+}
+
+TEST_F(NodeTest, HeadersAndBodies) {
+    chord::NodeConfig config;
+    config.compression_threshold = 512;
+    config.snapshot_interval = 0;
+    chord::Node *node = startNode(50133, config);
+
+    chord::Client client(node->getInfo());
+    client.accountRegister({"headers_receiver@test.com", "test_psw"});
+    std::vector<mail::Message> messages;
+    for(int i = 0; i < 3; i++) {
+        mail::Message msg = getRandomMessage("headers_receiver@test.com");
+        msg.to = "headers_receiver@test.com";
+        msg.body = std::string(i == 1 ? 64 * 1024 : 100, 'a' + i);
+        messages.push_back(msg);
+        client.send(msg);
+    }
+
+    // Only the headers are downloaded, the sizes are the ones of the original bodies
+    ASSERT_TRUE(client.getHeaders());
+    ASSERT_EQ(client.getBox().getSize(), messages.size());
+    for(size_t i = 0; i < messages.size(); i++) {
+        const mail::Message &msg = client.getBox().getMessage(i);
+        ASSERT_EQ(msg.subject, messages[i].subject);
+        ASSERT_TRUE(msg.body.empty());
+        ASSERT_FALSE(client.hasBody(msg.id));
+        ASSERT_EQ(client.getBodySize(msg.id), messages[i].body.size());
+    }
+    ASSERT_EQ(node->getStats().decompressed_bodies, 0);
+
+    uint64_t big = client.getBox().getMessage(1).id;
+    ASSERT_TRUE(client.fetchBodies({big, 12345}));
+    ASSERT_TRUE(client.hasBody(big));
+    ASSERT_TRUE(client.getBox().getMessage(1).compare(messages[1]));
+    ASSERT_TRUE(client.getBox().getMessage(1).read);
+    ASSERT_EQ(node->getStats().decompressed_bodies, 1);
+
+    // A refresh keeps the bodies already downloaded
+    ASSERT_TRUE(client.getHeaders());
+    ASSERT_TRUE(client.hasBody(big));
+    ASSERT_TRUE(client.getBox().getMessage(1).compare(messages[1]));
+    ASSERT_FALSE(client.hasBody(client.getBox().getMessage(0).id));
+}
+
+TEST_F(NodeTest, ReceiveStream) {
+    chord::NodeConfig config;
+    config.receive_chunk_size = 64;
+    config.receive_chunk_messages = 4;
+    config.snapshot_interval = 0;
+    chord::Node *node = startNode(50134, config);
+
+    chord::Client client(node->getInfo());
+    client.accountRegister({"stream_receiver@test.com", "test_psw"});
+    std::vector<mail::Message> messages;
+    for(int i = 0; i < 20; i++) {
+        mail::Message msg = getRandomMessage("stream_receiver@test.com");
+        msg.to = "stream_receiver@test.com";
+        // Some bodies are bigger than a whole chunk, they travel alone
+        msg.body = std::string(i % 5 == 0 ? 100 * 1024 : 1000, 'a' + i);
+        messages.push_back(msg);
+        client.send(msg);
+    }
+
+    // The whole mailbox is received through many chunks
+    ASSERT_TRUE(client.getMessages());
+    ASSERT_EQ(client.getBox().getSize(), messages.size());
+    for(size_t i = 0; i < messages.size(); i++) {
+        ASSERT_TRUE(client.getBox().getMessage(i).compare(messages[i]));
+    }
+
+    // Pages from the most recent message
+    std::vector<mail::Message> page;
+    uint64_t next = 0;
+    size_t pages = 0;
+    do {
+        ASSERT_TRUE(client.getPage(next, 7, true, page, next));
+        pages++;
+    } while(next != 0);
+    ASSERT_EQ(pages, 3);
+    ASSERT_EQ(page.size(), messages.size());
+    for(size_t i = 0; i < page.size(); i++) {
+        ASSERT_TRUE(page[i].compare(messages[messages.size() - 1 - i]));
+    }
+
+    // A page starting from a given message in insertion order
+    page.clear();
+    uint64_t start = client.getBox().getMessage(15).id;
+    ASSERT_TRUE(client.getPage(start, 0, false, page, next));
+    ASSERT_EQ(page.size(), 5);
+    ASSERT_EQ(next, 0);
+    ASSERT_TRUE(page.front().compare(messages[15]));
+}
+
+TEST_F(NodeTest, Sync) {
+    chord::NodeConfig config;
+    config.receive_chunk_messages = 2;
+    config.snapshot_interval = 0;
+    chord::Node *node = startNode(50135, config);
+
+    chord::Client client(node->getInfo()), other(node->getInfo());
+    client.accountRegister({"sync_receiver@test.com", "test_psw"});
+    other.accountLogin({"sync_receiver@test.com", "test_psw"});
+    std::vector<mail::Message> messages;
+    auto sendMessages = [&](int count) {
+        for(int i = 0; i < count; i++) {
+            mail::Message msg = getRandomMessage("sync_receiver@test.com");
+            msg.to = "sync_receiver@test.com";
+            messages.push_back(msg);
+            other.send(msg);
+        }
+    };
+    auto checkBox = [&]() {
+        ASSERT_EQ(client.getBox().getSize(), messages.size());
+        for(size_t i = 0; i < messages.size(); i++) {
+            ASSERT_TRUE(client.getBox().getMessage(i).compare(messages[i]));
+        }
+    };
+
+    // The first call downloads the whole mailbox, the following ones only the new messages in many replies
+    sendMessages(3);
+    ASSERT_TRUE(client.sync());
+    checkBox();
+    sendMessages(5);
+    ASSERT_TRUE(client.sync());
+    checkBox();
+    ASSERT_TRUE(client.sync());
+    checkBox();
+
+    // Removals made by another client are applied
+    ASSERT_TRUE(other.getMessages());
+    other.removeById(other.getBox().getMessage(2).id);
+    messages.erase(messages.begin() + 2);
+    sendMessages(1);
+    ASSERT_TRUE(client.sync());
+    checkBox();
+
+    // A saved cache resumes from his version
+    ASSERT_TRUE(client.saveCache("sync_cache.dat"));
+    chord::Client resumed(node->getInfo());
+    resumed.accountLogin({"sync_receiver@test.com", "test_psw"});
+    ASSERT_TRUE(resumed.loadCache("sync_cache.dat"));
+    sendMessages(2);
+    ASSERT_TRUE(resumed.sync());
+    ASSERT_EQ(resumed.getBox().getSize(), messages.size());
+    ASSERT_TRUE(resumed.getBox().getMessage(messages.size() - 1).compare(messages.back()));
+    chord::Client stranger(node->getInfo());
+    stranger.accountRegister({"sync_stranger@test.com", "test_psw"});
+    ASSERT_FALSE(stranger.loadCache("sync_cache.dat"));
+
+    // After a restart the versions are not trusted, the whole mailbox is downloaded again
+    stopNodes();
+    node = startNode(50135, config);
+    client.connectTo(node->getInfo());
+    ASSERT_TRUE(client.sync());
+    checkBox();
+
+    std::filesystem::remove("sync_cache.dat");
+    std::filesystem::remove("sync_cache.dat.sync");
+}
+
+TEST_F(NodeTest, Watch) {
+    for(bool async : {false, true}) {
+        chord::NodeConfig config;
+        config.async_server = async;
+        config.snapshot_interval = 0;
+        chord::Node *node = startNode(async ? 50137 : 50136, config);
+
+        chord::Client client(node->getInfo()), sender(node->getInfo());
+        client.accountRegister({"watch_receiver@test.com", "test_psw"});
+        sender.accountRegister({"watch_sender@test.com", "test_psw"});
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<mail::Message> received;
+        std::vector<grpc::StatusCode> ends;
+        auto onMessage = [&](const mail::Message &msg) {
+            std::lock_guard<std::mutex> lock(mutex);
+            received.push_back(msg);
+            changed.notify_all();
+        };
+        auto onEnd = [&](const grpc::Status &status) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ends.push_back(status.error_code());
+            changed.notify_all();
+        };
+        auto waitFor = [&](size_t messages, size_t closed) {
+            std::unique_lock<std::mutex> lock(mutex);
+            return changed.wait_for(lock, std::chrono::seconds(5), [&]() { return received.size() >= messages && ends.size() >= closed; });
+        };
+
+        // The headers of the new messages are pushed as soon as they're inserted
+        ASSERT_TRUE(client.watch(onMessage, onEnd));
+        ASSERT_EQ(node->getStats().watchers, 1);
+        std::vector<mail::Message> messages;
+        for(int i = 0; i < 3; i++) {
+            mail::Message msg = getRandomMessage("watch_sender@test.com");
+            msg.to = "watch_receiver@test.com";
+            messages.push_back(msg);
+            sender.send(msg);
+        }
+        ASSERT_TRUE(waitFor(3, 0));
+        ASSERT_TRUE(client.sync());
+        for(size_t i = 0; i < messages.size(); i++) {
+            ASSERT_EQ(received[i].subject, messages[i].subject);
+            ASSERT_TRUE(received[i].body.empty());
+            ASSERT_TRUE(client.getBox().findMessage(received[i].id)->compare(messages[i]));
+        }
+        ASSERT_EQ(node->getStats().watch_notifications, 3);
+
+        // A watcher that goes away is removed
+        client.unwatch();
+        ASSERT_TRUE(waitFor(3, 1));
+        ASSERT_EQ(ends.back(), grpc::StatusCode::CANCELLED);
+        for(int i = 0; i < 20 && node->getStats().watchers > 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        ASSERT_EQ(node->getStats().watchers, 0);
+
+        // The watchers are closed when the node stops
+        ASSERT_TRUE(client.watch(onMessage, onEnd));
+        stopNodes();
+        ASSERT_TRUE(waitFor(3, 2));
+        ASSERT_EQ(ends.back(), grpc::StatusCode::UNAVAILABLE);
+        client.unwatch();
+    }
+}
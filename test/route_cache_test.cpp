@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+
+#include <chord/route_cache.hpp>
+
+TEST(RouteCacheTest, LeastRecentlyUsed) {
+    chord::RouteCache cache(3);
+    chord::NodeInfo owner;
+    for(chord::key_t key = 0; key < 3; key++) {
+        cache.put(key, {"127.0.0.1", static_cast<int>(50000 + key), key});
+    }
+    // Using the oldest key makes the second one the next to be discarded
+    ASSERT_TRUE(cache.get(0, owner));
+    ASSERT_EQ(owner.port, 50000);
+    cache.put(3, {"127.0.0.1", 50003, 3});
+    ASSERT_EQ(cache.size(), 3);
+    ASSERT_FALSE(cache.get(1, owner));
+    ASSERT_TRUE(cache.get(0, owner));
+    ASSERT_TRUE(cache.get(2, owner));
+    ASSERT_TRUE(cache.get(3, owner));
+    ASSERT_EQ(cache.hits(), 4);
+    ASSERT_EQ(cache.misses(), 1);
+}
+
+TEST(RouteCacheTest, Expiration) {
+    chord::RouteCache cache(10, std::chrono::milliseconds(50));
+    chord::NodeInfo owner;
+    cache.put(1, {"127.0.0.1", 50001, 1});
+    ASSERT_TRUE(cache.get(1, owner));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_FALSE(cache.get(1, owner));
+    ASSERT_EQ(cache.size(), 0);
+}
+
+TEST(RouteCacheTest, EraseOwner) {
+    chord::RouteCache cache(10);
+    chord::NodeInfo dead = {"127.0.0.1", 50001, 1},
+                    alive = {"127.0.0.1", 50002, 2},
+                    owner;
+    cache.put(10, dead);
+    cache.put(11, alive);
+    cache.put(12, dead);
+    cache.erase(dead);
+    ASSERT_EQ(cache.size(), 1);
+    ASSERT_FALSE(cache.get(10, owner));
+    ASSERT_TRUE(cache.get(11, owner));
+    ASSERT_EQ(owner, alive);
+    cache.erase(11);
+    ASSERT_EQ(cache.size(), 0);
+
+    // The interval wraps around the ring
+    for(chord::key_t key : {5, 10, 20, 30}) {
+        cache.put(key, alive);
+    }
+    cache.eraseRange(25, 10);
+    ASSERT_EQ(cache.size(), 1);
+    ASSERT_TRUE(cache.get(20, owner));
+    cache.eraseRange(10, 20);
+    ASSERT_EQ(cache.size(), 0);
+
+    chord::RouteCache disabled(0);
+    disabled.put(1, alive);
+    ASSERT_FALSE(disabled.get(1, owner));
+}
@@ -0,0 +1,293 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <chord/segment.hpp>
+
+class SegmentTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::filesystem::remove(path_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(path_);
+    }
+
+    static mail::MailBox makeBox(const std::string &owner, int messages) {
+        mail::MailBox box(owner, "psw");
+        for(int i = 0; i < messages; i++) {
+            box.insertMessage({owner, "sender@test.com", "subject " + std::to_string(i), std::string(i * 100, 'x')});
+        }
+        return box;
+    }
+
+    const std::string path_ = "segment_test.seg";
+};
+
+TEST_F(SegmentTest, WriteAndRead) {
+    std::vector<mail::MailBox> boxes = {makeBox("a@test.com", 0), makeBox("b@test.com", 3), makeBox("c@test.com", 10)};
+    boxes[2].removeMessage(4);
+    {
+        chord::SegmentWriter writer(path_, 7, boxes.size() + 2);
+        std::string record;
+        for(size_t i = 0; i < boxes.size(); i++) {
+            record.clear();
+            chord::SegmentWriter::encode(chord::MailboxView(boxes[i]), record);
+            ASSERT_TRUE(writer.add(static_cast<chord::key_t>(i * 10), record));
+        }
+        // Keys must be ascending
+        ASSERT_FALSE(writer.add(5, record));
+        ASSERT_TRUE(writer.finish());
+    }
+
+    auto segment = chord::Segment::open(path_);
+    ASSERT_NE(segment, nullptr);
+    ASSERT_EQ(segment->generation(), 7);
+    ASSERT_EQ(segment->size(), 3);
+    ASSERT_EQ(segment->keyAt(1), 10);
+    ASSERT_EQ(segment->lowerBound(11), 2);
+    ASSERT_TRUE(segment->contains(20));
+    ASSERT_FALSE(segment->contains(15));
+
+    for(size_t i = 0; i < boxes.size(); i++) {
+        chord::MailboxView view;
+        ASSERT_TRUE(segment->find(static_cast<chord::key_t>(i * 10), view));
+        ASSERT_EQ(view.owner(), boxes[i].getOwner());
+        ASSERT_EQ(view.password(), boxes[i].getPassword());
+        ASSERT_EQ(view.size(), boxes[i].getSize());
+        std::vector<mail::Message> expected = boxes[i].getMessages(), read;
+        view.forEachMessage([&read](const chord::MessageView &msg) { read.push_back(msg.toMessage()); });
+        ASSERT_EQ(read.size(), expected.size());
+        for(size_t j = 0; j < read.size(); j++) {
+            ASSERT_TRUE(read[j].compare(expected[j]));
+            ASSERT_EQ(read[j].id, expected[j].id);
+        }
+        // Ids survive the copy on the heap
+        mail::MailBox copy = view.toMailBox();
+        ASSERT_EQ(copy.getSize(), boxes[i].getSize());
+        if(!expected.empty()) {
+            ASSERT_NE(copy.findMessage(expected.back().id), nullptr);
+        }
+    }
+}
+
+TEST_F(SegmentTest, Invalid) {
+    ASSERT_EQ(chord::Segment::open(path_), nullptr);
+    {
+        std::ofstream os(path_);
+        os << "not a segment, just some text long enough for a header";
+    }
+    ASSERT_THROW(chord::Segment::open(path_), std::runtime_error);
+
+    // An unfinished segment is not valid
+    {
+        chord::SegmentWriter writer(path_, 1, 1);
+        std::string record;
+        chord::SegmentWriter::encode(chord::MailboxView(makeBox("a@test.com", 1)), record);
+        writer.add(1, record);
+    }
+    ASSERT_THROW(chord::Segment::open(path_), std::runtime_error);
+}
+
+TEST_F(SegmentTest, TruncatedRecord) {
+    {
+        chord::SegmentWriter writer(path_, 1, 1);
+        std::string record;
+        chord::SegmentWriter::encode(chord::MailboxView(makeBox("a@test.com", 5)), record);
+        writer.add(1, record);
+        ASSERT_TRUE(writer.finish());
+    }
+    // Cuts the body of the last message
+    std::filesystem::resize_file(path_, std::filesystem::file_size(path_) - 10);
+    auto segment = chord::Segment::open(path_);
+    chord::MailboxView view;
+    ASSERT_FALSE(segment->find(1, view));
+}
+
+TEST_F(SegmentTest, Load) {
+    {
+        chord::SegmentWriter writer(path_, 1, 100);
+        std::string record;
+        for(chord::key_t key = 0; key < 100; key++) {
+            record.clear();
+            chord::SegmentWriter::encode(chord::MailboxView(makeBox("user" + std::to_string(key), 5)), record);
+            ASSERT_TRUE(writer.add(key, record));
+        }
+        ASSERT_TRUE(writer.finish());
+    }
+    auto segment = chord::Segment::open(path_);
+    ASSERT_EQ(segment->load(0, 100), 100);
+    ASSERT_EQ(segment->load(40, 60), 20);
+    // The range is clamped to the index
+    ASSERT_EQ(segment->load(90, 1000), 10);
+    ASSERT_EQ(segment->load(60, 40), 0);
+}
+
+TEST_F(SegmentTest, Checksums) {
+    std::vector<uint64_t> offsets;
+    {
+        chord::SegmentWriter writer(path_, 1, 10);
+        std::string record;
+        uint64_t offset = 32 + 10 * 24;
+        for(chord::key_t key = 0; key < 10; key++) {
+            record.clear();
+            chord::SegmentWriter::encode(chord::MailboxView(makeBox("user" + std::to_string(key), 3)), record);
+            ASSERT_TRUE(writer.add(key, record));
+            offsets.push_back(offset);
+            offset += record.size();
+        }
+        ASSERT_TRUE(writer.finish());
+    }
+    // Flips a byte of the body of the last message of the mailbox 4
+    {
+        std::fstream fs(path_, std::ios::in | std::ios::out | std::ios::binary);
+        fs.seekp(offsets[5] - 1);
+        fs.put('#');
+    }
+    auto segment = chord::Segment::open(path_);
+    ASSERT_EQ(segment->version(), chord::Segment::VERSION);
+    chord::MailboxView view;
+    ASSERT_FALSE(segment->find(4, view));
+    ASSERT_TRUE(segment->contains(4));
+    ASSERT_EQ(segment->corrupt(), 1);
+    // The other mailboxes are still served
+    ASSERT_TRUE(segment->find(5, view));
+    ASSERT_EQ(segment->load(0, 10), 9);
+    ASSERT_EQ(segment->corrupt(), 1);
+}
+
+TEST_F(SegmentTest, SelectedMessages) {
+    mail::MailBox box = makeBox("a@test.com", 10);
+    std::vector<uint64_t> ids = {box.getMessage(2).id, box.getMessage(7).id, 1000, box.getMessage(2).id};
+    {
+        chord::SegmentWriter writer(path_, 1, 1);
+        std::string record;
+        chord::SegmentWriter::encode(chord::MailboxView(box), record);
+        ASSERT_TRUE(writer.add(1, record));
+        ASSERT_TRUE(writer.finish());
+    }
+    auto segment = chord::Segment::open(path_);
+    chord::MailboxView record;
+    ASSERT_TRUE(segment->find(1, record));
+    std::vector<uint64_t> visited;
+    record.forEachMessage(ids, [&visited](const chord::MessageView &msg) { visited.push_back(msg.id); });
+    std::sort(visited.begin(), visited.end());
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[0], ids[1]}));
+
+    // Only the bodies of the selected messages are loaded
+    mail::MailBox empty = box;
+    empty.forEachBody([](uint64_t id, std::string &body) { body.clear(); });
+    size_t loads = 0;
+    chord::MailboxView heap(empty, [&box, &loads](uint64_t id, std::string &body) {
+        loads++;
+        body = box.findMessage(id)->body;
+        return true;
+    });
+    visited.clear();
+    heap.forEachMessage(ids, [&](const chord::MessageView &msg) {
+        visited.push_back(msg.id);
+        ASSERT_EQ(msg.body, box.findMessage(msg.id)->body);
+    });
+    std::sort(visited.begin(), visited.end());
+    ASSERT_EQ(visited, std::vector<uint64_t>({ids[0], ids[1]}));
+    ASSERT_EQ(loads, 2);
+    ASSERT_FALSE(heap.lost());
+
+    // A body that can't be loaded is left empty and reported
+    chord::MailboxView broken(empty, [](uint64_t id, std::string &body) { return false; });
+    ASSERT_TRUE(broken.toMailBox().findMessage(ids[0])->body.empty());
+    ASSERT_TRUE(broken.lost());
+}
+
+TEST_F(SegmentTest, VisitFrom) {
+    mail::MailBox box = makeBox("a@test.com", 10);
+    std::vector<uint64_t> ids;
+    box.forEachMessage([&ids](const mail::Message &msg) { ids.push_back(msg.id); });
+    box.removeMessageById(ids[5]);
+    {
+        chord::SegmentWriter writer(path_, 1, 1);
+        std::string record;
+        chord::SegmentWriter::encode(chord::MailboxView(box), record);
+        ASSERT_TRUE(writer.add(1, record));
+        ASSERT_TRUE(writer.finish());
+    }
+    auto segment = chord::Segment::open(path_);
+    chord::MailboxView record, heap(box);
+    ASSERT_TRUE(segment->find(1, record));
+
+    // Both kinds of view visit the same pages
+    for(const chord::MailboxView *view : {&heap, &record}) {
+        auto visit = [view](uint64_t id, bool newest_first, size_t max) {
+            std::vector<uint64_t> visited;
+            view->forEachMessageFrom(id, newest_first, max, [&visited](const chord::MessageView &msg) {
+                visited.push_back(msg.id);
+                return true;
+            });
+            return visited;
+        };
+        ASSERT_EQ(visit(0, false, 3), std::vector<uint64_t>({ids[0], ids[1], ids[2]}));
+        ASSERT_EQ(visit(0, true, 3), std::vector<uint64_t>({ids[9], ids[8], ids[7]}));
+        ASSERT_EQ(visit(ids[4], false, 3), std::vector<uint64_t>({ids[4], ids[6], ids[7]}));
+        ASSERT_EQ(visit(ids[5], true, 2), std::vector<uint64_t>({ids[4], ids[3]}));
+        ASSERT_EQ(visit(ids[1], true, 5), std::vector<uint64_t>({ids[1], ids[0]}));
+        ASSERT_TRUE(visit(ids[9] + 1, false, 5).empty());
+        ASSERT_TRUE(visit(0, true, 0).empty());
+        // The visitor can stop the visit
+        std::vector<uint64_t> visited;
+        view->forEachMessageFrom(0, true, 10, [&visited](const chord::MessageView &msg) {
+            visited.push_back(msg.id);
+            return visited.size() < 2;
+        });
+        ASSERT_EQ(visited, std::vector<uint64_t>({ids[9], ids[8]}));
+    }
+}
+
+TEST_F(SegmentTest, Version) {
+    mail::MailBox box = makeBox("a@test.com", 5);
+    box.removeMessage(4);
+    box.removeMessage(3);
+    ASSERT_GT(box.getVersion(), box.getMessage(2).id);
+    {
+        chord::SegmentWriter writer(path_, 1, 1);
+        std::string record;
+        chord::SegmentWriter::encode(chord::MailboxView(box), record);
+        ASSERT_TRUE(writer.add(1, record));
+        ASSERT_TRUE(writer.finish());
+    }
+    auto segment = chord::Segment::open(path_);
+    chord::MailboxView view;
+    ASSERT_TRUE(segment->find(1, view));
+    // The version survives the removal of the last messages
+    ASSERT_EQ(view.version(), box.getVersion());
+    ASSERT_TRUE(view.forEachRemoval(box.getVersion(), [](uint64_t, uint64_t) {}));
+    ASSERT_FALSE(view.forEachRemoval(box.getVersion() - 1, [](uint64_t, uint64_t) {}));
+    mail::MailBox copy = view.toMailBox();
+    ASSERT_EQ(copy.getVersion(), box.getVersion());
+    ASSERT_GT(copy.insertMessage({"a@test.com", "b@test.com", "new", "body"}), box.getVersion());
+
+    // The records of version 2 don't store it, the identifier of the last message is used
+    {
+        chord::SegmentWriter writer(path_, 1, 1);
+        std::string record;
+        chord::SegmentWriter::encode(chord::MailboxView(box), record);
+        record.erase(sizeof(uint32_t) + box.getOwner().size() + sizeof(int64_t) + sizeof(uint32_t), sizeof(uint64_t));
+        ASSERT_TRUE(writer.add(1, record));
+        ASSERT_TRUE(writer.finish());
+    }
+    {
+        std::fstream fs(path_, std::ios::in | std::ios::out | std::ios::binary);
+        uint32_t version = 2;
+        fs.seekp(8);
+        fs.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    }
+    segment = chord::Segment::open(path_);
+    ASSERT_EQ(segment->version(), 2);
+    ASSERT_TRUE(segment->find(1, view));
+    ASSERT_EQ(view.size(), 3);
+    ASSERT_EQ(view.version(), box.getMessage(2).id);
+}
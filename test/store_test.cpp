@@ -0,0 +1,323 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/map.hpp>
+
+#include <chord/mailbox_store.hpp>
+
+TEST(MailboxStoreTest, Basic) {
+    chord::MailboxStore store(4);
+    ASSERT_TRUE(store.empty());
+    ASSERT_TRUE(store.insert(1, {"user1", "psw"}));
+    ASSERT_FALSE(store.insert(1, {"other", "psw"}));
+    ASSERT_TRUE(store.insert(2, {"user2", "psw"}));
+    ASSERT_EQ(store.size(), 2);
+    ASSERT_TRUE(store.contains(1));
+    ASSERT_FALSE(store.contains(3));
+
+    // The callback runs only for a new key and can refuse the mailbox
+    int calls = 0;
+    ASSERT_FALSE(store.insert(1, {"other", "psw"}, [&calls]() { calls++; return true; }));
+    ASSERT_FALSE(store.insert(4, {"user4", "psw"}, [&calls]() { calls++; return false; }));
+    ASSERT_EQ(calls, 1);
+    ASSERT_FALSE(store.contains(4));
+
+    ASSERT_TRUE(store.write(1, [](mail::MailBox &box) {
+        box.insertMessage({"user1", "user2", "subject", "body"});
+    }));
+    ASSERT_FALSE(store.write(3, [](mail::MailBox &box) {}));
+    std::string owner;
+    size_t messages = 0;
+    ASSERT_TRUE(store.read(1, [&](const mail::MailBox &box) {
+        owner = box.getOwner();
+        messages = box.getSize();
+    }));
+    ASSERT_EQ(owner, "user1");
+    ASSERT_EQ(messages, 1);
+
+    // Mailboxes already present are left in the source
+    std::map<chord::key_t, mail::MailBox> boxes = {{2, {"user2", "psw"}}, {3, {"user3", "psw"}}};
+    store.merge(boxes);
+    ASSERT_EQ(store.size(), 3);
+    ASSERT_EQ(boxes.size(), 1);
+    ASSERT_EQ(boxes.count(2), 1);
+
+    ASSERT_TRUE(store.erase(2));
+    ASSERT_FALSE(store.erase(2));
+    ASSERT_EQ(store.size(), 2);
+
+    // A mailbox modified after the copy is kept
+    uint64_t version = 0;
+    store.read(1, [&version](const mail::MailBox &box) { version = box.getVersion(); });
+    store.write(1, [](mail::MailBox &box) { box.insertMessage({"user1", "user3", "subject", "body"}); });
+    ASSERT_FALSE(store.erase(1, version));
+    ASSERT_TRUE(store.contains(1));
+    ASSERT_TRUE(store.erase(1, version + 1));
+    ASSERT_FALSE(store.contains(1));
+}
+
+TEST(MailboxStoreTest, Range) {
+    chord::MailboxStore store(4);
+    for(chord::key_t key = 100; key > 0; key -= 3) {
+        store.insert(key, {"user" + std::to_string(key), "psw"});
+    }
+    store.erase(7);
+    std::vector<chord::key_t> visited;
+    store.forRange(5, 20, [&visited](chord::key_t key, const mail::MailBox &box) {
+        visited.push_back(key);
+    });
+    ASSERT_EQ(visited, std::vector<chord::key_t>({10, 13, 16, 19}));
+    ASSERT_TRUE(store.keys(20, 5).empty());
+    ASSERT_EQ(store.keys(0, 1000).size(), 33);
+}
+
+TEST(MailboxStoreTest, DirtyKeys) {
+    chord::MailboxStore store(4);
+    store.insert(1, {"user1", "psw"});
+    store.insert(2, {"user2", "psw"});
+    store.insert(3, {"user3", "psw"});
+    auto dirty = store.takeDirty();
+    std::sort(dirty.begin(), dirty.end());
+    ASSERT_EQ(dirty, std::vector<chord::key_t>({1, 2, 3}));
+    ASSERT_TRUE(store.takeDirty().empty());
+
+    // Reads don't mark the mailboxes, failed modifications neither
+    store.read(1, [](const mail::MailBox &box) {});
+    store.insert(1, {"other", "psw"});
+    store.write(4, [](mail::MailBox &box) {});
+    ASSERT_TRUE(store.takeDirty().empty());
+
+    store.write(2, [](mail::MailBox &box) {});
+    store.erase(3);
+    dirty = store.takeDirty();
+    std::sort(dirty.begin(), dirty.end());
+    ASSERT_EQ(dirty, std::vector<chord::key_t>({2, 3}));
+}
+
+TEST(MailboxStoreTest, Segment) {
+    const std::string path = "store_test.seg";
+    {
+        chord::SegmentWriter writer(path, 1, 3);
+        std::string record;
+        for(chord::key_t key = 1; key <= 3; key++) {
+            mail::MailBox box("user" + std::to_string(key), "psw");
+            box.insertMessage({box.getOwner(), "sender", "subject", "body"});
+            record.clear();
+            chord::SegmentWriter::encode(chord::MailboxView(box), record);
+            ASSERT_TRUE(writer.add(key, record));
+        }
+        ASSERT_TRUE(writer.finish());
+    }
+    chord::MailboxStore store(4);
+    store.insert(10, {"user10", "psw"});
+    store.attach(chord::Segment::open(path));
+    ASSERT_EQ(store.size(), 4);
+    ASSERT_EQ(store.resident(), 1);
+    ASSERT_TRUE(store.contains(2));
+    ASSERT_FALSE(store.insert(2, {"other", "psw"}));
+    ASSERT_EQ(store.keys(0, 100), std::vector<chord::key_t>({1, 2, 3, 10}));
+
+    // Reads don't copy the mailboxes of the segment, writes do
+    std::string owner;
+    ASSERT_TRUE(store.view(2, [&owner](const chord::MailboxView &box) { owner = std::string(box.owner()); }));
+    ASSERT_EQ(owner, "user2");
+    ASSERT_EQ(store.resident(), 1);
+    ASSERT_TRUE(store.write(2, [](mail::MailBox &box) { box.insertMessage({"user2", "sender", "subject", "body"}); }));
+    ASSERT_EQ(store.resident(), 2);
+    ASSERT_EQ(store.size(), 4);
+    size_t messages = 0;
+    store.read(2, [&messages](const mail::MailBox &box) { messages = box.getSize(); });
+    ASSERT_EQ(messages, 2);
+
+    // Removed mailboxes of the segment stay removed
+    ASSERT_TRUE(store.erase(3));
+    ASSERT_FALSE(store.erase(3));
+    ASSERT_FALSE(store.contains(3));
+    ASSERT_EQ(store.size(), 3);
+    ASSERT_EQ(store.keys(0, 100), std::vector<chord::key_t>({1, 2, 10}));
+    ASSERT_TRUE(store.insert(3, {"user3", "new"}));
+    ASSERT_EQ(store.size(), 4);
+
+    // Attaching the same segment again drops the copies that were not modified
+    store.takeDirty();
+    store.attach(chord::Segment::open(path));
+    ASSERT_EQ(store.resident(), 1);
+    ASSERT_EQ(store.size(), 4);
+    store.clear();
+    ASSERT_TRUE(store.empty());
+    ASSERT_EQ(store.segment(), nullptr);
+    std::filesystem::remove(path);
+}
+
+TEST(MailboxStoreTest, MemoryBudget) {
+    const std::string path = "store_test.bodies";
+    chord::MailboxStore store(4);
+    auto bodies = std::make_shared<chord::BodyStore>(path);
+    store.setBudget(10000, bodies);
+    for(chord::key_t key = 0; key < 10; key++) {
+        mail::MailBox box("user" + std::to_string(key), "psw");
+        box.insertMessage({box.getOwner(), "sender", "subject", std::string(500, 'a' + key)});
+        store.insert(key, box);
+    }
+    ASSERT_EQ(store.bodyBytes(), 5000);
+    ASSERT_EQ(store.spilledBodies(), 0);
+
+    // Mailbox 0 is the most recently used, so his bodies are the last ones moved to disk
+    store.view(0, [](const chord::MailboxView &) {});
+    for(chord::key_t key = 0; key < 10; key++) {
+        ASSERT_TRUE(store.write(key, [key](mail::MailBox &box) {
+            box.insertMessage({box.getOwner(), "sender", "subject", std::string(1000, 'a' + key)});
+        }));
+    }
+    ASSERT_LE(store.bodyBytes(), 10000);
+    ASSERT_GT(store.spilledBodies(), 0);
+    ASSERT_GT(bodies->bytes(), 0);
+
+    // The headers stay in memory, the bodies are read back from disk
+    for(chord::key_t key = 0; key < 10; key++) {
+        std::vector<std::string> read;
+        ASSERT_TRUE(store.view(key, [&read](const chord::MailboxView &box) {
+            box.forEachMessage([&read](const chord::MessageView &msg) { read.push_back(std::string(msg.body)); });
+        }));
+        ASSERT_EQ(read, std::vector<std::string>({std::string(500, 'a' + key), std::string(1000, 'a' + key)}));
+        mail::MailBox copy;
+        store.read(key, [&copy](const mail::MailBox &box) { copy = box; });
+        ASSERT_EQ(copy.getMessage(0).body, read[0]);
+        ASSERT_EQ(copy.getBodyBytes(), 1500);
+    }
+    ASSERT_GT(bodies->reads(), 0);
+
+    // Removing the mailboxes releases the bodies on disk, the next spill starts the file again
+    for(chord::key_t key = 0; key < 10; key++) {
+        store.erase(key);
+    }
+    ASSERT_EQ(store.bodyBytes(), 0);
+    ASSERT_EQ(store.spilledBodies(), 0);
+    mail::MailBox big("big", "psw");
+    big.insertMessage({"big", "sender", "subject", std::string(20000, 'z')});
+    store.insert(100, big);
+    ASSERT_EQ(store.bodyBytes(), 0);
+    ASSERT_EQ(bodies->bytes(), 20000);
+    std::string body;
+    store.read(100, [&body](const mail::MailBox &box) { body = box.getMessage(0).body; });
+    ASSERT_EQ(body, std::string(20000, 'z'));
+}
+
+TEST(MailboxStoreTest, Dedup) {
+    chord::MailboxStore store(4);
+    store.setDedup(100);
+    const std::string newsletter(5000, 'n');
+    for(chord::key_t key = 0; key < 10; key++) {
+        mail::MailBox box("user" + std::to_string(key), "psw");
+        box.insertMessage({box.getOwner(), "sender", "welcome", newsletter});
+        store.insert(key, box);
+        store.write(key, [&newsletter](mail::MailBox &box) {
+            box.insertMessage({box.getOwner(), "sender", "news", newsletter});
+            box.insertMessage({box.getOwner(), "sender", "short", "not shared"});
+        });
+    }
+    ASSERT_EQ(store.sharedBodies(), 20);
+    ASSERT_EQ(store.sharedBytes(), 20 * newsletter.size());
+    ASSERT_EQ(store.blobs().size(), 1);
+    ASSERT_EQ(store.blobs().bytes(), newsletter.size());
+    ASSERT_EQ(store.bodyBytes(), 10 * std::string("not shared").size());
+
+    // The shared bodies are put back in the mailboxes that are read
+    std::vector<std::string> bodies;
+    store.view(3, [&bodies](const chord::MailboxView &box) {
+        box.forEachMessage([&bodies](const chord::MessageView &msg) { bodies.push_back(std::string(msg.body)); });
+    });
+    ASSERT_EQ(bodies, std::vector<std::string>({newsletter, newsletter, "not shared"}));
+    mail::MailBox copy;
+    store.read(3, [&copy](const mail::MailBox &box) { copy = box; });
+    ASSERT_EQ(copy.getMessage(1).body, newsletter);
+
+    // Removing messages and mailboxes releases their references, the blob goes away with the last one
+    for(chord::key_t key = 0; key < 10; key++) {
+        store.write(key, [](mail::MailBox &box) { box.removeMessage(0); });
+    }
+    ASSERT_EQ(store.sharedBodies(), 10);
+    for(chord::key_t key = 0; key < 9; key++) {
+        store.erase(key);
+    }
+    ASSERT_EQ(store.sharedBodies(), 1);
+    ASSERT_EQ(store.blobs().size(), 1);
+    store.erase(9);
+    ASSERT_EQ(store.sharedBodies(), 0);
+    ASSERT_EQ(store.sharedBytes(), 0);
+    ASSERT_EQ(store.blobs().size(), 0);
+}
+
+TEST(MailboxStoreTest, Serialization) {
+    chord::MailboxStore store;
+    for(chord::key_t key = 0; key < 100; key++) {
+        store.insert(key, {"user" + std::to_string(key), "psw"});
+    }
+    std::stringstream ss;
+    {
+        cereal::BinaryOutputArchive archive(ss);
+        archive(store);
+    }
+    // The store is saved with the same format of the map it replaced
+    std::map<chord::key_t, mail::MailBox> boxes;
+    {
+        std::stringstream copy(ss.str());
+        cereal::BinaryInputArchive archive(copy);
+        archive(boxes);
+    }
+    ASSERT_EQ(boxes.size(), 100);
+    ASSERT_EQ(boxes.at(42).getOwner(), "user42");
+
+    chord::MailboxStore loaded(3);
+    cereal::BinaryInputArchive archive(ss);
+    archive(loaded);
+    ASSERT_EQ(loaded.size(), 100);
+    ASSERT_EQ(loaded.snapshot().size(), 100);
+}
+
+TEST(MailboxStoreTest, ConcurrentAccess) {
+    const int threads = 8, keys = 64, iterations = 2000;
+    chord::MailboxStore store(4);
+    for(chord::key_t key = 0; key < keys; key++) {
+        store.insert(key, {"user" + std::to_string(key), "psw"});
+    }
+
+    // Every thread adds messages to all the mailboxes while reading, inserting and erasing others
+    std::atomic<int> inconsistent(0);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            for(int i = 0; i < iterations; i++) {
+                chord::key_t key = i % keys;
+                store.write(key, [](mail::MailBox &box) {
+                    box.insertMessage({"to", "from", "subject", "body"});
+                });
+                store.read((key + t) % keys, [&](const mail::MailBox &box) {
+                    if(static_cast<size_t>(box.getSize()) != box.getMessages().size()) {
+                        inconsistent++;
+                    }
+                });
+                chord::key_t temporary = keys + t * iterations + i;
+                store.insert(temporary, {"temporary", "psw"});
+                store.erase(temporary);
+            }
+        });
+    }
+    for(auto &worker : workers) {
+        worker.join();
+    }
+
+    ASSERT_EQ(inconsistent, 0);
+    ASSERT_EQ(store.size(), keys);
+    size_t messages = 0;
+    store.forEach([&messages](chord::key_t key, const mail::MailBox &box) {
+        messages += box.getSize();
+    });
+    ASSERT_EQ(messages, static_cast<size_t>(threads * iterations));
+}
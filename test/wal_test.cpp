@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <chord/wal.hpp>
+
+class WalTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::filesystem::remove(path_);
+        std::filesystem::remove(archive_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(path_);
+        std::filesystem::remove(archive_);
+    }
+
+    std::vector<chord::WalRecord> replay() {
+        return replay(path_);
+    }
+
+    std::vector<chord::WalRecord> replay(const std::string &path) {
+        std::vector<chord::WalRecord> records;
+        chord::WriteAheadLog::replay(path, [&records](const chord::WalRecord &record) {
+            records.push_back(record);
+        });
+        return records;
+    }
+
+    const std::string path_ = "wal_test.wal",
+                      archive_ = "wal_test.wal.old";
+};
+
+TEST_F(WalTest, Replay) {
+    mail::MailBox box("wal@test.com", "psw");
+    mail::Message msg("wal@test.com", "sender@test.com", "subject", "body");
+    msg.id = 7;
+    box.insertMessage(msg);
+    box.insertMessage(mail::Message("wal@test.com", "sender@test.com", "removed", "body"));
+    box.removeMessageById(8);
+    {
+        chord::WriteAheadLog wal(path_, chord::WalMode::ALWAYS);
+        ASSERT_TRUE(wal.append(chord::WalRecord::insertMailbox(1, box)));
+        ASSERT_TRUE(wal.append(chord::WalRecord::send(1, msg)));
+        ASSERT_TRUE(wal.append(chord::WalRecord::remove(1, 7)));
+        ASSERT_TRUE(wal.append(chord::WalRecord::transfer(2, box)));
+        ASSERT_TRUE(wal.append(chord::WalRecord::erase(3)));
+        ASSERT_EQ(wal.records(), 5);
+    }
+    auto records = replay();
+    ASSERT_EQ(records.size(), 5);
+    ASSERT_EQ(records[0].type, chord::WalRecord::Type::INSERT_MAILBOX);
+    ASSERT_EQ(records[0].box.getOwner(), "wal@test.com");
+    ASSERT_EQ(records[0].box.getPassword(), box.getPassword());
+    ASSERT_EQ(records[0].box.getSize(), 0);
+    ASSERT_EQ(records[1].type, chord::WalRecord::Type::SEND);
+    ASSERT_TRUE(records[1].message.compare(msg));
+    ASSERT_EQ(records[1].message.id, 7);
+    ASSERT_EQ(records[2].type, chord::WalRecord::Type::DELETE);
+    ASSERT_EQ(records[2].id, 7);
+    ASSERT_EQ(records[3].type, chord::WalRecord::Type::TRANSFER);
+    ASSERT_EQ(records[3].key, 2);
+    ASSERT_EQ(records[3].box.getSize(), 1);
+    ASSERT_EQ(records[3].box.getMessage(0).id, 7);
+    // The identifier of the removed message is not given again
+    ASSERT_EQ(records[3].box.getVersion(), box.getVersion());
+    ASSERT_EQ(records[4].type, chord::WalRecord::Type::ERASE);
+    ASSERT_EQ(records[4].key, 3);
+}
+
+TEST_F(WalTest, TornTail) {
+    {
+        chord::WriteAheadLog wal(path_, chord::WalMode::NO_SYNC);
+        wal.append(chord::WalRecord::erase(1));
+        wal.append(chord::WalRecord::erase(2));
+    }
+    // Simulates a crash in the middle of a write
+    auto size = std::filesystem::file_size(path_);
+    std::filesystem::resize_file(path_, size - 3);
+    ASSERT_EQ(replay().size(), 1);
+    ASSERT_LT(std::filesystem::file_size(path_), size - 3);
+
+    // New records follow the last valid one
+    {
+        chord::WriteAheadLog wal(path_, chord::WalMode::NO_SYNC);
+        wal.append(chord::WalRecord::erase(3));
+    }
+    auto records = replay();
+    ASSERT_EQ(records.size(), 2);
+    ASSERT_EQ(records[1].key, 3);
+}
+
+TEST_F(WalTest, GroupCommit) {
+    const int threads = 8, appends = 200;
+    {
+        chord::WriteAheadLog wal(path_, chord::WalMode::ALWAYS);
+        std::vector<std::thread> writers;
+        for(int t = 0; t < threads; t++) {
+            writers.emplace_back([&wal, t]() {
+                for(int i = 0; i < appends; i++) {
+                    wal.append(chord::WalRecord::remove(t, i + 1));
+                }
+            });
+        }
+        for(auto &writer : writers) {
+            writer.join();
+        }
+        ASSERT_EQ(wal.records(), threads * appends);
+        ASSERT_LE(wal.batches(), wal.records());
+        ASSERT_EQ(wal.syncs(), wal.batches());
+    }
+    // Records of each writer keep their order
+    std::vector<uint64_t> last(threads, 0);
+    auto records = replay();
+    ASSERT_EQ(records.size(), threads * appends);
+    for(auto &record : records) {
+        ASSERT_EQ(record.id, last[record.key] + 1);
+        last[record.key] = record.id;
+    }
+
+    chord::WriteAheadLog wal(path_, chord::WalMode::NO_SYNC);
+    ASSERT_TRUE(wal.reset());
+    ASSERT_EQ(std::filesystem::file_size(path_), 0);
+}
+
+TEST_F(WalTest, Rotate) {
+    mail::MailBox box("wal@test.com", "psw");
+    {
+        chord::WriteAheadLog wal(path_, chord::WalMode::NO_SYNC);
+        wal.append(chord::WalRecord::erase(1));
+        wal.append(chord::WalRecord::erase(2));
+        ASSERT_TRUE(wal.rotate(archive_));
+        wal.append(chord::WalRecord::snapshot(3, box));
+        ASSERT_TRUE(wal.sync());
+        ASSERT_EQ(replay(archive_).size(), 2);
+        ASSERT_EQ(replay().size(), 1);
+
+        // An archive that wasn't removed keeps his records, the new ones follow them
+        wal.append(chord::WalRecord::clear());
+        ASSERT_TRUE(wal.rotate(archive_));
+        wal.append(chord::WalRecord::erase(4));
+    }
+    auto archived = replay(archive_);
+    ASSERT_EQ(archived.size(), 4);
+    ASSERT_EQ(archived[2].type, chord::WalRecord::Type::SNAPSHOT);
+    ASSERT_EQ(archived[2].key, 3);
+    ASSERT_EQ(archived[2].box.getOwner(), "wal@test.com");
+    ASSERT_EQ(archived[3].type, chord::WalRecord::Type::CLEAR);
+    auto records = replay();
+    ASSERT_EQ(records.size(), 1);
+    ASSERT_EQ(records[0].key, 4);
+}
+
+TEST_F(WalTest, Enqueue) {
+    {
+        chord::WriteAheadLog wal(path_, chord::WalMode::ALWAYS);
+        uint64_t first = wal.enqueue(chord::WalRecord::erase(1)),
+                 second = wal.enqueue(chord::WalRecord::erase(2));
+        ASSERT_LT(first, second);
+        // Waiting for a record writes the ones queued before it too
+        ASSERT_TRUE(wal.wait(second));
+        ASSERT_TRUE(wal.wait(first));
+        ASSERT_EQ(wal.batches(), 1);
+    }
+    auto records = replay();
+    ASSERT_EQ(records.size(), 2);
+    ASSERT_EQ(records[0].key, 1);
+    ASSERT_EQ(records[1].key, 2);
+
+    // Once a write failed the records are refused, a later write can't bring them back
+    chord::WriteAheadLog full("/dev/full", chord::WalMode::NO_SYNC);
+    ASSERT_FALSE(full.append(chord::WalRecord::erase(1)));
+    ASSERT_EQ(full.enqueue(chord::WalRecord::erase(2)), 0);
+    ASSERT_FALSE(full.wait(0));
+    ASSERT_EQ(full.records(), 1);
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+
+#include <chord/watch_hub.hpp>
+
+TEST(WatchHubTest, Publish) {
+    chord::WatchHub hub;
+    chord::WatchQueue first(10), second(10), other(10);
+    chord::HeaderMessage header;
+    header.set_id(7);
+    header.set_subject("subject");
+    ASSERT_EQ(hub.publish(1, header), 0);
+    ASSERT_TRUE(hub.subscribe(1, &first));
+    ASSERT_TRUE(hub.subscribe(1, &second));
+    ASSERT_TRUE(hub.subscribe(2, &other));
+    ASSERT_EQ(hub.size(), 3);
+
+    // The watchers of the mailbox share the same header
+    ASSERT_EQ(hub.publish(1, header), 2);
+    std::shared_ptr<const chord::HeaderMessage> a, b;
+    ASSERT_TRUE(first.pop(a, std::chrono::milliseconds(0)));
+    ASSERT_TRUE(second.pop(b, std::chrono::milliseconds(0)));
+    ASSERT_EQ(a, b);
+    ASSERT_EQ(a->id(), 7);
+    ASSERT_FALSE(other.pop(a, std::chrono::milliseconds(0)));
+    ASSERT_EQ(hub.notifications(), 2);
+
+    hub.unsubscribe(1, &first);
+    hub.unsubscribe(1, &first);
+    ASSERT_EQ(hub.publish(1, header), 1);
+    ASSERT_FALSE(first.pop(a, std::chrono::milliseconds(0)));
+    ASSERT_EQ(hub.size(), 2);
+}
+
+TEST(WatchHubTest, Close) {
+    chord::WatchHub hub;
+    chord::WatchQueue first(10), second(10);
+    ASSERT_TRUE(hub.subscribe(1, &first));
+    ASSERT_TRUE(hub.subscribe(2, &second));
+
+    // A moved mailbox only closes his watchers
+    hub.close(1);
+    ASSERT_TRUE(first.closed());
+    ASSERT_FALSE(second.closed());
+    ASSERT_EQ(hub.size(), 1);
+
+    hub.close();
+    ASSERT_TRUE(second.closed());
+    ASSERT_EQ(hub.size(), 0);
+    chord::WatchQueue late(10);
+    ASSERT_FALSE(hub.subscribe(1, &late));
+    hub.open();
+    ASSERT_TRUE(hub.subscribe(1, &late));
+}
+
+TEST(WatchHubTest, Queue) {
+    chord::WatchQueue queue(2);
+    chord::HeaderMessage header;
+    auto shared = std::make_shared<const chord::HeaderMessage>(header);
+    std::shared_ptr<const chord::HeaderMessage> taken;
+
+    // A waiting thread is woken up by a new header
+    std::thread producer([&queue, shared]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        queue.notify(shared);
+    });
+    ASSERT_TRUE(queue.pop(taken, std::chrono::milliseconds(5000)));
+    producer.join();
+    ASSERT_EQ(taken, shared);
+
+    // A watcher that falls behind doesn't buffer more than his capacity
+    for(int i = 0; i < 3; i++) {
+        queue.notify(shared);
+    }
+    ASSERT_TRUE(queue.overflowed());
+    queue.close();
+    ASSERT_TRUE(queue.pop(taken, std::chrono::milliseconds(0)));
+    ASSERT_TRUE(queue.pop(taken, std::chrono::milliseconds(0)));
+    ASSERT_FALSE(queue.pop(taken, std::chrono::milliseconds(5000)));
+}